@@ -0,0 +1,670 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * File System Virtual Channel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/collections.h>
+
+#if defined(HAVE_SYS_INOTIFY_H)
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "drive_file.h"
+#include "drive_cache.h"
+
+/* upper bound of directories watched for changes, all watches are dropped when it is hit */
+#define DRIVE_CACHE_MAX_WATCHES 1024
+
+#define DRIVE_CACHE_WATCH_MASK                                                              \
+	(IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | \
+	 IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+typedef struct
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	UINT64 expires;
+} DRIVE_CACHE_ENTRY;
+
+struct s_DRIVE_CACHE
+{
+	CRITICAL_SECTION lock;
+	wHashTable* entries;
+	DRIVE_LISTING* listings[DRIVE_CACHE_MAX_LISTINGS];
+
+	/* bumped by every invalidation, results looked up meanwhile are not inserted */
+	UINT64 generation;
+
+#if defined(HAVE_SYS_INOTIFY_H)
+	int inotify;
+	wHashTable* watches;
+#endif
+};
+
+static void drive_cache_invalidate_int(DRIVE_CACHE* cache, const WCHAR* path, BOOL tree);
+
+static UINT32 drive_cache_hash(const void* key)
+{
+	const WCHAR* str = (const WCHAR*)key;
+	UINT32 hash = 5381;
+
+	while (*str)
+		hash = (hash << 5) + hash + *str++;
+
+	return hash;
+}
+
+static BOOL drive_cache_equals(const void* key1, const void* key2)
+{
+	return _wcscmp((const WCHAR*)key1, (const WCHAR*)key2) == 0;
+}
+
+static void* drive_cache_clone(const void* key)
+{
+	return _wcsdup((const WCHAR*)key);
+}
+
+static WCHAR* drive_cache_strndup(const WCHAR* str, size_t length)
+{
+	WCHAR* copy = (WCHAR*)calloc(length + 1, sizeof(WCHAR));
+
+	if (copy)
+		CopyMemory(copy, str, length * sizeof(WCHAR));
+
+	return copy;
+}
+
+/* length of the directory part of a path, the root keeps its slash */
+static size_t drive_cache_parent_length(const WCHAR* path, size_t length)
+{
+	while ((length > 0) && (path[length - 1] != L'/'))
+		length--;
+
+	if (length > 1)
+		length--;
+
+	return length;
+}
+
+static BOOL drive_cache_is_below(const WCHAR* str, size_t strLength, const WCHAR* directory,
+                                 size_t length)
+{
+	if ((length == 0) || (strLength <= length))
+		return FALSE;
+
+	if (memcmp(str, directory, length * sizeof(WCHAR)) != 0)
+		return FALSE;
+
+	return (directory[length - 1] == L'/') || (str[length] == L'/');
+}
+
+static void drive_cache_listing_free(DRIVE_LISTING* listing)
+{
+	if (!listing)
+		return;
+
+	free(listing->entries);
+	free(listing->pattern);
+	free(listing);
+}
+
+static void drive_cache_drop_listing(DRIVE_CACHE* cache, size_t index)
+{
+	DRIVE_LISTING* listing = cache->listings[index];
+
+	cache->listings[index] = NULL;
+
+	if (!listing)
+		return;
+
+	listing->cached = FALSE;
+
+	/* files still enumerating it keep their snapshot */
+	if (listing->refs == 0)
+		drive_cache_listing_free(listing);
+}
+
+static void drive_cache_drop_listings(DRIVE_CACHE* cache, const WCHAR* directory, size_t length,
+                                      BOOL tree)
+{
+	size_t x;
+
+	for (x = 0; x < ARRAYSIZE(cache->listings); x++)
+	{
+		const DRIVE_LISTING* listing = cache->listings[x];
+
+		if (!listing)
+			continue;
+
+		if (directory)
+		{
+			const BOOL equal = (listing->directoryLength == length) &&
+			                   (memcmp(listing->pattern, directory, length * sizeof(WCHAR)) == 0);
+
+			if (!equal && (!tree || !drive_cache_is_below(listing->pattern,
+			                                              listing->directoryLength, directory,
+			                                              length)))
+				continue;
+		}
+
+		drive_cache_drop_listing(cache, x);
+	}
+}
+
+#if defined(HAVE_SYS_INOTIFY_H)
+
+static void drive_cache_reset_watches(DRIVE_CACHE* cache)
+{
+	if (cache->inotify >= 0)
+		close(cache->inotify);
+
+	HashTable_Clear(cache->watches);
+	cache->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (cache->inotify < 0)
+		WLog_WARN(TAG, "inotify_init1 failed (%d), cached entries rely on the timeout", errno);
+}
+
+static void drive_cache_clear(DRIVE_CACHE* cache)
+{
+	cache->generation++;
+	HashTable_Clear(cache->entries);
+	drive_cache_drop_listings(cache, NULL, 0, TRUE);
+	drive_cache_reset_watches(cache);
+}
+
+/* Watch a directory before its contents are looked at, so nothing changing in between is
+ * missed. Adding a watch twice returns the existing descriptor. */
+static void drive_cache_watch(DRIVE_CACHE* cache, const WCHAR* path, size_t length)
+{
+	int wd;
+	char* directory = NULL;
+	WCHAR* wdirectory;
+
+	if ((cache->inotify < 0) || (length == 0))
+		return;
+
+	if (HashTable_Count(cache->watches) >= DRIVE_CACHE_MAX_WATCHES)
+		drive_cache_clear(cache);
+
+	wdirectory = drive_cache_strndup(path, length);
+
+	if (!wdirectory)
+		return;
+
+	if (ConvertFromUnicode(CP_UTF8, 0, wdirectory, -1, &directory, 0, NULL, NULL) <= 0)
+	{
+		free(wdirectory);
+		return;
+	}
+
+	wd = inotify_add_watch(cache->inotify, directory, DRIVE_CACHE_WATCH_MASK);
+	free(directory);
+
+	if ((wd >= 0) && !HashTable_Contains(cache->watches, (void*)(size_t)wd))
+	{
+		if (HashTable_Insert(cache->watches, (void*)(size_t)wd, wdirectory))
+			wdirectory = NULL;
+	}
+
+	free(wdirectory);
+}
+
+static BOOL drive_cache_handle_event(DRIVE_CACHE* cache, const struct inotify_event* event)
+{
+	size_t length;
+	WCHAR* name = NULL;
+	WCHAR* path;
+	const WCHAR* directory;
+	const void* key = (void*)(size_t)event->wd;
+
+	if (event->mask & IN_Q_OVERFLOW)
+	{
+		drive_cache_clear(cache);
+		return FALSE;
+	}
+
+	directory = (const WCHAR*)HashTable_GetItemValue(cache->watches, key);
+
+	if (!directory)
+		return TRUE;
+
+	/* the watched directory itself is gone or renamed, the path it was watched under is stale */
+	if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+	{
+		drive_cache_invalidate_int(cache, directory, TRUE);
+
+		if (!(event->mask & IN_IGNORED))
+			inotify_rm_watch(cache->inotify, event->wd);
+
+		HashTable_Remove(cache->watches, key);
+		return TRUE;
+	}
+
+	if ((event->len == 0) || (event->name[0] == '\0'))
+	{
+		drive_cache_invalidate_int(cache, directory, FALSE);
+		return TRUE;
+	}
+
+	if (ConvertToUnicode(CP_UTF8, 0, event->name, -1, &name, 0) <= 0)
+	{
+		drive_cache_clear(cache);
+		return FALSE;
+	}
+
+	length = _wcslen(directory);
+	path = (WCHAR*)calloc(length + _wcslen(name) + 2, sizeof(WCHAR));
+
+	if (!path)
+	{
+		free(name);
+		drive_cache_clear(cache);
+		return FALSE;
+	}
+
+	CopyMemory(path, directory, length * sizeof(WCHAR));
+
+	if ((length == 0) || (path[length - 1] != L'/'))
+		path[length++] = L'/';
+
+	CopyMemory(&path[length], name, _wcslen(name) * sizeof(WCHAR));
+	drive_cache_invalidate_int(cache, path, (event->mask & IN_ISDIR) != 0);
+	free(path);
+	free(name);
+	return TRUE;
+}
+
+/* Apply the changes reported since the last call, done before every lookup. */
+static void drive_cache_update(DRIVE_CACHE* cache)
+{
+	union
+	{
+		struct inotify_event event;
+		char data[4096];
+	} buffer;
+
+	while (cache->inotify >= 0)
+	{
+		size_t offset = 0;
+		const ssize_t length = read(cache->inotify, &buffer, sizeof(buffer));
+
+		if (length <= 0)
+			break;
+
+		while (offset + sizeof(struct inotify_event) <= (size_t)length)
+		{
+			const struct inotify_event* event =
+			    (const struct inotify_event*)&buffer.data[offset];
+
+			if (!drive_cache_handle_event(cache, event))
+				break;
+
+			offset += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+#else
+
+static void drive_cache_watch(DRIVE_CACHE* cache, const WCHAR* path, size_t length)
+{
+	WINPR_UNUSED(cache);
+	WINPR_UNUSED(path);
+	WINPR_UNUSED(length);
+}
+
+static void drive_cache_update(DRIVE_CACHE* cache)
+{
+	WINPR_UNUSED(cache);
+}
+
+#endif
+
+static void drive_cache_invalidate_int(DRIVE_CACHE* cache, const WCHAR* path, BOOL tree)
+{
+	const size_t length = _wcslen(path);
+	const size_t parentLength = drive_cache_parent_length(path, length);
+	WCHAR* parent = drive_cache_strndup(path, parentLength);
+
+	cache->generation++;
+	HashTable_Remove(cache->entries, path);
+
+	/* the parent directory changes along with its entries */
+	if (parent)
+		HashTable_Remove(cache->entries, parent);
+
+	free(parent);
+	drive_cache_drop_listings(cache, path, parentLength, FALSE);
+
+	if (tree)
+	{
+		size_t x;
+		ULONG_PTR* keys = NULL;
+		const size_t count = HashTable_GetKeys(cache->entries, &keys);
+
+		for (x = 0; x < count; x++)
+		{
+			const WCHAR* key = (const WCHAR*)keys[x];
+
+			if (drive_cache_is_below(key, _wcslen(key), path, length))
+				HashTable_Remove(cache->entries, key);
+		}
+
+		free(keys);
+		drive_cache_drop_listings(cache, path, length, TRUE);
+	}
+}
+
+DRIVE_CACHE* drive_cache_new(void)
+{
+	wObject* obj;
+	DRIVE_CACHE* cache = (DRIVE_CACHE*)calloc(1, sizeof(DRIVE_CACHE));
+
+	if (!cache)
+		return NULL;
+
+	InitializeCriticalSection(&cache->lock);
+#if defined(HAVE_SYS_INOTIFY_H)
+	cache->inotify = -1;
+#endif
+	cache->entries = HashTable_New(FALSE);
+
+	if (!cache->entries || !HashTable_SetHashFunction(cache->entries, drive_cache_hash))
+		goto fail;
+
+	obj = HashTable_KeyObject(cache->entries);
+	obj->fnObjectEquals = drive_cache_equals;
+	obj->fnObjectNew = drive_cache_clone;
+	obj->fnObjectFree = free;
+	obj = HashTable_ValueObject(cache->entries);
+	obj->fnObjectFree = free;
+
+#if defined(HAVE_SYS_INOTIFY_H)
+	cache->watches = HashTable_New(FALSE);
+
+	if (!cache->watches)
+		goto fail;
+
+	obj = HashTable_ValueObject(cache->watches);
+	obj->fnObjectFree = free;
+	drive_cache_reset_watches(cache);
+#endif
+
+	return cache;
+fail:
+	drive_cache_free(cache);
+	return NULL;
+}
+
+void drive_cache_free(DRIVE_CACHE* cache)
+{
+	size_t x;
+
+	if (!cache)
+		return;
+
+	for (x = 0; x < ARRAYSIZE(cache->listings); x++)
+		drive_cache_listing_free(cache->listings[x]);
+
+#if defined(HAVE_SYS_INOTIFY_H)
+	if (cache->inotify >= 0)
+		close(cache->inotify);
+
+	HashTable_Free(cache->watches);
+#endif
+	HashTable_Free(cache->entries);
+	DeleteCriticalSection(&cache->lock);
+	free(cache);
+}
+
+/**
+ * Look up the information of a file, from the cache if it is current.
+ */
+BOOL drive_cache_get_information(DRIVE_CACHE* cache, const WCHAR* path,
+                                 BY_HANDLE_FILE_INFORMATION* info)
+{
+	BOOL status;
+	HANDLE hFile;
+	UINT64 generation;
+	DRIVE_CACHE_ENTRY* entry;
+
+	if (!cache || !path || !info)
+		return FALSE;
+
+	EnterCriticalSection(&cache->lock);
+	drive_cache_update(cache);
+	entry = (DRIVE_CACHE_ENTRY*)HashTable_GetItemValue(cache->entries, path);
+
+	if (entry && (entry->expires > GetTickCount64()))
+	{
+		*info = entry->info;
+		LeaveCriticalSection(&cache->lock);
+		return TRUE;
+	}
+
+	drive_cache_watch(cache, path, drive_cache_parent_length(path, _wcslen(path)));
+	generation = cache->generation;
+	LeaveCriticalSection(&cache->lock);
+
+	hFile = CreateFileW(path, 0, FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+	                    NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	status = GetFileInformationByHandle(hFile, info);
+	CloseHandle(hFile);
+
+	if (!status)
+		return FALSE;
+
+	EnterCriticalSection(&cache->lock);
+	drive_cache_update(cache);
+
+	if (generation == cache->generation)
+	{
+		if (HashTable_Count(cache->entries) >= DRIVE_CACHE_MAX_ENTRIES)
+			HashTable_Clear(cache->entries);
+
+		entry = (DRIVE_CACHE_ENTRY*)calloc(1, sizeof(DRIVE_CACHE_ENTRY));
+
+		if (entry)
+		{
+			entry->info = *info;
+			entry->expires = GetTickCount64() + DRIVE_CACHE_TIMEOUT;
+
+			if (!HashTable_Insert(cache->entries, path, entry))
+				free(entry);
+		}
+	}
+
+	LeaveCriticalSection(&cache->lock);
+	return TRUE;
+}
+
+static DRIVE_LISTING* drive_cache_read_listing(const WCHAR* pattern, size_t directoryLength)
+{
+	HANDLE hFind;
+	size_t capacity = 0;
+	WIN32_FIND_DATAW data;
+	DRIVE_LISTING* listing = (DRIVE_LISTING*)calloc(1, sizeof(DRIVE_LISTING));
+
+	if (!listing)
+		goto fail;
+
+	listing->pattern = _wcsdup(pattern);
+	listing->directoryLength = directoryLength;
+
+	if (!listing->pattern)
+		goto fail;
+
+	hFind = FindFirstFileW(pattern, &data);
+
+	if (hFind == INVALID_HANDLE_VALUE)
+	{
+		/* a failed search is cached as well, clients probe for many files that do not exist */
+		listing->error = GetLastError();
+
+		if (listing->error == ERROR_SUCCESS)
+			listing->error = ERROR_FILE_NOT_FOUND;
+
+		return listing;
+	}
+
+	do
+	{
+		if (listing->count == capacity)
+		{
+			const size_t size = capacity ? capacity * 2 : 32;
+			WIN32_FIND_DATAW* entries = (WIN32_FIND_DATAW*)realloc(
+			    listing->entries, size * sizeof(WIN32_FIND_DATAW));
+
+			if (!entries)
+			{
+				FindClose(hFind);
+				goto fail;
+			}
+
+			listing->entries = entries;
+			capacity = size;
+		}
+
+		listing->entries[listing->count++] = data;
+	} while (FindNextFileW(hFind, &data));
+
+	FindClose(hFind);
+	return listing;
+fail:
+	drive_cache_listing_free(listing);
+	SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+	return NULL;
+}
+
+/**
+ * Get the entries matching a search pattern, the listing stays valid until it is released.
+ */
+DRIVE_LISTING* drive_cache_get_listing(DRIVE_CACHE* cache, const WCHAR* pattern)
+{
+	size_t x;
+	size_t slot = 0;
+	UINT64 generation;
+	size_t directoryLength;
+	DRIVE_LISTING* listing;
+	const UINT64 now = GetTickCount64();
+
+	if (!cache || !pattern)
+		return NULL;
+
+	EnterCriticalSection(&cache->lock);
+	drive_cache_update(cache);
+
+	for (x = 0; x < ARRAYSIZE(cache->listings); x++)
+	{
+		listing = cache->listings[x];
+
+		if (!listing)
+			continue;
+
+		if (listing->expires <= now)
+		{
+			drive_cache_drop_listing(cache, x);
+			continue;
+		}
+
+		if (_wcscmp(listing->pattern, pattern) == 0)
+		{
+			listing->refs++;
+			listing->used = now;
+			LeaveCriticalSection(&cache->lock);
+			return listing;
+		}
+	}
+
+	directoryLength = drive_cache_parent_length(pattern, _wcslen(pattern));
+	drive_cache_watch(cache, pattern, directoryLength);
+	generation = cache->generation;
+	LeaveCriticalSection(&cache->lock);
+
+	listing = drive_cache_read_listing(pattern, directoryLength);
+
+	if (!listing)
+		return NULL;
+
+	listing->refs = 1;
+
+	EnterCriticalSection(&cache->lock);
+	drive_cache_update(cache);
+
+	if (generation == cache->generation)
+	{
+		/* take a free slot or replace the least recently used listing */
+		for (x = 0; x < ARRAYSIZE(cache->listings); x++)
+		{
+			if (!cache->listings[x])
+			{
+				slot = x;
+				break;
+			}
+
+			if (cache->listings[x]->used < cache->listings[slot]->used)
+				slot = x;
+		}
+
+		drive_cache_drop_listing(cache, slot);
+		listing->cached = TRUE;
+		listing->expires = GetTickCount64() + DRIVE_CACHE_TIMEOUT;
+		listing->used = now;
+		cache->listings[slot] = listing;
+	}
+
+	LeaveCriticalSection(&cache->lock);
+	return listing;
+}
+
+void drive_cache_release_listing(DRIVE_CACHE* cache, DRIVE_LISTING* listing)
+{
+	if (!cache || !listing)
+		return;
+
+	EnterCriticalSection(&cache->lock);
+
+	if ((--listing->refs == 0) && !listing->cached)
+		drive_cache_listing_free(listing);
+
+	LeaveCriticalSection(&cache->lock);
+}
+
+/**
+ * Forget what is known about a path and its directory, with tree set also everything below it.
+ */
+void drive_cache_invalidate(DRIVE_CACHE* cache, const WCHAR* path, BOOL tree)
+{
+	if (!cache || !path)
+		return;
+
+	EnterCriticalSection(&cache->lock);
+	drive_cache_update(cache);
+	drive_cache_invalidate_int(cache, path, tree);
+	LeaveCriticalSection(&cache->lock);
+}
@@ -0,0 +1,62 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * File System Virtual Channel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CHANNEL_DRIVE_CLIENT_CACHE_H
+#define FREERDP_CHANNEL_DRIVE_CLIENT_CACHE_H
+
+#include <winpr/wtypes.h>
+#include <winpr/file.h>
+
+/* how long cached results are trusted without a change notification, in milliseconds */
+#define DRIVE_CACHE_TIMEOUT 2000
+
+/* number of directory listings kept per drive */
+#define DRIVE_CACHE_MAX_LISTINGS 8
+
+/* number of file information entries kept per drive */
+#define DRIVE_CACHE_MAX_ENTRIES 16384
+
+typedef struct s_DRIVE_CACHE DRIVE_CACHE;
+
+/* a snapshot of all entries matching a search pattern, shared by the files enumerating it */
+typedef struct
+{
+	WIN32_FIND_DATAW* entries;
+	size_t count;
+	DWORD error;
+
+	/* bookkeeping of the cache */
+	WCHAR* pattern;
+	size_t directoryLength;
+	UINT64 expires;
+	UINT64 used;
+	size_t refs;
+	BOOL cached;
+} DRIVE_LISTING;
+
+DRIVE_CACHE* drive_cache_new(void);
+void drive_cache_free(DRIVE_CACHE* cache);
+
+BOOL drive_cache_get_information(DRIVE_CACHE* cache, const WCHAR* path,
+                                 BY_HANDLE_FILE_INFORMATION* info);
+
+DRIVE_LISTING* drive_cache_get_listing(DRIVE_CACHE* cache, const WCHAR* pattern);
+void drive_cache_release_listing(DRIVE_CACHE* cache, DRIVE_LISTING* listing);
+
+void drive_cache_invalidate(DRIVE_CACHE* cache, const WCHAR* path, BOOL tree);
+
+#endif /* FREERDP_CHANNEL_DRIVE_CLIENT_CACHE_H */
@@ -331,9 +331,10 @@ static BOOL drive_file_init(DRIVE_FILE* file)
 	return file->file_handle != INVALID_HANDLE_VALUE;
 }
 
-DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 PathLength, UINT32 id,
-                           UINT32 DesiredAccess, UINT32 CreateDisposition, UINT32 CreateOptions,
-                           UINT32 FileAttributes, UINT32 SharedAccess)
+DRIVE_FILE* drive_file_new(DRIVE_CACHE* cache, const WCHAR* base_path, const WCHAR* path,
+                           UINT32 PathLength, UINT32 id, UINT32 DesiredAccess,
+                           UINT32 CreateDisposition, UINT32 CreateOptions, UINT32 FileAttributes,
+                           UINT32 SharedAccess)
 {
 	DRIVE_FILE* file;
 
@@ -349,7 +350,7 @@ DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 Pat
 	}
 
 	file->file_handle = INVALID_HANDLE_VALUE;
-	file->find_handle = INVALID_HANDLE_VALUE;
+	file->cache = cache;
 	file->id = id;
 	file->basepath = base_path;
 	file->FileAttributes = FileAttributes;
@@ -358,8 +359,9 @@ DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 Pat
 	file->CreateOptions = CreateOptions;
 	file->SharedAccess = SharedAccess;
 	drive_file_set_fullpath(file, drive_file_combine_fullpath(base_path, path, PathLength));
+	file->irps = Queue_New(FALSE, 0, 0);
 
-	if (!drive_file_init(file))
+	if (!file->irps || !drive_file_init(file))
 	{
 		DWORD lastError = GetLastError();
 		drive_file_free(file);
@@ -367,6 +369,10 @@ DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 Pat
 		return NULL;
 	}
 
+	/* anything but opening may have created the file */
+	if (CreateDisposition != FILE_OPEN)
+		drive_cache_invalidate(cache, file->fullpath, FALSE);
+
 	return file;
 }
 
@@ -379,18 +385,22 @@ BOOL drive_file_free(DRIVE_FILE* file)
 
 	if (file->file_handle != INVALID_HANDLE_VALUE)
 	{
+		/* a failed write-behind is reported on close, like a failed write */
+		if (!file->delete_pending && !drive_file_flush(file))
+			goto fail;
+
 		CloseHandle(file->file_handle);
 		file->file_handle = INVALID_HANDLE_VALUE;
 	}
 
-	if (file->find_handle != INVALID_HANDLE_VALUE)
-	{
-		FindClose(file->find_handle);
-		file->find_handle = INVALID_HANDLE_VALUE;
-	}
+	drive_cache_release_listing(file->cache, file->listing);
+	file->listing = NULL;
 
 	if (file->delete_pending)
 	{
+		drive_cache_invalidate(file->cache, file->fullpath, file->is_dir);
+		file->modified = FALSE;
+
 		if (file->is_dir)
 		{
 			if (!drive_file_remove_dir(file->fullpath))
@@ -403,6 +413,17 @@ BOOL drive_file_free(DRIVE_FILE* file)
 	rc = TRUE;
 fail:
 	DEBUG_WSTR("Free %s", file->fullpath);
+
+	if (file->modified)
+		drive_cache_invalidate(file->cache, file->fullpath, FALSE);
+
+	if (file->file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file->file_handle);
+
+	Queue_Free(file->irps);
+	free(file->queryPath);
+	free(file->queryFullpath);
+	free(file->buffer);
 	free(file->fullpath);
 	free(file);
 	return rc;
@@ -422,61 +443,236 @@ BOOL drive_file_seek(DRIVE_FILE* file, UINT64 Offset)
 	return SetFilePointerEx(file->file_handle, loffset, NULL, FILE_BEGIN);
 }
 
-BOOL drive_file_read(DRIVE_FILE* file, BYTE* buffer, UINT32* Length)
+static BOOL drive_file_read_direct(DRIVE_FILE* file, UINT64 Offset, BYTE* buffer,
+                                   UINT32* Length)
 {
 	DWORD read;
 
+	if (!drive_file_seek(file, Offset))
+		return FALSE;
+
+	if (!ReadFile(file->file_handle, buffer, *Length, &read, NULL))
+		return FALSE;
+
+	*Length = read;
+	return TRUE;
+}
+
+static BOOL drive_file_write_direct(DRIVE_FILE* file, UINT64 Offset, const BYTE* buffer,
+                                    UINT32 Length)
+{
+	DWORD written;
+
+	if (!drive_file_seek(file, Offset))
+		return FALSE;
+
+	while (Length > 0)
+	{
+		if (!WriteFile(file->file_handle, buffer, Length, &written, NULL))
+			break;
+
+		Length -= written;
+		buffer += written;
+	}
+
+	/* once is enough, the cache is invalidated again on query and close */
+	if (!file->modified)
+		drive_cache_invalidate(file->cache, file->fullpath, FALSE);
+
+	file->modified = TRUE;
+	return Length == 0;
+}
+
+static BOOL drive_file_alloc_buffer(DRIVE_FILE* file)
+{
+	BYTE* buffer;
+
+	if (file->bufferSize >= DRIVE_FILE_BUFFER_SIZE)
+		return TRUE;
+
+	buffer = (BYTE*)realloc(file->buffer, DRIVE_FILE_BUFFER_SIZE);
+
+	if (!buffer)
+		return FALSE;
+
+	file->buffer = buffer;
+	file->bufferSize = DRIVE_FILE_BUFFER_SIZE;
+	return TRUE;
+}
+
+/**
+ * Give back the buffer of a handle that stopped reading ahead, open handles would keep it
+ * until close otherwise.
+ */
+static void drive_file_release_buffer(DRIVE_FILE* file)
+{
+	if (file->bufferDirty)
+		return;
+
+	free(file->buffer);
+	file->buffer = NULL;
+	file->bufferSize = 0;
+	file->bufferLength = 0;
+}
+
+/**
+ * The read ahead stopped short at the end of the file, only keep what is left to hand out.
+ */
+static void drive_file_shrink_buffer(DRIVE_FILE* file, UINT32 consumed)
+{
+	BYTE* buffer;
+
+	if (consumed >= file->bufferLength)
+	{
+		drive_file_release_buffer(file);
+		return;
+	}
+
+	buffer = (BYTE*)realloc(file->buffer, file->bufferLength);
+
+	if (!buffer)
+		return;
+
+	file->buffer = buffer;
+	file->bufferSize = file->bufferLength;
+}
+
+/**
+ * Write out data held back by write-behind and drop read-ahead data.
+ */
+BOOL drive_file_flush(DRIVE_FILE* file)
+{
+	BOOL rc = TRUE;
+
+	if (!file)
+		return FALSE;
+
+	if (file->bufferDirty)
+		rc = drive_file_write_direct(file, file->bufferOffset, file->buffer, file->bufferLength);
+
+	file->bufferDirty = FALSE;
+	file->bufferLength = 0;
+	return rc;
+}
+
+BOOL drive_file_read(DRIVE_FILE* file, UINT64 Offset, BYTE* buffer, UINT32* Length)
+{
+	BOOL sequential;
+
 	if (!file || !buffer || !Length)
 		return FALSE;
 
+	sequential = (Offset == file->nextOffset);
+
 	DEBUG_WSTR("Read file %s", file->fullpath);
 
-	if (ReadFile(file->file_handle, buffer, *Length, &read, NULL))
+	if (file->bufferDirty && !drive_file_flush(file))
+		return FALSE;
+
+	/* Read ahead only for sequential reads of files nobody else may write to, anything else
+	 * goes to the file directly so the data is never stale. */
+	if (!file->bufferDirty && (file->bufferLength > 0) && (Offset >= file->bufferOffset) &&
+	    (Offset + *Length <= file->bufferOffset + file->bufferLength))
 	{
-		*Length = read;
-		return TRUE;
+		memcpy(buffer, &file->buffer[Offset - file->bufferOffset], *Length);
+
+		/* everything up to the end of the file was handed out */
+		if ((file->bufferLength < DRIVE_FILE_BUFFER_SIZE) &&
+		    (Offset + *Length == file->bufferOffset + file->bufferLength))
+			drive_file_release_buffer(file);
 	}
+	else if (sequential && (*Length < DRIVE_FILE_BUFFER_SIZE) &&
+	         !(file->SharedAccess & FILE_SHARE_WRITE) && drive_file_alloc_buffer(file))
+	{
+		UINT32 length = DRIVE_FILE_BUFFER_SIZE;
 
-	return FALSE;
+		file->bufferLength = 0;
+
+		if (!drive_file_read_direct(file, Offset, file->buffer, &length))
+			return FALSE;
+
+		file->bufferOffset = Offset;
+		file->bufferLength = length;
+
+		if (*Length > length)
+			*Length = length;
+
+		memcpy(buffer, file->buffer, *Length);
+
+		if (length < DRIVE_FILE_BUFFER_SIZE)
+			drive_file_shrink_buffer(file, *Length);
+	}
+	else
+	{
+		drive_file_release_buffer(file);
+
+		if (!drive_file_read_direct(file, Offset, buffer, Length))
+			return FALSE;
+	}
+
+	file->nextOffset = Offset + *Length;
+	return TRUE;
 }
 
-BOOL drive_file_write(DRIVE_FILE* file, BYTE* buffer, UINT32 Length)
+BOOL drive_file_write(DRIVE_FILE* file, UINT64 Offset, const BYTE* buffer, UINT32 Length)
 {
-	DWORD written;
+	BOOL sequential;
 
 	if (!file || !buffer)
 		return FALSE;
 
 	DEBUG_WSTR("Write file %s", file->fullpath);
 
-	while (Length > 0)
+	sequential = (Offset == file->nextOffset);
+	file->nextOffset = Offset + Length;
+
+	/* Write behind only for files nobody else may look at, sequential writes are collected
+	 * until the buffer is full. Sharing does not cover handles opened just for attributes,
+	 * those see the size on disk which lags by up to DRIVE_FILE_BUFFER_SIZE until this
+	 * handle writes the buffer out, is queried or is closed. */
+	if (file->bufferDirty && (Offset == file->bufferOffset + file->bufferLength) &&
+	    (Length <= DRIVE_FILE_BUFFER_SIZE - file->bufferLength))
 	{
-		if (!WriteFile(file->file_handle, buffer, Length, &written, NULL))
-			return FALSE;
+		memcpy(&file->buffer[file->bufferLength], buffer, Length);
+		file->bufferLength += Length;
+		return TRUE;
+	}
 
-		Length -= written;
-		buffer += written;
+	if (!drive_file_flush(file))
+		return FALSE;
+
+	if (sequential && (Length < DRIVE_FILE_BUFFER_SIZE) &&
+	    !(file->SharedAccess & (FILE_SHARE_READ | FILE_SHARE_WRITE)) &&
+	    drive_file_alloc_buffer(file))
+	{
+		memcpy(file->buffer, buffer, Length);
+		file->bufferOffset = Offset;
+		file->bufferLength = Length;
+		file->bufferDirty = TRUE;
+		return TRUE;
 	}
 
-	return TRUE;
+	return drive_file_write_direct(file, Offset, buffer, Length);
 }
 
 BOOL drive_file_query_information(DRIVE_FILE* file, UINT32 FsInformationClass, wStream* output)
 {
 	BY_HANDLE_FILE_INFORMATION fileInformation;
-	BOOL status;
-	HANDLE hFile;
 
 	if (!file || !output)
 		return FALSE;
 
-	hFile = CreateFileW(file->fullpath, 0, FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
-	                    FILE_ATTRIBUTE_NORMAL, NULL);
-	if (hFile == INVALID_HANDLE_VALUE)
-		goto out_fail;
-	status = GetFileInformationByHandle(hFile, &fileInformation);
-	CloseHandle(hFile);
-	if (!status)
+	/* the size is taken from the file system */
+	if (!drive_file_flush(file))
+		return FALSE;
+
+	if (file->modified)
+	{
+		drive_cache_invalidate(file->cache, file->fullpath, FALSE);
+		file->modified = FALSE;
+	}
+
+	if (!drive_cache_get_information(file->cache, file->fullpath, &fileInformation))
 		goto out_fail;
 
 	switch (FsInformationClass)
@@ -574,6 +770,12 @@ BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UIN
 	if (!file || !input)
 		return FALSE;
 
+	if (!drive_file_flush(file))
+		return FALSE;
+
+	/* also done up front for changes that are made before a failure */
+	drive_cache_invalidate(file->cache, file->fullpath, FALSE);
+
 	switch (FsInformationClass)
 	{
 		case FileBasicInformation:
@@ -742,6 +944,9 @@ BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UIN
 			                MOVEFILE_COPY_ALLOWED |
 			                    (ReplaceIfExists ? MOVEFILE_REPLACE_EXISTING : 0)))
 			{
+				drive_cache_invalidate(file->cache, file->fullpath, file->is_dir);
+				drive_cache_invalidate(file->cache, fullpath, TRUE);
+
 				if (!drive_file_set_fullpath(file, fullpath))
 					return FALSE;
 			}
@@ -760,36 +965,85 @@ BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UIN
 			return FALSE;
 	}
 
+	drive_cache_invalidate(file->cache, file->fullpath, FALSE);
 	return TRUE;
 }
 
+/**
+ * Clients repeat the initial query with the same pattern on a handle, the converted path of the
+ * last one is kept and reused.
+ */
+static WCHAR* drive_file_query_fullpath(DRIVE_FILE* file, const WCHAR* path, UINT32 PathLength)
+{
+	BYTE* queryPath;
+	WCHAR* fullpath;
+
+	if (file->queryFullpath && (file->queryPathLength == PathLength) &&
+	    (memcmp(file->queryPath, path, PathLength) == 0))
+		return file->queryFullpath;
+
+	fullpath = drive_file_combine_fullpath(file->basepath, path, PathLength);
+	queryPath = (BYTE*)malloc(PathLength + 1);
+
+	if (!fullpath || !queryPath)
+	{
+		free(fullpath);
+		free(queryPath);
+		return NULL;
+	}
+
+	memcpy(queryPath, path, PathLength);
+	free(file->queryPath);
+	free(file->queryFullpath);
+	file->queryPath = queryPath;
+	file->queryPathLength = PathLength;
+	file->queryFullpath = fullpath;
+	return fullpath;
+}
+
 BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYTE InitialQuery,
                                 const WCHAR* path, UINT32 PathLength, wStream* output)
 {
 	size_t length;
 	WCHAR* ent_path;
+	const WIN32_FIND_DATAW* find_data;
 
 	if (!file || !path || !output)
 		return FALSE;
 
 	if (InitialQuery != 0)
 	{
-		/* release search handle */
-		if (file->find_handle != INVALID_HANDLE_VALUE)
-			FindClose(file->find_handle);
+		/* the whole listing is read on the initial query and handed out one entry at a time */
+		drive_cache_release_listing(file->cache, file->listing);
+		file->listingIndex = 0;
 
-		ent_path = drive_file_combine_fullpath(file->basepath, path, PathLength);
-		/* open new search handle and retrieve the first entry */
-		file->find_handle = FindFirstFileW(ent_path, &file->find_data);
-		free(ent_path);
+		ent_path = drive_file_query_fullpath(file, path, PathLength);
+		file->listing = ent_path ? drive_cache_get_listing(file->cache, ent_path) : NULL;
 
-		if (file->find_handle == INVALID_HANDLE_VALUE)
+		if (!file->listing)
 			goto out_fail;
 	}
-	else if (!FindNextFileW(file->find_handle, &file->find_data))
+
+	if (!file->listing)
+	{
+		SetLastError(ERROR_NO_MORE_FILES);
+		goto out_fail;
+	}
+
+	if (file->listing->error != ERROR_SUCCESS)
+	{
+		SetLastError(file->listing->error);
 		goto out_fail;
+	}
+
+	if (file->listingIndex >= file->listing->count)
+	{
+		SetLastError(ERROR_NO_MORE_FILES);
+		goto out_fail;
+	}
 
-	length = _wcslen(file->find_data.cFileName) * 2;
+	find_data = &file->listing->entries[file->listingIndex++];
+	length = _wcslen(find_data->cFileName) * 2;
 
 	switch (FsInformationClass)
 	{
@@ -806,28 +1060,28 @@ BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYT
 			Stream_Write_UINT32(output, 0);                     /* NextEntryOffset */
 			Stream_Write_UINT32(output, 0);                     /* FileIndex */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftCreationTime.dwLowDateTime); /* CreationTime */
+			                    find_data->ftCreationTime.dwLowDateTime); /* CreationTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftCreationTime.dwHighDateTime); /* CreationTime */
+			                    find_data->ftCreationTime.dwHighDateTime); /* CreationTime */
 			Stream_Write_UINT32(
-			    output, file->find_data.ftLastAccessTime.dwLowDateTime); /* LastAccessTime */
+			    output, find_data->ftLastAccessTime.dwLowDateTime); /* LastAccessTime */
 			Stream_Write_UINT32(
-			    output, file->find_data.ftLastAccessTime.dwHighDateTime); /* LastAccessTime */
+			    output, find_data->ftLastAccessTime.dwHighDateTime); /* LastAccessTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwLowDateTime); /* LastWriteTime */
+			                    find_data->ftLastWriteTime.dwLowDateTime); /* LastWriteTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwHighDateTime); /* LastWriteTime */
+			                    find_data->ftLastWriteTime.dwHighDateTime); /* LastWriteTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwLowDateTime); /* ChangeTime */
+			                    find_data->ftLastWriteTime.dwLowDateTime); /* ChangeTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwHighDateTime); /* ChangeTime */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeLow);           /* EndOfFile */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeHigh);          /* EndOfFile */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeLow);     /* AllocationSize */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeHigh);    /* AllocationSize */
-			Stream_Write_UINT32(output, file->find_data.dwFileAttributes); /* FileAttributes */
+			                    find_data->ftLastWriteTime.dwHighDateTime); /* ChangeTime */
+			Stream_Write_UINT32(output, find_data->nFileSizeLow);           /* EndOfFile */
+			Stream_Write_UINT32(output, find_data->nFileSizeHigh);          /* EndOfFile */
+			Stream_Write_UINT32(output, find_data->nFileSizeLow);     /* AllocationSize */
+			Stream_Write_UINT32(output, find_data->nFileSizeHigh);    /* AllocationSize */
+			Stream_Write_UINT32(output, find_data->dwFileAttributes); /* FileAttributes */
 			Stream_Write_UINT32(output, (UINT32)length);                   /* FileNameLength */
-			Stream_Write(output, file->find_data.cFileName, length);
+			Stream_Write(output, find_data->cFileName, length);
 			break;
 
 		case FileFullDirectoryInformation:
@@ -843,29 +1097,29 @@ BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYT
 			Stream_Write_UINT32(output, 0);                     /* NextEntryOffset */
 			Stream_Write_UINT32(output, 0);                     /* FileIndex */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftCreationTime.dwLowDateTime); /* CreationTime */
+			                    find_data->ftCreationTime.dwLowDateTime); /* CreationTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftCreationTime.dwHighDateTime); /* CreationTime */
+			                    find_data->ftCreationTime.dwHighDateTime); /* CreationTime */
 			Stream_Write_UINT32(
-			    output, file->find_data.ftLastAccessTime.dwLowDateTime); /* LastAccessTime */
+			    output, find_data->ftLastAccessTime.dwLowDateTime); /* LastAccessTime */
 			Stream_Write_UINT32(
-			    output, file->find_data.ftLastAccessTime.dwHighDateTime); /* LastAccessTime */
+			    output, find_data->ftLastAccessTime.dwHighDateTime); /* LastAccessTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwLowDateTime); /* LastWriteTime */
+			                    find_data->ftLastWriteTime.dwLowDateTime); /* LastWriteTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwHighDateTime); /* LastWriteTime */
+			                    find_data->ftLastWriteTime.dwHighDateTime); /* LastWriteTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwLowDateTime); /* ChangeTime */
+			                    find_data->ftLastWriteTime.dwLowDateTime); /* ChangeTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwHighDateTime); /* ChangeTime */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeLow);           /* EndOfFile */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeHigh);          /* EndOfFile */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeLow);     /* AllocationSize */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeHigh);    /* AllocationSize */
-			Stream_Write_UINT32(output, file->find_data.dwFileAttributes); /* FileAttributes */
+			                    find_data->ftLastWriteTime.dwHighDateTime); /* ChangeTime */
+			Stream_Write_UINT32(output, find_data->nFileSizeLow);           /* EndOfFile */
+			Stream_Write_UINT32(output, find_data->nFileSizeHigh);          /* EndOfFile */
+			Stream_Write_UINT32(output, find_data->nFileSizeLow);     /* AllocationSize */
+			Stream_Write_UINT32(output, find_data->nFileSizeHigh);    /* AllocationSize */
+			Stream_Write_UINT32(output, find_data->dwFileAttributes); /* FileAttributes */
 			Stream_Write_UINT32(output, (UINT32)length);                   /* FileNameLength */
 			Stream_Write_UINT32(output, 0);                                /* EaSize */
-			Stream_Write(output, file->find_data.cFileName, length);
+			Stream_Write(output, find_data->cFileName, length);
 			break;
 
 		case FileBothDirectoryInformation:
@@ -881,32 +1135,32 @@ BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYT
 			Stream_Write_UINT32(output, 0);                     /* NextEntryOffset */
 			Stream_Write_UINT32(output, 0);                     /* FileIndex */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftCreationTime.dwLowDateTime); /* CreationTime */
+			                    find_data->ftCreationTime.dwLowDateTime); /* CreationTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftCreationTime.dwHighDateTime); /* CreationTime */
+			                    find_data->ftCreationTime.dwHighDateTime); /* CreationTime */
 			Stream_Write_UINT32(
-			    output, file->find_data.ftLastAccessTime.dwLowDateTime); /* LastAccessTime */
+			    output, find_data->ftLastAccessTime.dwLowDateTime); /* LastAccessTime */
 			Stream_Write_UINT32(
-			    output, file->find_data.ftLastAccessTime.dwHighDateTime); /* LastAccessTime */
+			    output, find_data->ftLastAccessTime.dwHighDateTime); /* LastAccessTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwLowDateTime); /* LastWriteTime */
+			                    find_data->ftLastWriteTime.dwLowDateTime); /* LastWriteTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwHighDateTime); /* LastWriteTime */
+			                    find_data->ftLastWriteTime.dwHighDateTime); /* LastWriteTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwLowDateTime); /* ChangeTime */
+			                    find_data->ftLastWriteTime.dwLowDateTime); /* ChangeTime */
 			Stream_Write_UINT32(output,
-			                    file->find_data.ftLastWriteTime.dwHighDateTime); /* ChangeTime */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeLow);           /* EndOfFile */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeHigh);          /* EndOfFile */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeLow);     /* AllocationSize */
-			Stream_Write_UINT32(output, file->find_data.nFileSizeHigh);    /* AllocationSize */
-			Stream_Write_UINT32(output, file->find_data.dwFileAttributes); /* FileAttributes */
+			                    find_data->ftLastWriteTime.dwHighDateTime); /* ChangeTime */
+			Stream_Write_UINT32(output, find_data->nFileSizeLow);           /* EndOfFile */
+			Stream_Write_UINT32(output, find_data->nFileSizeHigh);          /* EndOfFile */
+			Stream_Write_UINT32(output, find_data->nFileSizeLow);     /* AllocationSize */
+			Stream_Write_UINT32(output, find_data->nFileSizeHigh);    /* AllocationSize */
+			Stream_Write_UINT32(output, find_data->dwFileAttributes); /* FileAttributes */
 			Stream_Write_UINT32(output, (UINT32)length);                   /* FileNameLength */
 			Stream_Write_UINT32(output, 0);                                /* EaSize */
 			Stream_Write_UINT8(output, 0);                                 /* ShortNameLength */
 			/* Reserved(1), MUST NOT be added! */
 			Stream_Zero(output, 24); /* ShortName */
-			Stream_Write(output, file->find_data.cFileName, length);
+			Stream_Write(output, find_data->cFileName, length);
 			break;
 
 		case FileNamesInformation:
@@ -922,7 +1176,7 @@ BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYT
 			Stream_Write_UINT32(output, 0);                     /* NextEntryOffset */
 			Stream_Write_UINT32(output, 0);                     /* FileIndex */
 			Stream_Write_UINT32(output, (UINT32)length);        /* FileNameLength */
-			Stream_Write(output, file->find_data.cFileName, length);
+			Stream_Write(output, find_data->cFileName, length);
 			break;
 
 		default:
@@ -27,17 +27,27 @@
 #define FREERDP_CHANNEL_DRIVE_CLIENT_FILE_H
 
 #include <winpr/stream.h>
+#include <winpr/collections.h>
 #include <freerdp/channels/log.h>
 
+#include "drive_cache.h"
+
 #define TAG CHANNELS_TAG("drive.client")
 
+/* size of the read-ahead and write-behind buffer of a file */
+#define DRIVE_FILE_BUFFER_SIZE (256 * 1024)
+
 typedef struct
 {
 	UINT32 id;
 	BOOL is_dir;
 	HANDLE file_handle;
-	HANDLE find_handle;
-	WIN32_FIND_DATAW find_data;
+	DRIVE_CACHE* cache;
+	DRIVE_LISTING* listing;
+	size_t listingIndex;
+	BYTE* queryPath;
+	UINT32 queryPathLength;
+	WCHAR* queryFullpath;
 	const WCHAR* basepath;
 	WCHAR* fullpath;
 	WCHAR* filename;
@@ -47,17 +57,31 @@ typedef struct
 	UINT32 DesiredAccess;
 	UINT32 CreateDisposition;
 	UINT32 CreateOptions;
+	BOOL modified;
+
+	/* IRPs waiting to run, in order, and whether a worker has them scheduled */
+	wQueue* irps;
+	BOOL queued;
+
+	BYTE* buffer;
+	UINT32 bufferSize;
+	UINT64 bufferOffset;
+	UINT32 bufferLength;
+	BOOL bufferDirty;
+	UINT64 nextOffset;
 } DRIVE_FILE;
 
-DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 PathLength, UINT32 id,
-                           UINT32 DesiredAccess, UINT32 CreateDisposition, UINT32 CreateOptions,
-                           UINT32 FileAttributes, UINT32 SharedAccess);
+DRIVE_FILE* drive_file_new(DRIVE_CACHE* cache, const WCHAR* base_path, const WCHAR* path,
+                           UINT32 PathLength, UINT32 id, UINT32 DesiredAccess,
+                           UINT32 CreateDisposition, UINT32 CreateOptions, UINT32 FileAttributes,
+                           UINT32 SharedAccess);
 BOOL drive_file_free(DRIVE_FILE* file);
 
 BOOL drive_file_open(DRIVE_FILE* file);
 BOOL drive_file_seek(DRIVE_FILE* file, UINT64 Offset);
-BOOL drive_file_read(DRIVE_FILE* file, BYTE* buffer, UINT32* Length);
-BOOL drive_file_write(DRIVE_FILE* file, BYTE* buffer, UINT32 Length);
+BOOL drive_file_read(DRIVE_FILE* file, UINT64 Offset, BYTE* buffer, UINT32* Length);
+BOOL drive_file_write(DRIVE_FILE* file, UINT64 Offset, const BYTE* buffer, UINT32 Length);
+BOOL drive_file_flush(DRIVE_FILE* file);
 BOOL drive_file_query_information(DRIVE_FILE* file, UINT32 FsInformationClass, wStream* output);
 BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UINT32 Length,
                                 wStream* input);
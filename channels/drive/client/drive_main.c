@@ -45,6 +45,9 @@
 
 #include "drive_file.h"
 
+/* IRPs of different files run in parallel on this many threads */
+#define DRIVE_WORKER_THREADS 4
+
 typedef struct
 {
 	DEVICE device;
@@ -53,10 +56,15 @@ typedef struct
 	BOOL automount;
 	UINT32 PathLength;
 	wListDictionary* files;
+	DRIVE_CACHE* cache;
 
 	HANDLE thread;
 	wMessageQueue* IrpQueue;
 
+	CRITICAL_SECTION lock;
+	HANDLE workers[DRIVE_WORKER_THREADS];
+	wMessageQueue* FileQueue;
+
 	DEVMAN* devman;
 
 	rdpContext* rdpcontext;
@@ -64,6 +72,8 @@ typedef struct
 
 static UINT sys_code_page = 0;
 
+static UINT drive_process_irp(DRIVE_DEVICE* drive, IRP* irp);
+
 static DWORD drive_map_windows_err(DWORD fs_errno)
 {
 	DWORD rc;
@@ -181,8 +191,8 @@ static UINT drive_process_irp_create(DRIVE_DEVICE* drive, IRP* irp)
 
 	path = (const WCHAR*)Stream_Pointer(irp->input);
 	FileId = irp->devman->id_sequence++;
-	file = drive_file_new(drive->path, path, PathLength, FileId, DesiredAccess, CreateDisposition,
-	                      CreateOptions, FileAttributes, SharedAccess);
+	file = drive_file_new(drive->cache, drive->path, path, PathLength, FileId, DesiredAccess,
+	                      CreateDisposition, CreateOptions, FileAttributes, SharedAccess);
 
 	if (!file)
 	{
@@ -236,19 +246,37 @@ static UINT drive_process_irp_create(DRIVE_DEVICE* drive, IRP* irp)
 static UINT drive_process_irp_close(DRIVE_DEVICE* drive, IRP* irp)
 {
 	void* key;
+	IRP* pending;
 	DRIVE_FILE* file;
+	UINT error = CHANNEL_RC_OK;
+	UINT status;
 
 	if (!drive || !irp || !irp->Complete || !irp->output)
 		return ERROR_INVALID_PARAMETER;
 
-	file = drive_get_file_by_id(drive, irp->FileId);
 	key = (void*)(size_t)irp->FileId;
+	EnterCriticalSection(&drive->lock);
+	file = drive_get_file_by_id(drive, irp->FileId);
+
+	if (file)
+		ListDictionary_Remove(drive->files, key);
+
+	LeaveCriticalSection(&drive->lock);
 
 	if (!file)
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
 	else
 	{
-		ListDictionary_Remove(drive->files, key);
+		/* requests that were queued behind the close no longer find the file, the file is
+		 * freed and the close completed even if one of them fails */
+		while ((pending = (IRP*)Queue_Dequeue(file->irps)))
+		{
+			if ((status = drive_process_irp(drive, pending)) && !error)
+			{
+				WLog_ERR(TAG, "drive_process_irp failed with error %" PRIu32 "!", status);
+				error = status;
+			}
+		}
 
 		if (drive_file_free(file))
 			irp->IoStatus = STATUS_SUCCESS;
@@ -257,7 +285,8 @@ static UINT drive_process_irp_close(DRIVE_DEVICE* drive, IRP* irp)
 	}
 
 	Stream_Zero(irp->output, 5); /* Padding(5) */
-	return irp->Complete(irp);
+	status = irp->Complete(irp);
+	return error ? error : status;
 }
 
 /**
@@ -286,11 +315,6 @@ static UINT drive_process_irp_read(DRIVE_DEVICE* drive, IRP* irp)
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
 		Length = 0;
 	}
-	else if (!drive_file_seek(file, Offset))
-	{
-		irp->IoStatus = drive_map_windows_err(GetLastError());
-		Length = 0;
-	}
 
 	if (!Stream_EnsureRemainingCapacity(irp->output, Length + 4))
 	{
@@ -303,7 +327,7 @@ static UINT drive_process_irp_read(DRIVE_DEVICE* drive, IRP* irp)
 	{
 		BYTE* buffer = Stream_Pointer(irp->output) + sizeof(UINT32);
 
-		if (!drive_file_read(file, buffer, &Length))
+		if (!drive_file_read(file, Offset, buffer, &Length))
 		{
 			irp->IoStatus = drive_map_windows_err(GetLastError());
 			Stream_Write_UINT32(irp->output, 0);
@@ -349,12 +373,7 @@ static UINT drive_process_irp_write(DRIVE_DEVICE* drive, IRP* irp)
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
 		Length = 0;
 	}
-	else if (!drive_file_seek(file, Offset))
-	{
-		irp->IoStatus = drive_map_windows_err(GetLastError());
-		Length = 0;
-	}
-	else if (!drive_file_write(file, ptr, Length))
+	else if (!drive_file_write(file, Offset, ptr, Length))
 	{
 		irp->IoStatus = drive_map_windows_err(GetLastError());
 		Length = 0;
@@ -748,6 +767,110 @@ static UINT drive_process_irp(DRIVE_DEVICE* drive, IRP* irp)
 	return error;
 }
 
+/**
+ * Function description
+ * Hand an IRP to the file it is for. The IRPs of a file run in order on one of the workers,
+ * those of different files in parallel. IRPs without an open file run right away.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drive_dispatch_irp(DRIVE_DEVICE* drive, IRP* irp)
+{
+	UINT error = CHANNEL_RC_OK;
+	DRIVE_FILE* file = NULL;
+
+	if (irp->MajorFunction != IRP_MJ_CREATE)
+	{
+		EnterCriticalSection(&drive->lock);
+		file = drive_get_file_by_id(drive, irp->FileId);
+
+		if (file)
+		{
+			if (!Queue_Enqueue(file->irps, irp))
+			{
+				WLog_ERR(TAG, "Queue_Enqueue failed!");
+				error = ERROR_INTERNAL_ERROR;
+			}
+			else if (!file->queued)
+			{
+				file->queued = MessageQueue_Post(drive->FileQueue, NULL, 0, file, NULL);
+
+				if (!file->queued)
+				{
+					WLog_ERR(TAG, "MessageQueue_Post failed!");
+					error = ERROR_INTERNAL_ERROR;
+				}
+			}
+		}
+
+		LeaveCriticalSection(&drive->lock);
+
+		if (file)
+			return error;
+	}
+
+	return drive_process_irp(drive, irp);
+}
+
+static DWORD WINAPI drive_worker_func(LPVOID arg)
+{
+	IRP* irp;
+	BOOL closing;
+	wMessage message;
+	DRIVE_FILE* file;
+	DRIVE_DEVICE* drive = (DRIVE_DEVICE*)arg;
+	UINT error = CHANNEL_RC_OK;
+
+	WINPR_ASSERT(drive);
+
+	while (MessageQueue_Wait(drive->FileQueue))
+	{
+		/* another worker may have been faster */
+		if (!MessageQueue_Peek(drive->FileQueue, &message, TRUE))
+			continue;
+
+		file = (DRIVE_FILE*)message.wParam;
+
+		if (!file)
+			break;
+
+		EnterCriticalSection(&drive->lock);
+		irp = (IRP*)Queue_Dequeue(file->irps);
+		LeaveCriticalSection(&drive->lock);
+
+		if (!irp)
+			continue;
+
+		/* a close frees the file */
+		closing = (irp->MajorFunction == IRP_MJ_CLOSE);
+
+		if ((error = drive_process_irp(drive, irp)))
+		{
+			WLog_ERR(TAG, "drive_process_irp failed with error %" PRIu32 "!", error);
+			break;
+		}
+
+		if (closing)
+			continue;
+
+		/* one IRP at a time, other files get their turn in between */
+		EnterCriticalSection(&drive->lock);
+
+		if (Queue_Count(file->irps) > 0)
+			file->queued = MessageQueue_Post(drive->FileQueue, NULL, 0, file, NULL);
+		else
+			file->queued = FALSE;
+
+		LeaveCriticalSection(&drive->lock);
+	}
+
+	if (error && drive->rdpcontext)
+		setChannelError(drive->rdpcontext, error, "drive_worker_func reported an error");
+
+	ExitThread(error);
+	return error;
+}
+
 static DWORD WINAPI drive_thread_func(LPVOID arg)
 {
 	IRP* irp;
@@ -784,9 +907,9 @@ static DWORD WINAPI drive_thread_func(LPVOID arg)
 
 		if (irp)
 		{
-			if ((error = drive_process_irp(drive, irp)))
+			if ((error = drive_dispatch_irp(drive, irp)))
 			{
-				WLog_ERR(TAG, "drive_process_irp failed with error %" PRIu32 "!", error);
+				WLog_ERR(TAG, "drive_dispatch_irp failed with error %" PRIu32 "!", error);
 				break;
 			}
 		}
@@ -824,20 +947,77 @@ static UINT drive_irp_request(DEVICE* device, IRP* irp)
 
 static UINT drive_free_int(DRIVE_DEVICE* drive)
 {
+	size_t x;
 	UINT error = CHANNEL_RC_OK;
 
 	if (!drive)
 		return ERROR_INVALID_PARAMETER;
 
 	CloseHandle(drive->thread);
+
+	for (x = 0; x < ARRAYSIZE(drive->workers); x++)
+	{
+		if (drive->workers[x])
+			CloseHandle(drive->workers[x]);
+	}
+
 	ListDictionary_Free(drive->files);
+	drive_cache_free(drive->cache);
 	MessageQueue_Free(drive->IrpQueue);
+	MessageQueue_Free(drive->FileQueue);
+	DeleteCriticalSection(&drive->lock);
 	Stream_Free(drive->device.data, TRUE);
 	free(drive->path);
 	free(drive);
 	return error;
 }
 
+/**
+ * Function description
+ * Stop the workers once the dispatcher is gone and drop the IRPs they did not get to.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drive_stop_workers(DRIVE_DEVICE* drive)
+{
+	size_t x;
+	IRP* irp;
+	wMessage message;
+	DRIVE_FILE* file;
+
+	/* a message without a file stops one worker */
+	for (x = 0; x < ARRAYSIZE(drive->workers); x++)
+	{
+		if (drive->workers[x] && !MessageQueue_Post(drive->FileQueue, NULL, 0, NULL, NULL))
+			return ERROR_INTERNAL_ERROR;
+	}
+
+	for (x = 0; x < ARRAYSIZE(drive->workers); x++)
+	{
+		if (drive->workers[x] && (WaitForSingleObject(drive->workers[x], INFINITE) == WAIT_FAILED))
+		{
+			const UINT error = GetLastError();
+			WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "", error);
+			return error;
+		}
+	}
+
+	while (MessageQueue_Peek(drive->FileQueue, &message, TRUE))
+	{
+		file = (DRIVE_FILE*)message.wParam;
+
+		if (!file)
+			continue;
+
+		while ((irp = (IRP*)Queue_Dequeue(file->irps)))
+			irp->Discard(irp);
+
+		file->queued = FALSE;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  *
@@ -859,6 +1039,9 @@ static UINT drive_free(DEVICE* device)
 		return error;
 	}
 
+	if ((error = drive_stop_workers(drive)))
+		return error;
+
 	return drive_free_int(drive);
 }
 
@@ -900,6 +1083,7 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 			return CHANNEL_RC_NO_MEMORY;
 		}
 
+		InitializeCriticalSection(&drive->lock);
 		drive->device.type = RDPDR_DTYP_FILESYSTEM;
 		drive->device.IRPRequest = drive_irp_request;
 		drive->device.Free = drive_free;
@@ -961,6 +1145,15 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 		}
 
 		ListDictionary_ValueObject(drive->files)->fnObjectFree = drive_file_objfree;
+		drive->cache = drive_cache_new();
+
+		if (!drive->cache)
+		{
+			WLog_ERR(TAG, "drive_cache_new failed!");
+			error = CHANNEL_RC_NO_MEMORY;
+			goto out_error;
+		}
+
 		drive->IrpQueue = MessageQueue_New(NULL);
 
 		if (!drive->IrpQueue)
@@ -970,12 +1163,31 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 			goto out_error;
 		}
 
+		drive->FileQueue = MessageQueue_New(NULL);
+
+		if (!drive->FileQueue)
+		{
+			WLog_ERR(TAG, "MessageQueue_New failed!");
+			error = CHANNEL_RC_NO_MEMORY;
+			goto out_error;
+		}
+
 		if ((error = pEntryPoints->RegisterDevice(pEntryPoints->devman, (DEVICE*)drive)))
 		{
 			WLog_ERR(TAG, "RegisterDevice failed with error %" PRIu32 "!", error);
 			goto out_error;
 		}
 
+		for (i = 0; i < ARRAYSIZE(drive->workers); i++)
+		{
+			if (!(drive->workers[i] =
+			          CreateThread(NULL, 0, drive_worker_func, drive, CREATE_SUSPENDED, NULL)))
+			{
+				WLog_ERR(TAG, "CreateThread failed!");
+				goto out_error;
+			}
+		}
+
 		if (!(drive->thread =
 		          CreateThread(NULL, 0, drive_thread_func, drive, CREATE_SUSPENDED, NULL)))
 		{
@@ -983,6 +1195,9 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 			goto out_error;
 		}
 
+		for (i = 0; i < ARRAYSIZE(drive->workers); i++)
+			ResumeThread(drive->workers[i]);
+
 		ResumeThread(drive->thread);
 	}
 
@@ -618,6 +618,85 @@ static UINT rdpgfx_recv_evict_cache_entry_pdu(GENERIC_CHANNEL_CALLBACK* callback
 	return error;
 }
 
+static BOOL rdpgfx_use_persistent_store(const rdpSettings* settings)
+{
+	WINPR_ASSERT(settings);
+
+	return settings->BitmapCachePersistEnabled && settings->BitmapCachePersistStore &&
+	       settings->BitmapCachePersistFile;
+}
+
+static rdpPersistentStore* rdpgfx_get_persistent_store(RDPGFX_PLUGIN* gfx)
+{
+	UINT32 flags = 0;
+	WINPR_ASSERT(gfx);
+	WINPR_ASSERT(gfx->rdpcontext);
+	rdpSettings* settings = gfx->rdpcontext->settings;
+
+	if (gfx->store)
+		return gfx->store;
+
+	if (settings->BitmapCachePersistCompress)
+		flags |= PERSISTENT_STORE_FLAG_COMPRESS;
+
+	gfx->store = persistent_store_open(settings->BitmapCachePersistFile, flags);
+
+	if (!gfx->store)
+		WLog_Print(gfx->log, WLOG_ERROR, "failed to open persistent cache store %s",
+		           settings->BitmapCachePersistFile);
+
+	return gfx->store;
+}
+
+/**
+ * Function description
+ * Build the cache import offer from the index of the persistent store, most recently used
+ * entries first. No bitmap data is read.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_load_store_offer(RDPGFX_PLUGIN* gfx, RDPGFX_CACHE_IMPORT_OFFER_PDU* offer)
+{
+	size_t idx, count;
+	PERSISTENT_CACHE_ENTRY* entries;
+	rdpPersistentStore* store = rdpgfx_get_persistent_store(gfx);
+
+	WINPR_ASSERT(offer);
+
+	offer->cacheEntriesCount = 0;
+	gfx->CacheOfferCount = 0;
+
+	if (!store)
+		return CHANNEL_RC_INITIALIZATION_ERROR;
+
+	count = RDPGFX_CACHE_ENTRY_MAX_COUNT - 1;
+
+	if (count > gfx->MaxCacheSlots)
+		count = gfx->MaxCacheSlots;
+
+	if (count < 1)
+		return CHANNEL_RC_OK;
+
+	entries = (PERSISTENT_CACHE_ENTRY*)calloc(count, sizeof(PERSISTENT_CACHE_ENTRY));
+
+	if (!entries)
+		return CHANNEL_RC_NO_MEMORY;
+
+	count = persistent_store_get_entries(store, entries, count);
+
+	for (idx = 0; idx < count; idx++)
+	{
+		offer->cacheEntries[idx].cacheKey = entries[idx].key64;
+		offer->cacheEntries[idx].bitmapLength = entries[idx].size;
+		gfx->CacheOfferKeys[idx] = entries[idx].key64;
+	}
+
+	offer->cacheEntriesCount = (UINT16)count;
+	gfx->CacheOfferCount = (UINT16)count;
+	free(entries);
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Load cache import offer from file (offline replay)
  *
@@ -644,6 +723,9 @@ UINT rdpgfx_load_cache_import_offer(RDPGFX_PLUGIN* gfx, RDPGFX_CACHE_IMPORT_OFFE
 	if (!settings->BitmapCachePersistFile)
 		return CHANNEL_RC_OK;
 
+	if (rdpgfx_use_persistent_store(settings))
+		return rdpgfx_load_store_offer(gfx, offer);
+
 	persistent = persistent_cache_new();
 
 	if (!persistent)
@@ -722,6 +804,10 @@ static UINT rdpgfx_save_persistent_cache(RDPGFX_PLUGIN* gfx)
 	if (!settings->BitmapCachePersistFile)
 		return CHANNEL_RC_OK;
 
+	/* the store is written as entries arrive, there is nothing left to save */
+	if (rdpgfx_use_persistent_store(settings))
+		return CHANNEL_RC_OK;
+
 	if (!context->ExportCacheEntry)
 		return CHANNEL_RC_INITIALIZATION_ERROR;
 
@@ -852,6 +938,19 @@ static UINT rdpgfx_send_cache_offer(RDPGFX_PLUGIN* gfx)
 	if (!settings->BitmapCachePersistFile)
 		return CHANNEL_RC_OK;
 
+	if (rdpgfx_use_persistent_store(settings))
+	{
+		error = rdpgfx_load_store_offer(gfx, &offer);
+
+		if ((error == CHANNEL_RC_OK) && (offer.cacheEntriesCount > 0))
+		{
+			WLog_DBG(TAG, "Sending Cache Import Offer: %" PRIu16, offer.cacheEntriesCount);
+			error = rdpgfx_send_cache_import_offer_pdu(context, &offer);
+		}
+
+		return error;
+	}
+
 	persistent = persistent_cache_new();
 
 	if (!persistent)
@@ -911,6 +1010,48 @@ fail:
 	return error;
 }
 
+/**
+ * Function description
+ * Load the entries the server accepted from the persistent store. Only these are read,
+ * in the order they were offered.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_load_store_import_reply(RDPGFX_PLUGIN* gfx,
+                                           const RDPGFX_CACHE_IMPORT_REPLY_PDU* reply)
+{
+	UINT16 idx, count;
+	PERSISTENT_CACHE_ENTRY entry = { 0 };
+	RdpgfxClientContext* context = gfx->context;
+	rdpPersistentStore* store = rdpgfx_get_persistent_store(gfx);
+
+	if (!store)
+		return CHANNEL_RC_INITIALIZATION_ERROR;
+
+	count = (gfx->CacheOfferCount < reply->importedEntriesCount) ? gfx->CacheOfferCount
+	                                                              : reply->importedEntriesCount;
+
+	WLog_DBG(TAG, "Receiving Cache Import Reply: %" PRIu16, count);
+
+	for (idx = 0; idx < count; idx++)
+	{
+		if (reply->cacheSlots[idx] == 0)
+			continue;
+
+		if (!persistent_store_read_entry(store, gfx->CacheOfferKeys[idx], &entry))
+		{
+			WLog_Print(gfx->log, WLOG_WARN, "offered cache entry 0x%016" PRIX64 " is gone",
+			           gfx->CacheOfferKeys[idx]);
+			continue;
+		}
+
+		if (context && context->ImportCacheEntry)
+			context->ImportCacheEntry(context, reply->cacheSlots[idx], &entry);
+	}
+
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  *
@@ -937,6 +1078,9 @@ static UINT rdpgfx_load_cache_import_reply(RDPGFX_PLUGIN* gfx, RDPGFX_CACHE_IMPO
 	if (!settings->BitmapCachePersistFile)
 		return CHANNEL_RC_OK;
 
+	if (rdpgfx_use_persistent_store(settings))
+		return rdpgfx_load_store_import_reply(gfx, reply);
+
 	persistent = persistent_cache_new();
 
 	if (!persistent)
@@ -1585,6 +1729,26 @@ static UINT rdpgfx_recv_surface_to_surface_pdu(GENERIC_CHANNEL_CALLBACK* callbac
 	return error;
 }
 
+static void rdpgfx_store_cache_entry(RDPGFX_PLUGIN* gfx, UINT16 cacheSlot)
+{
+	PERSISTENT_CACHE_ENTRY entry = { 0 };
+	rdpPersistentStore* store;
+	RdpgfxClientContext* context = gfx->context;
+	WINPR_ASSERT(gfx->rdpcontext);
+
+	if (!rdpgfx_use_persistent_store(gfx->rdpcontext->settings) || !context->ExportCacheEntry)
+		return;
+
+	store = rdpgfx_get_persistent_store(gfx);
+
+	if (!store || (context->ExportCacheEntry(context, cacheSlot, &entry) != CHANNEL_RC_OK))
+		return;
+
+	if (!persistent_store_write_entry(store, &entry))
+		WLog_Print(gfx->log, WLOG_WARN, "failed to store cache entry 0x%016" PRIX64,
+		           entry.key64);
+}
+
 /**
  * Function description
  *
@@ -1628,6 +1792,8 @@ static UINT rdpgfx_recv_surface_to_cache_pdu(GENERIC_CHANNEL_CALLBACK* callback,
 		if (error)
 			WLog_Print(gfx->log, WLOG_ERROR,
 			           "context->SurfaceToCache failed with error %" PRIu32 "", error);
+		else
+			rdpgfx_store_cache_entry(gfx, pdu.cacheSlot);
 	}
 
 	return error;
@@ -2167,6 +2333,10 @@ static UINT rdpgfx_on_close(IWTSVirtualChannelCallback* pChannelCallback)
 	free_surfaces(context, gfx->SurfaceTable);
 	evict_cache_slots(context, gfx->MaxCacheSlots, gfx->CacheSlots);
 
+	persistent_store_close(gfx->store);
+	gfx->store = NULL;
+	gfx->CacheOfferCount = 0;
+
 	free(callback);
 	gfx->UnacknowledgedFrames = 0;
 	gfx->TotalDecodedFrames = 0;
@@ -2187,6 +2357,8 @@ static void terminate_plugin_cb(GENERIC_DYNVC_PLUGIN* base)
 	RdpgfxClientContext* context = gfx->context;
 
 	DEBUG_RDPGFX(gfx->log, "Terminated");
+	persistent_store_close(gfx->store);
+	gfx->store = NULL;
 	rdpgfx_client_context_free(context);
 }
 
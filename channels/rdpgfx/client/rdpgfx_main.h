@@ -50,6 +50,9 @@ typedef struct
 	UINT16 MaxCacheSlots;
 	void* CacheSlots[25600];
 	rdpPersistentCache* persistent;
+	rdpPersistentStore* store;
+	UINT16 CacheOfferCount;
+	UINT64 CacheOfferKeys[RDPGFX_CACHE_ENTRY_MAX_COUNT];
 
 	rdpContext* rdpcontext;
 
@@ -1835,6 +1835,10 @@ static int parse_tls_options(rdpSettings* settings, const COMMAND_LINE_ARGUMENT_
 			rc = parse_tls_secrets_file(settings, &arg->Value[13]);
 		else if (option_starts_with("enforce:", arg->Value))
 			rc = parse_tls_enforce(settings, &arg->Value[8]);
+		else if (option_equals("kernel-offload", arg->Value))
+			rc = freerdp_settings_set_bool(settings, FreeRDP_TlsKernelOffload, TRUE)
+			         ? 0
+			         : COMMAND_LINE_ERROR;
 	}
 
 #if defined(WITH_FREERDP_DEPRECATED_COMMANDLINE)
@@ -2301,6 +2305,18 @@ static int parse_cache_options(rdpSettings* settings, const COMMAND_LINE_ARGUMEN
 					                                          : GLYPH_SUPPORT_NONE))
 						rc = COMMAND_LINE_ERROR;
 				}
+				else if (option_starts_with("persist-store", val))
+				{
+					if (!freerdp_settings_set_bool(settings, FreeRDP_BitmapCachePersistStore,
+					                               bval > 0))
+						rc = COMMAND_LINE_ERROR;
+				}
+				else if (option_starts_with("persist-compress", val))
+				{
+					if (!freerdp_settings_set_bool(settings, FreeRDP_BitmapCachePersistCompress,
+					                               bval > 0))
+						rc = COMMAND_LINE_ERROR;
+				}
 				else if (option_starts_with("persist", val))
 				{
 					if (!freerdp_settings_set_bool(settings, FreeRDP_BitmapCachePersistEnabled,
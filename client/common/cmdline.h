@@ -84,7 +84,7 @@ static const COMMAND_LINE_ARGUMENT_A global_cmd_args[] = {
 	  NULL, "Print the build configuration" },
 	{ "cache", COMMAND_LINE_VALUE_REQUIRED,
 	  "[bitmap[:on|off],codec[:rfx|nsc],glyph[:on|off],offscreen[:on|off],persist,persist-file:<"
-	  "filename>]",
+	  "filename>,persist-store[:on|off],persist-compress[:on|off]]",
 	  NULL, NULL, -1, NULL, "" },
 	{ "cert", COMMAND_LINE_VALUE_REQUIRED,
 	  "[deny,ignore,name:<name>,tofu,fingerprint:<hash>:<hash as hex>[,fingerprint:<hash>:<another "
@@ -408,8 +408,8 @@ static const COMMAND_LINE_ARGUMENT_A global_cmd_args[] = {
 	{ "timeout", COMMAND_LINE_VALUE_REQUIRED, "<time in ms>", "9000", NULL, -1, "timeout",
 	  "Advanced setting for high latency links: Adjust connection timeout, use if you encounter "
 	  "timeout failures with your connection" },
-	{ "tls", COMMAND_LINE_VALUE_REQUIRED, "[ciphers|seclevel|secrets-file|enforce]", NULL, NULL, -1,
-	  NULL,
+	{ "tls", COMMAND_LINE_VALUE_REQUIRED, "[ciphers|seclevel|secrets-file|enforce|kernel-offload]",
+	  NULL, NULL, -1, NULL,
 	  "TLS configuration options:"
 	  " * ciphers:[netmon|ma|<cipher names>]"
 	  " * seclevel:<level>, default: 1, range: [0-5] Override the default TLS security level, "
@@ -418,7 +418,9 @@ static const COMMAND_LINE_ARGUMENT_A global_cmd_args[] = {
 	  " * enforce[:[ssl3|1.0|1.1|1.2|1.3]] Force use of SSL/TLS version for a connection. Some "
 	  "servers have a buggy TLS "
 	  "version negotiation and might fail without this. Defaults to TLS 1.2 if no argument is "
-	  "supplied. Use 1.0 for windows 7" },
+	  "supplied. Use 1.0 for windows 7"
+	  " * kernel-offload Let the kernel encrypt what is sent once the handshake is done (Linux "
+	  "kTLS), falls back to OpenSSL if the kernel or cipher does not support it" },
 #if defined(WITH_FREERDP_DEPRECATED_COMMANDLINE)
 	{ "tls-ciphers", COMMAND_LINE_VALUE_REQUIRED, "[netmon|ma|ciphers]", NULL, NULL, -1, NULL,
 	  "[DEPRECATED, use /tls:ciphers] Allowed TLS ciphers" },
@@ -0,0 +1,943 @@
+#include <freerdp/config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/stream.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/peer.h>
+#include <freerdp/client.h>
+#include <freerdp/client/cmdline.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/codec/rfx.h>
+#include <freerdp/codec/planar.h>
+#include <freerdp/streamdump.h>
+#include <freerdp/transport_io.h>
+#include <freerdp/utils/stopwatch.h>
+
+#if defined(CHANNEL_RDPGFX_CLIENT)
+#include <freerdp/client/rdpgfx.h>
+#include <freerdp/channels/rdpgfx.h>
+#include <freerdp/gdi/gfx.h>
+#endif
+
+#define TEST_FRAMES 48
+#define TEST_TILE 128
+#define TEST_BITMAP 64
+
+/**
+ * Without arguments a session is recorded against an in-process server and replayed, the replay
+ * has to end up with the picture the live client saw. With arguments a recording made with
+ * /dump:record,<file> is replayed, e.g.
+ *
+ * TestClient TestClientReplay [--paced] [--json=<file>] /dump:replay,<file> [<client options>]
+ *
+ * The client options have to enable what the recorded client used, /gfx for example.
+ */
+
+typedef struct
+{
+	rdpClientContext common;
+
+	int sockfd;
+	rdpTransportIo io;
+	pSurfaceBits SurfaceBits;
+	pBitmapUpdate BitmapUpdate;
+	pEndPaint EndPaint;
+#if defined(CHANNEL_RDPGFX_CLIENT)
+	pcRdpgfxSurfaceCommand SurfaceCommand;
+#endif
+
+	STOPWATCH transport;
+	STOPWATCH bulk;
+	STOPWATCH codec;
+	UINT64 pdus;
+	UINT64 bytes;
+	UINT64 frames;
+} test_client;
+
+typedef struct
+{
+	int sockfd;
+	const char* certificate;
+	const char* key;
+	BOOL activated;
+	BOOL success;
+} test_server;
+
+typedef struct
+{
+	const char* recording;
+	BOOL paced;
+	UINT64 pdus;
+	UINT64 bytes;
+	UINT64 frames;
+	UINT64 duration;
+	UINT64 transport;
+	UINT64 bulk;
+	UINT64 codec;
+	UINT64 gdi;
+	long maxRss;
+} test_result;
+
+static char* test_pem(BIO* bio)
+{
+	char* data = NULL;
+	char* pem = NULL;
+	const long length = BIO_get_mem_data(bio, &data);
+
+	if ((length > 0) && (pem = (char*)calloc((size_t)length + 1, sizeof(char))))
+		memcpy(pem, data, (size_t)length);
+
+	BIO_free_all(bio);
+	return pem;
+}
+
+/* a throwaway self signed certificate for the server */
+static BOOL test_certificate(char** certificate, char** key)
+{
+	BOOL rc = FALSE;
+	BIO* bio;
+	EVP_PKEY* pkey = NULL;
+	X509* x509 = NULL;
+	X509_NAME* name;
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+
+	if (!ctx || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+	    (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0) || (EVP_PKEY_keygen(ctx, &pkey) <= 0))
+		goto fail;
+
+	if (!(x509 = X509_new()))
+		goto fail;
+
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 60 * 60);
+	X509_set_pubkey(x509, pkey);
+	name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1,
+	                           -1, 0);
+	X509_set_issuer_name(x509, name);
+
+	if (!X509_sign(x509, pkey, EVP_sha256()))
+		goto fail;
+
+	if (!(bio = BIO_new(BIO_s_mem())) || !PEM_write_bio_X509(bio, x509))
+		goto fail;
+
+	*certificate = test_pem(bio);
+
+	if (!(bio = BIO_new(BIO_s_mem())) ||
+	    !PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0, NULL, NULL))
+		goto fail;
+
+	*key = test_pem(bio);
+	rc = *certificate && *key;
+fail:
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+	EVP_PKEY_CTX_free(ctx);
+	return rc;
+}
+
+static BOOL test_connection(int* client, int* server)
+{
+	BOOL rc = FALSE;
+	struct sockaddr_in addr = { 0 };
+	socklen_t length = sizeof(addr);
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listener < 0)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+	    (listen(listener, 1) != 0) ||
+	    (getsockname(listener, (struct sockaddr*)&addr, &length) != 0))
+		goto fail;
+
+	if ((*client = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		goto fail;
+
+	if (connect(*client, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		goto fail;
+
+	if ((*server = accept(listener, NULL, NULL)) < 0)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	close(listener);
+	return rc;
+}
+
+/* a gradient moving with the frame number */
+static void test_image(BYTE* image, UINT32 frame)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < TEST_TILE; y++)
+	{
+		for (x = 0; x < TEST_TILE; x++)
+		{
+			BYTE* pixel = &image[(y * TEST_TILE + x) * 4];
+			pixel[0] = (BYTE)(x * 2 + frame * 5);
+			pixel[1] = (BYTE)(y * 2 + frame * 3);
+			pixel[2] = (BYTE)((x ^ y) + frame);
+			pixel[3] = 0xFF;
+		}
+	}
+}
+
+static BOOL test_server_surface_bits(rdpContext* context, RFX_CONTEXT* rfx, wStream* s,
+                                     const BYTE* image, UINT32 frame, UINT16 x, UINT16 y)
+{
+	const RFX_RECT rect = { 0, 0, TEST_TILE, TEST_TILE };
+	SURFACE_BITS_COMMAND cmd = { 0 };
+	SURFACE_FRAME_MARKER marker = { 0 };
+	rdpUpdate* update = context->update;
+
+	Stream_SetPosition(s, 0);
+
+	if (!rfx_compose_message(rfx, s, &rect, 1, image, TEST_TILE, TEST_TILE, TEST_TILE * 4))
+		return FALSE;
+
+	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd.destLeft = x;
+	cmd.destTop = y;
+	cmd.destRight = x + TEST_TILE;
+	cmd.destBottom = y + TEST_TILE;
+	cmd.bmp.codecID = (UINT16)context->settings->RemoteFxCodecId;
+	cmd.bmp.bpp = 32;
+	cmd.bmp.width = TEST_TILE;
+	cmd.bmp.height = TEST_TILE;
+	cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
+	cmd.bmp.bitmapData = Stream_Buffer(s);
+
+	marker.frameId = frame;
+	marker.frameAction = SURFACECMD_FRAMEACTION_BEGIN;
+
+	if (!update->SurfaceFrameMarker(context, &marker) || !update->SurfaceBits(context, &cmd))
+		return FALSE;
+
+	marker.frameAction = SURFACECMD_FRAMEACTION_END;
+	return update->SurfaceFrameMarker(context, &marker);
+}
+
+static BOOL test_server_bitmap(rdpContext* context, BITMAP_PLANAR_CONTEXT* planar,
+                               const BYTE* image, UINT16 x, UINT16 y)
+{
+	BOOL rc;
+	UINT32 size = 0;
+	BITMAP_DATA bitmap = { 0 };
+	BITMAP_UPDATE bitmapUpdate = { 0 };
+	BYTE* data = freerdp_bitmap_compress_planar(planar, image, PIXEL_FORMAT_BGRX32, TEST_BITMAP,
+	                                            TEST_BITMAP, TEST_TILE * 4, NULL, &size);
+
+	if (!data)
+		return FALSE;
+
+	bitmap.destLeft = x;
+	bitmap.destTop = y;
+	bitmap.destRight = x + TEST_BITMAP - 1;
+	bitmap.destBottom = y + TEST_BITMAP - 1;
+	bitmap.width = TEST_BITMAP;
+	bitmap.height = TEST_BITMAP;
+	bitmap.bitsPerPixel = 32;
+	bitmap.compressed = TRUE;
+	bitmap.bitmapDataStream = data;
+	bitmap.bitmapLength = size;
+	bitmap.cbCompMainBodySize = size;
+	bitmap.cbScanWidth = TEST_BITMAP * 4;
+	bitmap.cbUncompressedSize = TEST_BITMAP * TEST_BITMAP * 4;
+	bitmapUpdate.number = 1;
+	bitmapUpdate.rectangles = &bitmap;
+
+	rc = context->update->BitmapUpdate(context, &bitmapUpdate);
+	free(data);
+	return rc;
+}
+
+static BOOL test_server_orders(rdpContext* context, UINT32 frame, UINT16 x, UINT16 y)
+{
+	rdpUpdate* update = context->update;
+	OPAQUE_RECT_ORDER opaqueRect = { 0 };
+	SCRBLT_ORDER scrblt = { 0 };
+	DSTBLT_ORDER dstblt = { 0 };
+
+	opaqueRect.nLeftRect = x;
+	opaqueRect.nTopRect = y;
+	opaqueRect.nWidth = 48;
+	opaqueRect.nHeight = 24;
+	opaqueRect.color = (frame * 0x0A1429) & 0xFFFFFF;
+
+	/* copies part of the last surface bits somewhere else */
+	scrblt.nLeftRect = x + 64;
+	scrblt.nTopRect = y + 32;
+	scrblt.nWidth = 96;
+	scrblt.nHeight = 64;
+	scrblt.bRop = 0xCC; /* SRCCOPY */
+	scrblt.nXSrc = x;
+	scrblt.nYSrc = y;
+
+	dstblt.nLeftRect = x + 16;
+	dstblt.nTopRect = y + 16;
+	dstblt.nWidth = 32;
+	dstblt.nHeight = 32;
+	dstblt.bRop = 0x55; /* DSTINVERT */
+
+	return update->BeginPaint(context) && update->primary->OpaqueRect(context, &opaqueRect) &&
+	       update->primary->ScrBlt(context, &scrblt) &&
+	       update->primary->DstBlt(context, &dstblt) && update->EndPaint(context);
+}
+
+/* every kind of update the legacy GDI path decodes, at changing positions */
+static BOOL test_server_send(freerdp_peer* peer)
+{
+	UINT32 frame;
+	BOOL rc = FALSE;
+	rdpSettings* settings = peer->context->settings;
+	const UINT32 width = settings->DesktopWidth;
+	const UINT32 height = settings->DesktopHeight;
+	RFX_CONTEXT* rfx = rfx_context_new(TRUE);
+	BITMAP_PLANAR_CONTEXT* planar =
+	    freerdp_bitmap_planar_context_new(PLANAR_FORMAT_HEADER_RLE, TEST_BITMAP, TEST_BITMAP);
+	wStream* s = Stream_New(NULL, 0x10000);
+	BYTE* image = (BYTE*)malloc(TEST_TILE * TEST_TILE * 4);
+
+	if (!rfx || !planar || !s || !image || (width < 2 * TEST_TILE) || (height < 2 * TEST_TILE))
+		goto fail;
+
+	if (!rfx_context_reset(rfx, width, height))
+		goto fail;
+
+	rfx_context_set_pixel_format(rfx, PIXEL_FORMAT_BGRX32);
+
+	for (frame = 0; frame < TEST_FRAMES; frame++)
+	{
+		const UINT16 x = (UINT16)((frame * 53) % (width - 2 * TEST_TILE));
+		const UINT16 y = (UINT16)((frame * 29) % (height - 2 * TEST_TILE));
+
+		test_image(image, frame);
+
+		if (!test_server_surface_bits(peer->context, rfx, s, image, frame, x, y) ||
+		    !test_server_bitmap(peer->context, planar, image, (UINT16)(width - x - TEST_BITMAP),
+		                        y) ||
+		    !test_server_orders(peer->context, frame, x, y))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(image);
+	Stream_Free(s, TRUE);
+	freerdp_bitmap_planar_context_free(planar);
+	rfx_context_free(rfx);
+	return rc;
+}
+
+static BOOL test_server_post_connect(freerdp_peer* peer)
+{
+	WINPR_UNUSED(peer);
+	return TRUE;
+}
+
+static BOOL test_server_activate(freerdp_peer* peer)
+{
+	test_server* server = (test_server*)peer->ContextExtra;
+	server->activated = TRUE;
+	return TRUE;
+}
+
+static DWORD WINAPI test_server_thread(LPVOID arg)
+{
+	rdpSettings* settings;
+	test_server* server = (test_server*)arg;
+	freerdp_peer* peer = freerdp_peer_new(server->sockfd);
+
+	if (!peer)
+	{
+		close(server->sockfd);
+		return 0;
+	}
+
+	peer->ContextExtra = server;
+
+	if (!freerdp_peer_context_new(peer))
+		goto fail;
+
+	settings = peer->context->settings;
+
+	if (!freerdp_settings_set_string(settings, FreeRDP_CertificateContent, server->certificate) ||
+	    !freerdp_settings_set_string(settings, FreeRDP_PrivateKeyContent, server->key) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_RdpSecurity, FALSE) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_TlsSecurity, TRUE) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_NlaSecurity, FALSE) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec, TRUE) ||
+	    !freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, 32))
+		goto fail;
+
+	peer->PostConnect = test_server_post_connect;
+	peer->Activate = test_server_activate;
+
+	if (!peer->Initialize(peer))
+		goto fail;
+
+	while (!server->activated)
+	{
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+		const DWORD count = peer->GetEventHandles(peer, handles, ARRAYSIZE(handles));
+
+		if (count == 0)
+			goto fail;
+
+		if (WaitForMultipleObjects(count, handles, FALSE, INFINITE) == WAIT_FAILED)
+			goto fail;
+
+		if (!peer->CheckFileDescriptor(peer))
+			goto fail;
+	}
+
+	server->success = test_server_send(peer);
+fail:
+	/* the client notices the end of the session by the closed connection */
+	peer->Disconnect(peer);
+	freerdp_peer_context_free(peer);
+	freerdp_peer_free(peer);
+	return 0;
+}
+
+static int test_client_tcp_connect(rdpContext* context, rdpSettings* settings,
+                                   const char* hostname, int port, DWORD timeout)
+{
+	test_client* client = (test_client*)context;
+
+	WINPR_UNUSED(settings);
+	WINPR_UNUSED(hostname);
+	WINPR_UNUSED(port);
+	WINPR_UNUSED(timeout);
+	return client->sockfd;
+}
+
+static int test_client_read_pdu(rdpTransport* transport, wStream* s)
+{
+	int rc;
+	test_client* client = (test_client*)transport_get_context(transport);
+
+	stopwatch_start(&client->transport);
+	rc = client->io.ReadPdu(transport, s);
+	stopwatch_stop(&client->transport);
+
+	if (rc > 0)
+	{
+		client->pdus++;
+		client->bytes += Stream_Length(s);
+	}
+
+	return rc;
+}
+
+static BOOL test_client_surface_bits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	BOOL rc;
+	test_client* client = (test_client*)context;
+
+	stopwatch_start(&client->codec);
+	rc = client->SurfaceBits(context, cmd);
+	stopwatch_stop(&client->codec);
+	return rc;
+}
+
+static BOOL test_client_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bitmap)
+{
+	BOOL rc;
+	test_client* client = (test_client*)context;
+
+	stopwatch_start(&client->codec);
+	rc = client->BitmapUpdate(context, bitmap);
+	stopwatch_stop(&client->codec);
+	return rc;
+}
+
+static BOOL test_client_end_paint(rdpContext* context)
+{
+	test_client* client = (test_client*)context;
+
+	client->frames++;
+	return IFCALLRESULT(TRUE, client->EndPaint, context);
+}
+
+#if defined(CHANNEL_RDPGFX_CLIENT)
+static UINT test_client_surface_command(RdpgfxClientContext* gfx,
+                                        const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	UINT rc;
+	rdpGdi* gdi = (rdpGdi*)gfx->custom;
+	test_client* client = (test_client*)gdi->context;
+
+	stopwatch_start(&client->codec);
+	rc = client->SurfaceCommand(gfx, cmd);
+	stopwatch_stop(&client->codec);
+	return rc;
+}
+#endif
+
+static void test_client_channel_connected(void* context, const ChannelConnectedEventArgs* e)
+{
+	freerdp_client_OnChannelConnectedEventHandler(context, e);
+
+#if defined(CHANNEL_RDPGFX_CLIENT)
+	if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0)
+	{
+		test_client* client = (test_client*)context;
+		RdpgfxClientContext* gfx = (RdpgfxClientContext*)e->pInterface;
+
+		client->SurfaceCommand = gfx->SurfaceCommand;
+		gfx->SurfaceCommand = test_client_surface_command;
+	}
+#endif
+}
+
+static BOOL test_client_pre_connect(freerdp* instance)
+{
+	rdpContext* context = instance->context;
+
+	PubSub_SubscribeChannelConnected(context->pubSub, test_client_channel_connected);
+	PubSub_SubscribeChannelDisconnected(context->pubSub,
+	                                    freerdp_client_OnChannelDisconnectedEventHandler);
+	return TRUE;
+}
+
+static BOOL test_client_post_connect(freerdp* instance)
+{
+	rdpUpdate* update;
+	test_client* client = (test_client*)instance->context;
+
+	if (!gdi_init(instance, PIXEL_FORMAT_BGRX32))
+		return FALSE;
+
+	update = instance->context->update;
+	client->SurfaceBits = update->SurfaceBits;
+	client->BitmapUpdate = update->BitmapUpdate;
+	client->EndPaint = update->EndPaint;
+	update->SurfaceBits = test_client_surface_bits;
+	update->BitmapUpdate = test_client_bitmap_update;
+	update->EndPaint = test_client_end_paint;
+	return TRUE;
+}
+
+static void test_client_post_disconnect(freerdp* instance)
+{
+	rdpContext* context = instance->context;
+
+	PubSub_UnsubscribeChannelConnected(context->pubSub, test_client_channel_connected);
+	PubSub_UnsubscribeChannelDisconnected(context->pubSub,
+	                                      freerdp_client_OnChannelDisconnectedEventHandler);
+	gdi_free(instance);
+}
+
+static BOOL test_client_new(freerdp* instance, rdpContext* context)
+{
+	test_client* client = (test_client*)context;
+
+	client->sockfd = -1;
+	instance->PreConnect = test_client_pre_connect;
+	instance->PostConnect = test_client_post_connect;
+	instance->PostDisconnect = test_client_post_disconnect;
+	return TRUE;
+}
+
+static rdpContext* test_client_context_new(void)
+{
+	RDP_CLIENT_ENTRY_POINTS entryPoints = { 0 };
+
+	entryPoints.Version = RDP_CLIENT_INTERFACE_VERSION;
+	entryPoints.Size = sizeof(RDP_CLIENT_ENTRY_POINTS_V1);
+	entryPoints.ContextSize = sizeof(test_client);
+	entryPoints.ClientNew = test_client_new;
+	return freerdp_client_context_new(&entryPoints);
+}
+
+/* a copy of the picture once the server closed the connection */
+static BYTE* test_client_run(rdpContext* context, size_t* size)
+{
+	BYTE* picture = NULL;
+	rdpGdi* gdi;
+
+	if (!freerdp_connect(context->instance))
+		goto fail;
+
+	while (!freerdp_shall_disconnect_context(context))
+	{
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+		const DWORD count = freerdp_get_event_handles(context, handles, ARRAYSIZE(handles));
+
+		if ((count == 0) || (WaitForMultipleObjects(count, handles, FALSE, 100) == WAIT_FAILED))
+			break;
+
+		if (!freerdp_check_event_handles(context))
+			break;
+	}
+
+	gdi = context->gdi;
+	*size = 1ull * gdi->stride * gdi->height;
+
+	if ((picture = (BYTE*)malloc(*size)))
+		memcpy(picture, gdi->primary_buffer, *size);
+
+fail:
+	freerdp_disconnect(context->instance);
+	return picture;
+}
+
+static BOOL test_client_settings(rdpSettings* settings, const char* recording, BOOL replay)
+{
+	/* frame acknowledgements would still be sent while the server already closed the connection */
+	return freerdp_settings_set_uint32(settings, FreeRDP_FrameAcknowledge, 0) &&
+	       freerdp_settings_set_string(settings, FreeRDP_ServerHostname, "localhost") &&
+	       freerdp_settings_set_bool(settings, FreeRDP_IgnoreCertificate, TRUE) &&
+	       freerdp_settings_set_bool(settings, FreeRDP_RdpSecurity, FALSE) &&
+	       freerdp_settings_set_bool(settings, FreeRDP_NlaSecurity, FALSE) &&
+	       freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec, TRUE) &&
+	       freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, 32) &&
+	       freerdp_settings_set_bool(settings, FreeRDP_TransportDump, !replay) &&
+	       freerdp_settings_set_bool(settings, FreeRDP_TransportDumpReplay, replay) &&
+	       freerdp_settings_set_string(settings, FreeRDP_TransportDumpFile, recording);
+}
+
+/* records a session with the in-process server, returns the picture the client ended up with */
+static BYTE* test_record(const char* recording, size_t* size)
+{
+	BYTE* picture = NULL;
+	int fds[2] = { -1, -1 };
+	HANDLE thread = NULL;
+	char* certificate = NULL;
+	char* key = NULL;
+	test_server server = { 0 };
+	rdpTransportIo io;
+	test_client* client = NULL;
+	rdpContext* context = test_client_context_new();
+
+	if (!context || !test_client_settings(context->settings, recording, FALSE))
+		goto fail;
+
+	if (!test_certificate(&certificate, &key) || !test_connection(&fds[0], &fds[1]))
+		goto fail;
+
+	/* the transports own the sockets from now on */
+	client = (test_client*)context;
+	client->sockfd = fds[0];
+	server.sockfd = fds[1];
+	server.certificate = certificate;
+	server.key = key;
+	fds[1] = -1;
+
+	if (!(thread = CreateThread(NULL, 0, test_server_thread, &server, 0, NULL)))
+		goto fail;
+
+	/* the recording hooks wrap what is installed when they are registered */
+	io = *freerdp_get_io_callbacks(context);
+	io.TCPConnect = test_client_tcp_connect;
+
+	if (!freerdp_set_io_callbacks(context, &io) ||
+	    !stream_dump_register_handlers(context, CONNECTION_STATE_MCS_CONNECT, FALSE))
+		goto fail;
+
+	fds[0] = -1;
+	picture = test_client_run(context, size);
+	WaitForSingleObject(thread, INFINITE);
+
+	if (picture && !server.success)
+	{
+		fprintf(stderr, "the server failed to send the session\n");
+		free(picture);
+		picture = NULL;
+	}
+
+fail:
+	/* a failed client closes the connection and with it the server */
+	if (fds[0] >= 0)
+		close(fds[0]);
+
+	if (fds[1] >= 0)
+		close(fds[1]);
+
+	freerdp_client_context_free(context);
+
+	if (thread)
+	{
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+
+	free(certificate);
+	free(key);
+	return picture;
+}
+
+static UINT64 test_elapsed(const STOPWATCH* stopwatch)
+{
+	return stopwatch->elapsed;
+}
+
+/* replays a session as the only source of PDUs, returns the picture the client ended up with */
+static BYTE* test_replay(rdpContext* context, test_result* result, size_t* size)
+{
+	BYTE* picture = NULL;
+	UINT64 stages;
+	STOPWATCH total = { 0 };
+	struct rusage usage = { 0 };
+	rdpTransportIo io;
+	rdpGdi* gdi;
+	test_client* client = (test_client*)context;
+
+	if (!stream_dump_register_handlers(context, CONNECTION_STATE_MCS_CONNECT, FALSE))
+		return NULL;
+
+	stream_dump_set_replay_pacing(context, result->paced);
+	client->io = *freerdp_get_io_callbacks(context);
+	io = client->io;
+	io.ReadPdu = test_client_read_pdu;
+
+	if (!freerdp_set_io_callbacks(context, &io) || !freerdp_connect(context->instance))
+	{
+		fprintf(stderr, "replaying the connection sequence failed\n");
+		goto fail;
+	}
+
+	/* only the active session is measured */
+	client->pdus = 0;
+	client->bytes = 0;
+	client->frames = 0;
+	stopwatch_reset(&client->transport);
+	stopwatch_reset(&client->bulk);
+	stopwatch_reset(&client->codec);
+	metrics_set_decompression_stopwatch(context->metrics, &client->bulk);
+
+	/* nothing to wait for, the next PDU is always available */
+	stopwatch_start(&total);
+	while (freerdp_check_event_handles(context))
+		;
+	stopwatch_stop(&total);
+	metrics_set_decompression_stopwatch(context->metrics, NULL);
+
+	if (!stream_dump_replay_finished(context))
+	{
+		fprintf(stderr, "replay failed after %" PRIu64 " PDUs\n", client->pdus);
+		goto fail;
+	}
+
+	result->pdus = client->pdus;
+	result->bytes = client->bytes;
+	result->frames = client->frames;
+	result->duration = test_elapsed(&total);
+	result->transport = test_elapsed(&client->transport);
+	result->bulk = test_elapsed(&client->bulk);
+	result->codec = test_elapsed(&client->codec);
+
+	/* the codec callbacks draw what they decoded, the rest is PDU parsing and GDI orders */
+	stages = result->transport + result->bulk + result->codec;
+	result->gdi = (result->duration > stages) ? result->duration - stages : 0;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		result->maxRss = usage.ru_maxrss;
+
+	gdi = context->gdi;
+	*size = 1ull * gdi->stride * gdi->height;
+
+	if ((picture = (BYTE*)malloc(*size)))
+		memcpy(picture, gdi->primary_buffer, *size);
+
+fail:
+	freerdp_disconnect(context->instance);
+	return picture;
+}
+
+static void test_report(FILE* fp, const test_result* result, BOOL json)
+{
+	const UINT64 duration = result->duration ? result->duration : 1;
+	const double fps = result->frames * 1000000.0 / (double)duration;
+
+	if (!json)
+	{
+		fprintf(fp,
+		        "%s: %" PRIu64 " PDUs, %" PRIu64 " bytes, %" PRIu64 " frames in %" PRIu64
+		        " us (%.1f frames/s), transport %" PRIu64 " us, bulk %" PRIu64
+		        " us, codec %" PRIu64 " us, gdi %" PRIu64 " us, max RSS %ld KiB\n",
+		        result->paced ? "paced" : "fast", result->pdus, result->bytes, result->frames,
+		        result->duration, fps, result->transport, result->bulk, result->codec, result->gdi,
+		        result->maxRss);
+		return;
+	}
+
+	fprintf(fp,
+	        "{ \"recording\": \"%s\", \"paced\": %s, \"pdus\": %" PRIu64 ", \"bytes\": %" PRIu64
+	        ", \"frames\": %" PRIu64 ", \"duration_us\": %" PRIu64
+	        ", \"frames_per_second\": %.1f, \"stages_us\": { \"transport\": %" PRIu64
+	        ", \"bulk\": %" PRIu64 ", \"codec\": %" PRIu64 ", \"gdi\": %" PRIu64
+	        " }, \"max_rss_kib\": %ld }\n",
+	        result->recording, result->paced ? "true" : "false", result->pdus, result->bytes,
+	        result->frames, result->duration, fps, result->transport, result->bulk, result->codec,
+	        result->gdi, result->maxRss);
+}
+
+static BOOL test_replay_recording(const char* recording, BOOL paced, const BYTE* expected,
+                                  size_t expectedSize)
+{
+	BOOL rc = FALSE;
+	size_t size = 0;
+	BYTE* picture = NULL;
+	test_result result = { 0 };
+	rdpContext* context = test_client_context_new();
+
+	result.recording = recording;
+	result.paced = paced;
+
+	if (!context || !test_client_settings(context->settings, recording, TRUE))
+		goto fail;
+
+	if (!(picture = test_replay(context, &result, &size)))
+		goto fail;
+
+	test_report(stdout, &result, FALSE);
+	test_report(stdout, &result, TRUE);
+
+	if ((result.pdus == 0) || (result.frames == 0) || (result.codec == 0) || (result.bulk == 0))
+	{
+		fprintf(stderr, "the replay did not go through every stage\n");
+		goto fail;
+	}
+
+	if ((size != expectedSize) || (memcmp(picture, expected, size) != 0))
+	{
+		fprintf(stderr, "the replay ended with a different picture than the session\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(picture);
+	freerdp_client_context_free(context);
+	return rc;
+}
+
+/* replays a recording given on the command line */
+static int test_replay_file(int argc, char* argv[])
+{
+	int x;
+	int rc = -1;
+	int count = 1;
+	size_t size = 0;
+	BYTE* picture = NULL;
+	const char* json = NULL;
+	test_result result = { 0 };
+	char** args = (char**)calloc((size_t)argc + 1, sizeof(char*));
+	rdpContext* context = test_client_context_new();
+
+	if (!args || !context)
+		goto fail;
+
+	args[0] = argv[0];
+
+	for (x = 1; x < argc; x++)
+	{
+		if (strcmp(argv[x], "--paced") == 0)
+			result.paced = TRUE;
+		else if (strncmp(argv[x], "--json=", 7) == 0)
+			json = &argv[x][7];
+		else
+			args[count++] = argv[x];
+	}
+
+	if ((freerdp_client_settings_parse_command_line(context->settings, count, args, FALSE) != 0) ||
+	    !freerdp_settings_get_bool(context->settings, FreeRDP_TransportDumpReplay))
+	{
+		fprintf(stderr, "usage: %s [--paced] [--json=<file>] /dump:replay,<file> [options]\n",
+		        argv[0]);
+		goto fail;
+	}
+
+	/* nothing is connected to, /v: is optional */
+	if (!freerdp_settings_get_string(context->settings, FreeRDP_ServerHostname) &&
+	    !freerdp_settings_set_string(context->settings, FreeRDP_ServerHostname, "localhost"))
+		goto fail;
+
+	result.recording = freerdp_settings_get_string(context->settings, FreeRDP_TransportDumpFile);
+
+	if (!(picture = test_replay(context, &result, &size)))
+		goto fail;
+
+	test_report(stdout, &result, FALSE);
+
+	if (json)
+	{
+		FILE* fp = winpr_fopen(json, "w");
+
+		if (!fp)
+			goto fail;
+
+		test_report(fp, &result, TRUE);
+		fclose(fp);
+	}
+	else
+		test_report(stdout, &result, TRUE);
+
+	rc = 0;
+fail:
+	free(picture);
+	freerdp_client_context_free(context);
+	free(args);
+	return rc;
+}
+
+int TestClientReplay(int argc, char* argv[])
+{
+	int rc = -1;
+	size_t size = 0;
+	BYTE* picture = NULL;
+	char name[64] = { 0 };
+	char* recording;
+
+	if (argc > 1)
+		return test_replay_file(argc, argv);
+
+	sprintf_s(name, sizeof(name), "TestClientReplay-%" PRIu32 ".dump", GetCurrentProcessId());
+
+	if (!(recording = GetKnownSubPath(KNOWN_PATH_TEMP, name)))
+		return -1;
+
+	/* the recording is appended to */
+	winpr_DeleteFile(recording);
+
+	if (!(picture = test_record(recording, &size)))
+		goto fail;
+
+	if (!test_replay_recording(recording, FALSE, picture, size) ||
+	    !test_replay_recording(recording, TRUE, picture, size))
+		goto fail;
+
+	rc = 0;
+fail:
+	winpr_DeleteFile(recording);
+	free(recording);
+	free(picture);
+	return rc;
+}
@@ -23,6 +23,12 @@ else()
 	option(WITH_SSE2 "Enable SSE2 optimization." OFF)
 endif()
 
+if(WITH_SSE2)
+	option(WITH_AVX2 "Enable AVX2 optimization (selected at runtime)." ON)
+else()
+	set(WITH_AVX2 OFF)
+endif()
+
 if(TARGET_ARCH MATCHES "ARM")
 	if (NOT DEFINED WITH_NEON)
 		option(WITH_NEON "Enable NEON optimization." ON)
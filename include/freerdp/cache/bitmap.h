@@ -51,6 +51,8 @@ typedef struct
 	/* internal */
 	rdpContext* context;
 	rdpPersistentCache* persistent;
+	rdpPersistentStore* store;
+	BOOL storeFailed;
 } rdpBitmapCache;
 
 #ifdef __cplusplus
@@ -29,6 +29,10 @@
 #include <winpr/stream.h>
 
 typedef struct rdp_persistent_cache rdpPersistentCache;
+typedef struct rdp_persistent_store rdpPersistentStore;
+
+/* compress entries losslessly when stored */
+#define PERSISTENT_STORE_FLAG_COMPRESS 0x00000001
 
 #pragma pack(push, 1)
 
@@ -96,6 +100,18 @@ extern "C"
 	FREERDP_API rdpPersistentCache* persistent_cache_new(void);
 	FREERDP_API void persistent_cache_free(rdpPersistentCache* persistent);
 
+	FREERDP_API rdpPersistentStore* persistent_store_open(const char* filename, UINT32 flags);
+	FREERDP_API void persistent_store_close(rdpPersistentStore* store);
+
+	FREERDP_API size_t persistent_store_get_count(rdpPersistentStore* store);
+	FREERDP_API size_t persistent_store_get_entries(rdpPersistentStore* store,
+	                                                PERSISTENT_CACHE_ENTRY* entries, size_t count);
+
+	FREERDP_API BOOL persistent_store_read_entry(rdpPersistentStore* store, UINT64 key64,
+	                                             PERSISTENT_CACHE_ENTRY* entry);
+	FREERDP_API BOOL persistent_store_write_entry(rdpPersistentStore* store,
+	                                              const PERSISTENT_CACHE_ENTRY* entry);
+
 #ifdef __cplusplus
 }
 #endif
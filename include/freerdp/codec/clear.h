@@ -34,6 +34,7 @@ extern "C"
 #endif
 
 	FREERDP_API int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize,
+	                               UINT32 SrcFormat, UINT32 nWidth, UINT32 nHeight, UINT32 nSrcStep,
 	                               BYTE** ppDstData, UINT32* pDstSize);
 
 	FREERDP_API INT32 clear_decompress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize,
@@ -57,6 +57,20 @@ extern "C"
 
 	FREERDP_API BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive);
 
+	/** Number of quality passes used by progressive_compress (1 - 3, default 1).
+	 *  With more than one pass changed tiles are first sent at coarse quality and
+	 *  refined with tile upgrades on later calls while they stay unchanged. */
+	FREERDP_API BOOL progressive_context_set_quality_passes(PROGRESSIVE_CONTEXT* progressive,
+	                                                        UINT32 passes);
+	FREERDP_API BOOL progressive_context_has_pending_upgrades(PROGRESSIVE_CONTEXT* progressive);
+
+	/** Forget the encoder state of the tiles intersecting region, e.g. after their surface
+	 *  content was replaced with other GFX commands. Tiles still waiting for quality
+	 *  upgrades are added to pending (may be NULL), they need to be encoded again. */
+	FREERDP_API BOOL progressive_context_invalidate_region(PROGRESSIVE_CONTEXT* progressive,
+	                                                       const REGION16* region,
+	                                                       REGION16* pending);
+
 	FREERDP_API PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor);
 	FREERDP_API void progressive_context_free(PROGRESSIVE_CONTEXT* progressive);
 
@@ -71,6 +71,8 @@ extern "C"
 		BYTE* YCbCrData;
 	} RFX_TILE;
 
+	typedef struct S_RFX_ENCODE_WORK RFX_ENCODE_WORK;
+
 	typedef struct
 	{
 		UINT32 frameIdx;
@@ -98,6 +100,9 @@ extern "C"
 		UINT32 tilesDataSize;
 
 		BOOL freeArray;
+
+		/* tiles still being encoded, see rfx_encode_message_begin */
+		RFX_ENCODE_WORK* encodeWork;
 	} RFX_MESSAGE;
 
 	typedef struct S_RFX_CONTEXT_PRIV RFX_CONTEXT_PRIV;
@@ -166,6 +171,11 @@ extern "C"
 
 	FREERDP_API void rfx_context_set_pixel_format(RFX_CONTEXT* context, UINT32 pixel_format);
 
+	/* Sets numQuant tables of 10 quantization values each, encoded messages reference the
+	 * tables of the context so this must not be called while messages are still in use */
+	FREERDP_API BOOL rfx_context_set_quantization(RFX_CONTEXT* context, const UINT32* quantVals,
+	                                              UINT32 numQuant);
+
 	FREERDP_API BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
 	                                     UINT32 left, UINT32 top, BYTE* dst, UINT32 dstFormat,
 	                                     UINT32 dstStride, UINT32 dstHeight,
@@ -182,6 +192,19 @@ extern "C"
 	                                            size_t numRects, const BYTE* data, UINT32 width,
 	                                            UINT32 height, size_t scanline);
 
+	/**
+	 * Asynchronous variant of rfx_encode_message: the tiles are encoded by the thread pool of
+	 * the context while the caller continues, e.g. to write the previous frame.
+	 * data must stay valid and the context must not be reconfigured until
+	 * rfx_encode_message_end returned. Without threads the message is encoded synchronously.
+	 * rfx_encode_message_end returns FALSE if a tile failed to encode, the message must then
+	 * be freed without being written.
+	 */
+	FREERDP_API RFX_MESSAGE* rfx_encode_message_begin(RFX_CONTEXT* context, const RFX_RECT* rects,
+	                                                  size_t numRects, const BYTE* data,
+	                                                  UINT32 width, UINT32 height, size_t scanline);
+	FREERDP_API BOOL rfx_encode_message_end(RFX_CONTEXT* context, RFX_MESSAGE* message);
+
 	FREERDP_API RFX_MESSAGE* rfx_encode_messages(RFX_CONTEXT* context, const RFX_RECT* rects,
 	                                             size_t numRects, const BYTE* data, UINT32 width,
 	                                             UINT32 height, UINT32 scanline,
@@ -189,6 +212,15 @@ extern "C"
 	FREERDP_API BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s,
 	                                   const RFX_MESSAGE* message);
 
+	/**
+	 * The two parts of rfx_write_message: the header blocks are written once per stream, only
+	 * if the context did not send them yet, the frame blocks do not depend on the stream.
+	 * This allows to encode a message once and send it on several connections.
+	 */
+	FREERDP_API BOOL rfx_write_message_header(RFX_CONTEXT* context, wStream* s);
+	FREERDP_API BOOL rfx_write_message_frame(RFX_CONTEXT* context, wStream* s,
+	                                         const RFX_MESSAGE* message);
+
 	FREERDP_API BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height);
 
 	FREERDP_API RFX_CONTEXT* rfx_context_new_ex(BOOL encoder, UINT32 ThreadingFlags);
@@ -32,6 +32,11 @@
 
 #define ZGFX_SEGMENTED_MAXSIZE 65535
 
+#define ZGFX_COMPRESSION_LEVEL_NONE 0
+#define ZGFX_COMPRESSION_LEVEL_FAST 1
+#define ZGFX_COMPRESSION_LEVEL_DEFAULT 2
+#define ZGFX_COMPRESSION_LEVEL_BEST 3
+
 typedef struct S_ZGFX_CONTEXT ZGFX_CONTEXT;
 
 #ifdef __cplusplus
@@ -47,6 +52,9 @@ extern "C"
 	                                        const BYTE* pUncompressed, UINT32 uncompressedSize,
 	                                        UINT32* pFlags);
 
+	FREERDP_API void zgfx_context_set_compression_level(ZGFX_CONTEXT* zgfx,
+	                                                    UINT32 CompressionLevel);
+
 	FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush);
 
 	FREERDP_API ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor);
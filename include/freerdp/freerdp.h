@@ -598,6 +598,13 @@ owned by rdpRdp */
 
 	FREERDP_API ULONG freerdp_get_transport_sent(rdpContext* context, BOOL resetCount);
 
+	/**
+	 * While the transport is corked, written PDUs are collected and sent in as few TLS records
+	 * as possible when the last cork is released. Corks nest, every cork needs an uncork.
+	 */
+	FREERDP_API BOOL freerdp_transport_cork(rdpContext* context);
+	FREERDP_API BOOL freerdp_transport_uncork(rdpContext* context);
+
 	FREERDP_API BOOL freerdp_nla_impersonate(rdpContext* context);
 	FREERDP_API BOOL freerdp_nla_revert_to_self(rdpContext* context);
 
@@ -21,6 +21,7 @@
 #define FREERDP_METRICS_H
 
 #include <freerdp/api.h>
+#include <freerdp/utils/stopwatch.h>
 
 struct rdp_metrics
 {
@@ -42,6 +43,11 @@ extern "C"
 	FREERDP_API rdpMetrics* metrics_new(rdpContext* context);
 	FREERDP_API void metrics_free(rdpMetrics* metrics);
 
+	/* Adds the time spent decompressing received PDUs to stopwatch, NULL (the default) stops
+	 * measuring. The caller keeps the stopwatch alive until it is unset. */
+	FREERDP_API void metrics_set_decompression_stopwatch(rdpMetrics* metrics,
+	                                                     STOPWATCH* stopwatch);
+
 #ifdef __cplusplus
 }
 #endif
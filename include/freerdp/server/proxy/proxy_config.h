@@ -33,6 +33,7 @@ struct proxy_config
 	/* server */
 	char* Host;
 	UINT16 Port;
+	UINT32 Workers; /* sessions share this many event loop threads, 0 for two threads each */
 
 	/* target */
 	BOOL FixedTarget;
@@ -57,6 +58,7 @@ struct proxy_config
 	BOOL ClientTlsSecurity;
 	BOOL ClientRdpSecurity;
 	BOOL ClientAllowFallbackToTls;
+	BOOL TlsKernelOffload; /* both sides, Linux kTLS */
 
 	/* channels */
 	BOOL GFX;
@@ -81,6 +83,7 @@ struct proxy_config
 
 	/* gfx settings */
 	BOOL DecodeGFX;
+	BOOL PassthroughUpdates; /* forward fast-path updates without decoding them */
 
 	/* modules */
 	char** Modules; /* module file names to load */
@@ -51,6 +51,7 @@ typedef struct rdp_shadow_encoder rdpShadowEncoder;
 typedef struct rdp_shadow_capture rdpShadowCapture;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
+typedef struct rdp_shadow_share rdpShadowShare;
 
 typedef struct S_RDP_SHADOW_ENTRY_POINTS RDP_SHADOW_ENTRY_POINTS;
 typedef int (*pfnShadowSubsystemEntry)(RDP_SHADOW_ENTRY_POINTS* pEntryPoints);
@@ -130,11 +131,13 @@ struct rdp_shadow_server
 	rdpShadowSurface* lobby;
 	rdpShadowCapture* capture;
 	rdpShadowSubsystem* subsystem;
+	rdpShadowShare* share;
 
 	DWORD port;
 	BOOL mayView;
 	BOOL mayInteract;
 	BOOL shareSubRect;
+	BOOL sharedEncode;
 	BOOL authentication;
 	UINT32 selectedMonitor;
 	RECTANGLE_16 subRect;
@@ -311,6 +314,13 @@ extern "C"
 	                                       UINT32 nHeight, BYTE* pData2, UINT32 nStep2,
 	                                       RECTANGLE_16* rect);
 
+	/** Compare two frames in 16x16 tiles, region receives the changed tiles.
+	 *  @return 1 if there are changes, 0 if the frames are equal, -1 on failure */
+	FREERDP_API int shadow_capture_compare_region(const BYTE* pData1, UINT32 nStep1,
+	                                              UINT32 nWidth, UINT32 nHeight,
+	                                              const BYTE* pData2, UINT32 nStep2,
+	                                              REGION16* region);
+
 	FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
 	FREERDP_API BOOL shadow_client_post_msg(rdpShadowClient* client, void* context, UINT32 type,
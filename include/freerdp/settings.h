@@ -647,6 +647,7 @@ typedef struct
 #define FreeRDP_TLSMaxVersion (1108)
 #define FreeRDP_TlsSecretsFile (1109)
 #define FreeRDP_AuthenticationPackageList (1110)
+#define FreeRDP_TlsKernelOffload (1111)
 #define FreeRDP_MstscCookieMode (1152)
 #define FreeRDP_CookieMaxLength (1153)
 #define FreeRDP_PreconnectionId (1154)
@@ -814,6 +815,8 @@ typedef struct
 #define FreeRDP_BitmapCacheV2NumCells (2501)
 #define FreeRDP_BitmapCacheV2CellInfo (2502)
 #define FreeRDP_BitmapCachePersistFile (2503)
+#define FreeRDP_BitmapCachePersistStore (2504)
+#define FreeRDP_BitmapCachePersistCompress (2505)
 #define FreeRDP_ColorPointerFlag (2560)
 #define FreeRDP_PointerCacheSize (2561)
 #define FreeRDP_KeyboardRemappingList (2622)
@@ -1137,7 +1140,8 @@ struct rdp_settings
 	ALIGN64 UINT16 TLSMaxVersion;              /* 1108 */
 	ALIGN64 char* TlsSecretsFile;              /* 1109 */
 	ALIGN64 char* AuthenticationPackageList;   /* 1110 */
-	UINT64 padding1152[1152 - 1111];           /* 1111 */
+	ALIGN64 BOOL TlsKernelOffload;             /* 1111 */
+	UINT64 padding1152[1152 - 1112];           /* 1112 */
 
 	/* Connection Cookie */
 	ALIGN64 BOOL MstscCookieMode;      /* 1152 */
@@ -1392,7 +1396,9 @@ struct rdp_settings
 	ALIGN64 UINT32 BitmapCacheV2NumCells;                     /* 2501 */
 	ALIGN64 BITMAP_CACHE_V2_CELL_INFO* BitmapCacheV2CellInfo; /* 2502 */
 	ALIGN64 char* BitmapCachePersistFile;                     /* 2503 */
-	UINT64 padding2560[2560 - 2504];                          /* 2504 */
+	ALIGN64 BOOL BitmapCachePersistStore;                     /* 2504 */
+	ALIGN64 BOOL BitmapCachePersistCompress;                  /* 2505 */
+	UINT64 padding2560[2560 - 2506];                          /* 2506 */
 
 	/* Pointer Capabilities */
 	ALIGN64 BOOL ColorPointerFlag;   /* 2560 */
@@ -48,6 +48,10 @@ extern "C"
 	FREERDP_API BOOL stream_dump_register_handlers(rdpContext* context, CONNECTION_STATE state,
 	                                               BOOL isServer);
 
+	/* replay at the recorded pace (the default) or as fast as the PDUs are processed */
+	FREERDP_API void stream_dump_set_replay_pacing(rdpContext* context, BOOL paced);
+	FREERDP_API BOOL stream_dump_replay_finished(const rdpContext* context);
+
 	FREERDP_API rdpStreamDumpContext* stream_dump_new(void);
 	FREERDP_API void stream_dump_free(rdpStreamDumpContext* dump);
 
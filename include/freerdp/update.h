@@ -190,6 +190,7 @@ typedef BOOL (*pSaveSessionInfo)(rdpContext* context, UINT32 type, void* data);
 typedef BOOL (*pSetKeyboardImeStatus)(rdpContext* context, UINT16 imeId, UINT32 imeState,
                                       UINT32 imeConvMode);
 typedef BOOL (*pServerStatusInfo)(rdpContext* context, UINT32 status);
+typedef BOOL (*pFastPathUpdate)(rdpContext* context, BYTE updateCode, wStream* s);
 
 struct rdp_update
 {
@@ -231,7 +232,11 @@ struct rdp_update
 	 * fills BITMAP_DATA struct members: flags, cbCompMainBodySize and cbCompFirstRowSize.
 	 */
 	BOOL autoCalculateBitmapData; /* 71 */
-	UINT32 paddingE[80 - 72];     /* 72 */
+	/* A reassembled and decompressed fast-path update, s holds the update data up to its
+	 * length. If set on a client the update is handed on without being decoded.
+	 */
+	pFastPathUpdate FastPathUpdate; /* 72 */
+	UINT32 paddingE[80 - 73];       /* 73 */
 };
 
 #ifdef __cplusplus
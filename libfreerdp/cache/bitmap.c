@@ -236,6 +236,53 @@ rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index
 	return bitmap;
 }
 
+static BOOL bitmap_cache_use_persistent_store(const rdpSettings* settings)
+{
+	return (settings->BitmapCacheVersion == 2) && settings->BitmapCachePersistEnabled &&
+	       settings->BitmapCachePersistStore && settings->BitmapCachePersistFile;
+}
+
+static void bitmap_cache_store_bitmap(rdpBitmapCache* bitmapCache, const rdpBitmap* bitmap)
+{
+	PERSISTENT_CACHE_ENTRY cacheEntry = { 0 };
+	rdpSettings* settings = bitmapCache->context->settings;
+
+	if (!bitmap || !bitmap->key64 || !bitmap->data)
+		return;
+
+	if (!bitmap_cache_use_persistent_store(settings) || bitmapCache->storeFailed)
+		return;
+
+	/* the store holds 32bpp entries only, like the persistent cache file */
+	if (FreeRDPGetBytesPerPixel(bitmap->format) != 4)
+		return;
+
+	if (!bitmapCache->store)
+	{
+		const UINT32 flags =
+		    settings->BitmapCachePersistCompress ? PERSISTENT_STORE_FLAG_COMPRESS : 0;
+
+		bitmapCache->store = persistent_store_open(settings->BitmapCachePersistFile, flags);
+
+		if (!bitmapCache->store)
+		{
+			WLog_ERR(TAG, "failed to open persistent cache store %s, not storing bitmaps",
+			         settings->BitmapCachePersistFile);
+			bitmapCache->storeFailed = TRUE;
+			return;
+		}
+	}
+
+	cacheEntry.key64 = bitmap->key64;
+	cacheEntry.width = bitmap->width;
+	cacheEntry.height = bitmap->height;
+	cacheEntry.size = (UINT32)(bitmap->width * bitmap->height * 4);
+	cacheEntry.data = bitmap->data;
+
+	if (!persistent_store_write_entry(bitmapCache->store, &cacheEntry))
+		WLog_WARN(TAG, "failed to store bitmap 0x%016" PRIX64, bitmap->key64);
+}
+
 BOOL bitmap_cache_put(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index, rdpBitmap* bitmap)
 {
 	if (id > bitmapCache->maxCells)
@@ -255,6 +302,7 @@ BOOL bitmap_cache_put(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index, rdpB
 	}
 
 	bitmapCache->cells[id].entries[index] = bitmap;
+	bitmap_cache_store_bitmap(bitmapCache, bitmap);
 	return TRUE;
 }
 
@@ -302,6 +350,9 @@ static int bitmap_cache_save_persistent(rdpBitmapCache* bitmapCache)
 	if (!settings->BitmapCachePersistFile)
 		return 0;
 
+	if (bitmap_cache_use_persistent_store(settings))
+		return 0; /* entries were stored as they arrived */
+
 	persistent = persistent_cache_new();
 
 	if (!persistent)
@@ -417,6 +468,7 @@ void bitmap_cache_free(rdpBitmapCache* bitmapCache)
 
 	free(bitmapCache->cells);
 	persistent_cache_free(bitmapCache->persistent);
+	persistent_store_close(bitmapCache->store);
 
 	free(bitmapCache);
 }
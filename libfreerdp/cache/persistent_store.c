@@ -0,0 +1,965 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Bitmap Cache Store
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/assert.h>
+#include <winpr/collections.h>
+
+#include <freerdp/log.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/planar.h>
+#include <freerdp/cache/persistent.h>
+
+#define TAG FREERDP_TAG("cache.persistent.store")
+
+/*
+ * Unlike the v2/v3 files, which are written as a whole on disconnect, the store is
+ * updated while the session runs: new entries are appended and changed entries are
+ * rewritten in place when they still fit. Only the record headers are read on open,
+ * the bitmap data is read when an entry is actually used.
+ *
+ * A record is only valid while its magic is set. The magic is written last when a
+ * record is added and cleared first when it is rewritten, so a client that crashes
+ * in between leaves an invalid record behind instead of a corrupted bitmap.
+ *
+ * Entries are written by a thread of the store. persistent_store_write_entry only copies
+ * the bitmap and queues it, a newer bitmap for a queued key replaces the older one. The
+ * writer takes all queued entries at once and flushes the file once per batch. A memory
+ * mapping would not take the write cost off the caller either: the file grows while the
+ * session runs and would have to be remapped, and pages are still written back
+ * synchronously when the caller touches them.
+ */
+
+#define PERSISTENT_STORE_SIGNATURE "FRDPbst"
+#define PERSISTENT_STORE_VERSION 1
+#define PERSISTENT_STORE_RECORD_MAGIC 0x52534250 /* "PBSR" */
+#define PERSISTENT_STORE_RECORD_COMPRESSED 0x00000001
+
+/* compact the file on open when dead records take more space than this */
+#define PERSISTENT_STORE_COMPACT_SIZE (4 * 1024 * 1024)
+#define PERSISTENT_STORE_MAX_ENTRIES 32768
+
+/* entries arriving while this much is queued are not stored */
+#define PERSISTENT_STORE_MAX_QUEUED (32 * 1024 * 1024)
+
+#pragma pack(push, 1)
+
+/* 16 bytes */
+
+typedef struct
+{
+	BYTE sig[8];
+	UINT32 version;
+	UINT32 flags;
+} PERSISTENT_STORE_HEADER;
+
+/* 40 bytes */
+
+typedef struct
+{
+	UINT32 magic;
+	UINT32 flags;
+	UINT64 key64;
+	UINT64 stamp;
+	UINT16 width;
+	UINT16 height;
+	UINT32 size;     /* uncompressed size */
+	UINT32 length;   /* stored size */
+	UINT32 capacity; /* space reserved for the data */
+} PERSISTENT_STORE_RECORD;
+
+#pragma pack(pop)
+
+typedef struct
+{
+	PERSISTENT_STORE_RECORD record;
+	INT64 offset;
+} PERSISTENT_STORE_INDEX_ENTRY;
+
+/* An entry waiting for the writer, data follows the struct */
+typedef struct
+{
+	PERSISTENT_STORE_RECORD record;
+	BYTE* data;
+} PERSISTENT_STORE_QUEUE_ENTRY;
+
+struct rdp_persistent_store
+{
+	FILE* fp;
+	char* filename;
+	UINT32 flags;
+
+	CRITICAL_SECTION lock; /* the file, the index and the codec */
+	wHashTable* index;     /* key64 -> PERSISTENT_STORE_INDEX_ENTRY */
+
+	CRITICAL_SECTION queueLock; /* everything below up to the thread */
+	wHashTable* queued;         /* key64 -> PERSISTENT_STORE_QUEUE_ENTRY */
+	wHashTable* writing;        /* the batch the writer is busy with */
+	size_t queuedBytes;
+	BOOL stop;
+	HANDLE event; /* queued entries or stop */
+	HANDLE idle;  /* nothing queued or being written */
+	HANDLE thread;
+
+	UINT64 stamp;
+	INT64 end;
+	UINT64 liveBytes;
+	UINT64 deadBytes;
+
+	BITMAP_PLANAR_CONTEXT* planar;
+	UINT32 planarWidth;
+	UINT32 planarHeight;
+
+	BYTE* data;
+	size_t dataSize;
+	BYTE* stored;
+	size_t storedSize;
+};
+
+static UINT32 persistent_store_key_hash(const void* key)
+{
+	const UINT64 key64 = *(const UINT64*)key;
+	return (UINT32)(key64 ^ (key64 >> 32));
+}
+
+static BOOL persistent_store_key_equals(const void* a, const void* b)
+{
+	return *(const UINT64*)a == *(const UINT64*)b;
+}
+
+static BOOL persistent_store_ensure(BYTE** pbuffer, size_t* psize, size_t size)
+{
+	BYTE* buffer;
+
+	if (*psize >= size)
+		return TRUE;
+
+	buffer = (BYTE*)realloc(*pbuffer, size);
+	if (!buffer)
+		return FALSE;
+
+	*pbuffer = buffer;
+	*psize = size;
+	return TRUE;
+}
+
+static BOOL persistent_store_planar(rdpPersistentStore* store, UINT32 width, UINT32 height)
+{
+	if (!store->planar)
+	{
+		store->planar = freerdp_bitmap_planar_context_new(PLANAR_FORMAT_HEADER_RLE, width, height);
+		if (!store->planar)
+			return FALSE;
+	}
+	else if ((width > store->planarWidth) || (height > store->planarHeight))
+	{
+		width = MAX(width, store->planarWidth);
+		height = MAX(height, store->planarHeight);
+
+		if (!freerdp_bitmap_planar_context_reset(store->planar, width, height))
+			return FALSE;
+	}
+	else
+		return TRUE;
+
+	store->planarWidth = width;
+	store->planarHeight = height;
+	return TRUE;
+}
+
+static BOOL persistent_store_write_at(rdpPersistentStore* store, INT64 offset, const void* data,
+                                      size_t length)
+{
+	if (_fseeki64(store->fp, offset, SEEK_SET) != 0)
+		return FALSE;
+
+	return fwrite(data, length, 1, store->fp) == 1;
+}
+
+static BOOL persistent_store_read_at(rdpPersistentStore* store, INT64 offset, void* data,
+                                     size_t length)
+{
+	if (_fseeki64(store->fp, offset, SEEK_SET) != 0)
+		return FALSE;
+
+	return fread(data, length, 1, store->fp) == 1;
+}
+
+/* Every write seeks first, which hands the buffered data to the system in order */
+static BOOL persistent_store_set_magic(rdpPersistentStore* store, INT64 offset, UINT32 magic)
+{
+	return persistent_store_write_at(store, offset, &magic, sizeof(magic));
+}
+
+static BOOL persistent_store_index_add(rdpPersistentStore* store,
+                                       const PERSISTENT_STORE_RECORD* record, INT64 offset)
+{
+	const UINT64 recordSize = sizeof(PERSISTENT_STORE_RECORD) + record->capacity;
+	PERSISTENT_STORE_INDEX_ENTRY* entry = HashTable_GetItemValue(store->index, &record->key64);
+
+	if (entry)
+	{
+		/* a duplicate left behind by a crash, keep the newer one */
+		if (entry->record.stamp > record->stamp)
+		{
+			store->deadBytes += recordSize;
+			return TRUE;
+		}
+
+		store->deadBytes += sizeof(PERSISTENT_STORE_RECORD) + entry->record.capacity;
+		store->liveBytes -= sizeof(PERSISTENT_STORE_RECORD) + entry->record.capacity;
+		entry->record = *record;
+		entry->offset = offset;
+	}
+	else
+	{
+		entry = (PERSISTENT_STORE_INDEX_ENTRY*)calloc(1, sizeof(PERSISTENT_STORE_INDEX_ENTRY));
+		if (!entry)
+			return FALSE;
+
+		entry->record = *record;
+		entry->offset = offset;
+
+		if (!HashTable_Insert(store->index, &entry->record.key64, entry))
+		{
+			free(entry);
+			return FALSE;
+		}
+	}
+
+	store->liveBytes += recordSize;
+	return TRUE;
+}
+
+static BOOL persistent_store_load(rdpPersistentStore* store)
+{
+	INT64 size;
+	INT64 offset = sizeof(PERSISTENT_STORE_HEADER);
+	PERSISTENT_STORE_HEADER header = { 0 };
+
+	if (_fseeki64(store->fp, 0, SEEK_END) != 0)
+		return FALSE;
+
+	size = _ftelli64(store->fp);
+
+	if (size == 0)
+	{
+		memcpy(header.sig, PERSISTENT_STORE_SIGNATURE, sizeof(header.sig));
+		header.version = PERSISTENT_STORE_VERSION;
+
+		if (!persistent_store_write_at(store, 0, &header, sizeof(header)))
+			return FALSE;
+
+		store->end = offset;
+		return fflush(store->fp) == 0;
+	}
+
+	if (!persistent_store_read_at(store, 0, &header, sizeof(header)) ||
+	    (memcmp(header.sig, PERSISTENT_STORE_SIGNATURE, sizeof(header.sig)) != 0) ||
+	    (header.version != PERSISTENT_STORE_VERSION))
+	{
+		WLog_ERR(TAG, "%s is not a persistent cache store", store->filename);
+		return FALSE;
+	}
+
+	while (offset + (INT64)sizeof(PERSISTENT_STORE_RECORD) <= size)
+	{
+		PERSISTENT_STORE_RECORD record = { 0 };
+		const INT64 next = offset + (INT64)sizeof(record);
+
+		/* sequential reads, stdio buffers the headers */
+		if (fread(&record, sizeof(record), 1, store->fp) != 1)
+			break;
+
+		/* a record that was not completely written before a crash */
+		if (next + record.capacity > size)
+			break;
+
+		if ((record.magic == PERSISTENT_STORE_RECORD_MAGIC) && (record.length <= record.capacity) &&
+		    (record.size == 4ull * record.width * record.height))
+		{
+			if (!persistent_store_index_add(store, &record, offset))
+				return FALSE;
+
+			store->stamp = MAX(store->stamp, record.stamp);
+		}
+		else
+			store->deadBytes += sizeof(record) + record.capacity;
+
+		offset = next + record.capacity;
+
+		if (_fseeki64(store->fp, offset, SEEK_SET) != 0)
+			return FALSE;
+	}
+
+	store->end = offset;
+	return TRUE;
+}
+
+static BOOL persistent_store_open_file(rdpPersistentStore* store)
+{
+	store->fp = winpr_fopen(store->filename, "r+b");
+
+	if (!store->fp)
+		store->fp = winpr_fopen(store->filename, "w+b");
+
+	if (!store->fp)
+	{
+		WLog_ERR(TAG, "failed to open %s", store->filename);
+		return FALSE;
+	}
+
+	return persistent_store_load(store);
+}
+
+static BOOL persistent_store_collect(const void* key, void* value, void* arg)
+{
+	wArrayList* list = (wArrayList*)arg;
+	WINPR_UNUSED(key);
+	return ArrayList_Append(list, value);
+}
+
+static int persistent_store_compare_stamp(const void* pa, const void* pb)
+{
+	const PERSISTENT_STORE_INDEX_ENTRY* a = *(const PERSISTENT_STORE_INDEX_ENTRY* const*)pa;
+	const PERSISTENT_STORE_INDEX_ENTRY* b = *(const PERSISTENT_STORE_INDEX_ENTRY* const*)pb;
+
+	if (a->record.stamp == b->record.stamp)
+		return 0;
+
+	return (a->record.stamp > b->record.stamp) ? -1 : 1;
+}
+
+/* The index entries, most recently written first */
+static PERSISTENT_STORE_INDEX_ENTRY** persistent_store_sorted(rdpPersistentStore* store,
+                                                              size_t* pcount)
+{
+	size_t x;
+	size_t count;
+	PERSISTENT_STORE_INDEX_ENTRY** entries = NULL;
+	wArrayList* list = ArrayList_New(FALSE);
+
+	*pcount = 0;
+
+	if (!list)
+		return NULL;
+
+	if (!HashTable_Foreach(store->index, persistent_store_collect, list))
+		goto fail;
+
+	count = ArrayList_Count(list);
+	entries = (PERSISTENT_STORE_INDEX_ENTRY**)calloc(count + 1, sizeof(*entries));
+	if (!entries)
+		goto fail;
+
+	for (x = 0; x < count; x++)
+		entries[x] = ArrayList_GetItem(list, x);
+
+	qsort(entries, count, sizeof(*entries), persistent_store_compare_stamp);
+	*pcount = count;
+fail:
+	ArrayList_Free(list);
+	return entries;
+}
+
+/**
+ * Rewrite the file without dead records, keeping the most recent entries only.
+ */
+static BOOL persistent_store_compact(rdpPersistentStore* store)
+{
+	size_t x;
+	size_t count;
+	BOOL rc = FALSE;
+	FILE* fp = NULL;
+	char* tmp = NULL;
+	size_t tmpLength;
+	PERSISTENT_STORE_HEADER header = { 0 };
+	PERSISTENT_STORE_INDEX_ENTRY** entries = persistent_store_sorted(store, &count);
+
+	if (!entries)
+		return FALSE;
+
+	tmpLength = strlen(store->filename) + 5;
+	tmp = (char*)malloc(tmpLength);
+	if (!tmp)
+		goto fail;
+
+	sprintf_s(tmp, tmpLength, "%s.tmp", store->filename);
+
+	fp = winpr_fopen(tmp, "wb");
+	if (!fp)
+		goto fail;
+
+	memcpy(header.sig, PERSISTENT_STORE_SIGNATURE, sizeof(header.sig));
+	header.version = PERSISTENT_STORE_VERSION;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		goto fail;
+
+	count = MIN(count, PERSISTENT_STORE_MAX_ENTRIES);
+
+	for (x = count; x > 0; x--)
+	{
+		PERSISTENT_STORE_RECORD record = entries[x - 1]->record;
+
+		if (!persistent_store_ensure(&store->stored, &store->storedSize, record.length) ||
+		    !persistent_store_read_at(store, entries[x - 1]->offset + (INT64)sizeof(record),
+		                              store->stored, record.length))
+			goto fail;
+
+		record.capacity = record.length;
+
+		if ((fwrite(&record, sizeof(record), 1, fp) != 1) ||
+		    (fwrite(store->stored, record.length, 1, fp) != 1))
+			goto fail;
+	}
+
+	if (fclose(fp) != 0)
+	{
+		fp = NULL;
+		goto fail;
+	}
+
+	fp = NULL;
+	fclose(store->fp);
+	store->fp = NULL;
+
+	if (!winpr_MoveFileEx(tmp, store->filename, MOVEFILE_REPLACE_EXISTING))
+		goto fail;
+
+	WLog_DBG(TAG, "compacted %s to %" PRIuz " entries", store->filename, count);
+
+	HashTable_Clear(store->index);
+	store->liveBytes = 0;
+	store->deadBytes = 0;
+	rc = persistent_store_open_file(store);
+fail:
+	if (fp)
+	{
+		fclose(fp);
+		winpr_DeleteFile(tmp);
+	}
+
+	free(tmp);
+	free(entries);
+	return rc;
+}
+
+static wHashTable* persistent_store_table_new(void)
+{
+	wObject* obj;
+	wHashTable* table = HashTable_New(FALSE);
+
+	if (!table)
+		return NULL;
+
+	if (!HashTable_SetHashFunction(table, persistent_store_key_hash))
+	{
+		HashTable_Free(table);
+		return NULL;
+	}
+
+	obj = HashTable_KeyObject(table);
+	obj->fnObjectEquals = persistent_store_key_equals;
+	obj = HashTable_ValueObject(table);
+	obj->fnObjectFree = free;
+	return table;
+}
+
+static const BYTE* persistent_store_encode(rdpPersistentStore* store,
+                                           const PERSISTENT_CACHE_ENTRY* entry,
+                                           PERSISTENT_STORE_RECORD* record)
+{
+	UINT32 length = entry->size + 2;
+
+	if (!(store->flags & PERSISTENT_STORE_FLAG_COMPRESS))
+		return entry->data;
+
+	if (!persistent_store_ensure(&store->stored, &store->storedSize, length) ||
+	    !persistent_store_planar(store, entry->width, entry->height))
+		return entry->data;
+
+	/* planar stores the lines bottom up, the decoder flips them back */
+	if (!freerdp_bitmap_compress_planar(store->planar, entry->data, PIXEL_FORMAT_BGRA32,
+	                                    entry->width, entry->height, entry->width * 4,
+	                                    store->stored, &length) ||
+	    (length >= entry->size))
+		return entry->data;
+
+	record->flags |= PERSISTENT_STORE_RECORD_COMPRESSED;
+	record->length = length;
+	return store->stored;
+}
+
+/**
+ * Write a queued entry, in place if it still fits its record, appended otherwise.
+ * Called by the writer with the store locked.
+ */
+static BOOL persistent_store_write_queued(rdpPersistentStore* store,
+                                          const PERSISTENT_STORE_QUEUE_ENTRY* queued)
+{
+	const BYTE* data;
+	INT64 offset;
+	PERSISTENT_CACHE_ENTRY entry = { 0 };
+	PERSISTENT_STORE_RECORD record = queued->record;
+	PERSISTENT_STORE_INDEX_ENTRY* indexEntry;
+
+	entry.key64 = record.key64;
+	entry.width = record.width;
+	entry.height = record.height;
+	entry.size = record.size;
+	entry.data = queued->data;
+
+	data = persistent_store_encode(store, &entry, &record);
+
+	indexEntry = HashTable_GetItemValue(store->index, &record.key64);
+
+	if (indexEntry && (record.length <= indexEntry->record.capacity))
+	{
+		offset = indexEntry->offset;
+		record.capacity = indexEntry->record.capacity;
+	}
+	else
+	{
+		/* does not fit, the old record is dropped and a new one appended */
+		if (indexEntry && !persistent_store_set_magic(store, indexEntry->offset, 0))
+			return FALSE;
+
+		offset = store->end;
+		record.capacity = record.length;
+	}
+
+	if (!persistent_store_set_magic(store, offset, 0))
+		return FALSE;
+
+	if (!persistent_store_write_at(store, offset + (INT64)sizeof(record), data, record.length))
+		return FALSE;
+
+	if (!persistent_store_write_at(store, offset, &record, sizeof(record)))
+		return FALSE;
+
+	record.magic = PERSISTENT_STORE_RECORD_MAGIC;
+
+	if (!persistent_store_set_magic(store, offset, record.magic))
+		return FALSE;
+
+	if (offset == store->end)
+		store->end += (INT64)sizeof(record) + record.capacity;
+
+	if (!indexEntry)
+		return persistent_store_index_add(store, &record, offset);
+
+	if (offset != indexEntry->offset)
+	{
+		store->deadBytes += sizeof(record) + indexEntry->record.capacity;
+		store->liveBytes -= sizeof(record) + indexEntry->record.capacity;
+		store->liveBytes += sizeof(record) + record.capacity;
+	}
+
+	indexEntry->record = record;
+	indexEntry->offset = offset;
+	return TRUE;
+}
+
+static BOOL persistent_store_write_batch(const void* key, void* value, void* arg)
+{
+	rdpPersistentStore* store = (rdpPersistentStore*)arg;
+	const PERSISTENT_STORE_QUEUE_ENTRY* queued = (const PERSISTENT_STORE_QUEUE_ENTRY*)value;
+
+	WINPR_UNUSED(key);
+
+	if (!persistent_store_write_queued(store, queued))
+		WLog_WARN(TAG, "failed to write entry 0x%016" PRIX64, queued->record.key64);
+
+	return TRUE;
+}
+
+static DWORD WINAPI persistent_store_writer(LPVOID arg)
+{
+	rdpPersistentStore* store = (rdpPersistentStore*)arg;
+	BOOL stop = FALSE;
+
+	WINPR_ASSERT(store);
+
+	while (!stop && (WaitForSingleObject(store->event, INFINITE) == WAIT_OBJECT_0))
+	{
+		size_t bytes;
+		wHashTable* batch;
+
+		/* take everything queued so far, the callers keep queueing meanwhile */
+		EnterCriticalSection(&store->queueLock);
+		batch = store->queued;
+		store->queued = store->writing;
+		store->writing = batch;
+		bytes = store->queuedBytes;
+		stop = store->stop;
+		LeaveCriticalSection(&store->queueLock);
+
+		EnterCriticalSection(&store->lock);
+		HashTable_Foreach(batch, persistent_store_write_batch, store);
+
+		if (fflush(store->fp) != 0)
+			WLog_WARN(TAG, "failed to flush %s", store->filename);
+
+		LeaveCriticalSection(&store->lock);
+
+		/* the entries are in the index now, readers find them there */
+		EnterCriticalSection(&store->queueLock);
+		HashTable_Clear(store->writing);
+		store->queuedBytes -= bytes;
+
+		if (HashTable_Count(store->queued) == 0)
+			SetEvent(store->idle);
+
+		LeaveCriticalSection(&store->queueLock);
+	}
+
+	return 0;
+}
+
+/* Wait until the writer wrote everything queued */
+static void persistent_store_drain(rdpPersistentStore* store)
+{
+	if (store->thread)
+		WaitForSingleObject(store->idle, INFINITE);
+}
+
+rdpPersistentStore* persistent_store_open(const char* filename, UINT32 flags)
+{
+	rdpPersistentStore* store;
+
+	WINPR_ASSERT(filename);
+
+	store = (rdpPersistentStore*)calloc(1, sizeof(rdpPersistentStore));
+	if (!store)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&store->lock, 4000))
+	{
+		free(store);
+		return NULL;
+	}
+
+	if (!InitializeCriticalSectionAndSpinCount(&store->queueLock, 4000))
+	{
+		DeleteCriticalSection(&store->lock);
+		free(store);
+		return NULL;
+	}
+
+	store->flags = flags;
+	store->filename = _strdup(filename);
+	if (!store->filename)
+		goto fail;
+
+	store->index = persistent_store_table_new();
+	store->queued = persistent_store_table_new();
+	store->writing = persistent_store_table_new();
+	if (!store->index || !store->queued || !store->writing)
+		goto fail;
+
+	if (!persistent_store_open_file(store))
+		goto fail;
+
+	if ((HashTable_Count(store->index) > PERSISTENT_STORE_MAX_ENTRIES) ||
+	    ((store->deadBytes > PERSISTENT_STORE_COMPACT_SIZE) &&
+	     (store->deadBytes > store->liveBytes)))
+	{
+		if (!persistent_store_compact(store))
+			goto fail;
+	}
+
+	store->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	store->idle = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (!store->event || !store->idle)
+		goto fail;
+
+	store->thread = CreateThread(NULL, 0, persistent_store_writer, store, 0, NULL);
+	if (!store->thread)
+		goto fail;
+
+	return store;
+fail:
+	persistent_store_close(store);
+	return NULL;
+}
+
+void persistent_store_close(rdpPersistentStore* store)
+{
+	if (!store)
+		return;
+
+	/* the writer writes what is still queued before it exits */
+	if (store->thread)
+	{
+		EnterCriticalSection(&store->queueLock);
+		store->stop = TRUE;
+		LeaveCriticalSection(&store->queueLock);
+		SetEvent(store->event);
+		WaitForSingleObject(store->thread, INFINITE);
+		CloseHandle(store->thread);
+	}
+
+	if (store->event)
+		CloseHandle(store->event);
+
+	if (store->idle)
+		CloseHandle(store->idle);
+
+	if (store->fp)
+		fclose(store->fp);
+
+	HashTable_Free(store->index);
+	HashTable_Free(store->queued);
+	HashTable_Free(store->writing);
+	freerdp_bitmap_planar_context_free(store->planar);
+	DeleteCriticalSection(&store->queueLock);
+	DeleteCriticalSection(&store->lock);
+	free(store->filename);
+	free(store->data);
+	free(store->stored);
+	free(store);
+}
+
+size_t persistent_store_get_count(rdpPersistentStore* store)
+{
+	size_t count;
+
+	WINPR_ASSERT(store);
+
+	persistent_store_drain(store);
+	EnterCriticalSection(&store->lock);
+	count = HashTable_Count(store->index);
+	LeaveCriticalSection(&store->lock);
+	return count;
+}
+
+/**
+ * Function description
+ * Fill entries with the index of the store, the most recently written entries first.
+ * Only the data pointers are left NULL, nothing but the record headers is read.
+ * Waits for the queued entries to be written.
+ *
+ * @return The number of entries filled in
+ */
+size_t persistent_store_get_entries(rdpPersistentStore* store, PERSISTENT_CACHE_ENTRY* entries,
+                                    size_t count)
+{
+	size_t x;
+	size_t total;
+	PERSISTENT_STORE_INDEX_ENTRY** sorted;
+
+	WINPR_ASSERT(store);
+	WINPR_ASSERT(entries || (count == 0));
+
+	persistent_store_drain(store);
+	EnterCriticalSection(&store->lock);
+	sorted = persistent_store_sorted(store, &total);
+	count = sorted ? MIN(count, total) : 0;
+
+	for (x = 0; x < count; x++)
+	{
+		const PERSISTENT_STORE_RECORD* record = &sorted[x]->record;
+		PERSISTENT_CACHE_ENTRY* entry = &entries[x];
+
+		entry->key64 = record->key64;
+		entry->width = record->width;
+		entry->height = record->height;
+		entry->size = record->size;
+		entry->flags = 0;
+		entry->data = NULL;
+	}
+
+	LeaveCriticalSection(&store->lock);
+	free(sorted);
+	return count;
+}
+
+/* Copy an entry the writer did not get to yet, the queue must be locked */
+static BOOL persistent_store_read_queued(rdpPersistentStore* store, UINT64 key64,
+                                         PERSISTENT_CACHE_ENTRY* entry, BOOL* found)
+{
+	const PERSISTENT_STORE_QUEUE_ENTRY* queued = HashTable_GetItemValue(store->queued, &key64);
+
+	if (!queued)
+		queued = HashTable_GetItemValue(store->writing, &key64);
+
+	*found = queued != NULL;
+
+	if (!queued)
+		return FALSE;
+
+	if (!persistent_store_ensure(&store->data, &store->dataSize, queued->record.size))
+		return FALSE;
+
+	CopyMemory(store->data, queued->data, queued->record.size);
+	entry->key64 = queued->record.key64;
+	entry->width = queued->record.width;
+	entry->height = queued->record.height;
+	entry->size = queued->record.size;
+	entry->flags = 0;
+	entry->data = store->data;
+	return TRUE;
+}
+
+static BOOL persistent_store_read_file(rdpPersistentStore* store, UINT64 key64,
+                                       PERSISTENT_CACHE_ENTRY* entry)
+{
+	const PERSISTENT_STORE_RECORD* record;
+	const PERSISTENT_STORE_INDEX_ENTRY* indexEntry;
+
+	indexEntry = HashTable_GetItemValue(store->index, &key64);
+	if (!indexEntry)
+		return FALSE;
+
+	record = &indexEntry->record;
+
+	if (!persistent_store_ensure(&store->data, &store->dataSize, record->size))
+		return FALSE;
+
+	if (record->flags & PERSISTENT_STORE_RECORD_COMPRESSED)
+	{
+		if (!persistent_store_ensure(&store->stored, &store->storedSize, record->length) ||
+		    !persistent_store_read_at(store, indexEntry->offset + (INT64)sizeof(*record),
+		                              store->stored, record->length))
+			return FALSE;
+
+		if (!persistent_store_planar(store, record->width, record->height) ||
+		    !planar_decompress(store->planar, store->stored, record->length, record->width,
+		                       record->height, store->data, PIXEL_FORMAT_BGRA32, 0, 0, 0,
+		                       record->width, record->height, TRUE))
+		{
+			WLog_ERR(TAG, "failed to decompress entry 0x%016" PRIX64, key64);
+			return FALSE;
+		}
+	}
+	else if (!persistent_store_read_at(store, indexEntry->offset + (INT64)sizeof(*record),
+	                                   store->data, record->size))
+		return FALSE;
+
+	entry->key64 = record->key64;
+	entry->width = record->width;
+	entry->height = record->height;
+	entry->size = record->size;
+	entry->flags = 0;
+	entry->data = store->data;
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Read the bitmap of an entry. The data is owned by the store and valid until the next
+ * call on it.
+ *
+ * @return TRUE on success, FALSE if the key is unknown or the entry can not be read
+ */
+BOOL persistent_store_read_entry(rdpPersistentStore* store, UINT64 key64,
+                                 PERSISTENT_CACHE_ENTRY* entry)
+{
+	BOOL rc;
+	BOOL found;
+
+	WINPR_ASSERT(store);
+	WINPR_ASSERT(entry);
+
+	/* the writer moves entries to the index before it drops them from the queue */
+	EnterCriticalSection(&store->queueLock);
+	rc = persistent_store_read_queued(store, key64, entry, &found);
+	LeaveCriticalSection(&store->queueLock);
+
+	if (found)
+		return rc;
+
+	EnterCriticalSection(&store->lock);
+	rc = persistent_store_read_file(store, key64, entry);
+	LeaveCriticalSection(&store->lock);
+	return rc;
+}
+
+/**
+ * Function description
+ * Add an entry to the store or replace the one with the same key. The bitmap is copied
+ * and written by the writer thread of the store. Entries arriving while the writer is
+ * too far behind are not stored.
+ *
+ * @return TRUE on success, FALSE otherwise
+ */
+BOOL persistent_store_write_entry(rdpPersistentStore* store, const PERSISTENT_CACHE_ENTRY* entry)
+{
+	BOOL rc = TRUE;
+	PERSISTENT_STORE_QUEUE_ENTRY* queued;
+	const PERSISTENT_STORE_QUEUE_ENTRY* old;
+
+	WINPR_ASSERT(store);
+	WINPR_ASSERT(entry);
+
+	if (!entry->data || (entry->size != 4ul * entry->width * entry->height))
+		return FALSE;
+
+	queued = (PERSISTENT_STORE_QUEUE_ENTRY*)malloc(sizeof(PERSISTENT_STORE_QUEUE_ENTRY) +
+	                                               entry->size);
+	if (!queued)
+		return FALSE;
+
+	ZeroMemory(&queued->record, sizeof(queued->record));
+	queued->record.key64 = entry->key64;
+	queued->record.width = entry->width;
+	queued->record.height = entry->height;
+	queued->record.size = entry->size;
+	queued->record.length = entry->size;
+	queued->data = (BYTE*)&queued[1];
+	CopyMemory(queued->data, entry->data, entry->size);
+
+	EnterCriticalSection(&store->queueLock);
+
+	if (store->queuedBytes + entry->size > PERSISTENT_STORE_MAX_QUEUED)
+	{
+		WLog_DBG(TAG, "writer behind, entry 0x%016" PRIX64 " not stored", entry->key64);
+		free(queued);
+		goto out;
+	}
+
+	/* the stamp orders the entries as they were written */
+	queued->record.stamp = ++store->stamp;
+
+	old = HashTable_GetItemValue(store->queued, &queued->record.key64);
+	if (old)
+	{
+		store->queuedBytes -= old->record.size;
+		HashTable_Remove(store->queued, &queued->record.key64);
+	}
+
+	if (!HashTable_Insert(store->queued, &queued->record.key64, queued))
+	{
+		free(queued);
+		rc = FALSE;
+		goto out;
+	}
+
+	store->queuedBytes += entry->size;
+	ResetEvent(store->idle);
+	SetEvent(store->event);
+out:
+	LeaveCriticalSection(&store->queueLock);
+	return rc;
+}
@@ -0,0 +1,230 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/crypto.h>
+
+#include <freerdp/cache/persistent.h>
+
+#define TEST_WIDTH 61
+#define TEST_HEIGHT 33
+#define TEST_SIZE (TEST_WIDTH * TEST_HEIGHT * 4)
+
+static BYTE images[3][TEST_SIZE];
+
+static void test_fill_images(void)
+{
+	size_t x;
+
+	/* noise does not compress, the others do */
+	winpr_RAND(images[0], sizeof(images[0]));
+
+	memset(images[1], 0x7F, sizeof(images[1]));
+
+	for (x = 0; x < TEST_SIZE; x++)
+		images[2][x] = (BYTE)((x % 4 == 3) ? (x / 512) : (x / 97));
+}
+
+static BOOL test_write(rdpPersistentStore* store, UINT64 key64, const BYTE* data)
+{
+	PERSISTENT_CACHE_ENTRY entry = { 0 };
+
+	entry.key64 = key64;
+	entry.width = TEST_WIDTH;
+	entry.height = TEST_HEIGHT;
+	entry.size = TEST_SIZE;
+	entry.data = (BYTE*)data;
+
+	if (!persistent_store_write_entry(store, &entry))
+	{
+		fprintf(stderr, "persistent_store_write_entry(0x%016" PRIx64 ") failed\n", key64);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_read(rdpPersistentStore* store, UINT64 key64, const BYTE* data)
+{
+	PERSISTENT_CACHE_ENTRY entry = { 0 };
+
+	if (!persistent_store_read_entry(store, key64, &entry))
+	{
+		fprintf(stderr, "persistent_store_read_entry(0x%016" PRIx64 ") failed\n", key64);
+		return FALSE;
+	}
+
+	if ((entry.key64 != key64) || (entry.width != TEST_WIDTH) || (entry.height != TEST_HEIGHT) ||
+	    (entry.size != TEST_SIZE) || (memcmp(entry.data, data, TEST_SIZE) != 0))
+	{
+		fprintf(stderr, "entry 0x%016" PRIx64 " does not match\n", key64);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_store(const char* name, UINT32 flags)
+{
+	BOOL rc = FALSE;
+	FILE* fp = NULL;
+	PERSISTENT_CACHE_ENTRY entries[4] = { 0 };
+	rdpPersistentStore* store = persistent_store_open(name, flags);
+
+	if (!store)
+	{
+		fprintf(stderr, "persistent_store_open(%s) failed\n", name);
+		return FALSE;
+	}
+
+	if (!test_write(store, 1, images[0]) || !test_write(store, 2, images[1]) ||
+	    !test_write(store, 3, images[2]))
+		goto fail;
+
+	if (!test_read(store, 1, images[0]) || !test_read(store, 2, images[1]) ||
+	    !test_read(store, 3, images[2]))
+		goto fail;
+
+	/* waits for the writer, the rewrites below then hit records in the file */
+	if (persistent_store_get_count(store) != 3)
+	{
+		fprintf(stderr, "queued entries missing from the store\n");
+		goto fail;
+	}
+
+	/* one that fits in place and one that has to move */
+	if (!test_write(store, 1, images[1]) || !test_write(store, 2, images[0]))
+		goto fail;
+
+	if (!test_read(store, 1, images[1]) || !test_read(store, 2, images[0]))
+		goto fail;
+
+	persistent_store_close(store);
+
+	/* a record cut short by a crash */
+	fp = fopen(name, "ab");
+	if (!fp || (fwrite(images[0], 57, 1, fp) != 1))
+		goto fail;
+
+	fclose(fp);
+	fp = NULL;
+
+	store = persistent_store_open(name, flags);
+	if (!store)
+	{
+		fprintf(stderr, "persistent_store_open(%s) failed after a crash\n", name);
+		goto fail;
+	}
+
+	if ((persistent_store_get_count(store) != 3) ||
+	    (persistent_store_get_entries(store, entries, ARRAYSIZE(entries)) != 3))
+	{
+		fprintf(stderr, "unexpected entry count %" PRIuz "\n", persistent_store_get_count(store));
+		goto fail;
+	}
+
+	/* most recently written first */
+	if ((entries[0].key64 != 2) || (entries[1].key64 != 1) || (entries[2].key64 != 3) ||
+	    (entries[0].size != TEST_SIZE) || entries[0].data)
+	{
+		fprintf(stderr, "unexpected index order\n");
+		goto fail;
+	}
+
+	if (!test_read(store, 1, images[1]) || !test_read(store, 2, images[0]) ||
+	    !test_read(store, 3, images[2]))
+		goto fail;
+
+	if (persistent_store_read_entry(store, 4, &entries[3]))
+	{
+		fprintf(stderr, "read of an unknown key unexpectedly succeeded\n");
+		goto fail;
+	}
+
+	/* appending after the cut record must not bring it back */
+	if (!test_write(store, 4, images[2]))
+		goto fail;
+
+	persistent_store_close(store);
+	store = persistent_store_open(name, flags);
+
+	if (!store || (persistent_store_get_count(store) != 4) || !test_read(store, 4, images[2]))
+	{
+		fprintf(stderr, "store broken after writing behind a cut record\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		fprintf(stderr, "store test with flags 0x%08" PRIx32 " failed\n", flags);
+
+	if (fp)
+		fclose(fp);
+
+	persistent_store_close(store);
+	return rc;
+}
+
+int TestPersistentStore(int argc, char* argv[])
+{
+	int rc = -1;
+	size_t x;
+	FILE* fp = NULL;
+	BYTE tmp[16] = { 0 };
+	char tmp2[64] = { 0 };
+	char* name = NULL;
+	rdpPersistentStore* store = NULL;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	winpr_RAND(tmp, sizeof(tmp));
+
+	for (x = 0; x < sizeof(tmp); x++)
+		_snprintf(&tmp2[x * 2], sizeof(tmp2) - 2 * x, "%02" PRIx8, tmp[x]);
+
+	name = GetKnownSubPath(KNOWN_PATH_TEMP, tmp2);
+	if (!name)
+		goto fail;
+
+	test_fill_images();
+
+	if (!test_store(name, 0))
+		goto fail;
+
+	winpr_DeleteFile(name);
+
+	if (!test_store(name, PERSISTENT_STORE_FLAG_COMPRESS))
+		goto fail;
+
+	winpr_DeleteFile(name);
+
+	/* files in other formats are left alone */
+	fp = fopen(name, "wb");
+	if (!fp || (fwrite(images[0], 1024, 1, fp) != 1))
+		goto fail;
+
+	fclose(fp);
+	fp = NULL;
+
+	store = persistent_store_open(name, 0);
+	if (store)
+	{
+		fprintf(stderr, "persistent_store_open unexpectedly accepted a foreign file\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	if (fp)
+		fclose(fp);
+
+	persistent_store_close(store);
+
+	if (name)
+		winpr_DeleteFile(name);
+
+	free(name);
+	return rc;
+}
@@ -41,6 +41,7 @@ struct rdp_bulk
 	ALIGN64 NCRUSH_CONTEXT* ncrushSend;
 	ALIGN64 XCRUSH_CONTEXT* xcrushRecv;
 	ALIGN64 XCRUSH_CONTEXT* xcrushSend;
+	ALIGN64 STOPWATCH* stopwatch; /* only set while decompression is measured */
 	ALIGN64 BYTE OutputBuffer[65536];
 };
 
@@ -167,6 +168,9 @@ int bulk_decompress(rdpBulk* bulk, const BYTE* pSrcData, UINT32 SrcSize, const B
 
 	if (flags & BULK_COMPRESSION_FLAGS_MASK)
 	{
+		if (bulk->stopwatch)
+			stopwatch_start(bulk->stopwatch);
+
 		switch (type)
 		{
 			case PACKET_COMPR_TYPE_8K:
@@ -201,6 +205,9 @@ int bulk_decompress(rdpBulk* bulk, const BYTE* pSrcData, UINT32 SrcSize, const B
 				status = -1;
 				break;
 		}
+
+		if (bulk->stopwatch)
+			stopwatch_stop(bulk->stopwatch);
 	}
 	else
 	{
@@ -333,6 +340,12 @@ void bulk_reset(rdpBulk* bulk)
 	xcrush_context_reset(bulk->xcrushSend, FALSE);
 }
 
+void bulk_set_stopwatch(rdpBulk* bulk, STOPWATCH* stopwatch)
+{
+	WINPR_ASSERT(bulk);
+	bulk->stopwatch = stopwatch;
+}
+
 rdpBulk* bulk_new(rdpContext* context)
 {
 	rdpBulk* bulk;
@@ -24,6 +24,7 @@ typedef struct rdp_bulk rdpBulk;
 
 #include <freerdp/api.h>
 #include <freerdp/freerdp.h>
+#include <freerdp/utils/stopwatch.h>
 
 #define BULK_COMPRESSION_FLAGS_MASK 0xE0
 #define BULK_COMPRESSION_TYPE_MASK 0x0F
@@ -36,6 +37,7 @@ FREERDP_LOCAL int bulk_compress(rdpBulk* bulk, const BYTE* pSrcData, UINT32 SrcS
                                 const BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags);
 
 FREERDP_LOCAL void bulk_reset(rdpBulk* bulk);
+FREERDP_LOCAL void bulk_set_stopwatch(rdpBulk* bulk, STOPWATCH* stopwatch);
 
 FREERDP_LOCAL rdpBulk* bulk_new(rdpContext* context);
 FREERDP_LOCAL void bulk_free(rdpBulk* bulk);
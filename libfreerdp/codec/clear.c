@@ -37,6 +37,11 @@
 
 #define CLEARCODEC_VBAR_SIZE 32768
 #define CLEARCODEC_VBAR_SHORT_SIZE 16384
+#define CLEARCODEC_GLYPH_SIZE 4000
+#define CLEARCODEC_GLYPH_MAX_PIXELS 1024
+#define CLEARCODEC_BAND_MAX_HEIGHT 52
+#define CLEARCODEC_RLEX_MAX_COLORS 127
+#define CLEARCODEC_LOOKUP_SIZE 65536
 
 typedef struct
 {
@@ -62,11 +67,29 @@ struct S_CLEAR_CONTEXT
 	UINT32 nTempStep;
 	UINT32 TempFormat;
 	UINT32 format;
-	CLEAR_GLYPH_ENTRY GlyphCache[4000];
+	CLEAR_GLYPH_ENTRY GlyphCache[CLEARCODEC_GLYPH_SIZE];
 	UINT32 VBarStorageCursor;
 	CLEAR_VBAR_ENTRY VBarStorage[CLEARCODEC_VBAR_SIZE];
 	UINT32 ShortVBarStorageCursor;
 	CLEAR_VBAR_ENTRY ShortVBarStorage[CLEARCODEC_VBAR_SHORT_SIZE];
+
+	/* Encoder state: content hashes of the mirrored caches and hash -> index + 1 lookups */
+	BOOL CacheResetPending;
+	UINT32 GlyphCursor;
+	UINT32 GlyphHash[CLEARCODEC_GLYPH_SIZE];
+	UINT16 GlyphLookup[CLEARCODEC_LOOKUP_SIZE];
+	UINT32 VBarHash[CLEARCODEC_VBAR_SIZE];
+	UINT16 VBarLookup[CLEARCODEC_LOOKUP_SIZE];
+	UINT32 ShortVBarHash[CLEARCODEC_VBAR_SHORT_SIZE];
+	UINT16 ShortVBarLookup[CLEARCODEC_LOOKUP_SIZE];
+	UINT32* RowCover;
+	UINT32 RowCoverSize;
+	BYTE* IndexBuffer;
+	UINT32 IndexBufferSize;
+	wStream* ResidualStream;
+	wStream* BandsStream;
+	wStream* SubcodecStream;
+	wStream* TempStream;
 };
 
 static const UINT32 CLEAR_LOG2_FLOOR[256] = {
@@ -903,7 +926,7 @@ static BOOL clear_decompress_glyph_data(CLEAR_CONTEXT* clear, wStream* s, UINT32
 
 	Stream_Read_UINT16(s, glyphIndex);
 
-	if (glyphIndex >= 4000)
+	if (glyphIndex >= CLEARCODEC_GLYPH_SIZE)
 	{
 		WLog_ERR(TAG, "Invalid glyphIndex %" PRIu16 "", glyphIndex);
 		return FALSE;
@@ -1117,10 +1140,737 @@ fail:
 	return rc;
 }
 
-int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData,
+static UINT32 clear_hash_pixels(const UINT32* pixels, UINT32 count, UINT32 stride)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261u;
+
+	for (i = 0; i < count; i++)
+	{
+		hash ^= pixels[i * stride];
+		hash *= 16777619u;
+	}
+
+	return hash ^ count;
+}
+
+static BOOL clear_pixels_equal(const UINT32* cached, const UINT32* pixels, UINT32 count,
+                               UINT32 stride)
+{
+	UINT32 i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (cached[i] != pixels[i * stride])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static INLINE void clear_write_color(wStream* s, UINT32 color)
+{
+	Stream_Write_UINT8(s, color & 0xFF);         /* blue */
+	Stream_Write_UINT8(s, (color >> 8) & 0xFF);  /* green */
+	Stream_Write_UINT8(s, (color >> 16) & 0xFF); /* red */
+}
+
+static INLINE void clear_write_run_length(wStream* s, UINT32 runLength)
+{
+	if (runLength < 0xFF)
+		Stream_Write_UINT8(s, (BYTE)runLength);
+	else if (runLength < 0xFFFF)
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, (UINT16)runLength);
+	}
+	else
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, 0xFFFF);
+		Stream_Write_UINT32(s, runLength);
+	}
+}
+
+static INT32 clear_vbar_lookup(const CLEAR_VBAR_ENTRY* storage, const UINT32* hashes,
+                               const UINT16* lookup, UINT32 hash, const UINT32* pixels,
+                               UINT32 count, UINT32 stride)
+{
+	const CLEAR_VBAR_ENTRY* entry;
+	const UINT16 slot = lookup[hash % CLEARCODEC_LOOKUP_SIZE];
+
+	if (slot == 0)
+		return -1;
+
+	entry = &storage[slot - 1];
+
+	if ((hashes[slot - 1] != hash) || (entry->count != count))
+		return -1;
+
+	if (!clear_pixels_equal((const UINT32*)entry->pixels, pixels, count, stride))
+		return -1;
+
+	return slot - 1;
+}
+
+static BOOL clear_vbar_insert(CLEAR_CONTEXT* clear, CLEAR_VBAR_ENTRY* storage, UINT32* hashes,
+                              UINT16* lookup, UINT32* cursor, UINT32 size, UINT32 hash,
+                              const UINT32* pixels, UINT32 count, UINT32 stride)
+{
+	UINT32 i;
+	UINT32* dst;
+	const UINT32 index = *cursor;
+	CLEAR_VBAR_ENTRY* entry = &storage[index];
+	UINT16* slot = &lookup[hashes[index] % CLEARCODEC_LOOKUP_SIZE];
+
+	/* The entry is recycled, drop the lookup of its previous content */
+	if (*slot == index + 1)
+		*slot = 0;
+
+	entry->count = count;
+
+	if (!resize_vbar_entry(clear, entry))
+		return FALSE;
+
+	dst = (UINT32*)entry->pixels;
+
+	for (i = 0; i < count; i++)
+		dst[i] = pixels[i * stride];
+
+	hashes[index] = hash;
+	lookup[hash % CLEARCODEC_LOOKUP_SIZE] = (UINT16)(index + 1);
+	*cursor = (index + 1) % size;
+	return TRUE;
+}
+
+static void clear_vbar_trim(const UINT32* column, UINT32 height, UINT32 stride, UINT32 colorBkg,
+                            UINT32* pYOn, UINT32* pYOff)
+{
+	UINT32 yOn = 0;
+	UINT32 yOff = height;
+
+	while ((yOn < height) && (column[yOn * stride] == colorBkg))
+		yOn++;
+
+	while ((yOff > yOn) && (column[(yOff - 1) * stride] == colorBkg))
+		yOff--;
+
+	*pYOn = yOn;
+	*pYOff = yOff;
+}
+
+static UINT32 clear_estimate_band(const CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 width,
+                                  UINT32 x0, UINT32 x1, UINT32 y0, UINT32 y1, UINT32 colorBkg)
+{
+	UINT32 x;
+	UINT32 seen[512] = { 0 };
+	UINT32 size = 11;
+	const UINT32 height = y1 - y0 + 1;
+
+	for (x = x0; x <= x1; x++)
+	{
+		UINT32 yOn;
+		UINT32 yOff;
+		UINT32 shortHash;
+		const UINT32* column = &pixels[y0 * width + x];
+		const UINT32 hash = clear_hash_pixels(column, height, width);
+		UINT32* seenSlot = &seen[hash % ARRAYSIZE(seen)];
+
+		/* Columns repeated within the band hit the entry inserted by their first occurrence */
+		if ((*seenSlot == (hash | 1)) ||
+		    (clear_vbar_lookup(clear->VBarStorage, clear->VBarHash, clear->VBarLookup, hash, column,
+		                       height, width) >= 0))
+		{
+			size += 2;
+			continue;
+		}
+
+		*seenSlot = hash | 1;
+		clear_vbar_trim(column, height, width, colorBkg, &yOn, &yOff);
+		shortHash = clear_hash_pixels(&column[yOn * width], yOff - yOn, width);
+
+		if (clear_vbar_lookup(clear->ShortVBarStorage, clear->ShortVBarHash,
+		                      clear->ShortVBarLookup, shortHash, &column[yOn * width], yOff - yOn,
+		                      width) >= 0)
+			size += 3;
+		else
+			size += 2 + 3 * (yOff - yOn);
+	}
+
+	return size;
+}
+
+static BOOL clear_encode_band(CLEAR_CONTEXT* clear, wStream* s, const UINT32* pixels,
+                              UINT32 width, UINT32 x0, UINT32 x1, UINT32 y0, UINT32 y1,
+                              UINT32 colorBkg)
+{
+	UINT32 x;
+	const UINT32 height = y1 - y0 + 1;
+
+	if (!Stream_EnsureRemainingCapacity(s, 11))
+		return FALSE;
+
+	Stream_Write_UINT16(s, (UINT16)x0); /* xStart */
+	Stream_Write_UINT16(s, (UINT16)x1); /* xEnd */
+	Stream_Write_UINT16(s, (UINT16)y0); /* yStart */
+	Stream_Write_UINT16(s, (UINT16)y1); /* yEnd */
+	clear_write_color(s, colorBkg);     /* blueBkg, greenBkg, redBkg */
+
+	for (x = x0; x <= x1; x++)
+	{
+		INT32 index;
+		UINT32 yOn;
+		UINT32 yOff;
+		UINT32 y;
+		UINT32 shortHash;
+		const UINT32* shortColumn;
+		const UINT32* column = &pixels[y0 * width + x];
+		const UINT32 hash = clear_hash_pixels(column, height, width);
+
+		if (!Stream_EnsureRemainingCapacity(s, 2 + 3 * CLEARCODEC_BAND_MAX_HEIGHT))
+			return FALSE;
+
+		index = clear_vbar_lookup(clear->VBarStorage, clear->VBarHash, clear->VBarLookup, hash,
+		                          column, height, width);
+
+		if (index >= 0)
+		{
+			Stream_Write_UINT16(s, 0x8000 | (UINT16)index); /* VBAR_CACHE_HIT */
+			continue;
+		}
+
+		clear_vbar_trim(column, height, width, colorBkg, &yOn, &yOff);
+		shortColumn = &column[yOn * width];
+		shortHash = clear_hash_pixels(shortColumn, yOff - yOn, width);
+		index = clear_vbar_lookup(clear->ShortVBarStorage, clear->ShortVBarHash,
+		                          clear->ShortVBarLookup, shortHash, shortColumn, yOff - yOn, width);
+
+		if (index >= 0)
+		{
+			Stream_Write_UINT16(s, 0x4000 | (UINT16)index); /* SHORT_VBAR_CACHE_HIT */
+			Stream_Write_UINT8(s, (BYTE)yOn);
+		}
+		else
+		{
+			Stream_Write_UINT16(s, (UINT16)((yOff << 8) | yOn)); /* SHORT_VBAR_CACHE_MISS */
+
+			for (y = yOn; y < yOff; y++)
+				clear_write_color(s, column[y * width]);
+
+			if (!clear_vbar_insert(clear, clear->ShortVBarStorage, clear->ShortVBarHash,
+			                       clear->ShortVBarLookup, &clear->ShortVBarStorageCursor,
+			                       CLEARCODEC_VBAR_SHORT_SIZE, shortHash, shortColumn, yOff - yOn,
+			                       width))
+				return FALSE;
+		}
+
+		/* Both short vBar variants make the decoder store the full vBar */
+		if (!clear_vbar_insert(clear, clear->VBarStorage, clear->VBarHash, clear->VBarLookup,
+		                       &clear->VBarStorageCursor, CLEARCODEC_VBAR_SIZE, hash, column,
+		                       height, width))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_rlex(CLEAR_CONTEXT* clear, wStream* s, const UINT32* pixels,
+                              UINT32 width, UINT32 x0, UINT32 y0, UINT32 w, UINT32 h)
+{
+	UINT32 x, y;
+	UINT32 i;
+	UINT32 index;
+	UINT32 numBits;
+	UINT32 maxDepth;
+	UINT32 paletteCount = 0;
+	UINT32 palette[CLEARCODEC_RLEX_MAX_COLORS] = { 0 };
+	const UINT32 pixelCount = w * h;
+
+	if (pixelCount > clear->IndexBufferSize)
+	{
+		BYTE* tmp = (BYTE*)realloc(clear->IndexBuffer, pixelCount);
+
+		if (!tmp)
+			return FALSE;
+
+		clear->IndexBuffer = tmp;
+		clear->IndexBufferSize = pixelCount;
+	}
+
+	/* Palette indices in order of first appearance, bail out if there are too many colors */
+	for (y = 0, i = 0; y < h; y++)
+	{
+		const UINT32* row = &pixels[(y0 + y) * width + x0];
+
+		for (x = 0; x < w; x++, i++)
+		{
+			if ((i > 0) && (row[x] == palette[clear->IndexBuffer[i - 1]]))
+			{
+				clear->IndexBuffer[i] = clear->IndexBuffer[i - 1];
+				continue;
+			}
+
+			for (index = 0; index < paletteCount; index++)
+			{
+				if (palette[index] == row[x])
+					break;
+			}
+
+			if (index == paletteCount)
+			{
+				if (paletteCount >= CLEARCODEC_RLEX_MAX_COLORS)
+					return FALSE;
+
+				palette[paletteCount++] = row[x];
+			}
+
+			clear->IndexBuffer[i] = (BYTE)index;
+		}
+	}
+
+	numBits = CLEAR_LOG2_FLOOR[paletteCount - 1] + 1;
+	maxDepth = CLEAR_8BIT_MASKS[8 - numBits];
+
+	if (!Stream_EnsureRemainingCapacity(s, 1 + 3 * paletteCount))
+		return FALSE;
+
+	Stream_Write_UINT8(s, (BYTE)paletteCount);
+
+	for (index = 0; index < paletteCount; index++)
+		clear_write_color(s, palette[index]);
+
+	i = 0;
+
+	while (i < pixelCount)
+	{
+		const BYTE startIndex = clear->IndexBuffer[i];
+		BYTE stopIndex = startIndex;
+		UINT32 suiteDepth = 0;
+		UINT32 runLength = 1;
+
+		while ((i + runLength < pixelCount) && (clear->IndexBuffer[i + runLength] == startIndex))
+			runLength++;
+
+		/* The last pixel of the run starts the suite of ascending palette indices */
+		i += runLength;
+
+		while ((i < pixelCount) && (suiteDepth < maxDepth) &&
+		       (clear->IndexBuffer[i] == stopIndex + 1))
+		{
+			stopIndex++;
+			suiteDepth++;
+			i++;
+		}
+
+		if (!Stream_EnsureRemainingCapacity(s, 8))
+			return FALSE;
+
+		Stream_Write_UINT8(s, (BYTE)((suiteDepth << numBits) | stopIndex));
+		clear_write_run_length(s, runLength - 1);
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_subcodec_header(wStream* s, UINT32 x0, UINT32 y0, UINT32 w, UINT32 h,
+                                         size_t bitmapDataByteCount, BYTE subcodecId)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 13 + bitmapDataByteCount))
+		return FALSE;
+
+	Stream_Write_UINT16(s, (UINT16)x0);                   /* xStart */
+	Stream_Write_UINT16(s, (UINT16)y0);                   /* yStart */
+	Stream_Write_UINT16(s, (UINT16)w);                    /* width */
+	Stream_Write_UINT16(s, (UINT16)h);                    /* height */
+	Stream_Write_UINT32(s, (UINT32)bitmapDataByteCount); /* bitmapDataByteCount */
+	Stream_Write_UINT8(s, subcodecId);                    /* subcodecId */
+	return TRUE;
+}
+
+static UINT32 clear_band_background(const UINT32* pixels, UINT32 width, UINT32 y0, UINT32 y1)
+{
+	UINT32 y;
+	UINT32 best = pixels[y0 * width];
+	UINT32 bestCount = 0;
+
+	/* Most frequent color of the left and right edge columns */
+	for (y = y0; y <= y1; y++)
+	{
+		UINT32 k;
+		UINT32 count = 0;
+		const UINT32 candidate = pixels[y * width];
+
+		for (k = y0; k <= y1; k++)
+		{
+			count += (pixels[k * width] == candidate) ? 1 : 0;
+			count += (pixels[k * width + width - 1] == candidate) ? 1 : 0;
+		}
+
+		if (count > bestCount)
+		{
+			best = candidate;
+			bestCount = count;
+		}
+	}
+
+	return best;
+}
+
+static BOOL clear_encode_region(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 width,
+                                UINT32 y0, UINT32 y1)
+{
+	UINT32 x, y;
+	UINT32 x0 = width;
+	UINT32 x1 = 0;
+	size_t bandsSize;
+	size_t rlexSize = SIZE_MAX;
+	size_t rawSize;
+	UINT32 w, h;
+	const UINT32 colorBkg = clear_band_background(pixels, width, y0, y1);
+
+	for (y = y0; y <= y1; y++)
+	{
+		const UINT32* row = &pixels[y * width];
+
+		for (x = 0; x < x0; x++)
+		{
+			if (row[x] != colorBkg)
+			{
+				x0 = x;
+				break;
+			}
+		}
+
+		for (x = width; x > x1 + 1; x--)
+		{
+			if (row[x - 1] != colorBkg)
+			{
+				x1 = x - 1;
+				break;
+			}
+		}
+	}
+
+	if (x0 > x1)
+		return TRUE;
+
+	w = x1 - x0 + 1;
+	h = y1 - y0 + 1;
+	bandsSize = clear_estimate_band(clear, pixels, width, x0, x1, y0, y1, colorBkg);
+	rawSize = 13 + 3ull * w * h;
+	Stream_SetPosition(clear->TempStream, 0);
+
+	if (clear_encode_rlex(clear, clear->TempStream, pixels, width, x0, y0, w, h))
+		rlexSize = 13 + Stream_GetPosition(clear->TempStream);
+
+	/* Everything outside of the covered area is left to the residual layer */
+	for (y = y0; y <= y1; y++)
+	{
+		clear->RowCover[2 * y] = x0;
+		clear->RowCover[2 * y + 1] = x1 + 1;
+	}
+
+	if ((bandsSize <= rlexSize) && (bandsSize <= rawSize))
+		return clear_encode_band(clear, clear->BandsStream, pixels, width, x0, x1, y0, y1,
+		                         colorBkg);
+
+	if (rlexSize <= rawSize)
+	{
+		const size_t length = Stream_GetPosition(clear->TempStream);
+
+		if (!clear_encode_subcodec_header(clear->SubcodecStream, x0, y0, w, h, length, 2))
+			return FALSE;
+
+		Stream_Write(clear->SubcodecStream, Stream_Buffer(clear->TempStream), length);
+		return TRUE;
+	}
+
+	if (!clear_encode_subcodec_header(clear->SubcodecStream, x0, y0, w, h, 3ull * w * h, 0))
+		return FALSE;
+
+	for (y = y0; y <= y1; y++)
+	{
+		for (x = x0; x <= x1; x++)
+			clear_write_color(clear->SubcodecStream, pixels[y * width + x]);
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_residual(CLEAR_CONTEXT* clear, wStream* s, const UINT32* pixels,
+                                  UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	UINT32 color = 0;
+	UINT32 runLength = 0;
+	BOOL covered = TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		const UINT32 coverStart = clear->RowCover[2 * y];
+		const UINT32 coverEnd = clear->RowCover[2 * y + 1];
+
+		if (coverStart > 0 || coverEnd < width)
+			covered = FALSE;
+	}
+
+	/* Bands and subcodecs overwrite the whole rectangle, no residual layer needed */
+	if (covered)
+		return TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		const UINT32* row = &pixels[y * width];
+		const UINT32 coverStart = clear->RowCover[2 * y];
+		const UINT32 coverEnd = clear->RowCover[2 * y + 1];
+
+		for (x = 0; x < width; x++)
+		{
+			/* Pixels painted by a later layer extend whatever run is active */
+			if ((runLength > 0) && ((row[x] == color) || ((x >= coverStart) && (x < coverEnd))))
+			{
+				runLength++;
+				continue;
+			}
+
+			if (runLength > 0)
+			{
+				if (!Stream_EnsureRemainingCapacity(s, 10))
+					return FALSE;
+
+				clear_write_color(s, color);
+				clear_write_run_length(s, runLength);
+			}
+
+			color = row[x];
+			runLength = 1;
+		}
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 10))
+		return FALSE;
+
+	clear_write_color(s, color);
+	clear_write_run_length(s, runLength);
+	return TRUE;
+}
+
+static INT32 clear_glyph_lookup(const CLEAR_CONTEXT* clear, UINT32 hash, const UINT32* pixels,
+                                UINT32 count)
+{
+	const CLEAR_GLYPH_ENTRY* entry;
+	const UINT16 slot = clear->GlyphLookup[hash % CLEARCODEC_LOOKUP_SIZE];
+
+	if (slot == 0)
+		return -1;
+
+	entry = &clear->GlyphCache[slot - 1];
+
+	if ((clear->GlyphHash[slot - 1] != hash) || (entry->count != count))
+		return -1;
+
+	if (!clear_pixels_equal(entry->pixels, pixels, count, 1))
+		return -1;
+
+	return slot - 1;
+}
+
+static INT32 clear_glyph_insert(CLEAR_CONTEXT* clear, UINT32 hash, const UINT32* pixels,
+                                UINT32 count)
+{
+	const UINT32 index = clear->GlyphCursor;
+	CLEAR_GLYPH_ENTRY* entry = &clear->GlyphCache[index];
+	UINT16* slot = &clear->GlyphLookup[clear->GlyphHash[index] % CLEARCODEC_LOOKUP_SIZE];
+
+	if (*slot == index + 1)
+		*slot = 0;
+
+	if (count > entry->size)
+	{
+		UINT32* tmp = (UINT32*)realloc(entry->pixels, count * sizeof(UINT32));
+
+		if (!tmp)
+			return -1;
+
+		entry->pixels = tmp;
+		entry->size = count;
+	}
+
+	entry->count = count;
+	CopyMemory(entry->pixels, pixels, count * sizeof(UINT32));
+	clear->GlyphHash[index] = hash;
+	clear->GlyphLookup[hash % CLEARCODEC_LOOKUP_SIZE] = (UINT16)(index + 1);
+	clear->GlyphCursor = (index + 1) % CLEARCODEC_GLYPH_SIZE;
+	return (INT32)index;
+}
+
+static BOOL clear_prepare_pixels(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcFormat,
+                                 UINT32 nWidth, UINT32 nHeight, UINT32 nSrcStep)
+{
+	UINT32 i;
+	const UINT32 count = nWidth * nHeight;
+	BYTE* data;
+
+	if (!clear_resize_buffer(clear, nWidth, nHeight))
+		return FALSE;
+
+	if (!freerdp_image_copy(clear->TempBuffer, PIXEL_FORMAT_BGRX32, nWidth * 4, 0, 0, nWidth,
+	                        nHeight, pSrcData, SrcFormat, nSrcStep, 0, 0, NULL, FREERDP_FLIP_NONE))
+		return FALSE;
+
+	/* Canonical 0x00RRGGBB values, independent of host byte order */
+	data = clear->TempBuffer;
+
+	for (i = 0; i < count; i++)
+	{
+		const UINT32 color = data[4 * i] | ((UINT32)data[4 * i + 1] << 8) |
+		                     ((UINT32)data[4 * i + 2] << 16);
+		((UINT32*)data)[i] = color;
+	}
+
+	if (2 * nHeight > clear->RowCoverSize)
+	{
+		UINT32* tmp = (UINT32*)realloc(clear->RowCover, 2ull * nHeight * sizeof(UINT32));
+
+		if (!tmp)
+			return FALSE;
+
+		clear->RowCover = tmp;
+		clear->RowCoverSize = 2 * nHeight;
+	}
+
+	ZeroMemory(clear->RowCover, 2ull * nHeight * sizeof(UINT32));
+	return TRUE;
+}
+
+static BOOL clear_row_is_uniform(const UINT32* row, UINT32 width)
+{
+	UINT32 x;
+
+	for (x = 1; x < width; x++)
+	{
+		if (row[x] != row[0])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, UINT32 SrcFormat,
+                   UINT32 nWidth, UINT32 nHeight, UINT32 nSrcStep, BYTE** ppDstData,
                    UINT32* pDstSize)
 {
-	WLog_ERR(TAG, "TODO: %s not implemented!", __FUNCTION__);
+	UINT32 y;
+	INT32 glyphIndex = -1;
+	BYTE glyphFlags = 0;
+	const UINT32* pixels;
+	size_t residualByteCount;
+	size_t bandsByteCount;
+	size_t subcodecByteCount;
+	wStream* s;
+
+	if (!clear || !clear->Compressor || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	if ((nWidth == 0) || (nHeight == 0) || (nWidth > 0xFFFF) || (nHeight > 0xFFFF))
+		return -1;
+
+	if (nSrcStep == 0)
+		nSrcStep = nWidth * FreeRDPGetBytesPerPixel(SrcFormat);
+
+	if (SrcSize < 1ull * nSrcStep * (nHeight - 1) + nWidth * FreeRDPGetBytesPerPixel(SrcFormat))
+		return -1;
+
+	if (!clear_prepare_pixels(clear, pSrcData, SrcFormat, nWidth, nHeight, nSrcStep))
+		return -1;
+
+	pixels = (const UINT32*)clear->TempBuffer;
+
+	if (clear->CacheResetPending)
+	{
+		glyphFlags |= CLEARCODEC_FLAG_CACHE_RESET;
+		clear->VBarStorageCursor = 0;
+		clear->ShortVBarStorageCursor = 0;
+		clear->CacheResetPending = FALSE;
+	}
+
+	if (nWidth * nHeight <= CLEARCODEC_GLYPH_MAX_PIXELS)
+	{
+		const UINT32 hash = clear_hash_pixels(pixels, nWidth * nHeight, 1);
+		glyphIndex = clear_glyph_lookup(clear, hash, pixels, nWidth * nHeight);
+
+		if (glyphIndex >= 0)
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX | CLEARCODEC_FLAG_GLYPH_HIT;
+		else
+		{
+			glyphIndex = clear_glyph_insert(clear, hash, pixels, nWidth * nHeight);
+
+			if (glyphIndex < 0)
+				return -1;
+
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX;
+		}
+	}
+
+	Stream_SetPosition(clear->ResidualStream, 0);
+	Stream_SetPosition(clear->BandsStream, 0);
+	Stream_SetPosition(clear->SubcodecStream, 0);
+
+	if (!(glyphFlags & CLEARCODEC_FLAG_GLYPH_HIT))
+	{
+		y = 0;
+
+		/* Rows of a single color go to the residual layer, everything else is grouped in bands */
+		while (y < nHeight)
+		{
+			UINT32 y0 = y;
+
+			while ((y < nHeight) && (y - y0 < CLEARCODEC_BAND_MAX_HEIGHT) &&
+			       !clear_row_is_uniform(&pixels[y * nWidth], nWidth))
+				y++;
+
+			if (y == y0)
+			{
+				y++;
+				continue;
+			}
+
+			if (!clear_encode_region(clear, pixels, nWidth, y0, y - 1))
+				return -1;
+		}
+
+		if (!clear_encode_residual(clear, clear->ResidualStream, pixels, nWidth, nHeight))
+			return -1;
+	}
+
+	residualByteCount = Stream_GetPosition(clear->ResidualStream);
+	bandsByteCount = Stream_GetPosition(clear->BandsStream);
+	subcodecByteCount = Stream_GetPosition(clear->SubcodecStream);
+	s = Stream_New(NULL, 16 + residualByteCount + bandsByteCount + subcodecByteCount);
+
+	if (!s)
+		return -1;
+
+	Stream_Write_UINT8(s, glyphFlags);                 /* glyphFlags (1 byte) */
+	Stream_Write_UINT8(s, (BYTE)clear->seqNumber);     /* seqNumber (1 byte) */
+	clear->seqNumber = (clear->seqNumber + 1) % 256;
+
+	if (glyphIndex >= 0)
+		Stream_Write_UINT16(s, (UINT16)glyphIndex); /* glyphIndex (2 bytes) */
+
+	if (!(glyphFlags & CLEARCODEC_FLAG_GLYPH_HIT))
+	{
+		Stream_Write_UINT32(s, (UINT32)residualByteCount); /* residualByteCount (4 bytes) */
+		Stream_Write_UINT32(s, (UINT32)bandsByteCount);    /* bandsByteCount (4 bytes) */
+		Stream_Write_UINT32(s, (UINT32)subcodecByteCount); /* subcodecByteCount (4 bytes) */
+		Stream_Write(s, Stream_Buffer(clear->ResidualStream), residualByteCount);
+		Stream_Write(s, Stream_Buffer(clear->BandsStream), bandsByteCount);
+		Stream_Write(s, Stream_Buffer(clear->SubcodecStream), subcodecByteCount);
+	}
+
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32)Stream_GetPosition(s);
+	Stream_Free(s, FALSE);
 	return 1;
 }
 
@@ -1163,6 +1913,19 @@ CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
 	if (!clear_context_reset(clear))
 		goto error_nsc;
 
+	if (Compressor)
+	{
+		clear->CacheResetPending = TRUE;
+		clear->ResidualStream = Stream_New(NULL, 4096);
+		clear->BandsStream = Stream_New(NULL, 4096);
+		clear->SubcodecStream = Stream_New(NULL, 4096);
+		clear->TempStream = Stream_New(NULL, 4096);
+
+		if (!clear->ResidualStream || !clear->BandsStream || !clear->SubcodecStream ||
+		    !clear->TempStream)
+			goto error_nsc;
+	}
+
 	return clear;
 error_nsc:
 	clear_context_free(clear);
@@ -1180,5 +1943,11 @@ void clear_context_free(CLEAR_CONTEXT* clear)
 	clear_reset_vbar_storage(clear, TRUE);
 	clear_reset_glyph_cache(clear);
 
+	Stream_Free(clear->ResidualStream, TRUE);
+	Stream_Free(clear->BandsStream, TRUE);
+	Stream_Free(clear->SubcodecStream, TRUE);
+	Stream_Free(clear->TempStream, TRUE);
+	free(clear->RowCover);
+	free(clear->IndexBuffer);
 	free(clear);
 }
@@ -108,6 +108,16 @@ static INLINE void progressive_component_codec_quant_read(wStream* s,
 	quantVal->HH1 = b >> 4;
 }
 
+static INLINE void progressive_component_codec_quant_write(wStream* s,
+                                                           const RFX_COMPONENT_CODEC_QUANT* quantVal)
+{
+	Stream_Write_UINT8(s, (UINT8)(quantVal->LL3 + (quantVal->HL3 << 4)));
+	Stream_Write_UINT8(s, (UINT8)(quantVal->LH3 + (quantVal->HH3 << 4)));
+	Stream_Write_UINT8(s, (UINT8)(quantVal->HL2 + (quantVal->LH2 << 4)));
+	Stream_Write_UINT8(s, (UINT8)(quantVal->HH2 + (quantVal->HL1 << 4)));
+	Stream_Write_UINT8(s, (UINT8)(quantVal->LH1 + (quantVal->HH1 << 4)));
+}
+
 static INLINE void progressive_rfx_quant_ladd(RFX_COMPONENT_CODEC_QUANT* q, int val)
 {
 	q->HL1 += val; /* HL1 */
@@ -1813,7 +1823,6 @@ static INLINE int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive, wS
 				break;
 			}
 
-			SubmitThreadpoolWork(work_objects[index]);
 			close_cnt = index + 1;
 		}
 		else
@@ -1835,11 +1844,11 @@ static INLINE int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive, wS
 
 	if (progressive->rfx_context->priv->UseThreads)
 	{
+		winpr_SubmitThreadpoolWorkBatch(work_objects, close_cnt);
+		winpr_WaitForThreadpoolWorkBatchCallbacks(work_objects, close_cnt, FALSE);
+
 		for (index = 0; index < close_cnt; index++)
-		{
-			WaitForThreadpoolWorkCallbacks(work_objects[index], FALSE);
 			CloseThreadpoolWork(work_objects[index]);
-		}
 	}
 
 fail:
@@ -1868,7 +1877,8 @@ static INLINE BOOL progressive_write_wb_sync(PROGRESSIVE_CONTEXT* progressive, w
 	return TRUE;
 }
 
-static INLINE BOOL progressive_write_wb_context(PROGRESSIVE_CONTEXT* progressive, wStream* s)
+static INLINE BOOL progressive_write_wb_context(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                                BYTE flags)
 {
 	const UINT32 blockLen = 10;
 	WINPR_ASSERT(progressive);
@@ -1881,7 +1891,7 @@ static INLINE BOOL progressive_write_wb_context(PROGRESSIVE_CONTEXT* progressive
 	Stream_Write_UINT32(s, blockLen);                /* blockLen (4 bytes) */
 	Stream_Write_UINT8(s, 0);                        /* ctxId (1 byte) */
 	Stream_Write_UINT16(s, 64);                      /* tileSize (2 bytes) */
-	Stream_Write_UINT8(s, 0);                        /* flags (1 byte) */
+	Stream_Write_UINT8(s, flags);                    /* flags (1 byte) */
 	return TRUE;
 }
 
@@ -1952,19 +1962,18 @@ static INLINE BOOL progressive_write_region(PROGRESSIVE_CONTEXT* progressive, wS
 }
 
 static INLINE BOOL progressive_write_frame_begin(PROGRESSIVE_CONTEXT* progressive, wStream* s,
-                                                 const RFX_MESSAGE* msg)
+                                                 UINT32 frameIndex)
 {
 	const UINT32 blockLen = 12;
 	WINPR_ASSERT(progressive);
 	WINPR_ASSERT(s);
-	WINPR_ASSERT(msg);
 
 	if (!Stream_EnsureRemainingCapacity(s, blockLen))
 		return FALSE;
 
 	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_BEGIN); /* blockType (2 bytes) */
 	Stream_Write_UINT32(s, blockLen);                    /* blockLen (4 bytes) */
-	Stream_Write_UINT32(s, msg->frameIdx);               /* frameIndex (4 bytes) */
+	Stream_Write_UINT32(s, frameIndex);                  /* frameIndex (4 bytes) */
 	Stream_Write_UINT16(s, 1);                           /* regionCount (2 bytes) */
 
 	return TRUE;
@@ -2581,6 +2590,821 @@ fail:
 	return rc;
 }
 
+#define PROGRESSIVE_ENCODE_MAX_PASSES 3
+#define PROGRESSIVE_ENCODE_RLGR_SIZE 8192
+#define PROGRESSIVE_ENCODE_SRL_SIZE 16384
+#define PROGRESSIVE_ENCODE_RAW_SIZE 8192
+
+/**
+ * Progressive quantization of the coarse and intermediate passes, the last pass
+ * of a tile is always sent at full quality (0xFF).
+ * Band order: LL3, HL3, LH3, HH3, HL2, LH2, HH2, HL1, LH1, HH1
+ */
+static const RFX_PROGRESSIVE_CODEC_QUANT progressive_encode_quant_prog[] = {
+	{ 30,
+	  { 1, 2, 2, 2, 3, 3, 3, 4, 4, 4 },
+	  { 1, 2, 2, 2, 3, 3, 3, 4, 4, 4 },
+	  { 1, 2, 2, 2, 3, 3, 3, 4, 4, 4 } },
+	{ 60,
+	  { 0, 1, 1, 1, 1, 1, 1, 2, 2, 2 },
+	  { 0, 1, 1, 1, 1, 1, 1, 2, 2, 2 },
+	  { 0, 1, 1, 1, 1, 1, 1, 2, 2, 2 } }
+};
+
+static const RFX_COMPONENT_CODEC_QUANT progressive_encode_quant = { 6, 6, 6, 6, 7, 7, 8, 8, 8, 9 };
+
+/* Band offsets of the reduce-extrapolate layout: HL1, LH1, HH1, HL2, LH2, HH2, HL3, LH3, HH3, LL3 */
+static const UINT32 progressive_encode_band_offset[] = { 0,    1023, 2046, 3007, 3279, 3551,
+	                                                     3807, 3879, 3951, 4015, 4096 };
+
+static INLINE void progressive_encode_quant_bands(const RFX_COMPONENT_CODEC_QUANT* q, BYTE* bands)
+{
+	bands[0] = q->HL1;
+	bands[1] = q->LH1;
+	bands[2] = q->HH1;
+	bands[3] = q->HL2;
+	bands[4] = q->LH2;
+	bands[5] = q->HH2;
+	bands[6] = q->HL3;
+	bands[7] = q->LH3;
+	bands[8] = q->HH3;
+	bands[9] = q->LL3;
+}
+
+static INLINE INT16 progressive_rfx_clamp_16s(INT32 value)
+{
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	return (INT16)value;
+}
+
+/* Forward lifting step matching progressive_rfx_idwt_x / progressive_rfx_idwt_y */
+static INLINE void progressive_rfx_dwt_encode(const INT16* pSrc, size_t nSrcStep, INT16* pLowBand,
+                                              size_t nLowStep, INT16* pHighBand, size_t nHighStep,
+                                              size_t nLowCount, size_t nHighCount)
+{
+	size_t n;
+	INT32 x0, x1, x2;
+	INT32 h0, h1;
+
+	for (n = 0; n < nHighCount; n++)
+	{
+		x0 = pSrc[(2 * n) * nSrcStep];
+		x1 = pSrc[(2 * n + 1) * nSrcStep];
+		x2 = pSrc[(2 * n + 2) * nSrcStep];
+		pHighBand[n * nHighStep] = progressive_rfx_clamp_16s((x1 - ((x0 + x2) / 2)) / 2);
+	}
+
+	pLowBand[0] = progressive_rfx_clamp_16s(pSrc[0] + pHighBand[0]);
+
+	for (n = 1; n < nHighCount; n++)
+	{
+		h0 = pHighBand[(n - 1) * nHighStep];
+		h1 = pHighBand[n * nHighStep];
+		x0 = pSrc[(2 * n) * nSrcStep];
+		pLowBand[n * nLowStep] = progressive_rfx_clamp_16s(x0 + ((h0 + h1) / 2));
+	}
+
+	h0 = pHighBand[(nHighCount - 1) * nHighStep];
+	x0 = pSrc[(2 * nHighCount) * nSrcStep];
+
+	if (nLowCount > (nHighCount + 1))
+	{
+		x1 = pSrc[(2 * nHighCount + 1) * nSrcStep];
+		pLowBand[nHighCount * nLowStep] = progressive_rfx_clamp_16s(x0 + (h0 / 2));
+		pLowBand[(nHighCount + 1) * nLowStep] = progressive_rfx_clamp_16s((2 * x1) - x0);
+	}
+	else
+	{
+		pLowBand[nHighCount * nLowStep] = progressive_rfx_clamp_16s(x0 + h0);
+	}
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode_block(INT16* buffer, INT16* temp, size_t level)
+{
+	size_t i;
+	INT16 *HL, *LH;
+	INT16 *HH, *LL;
+	INT16 *X, *L, *H;
+
+	const size_t nBandL = progressive_rfx_get_band_l_count(level);
+	const size_t nBandH = progressive_rfx_get_band_h_count(level);
+	const size_t nCount = nBandL + nBandH;
+
+	HL = &buffer[0];
+	LH = &HL[nBandL * nBandH];
+	HH = &LH[nBandH * nBandL];
+	LL = &HH[nBandH * nBandH];
+	X = &temp[0];
+	L = &X[nCount * nCount];
+	H = &L[nBandL * nCount];
+
+	CopyMemory(X, buffer, nCount * nCount * sizeof(INT16));
+
+	/* vertical (X -> L + H) */
+	for (i = 0; i < nCount; i++)
+		progressive_rfx_dwt_encode(&X[i], nCount, &L[i], nCount, &H[i], nCount, nBandL, nBandH);
+
+	/* horizontal (L -> LL + HL) */
+	for (i = 0; i < nBandL; i++)
+		progressive_rfx_dwt_encode(&L[i * nCount], 1, &LL[i * nBandL], 1, &HL[i * nBandH], 1,
+		                           nBandL, nBandH);
+
+	/* horizontal (H -> LH + HH) */
+	for (i = 0; i < nBandH; i++)
+		progressive_rfx_dwt_encode(&H[i * nCount], 1, &LH[i * nBandL], 1, &HH[i * nBandH], 1,
+		                           nBandL, nBandH);
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode(INT16* buffer, INT16* temp)
+{
+	progressive_rfx_dwt_2d_encode_block(&buffer[0], temp, 1);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3007], temp, 2);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3807], temp, 3);
+}
+
+static INLINE void progressive_rfx_quantize(INT16* buffer, const RFX_COMPONENT_CODEC_QUANT* quant)
+{
+	size_t band;
+	size_t index;
+	BYTE bands[10];
+
+	progressive_encode_quant_bands(quant, bands);
+
+	/* The coefficients are scaled by << 5 at RGB->YCbCr phase, quantize and round once */
+	for (band = 0; band < ARRAYSIZE(bands); band++)
+	{
+		const UINT32 factor = bands[band] - 1;
+		const INT32 half = 1 << (factor - 1);
+
+		for (index = progressive_encode_band_offset[band];
+		     index < progressive_encode_band_offset[band + 1]; index++)
+			buffer[index] = progressive_rfx_clamp_16s((buffer[index] + half) >> factor);
+	}
+}
+
+static const RFX_PROGRESSIVE_CODEC_QUANT*
+progressive_encode_get_quant_prog(const PROGRESSIVE_CONTEXT* progressive, UINT32 pass,
+                                  BYTE* quality)
+{
+	const size_t index =
+	    ARRAYSIZE(progressive_encode_quant_prog) + 1 - progressive->numPasses + pass;
+
+	if (index >= ARRAYSIZE(progressive_encode_quant_prog))
+	{
+		*quality = 0xFF;
+		return &progressive->quantProgValFull;
+	}
+
+	*quality = (BYTE)index;
+	return &progressive_encode_quant_prog[index];
+}
+
+static void progressive_encode_tiles_free(PROGRESSIVE_CONTEXT* progressive)
+{
+	size_t index;
+	const size_t count = progressive->encodeGridWidth * progressive->encodeGridHeight;
+
+	if (progressive->encodeTiles)
+	{
+		for (index = 0; index < count; index++)
+		{
+			RFX_PROGRESSIVE_ENCODE_TILE* tile = &progressive->encodeTiles[index];
+			free(tile->data);
+			free(tile->coeffs);
+		}
+	}
+
+	free(progressive->encodeTiles);
+	progressive->encodeTiles = NULL;
+	progressive->encodeWidth = 0;
+	progressive->encodeHeight = 0;
+	progressive->encodeGridWidth = 0;
+	progressive->encodeGridHeight = 0;
+}
+
+static BOOL progressive_encode_tiles_resize(PROGRESSIVE_CONTEXT* progressive, UINT32 width,
+                                            UINT32 height)
+{
+	const UINT32 gridWidth = (width + 63) / 64;
+	const UINT32 gridHeight = (height + 63) / 64;
+
+	if (progressive->encodeTiles && (progressive->encodeWidth == width) &&
+	    (progressive->encodeHeight == height))
+		return TRUE;
+
+	progressive_encode_tiles_free(progressive);
+	progressive->encodeTiles = (RFX_PROGRESSIVE_ENCODE_TILE*)calloc(
+	    1ull * gridWidth * gridHeight, sizeof(RFX_PROGRESSIVE_ENCODE_TILE));
+	if (!progressive->encodeTiles)
+		return FALSE;
+
+	progressive->encodeWidth = width;
+	progressive->encodeHeight = height;
+	progressive->encodeGridWidth = gridWidth;
+	progressive->encodeGridHeight = gridHeight;
+	return TRUE;
+}
+
+/**
+ * Copy the source pixels of a tile, replicating the last row and column of
+ * partial tiles, and check whether they changed since the tile was last sent.
+ */
+static BOOL progressive_encode_tile_update(PROGRESSIVE_CONTEXT* progressive,
+                                           RFX_PROGRESSIVE_ENCODE_TILE* tile, const BYTE* pSrcData,
+                                           UINT32 SrcFormat, UINT32 ScanLine,
+                                           const RECTANGLE_16* rect, BOOL* changed)
+{
+	UINT32 x, y;
+	BOOL rc = FALSE;
+	const UINT32 step = 64 * 4;
+	const UINT32 width = rect->right - rect->left;
+	const UINT32 height = rect->bottom - rect->top;
+	BYTE* pixels = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!pixels)
+		return FALSE;
+
+	if (!freerdp_image_copy(pixels, PIXEL_FORMAT_BGRX32, step, 0, 0, width, height, pSrcData,
+	                        SrcFormat, ScanLine, rect->left, rect->top, NULL, FREERDP_FLIP_NONE))
+		goto fail;
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* line = &pixels[y * step];
+		for (x = width; x < 64; x++)
+			CopyMemory(&line[x * 4], &line[(width - 1) * 4], 4);
+	}
+
+	for (y = height; y < 64; y++)
+		CopyMemory(&pixels[y * step], &pixels[(height - 1) * step], step);
+
+	*changed = TRUE;
+	if (!tile->data)
+	{
+		tile->data = (BYTE*)malloc(64ull * step);
+		if (!tile->data)
+			goto fail;
+	}
+	else if ((tile->pass > 0) && (memcmp(tile->data, pixels, 64ull * step) == 0))
+		*changed = FALSE;
+
+	if (*changed)
+		CopyMemory(tile->data, pixels, 64ull * step);
+
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, pixels);
+	return rc;
+}
+
+static BOOL progressive_encode_tile_coefficients(PROGRESSIVE_CONTEXT* progressive,
+                                                 RFX_PROGRESSIVE_ENCODE_TILE* tile)
+{
+	size_t i;
+	BYTE* pBuffer;
+	INT16* temp;
+	INT16* pSrcDst[3];
+	const INT16* pSrc[3];
+	static const prim_size_t roi_64x64 = { 64, 64 };
+	const primitives_t* prims = primitives_get();
+
+	if (!tile->coeffs)
+	{
+		tile->coeffs = (INT16*)calloc(3 * 4096, sizeof(INT16));
+		if (!tile->coeffs)
+			return FALSE;
+	}
+
+	pBuffer = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	temp = (INT16*)BufferPool_Take(progressive->bufferPool, -1); /* DWT buffer */
+	if (!pBuffer || !temp)
+	{
+		BufferPool_Return(progressive->bufferPool, pBuffer);
+		BufferPool_Return(progressive->bufferPool, temp);
+		return FALSE;
+	}
+
+	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+
+	for (i = 0; i < 4096; i++)
+	{
+		const BYTE* pixel = &tile->data[i * 4];
+		pSrcDst[0][i] = pixel[2];
+		pSrcDst[1][i] = pixel[1];
+		pSrcDst[2][i] = pixel[0];
+	}
+
+	pSrc[0] = pSrcDst[0];
+	pSrc[1] = pSrcDst[1];
+	pSrc[2] = pSrcDst[2];
+	prims->RGBToYCbCr_16s16s_P3P3(pSrc, 64 * sizeof(INT16), pSrcDst, 64 * sizeof(INT16),
+	                              &roi_64x64);
+
+	for (i = 0; i < 3; i++)
+	{
+		progressive_rfx_dwt_2d_encode(pSrcDst[i], temp);
+		progressive_rfx_quantize(pSrcDst[i], &progressive_encode_quant);
+		CopyMemory(&tile->coeffs[i * 4096], pSrcDst[i], 4096 * sizeof(INT16));
+	}
+
+	BufferPool_Return(progressive->bufferPool, temp);
+	BufferPool_Return(progressive->bufferPool, pBuffer);
+	return TRUE;
+}
+
+static INLINE int progressive_encode_first_component(PROGRESSIVE_CONTEXT* progressive,
+                                                     const INT16* coeffs,
+                                                     const RFX_COMPONENT_CODEC_QUANT* progQuant,
+                                                     INT16* buffer, BYTE* pDstData, UINT32 DstSize)
+{
+	size_t band;
+	size_t index;
+	BYTE bands[10];
+
+	progressive_encode_quant_bands(progQuant, bands);
+
+	for (band = 0; band < 9; band++)
+	{
+		for (index = progressive_encode_band_offset[band];
+		     index < progressive_encode_band_offset[band + 1]; index++)
+		{
+			const INT32 value = coeffs[index];
+
+			if (value < 0)
+				buffer[index] = (INT16)(-((-value) >> bands[band]));
+			else
+				buffer[index] = (INT16)(value >> bands[band]);
+		}
+	}
+
+	/* LL3 is not sign-magnitude coded, upgrades carry the low bits as unsigned values */
+	for (index = progressive_encode_band_offset[9]; index < 4096; index++)
+		buffer[index] = (INT16)(coeffs[index] >> bands[9]);
+
+	rfx_differential_encode(&buffer[4015], 81);
+	ZeroMemory(pDstData, DstSize);
+	return progressive->rfx_context->rlgr_encode(RLGR1, buffer, 4096, pDstData, DstSize);
+}
+
+static BOOL progressive_encode_tile_first(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                          RFX_PROGRESSIVE_ENCODE_TILE* tile, UINT16 xIdx,
+                                          UINT16 yIdx)
+{
+	size_t i;
+	size_t start, end;
+	BYTE quality;
+	BOOL rc = FALSE;
+	UINT16 len[3] = { 0 };
+	INT16* buffer;
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg;
+
+	if (!progressive_encode_tile_coefficients(progressive, tile))
+		return FALSE;
+
+	quantProg = progressive_encode_get_quant_prog(progressive, 0, &quality);
+
+	if (!Stream_EnsureRemainingCapacity(s, 23 + 3ull * PROGRESSIVE_ENCODE_RLGR_SIZE))
+		return FALSE;
+
+	buffer = (INT16*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!buffer)
+		return FALSE;
+
+	start = Stream_GetPosition(s);
+	Stream_Seek(s, 23);
+
+	for (i = 0; i < 3; i++)
+	{
+		const RFX_COMPONENT_CODEC_QUANT* progQuant = (i == 0)   ? &quantProg->yQuantValues
+		                                             : (i == 1) ? &quantProg->cbQuantValues
+		                                                        : &quantProg->crQuantValues;
+		const int status = progressive_encode_first_component(
+		    progressive, &tile->coeffs[i * 4096], progQuant, buffer, Stream_Pointer(s),
+		    PROGRESSIVE_ENCODE_RLGR_SIZE);
+
+		if ((status <= 0) || (status >= PROGRESSIVE_ENCODE_RLGR_SIZE))
+		{
+			WLog_Print(progressive->log, WLOG_ERROR, "RLGR1 encoding failed [%d]", status);
+			goto fail;
+		}
+
+		len[i] = (UINT16)status;
+		Stream_Seek(s, len[i]);
+	}
+
+	end = Stream_GetPosition(s);
+	Stream_SetPosition(s, start);
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_FIRST); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(end - start));     /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, xIdx);                       /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, yIdx);                       /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* flags (1 byte) */
+	Stream_Write_UINT8(s, quality);                     /* quality (1 byte) */
+	Stream_Write_UINT16(s, len[0]);                     /* yLen (2 bytes) */
+	Stream_Write_UINT16(s, len[1]);                     /* cbLen (2 bytes) */
+	Stream_Write_UINT16(s, len[2]);                     /* crLen (2 bytes) */
+	Stream_Write_UINT16(s, 0);                          /* tailLen (2 bytes) */
+	Stream_SetPosition(s, end);
+
+	tile->pass = 1;
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, buffer);
+	return rc;
+}
+
+static INLINE void progressive_rfx_srl_write(RFX_PROGRESSIVE_UPGRADE_STATE* state, INT16 value,
+                                             UINT32 numBits)
+{
+	UINT32 mag;
+	UINT32 max;
+	const UINT32 k = state->kp / 8;
+	wBitStream* bs = state->srl;
+
+	if (value == 0)
+	{
+		/* zero encoding, a '0' bit is a full run of (1 << k) zeros */
+		state->nz++;
+
+		if (state->nz == (1 << k))
+		{
+			BitStream_Write_Bits(bs, 0, 1);
+			state->kp += 4;
+
+			if (state->kp > 80)
+				state->kp = 80;
+
+			state->nz = 0;
+		}
+
+		return;
+	}
+
+	/* '1' bit followed by the length of the pending run in k bits */
+	BitStream_Write_Bits(bs, 1, 1);
+
+	if (k)
+		BitStream_Write_Bits(bs, (UINT32)state->nz, k);
+
+	state->nz = 0;
+
+	/* unary encoding */
+	BitStream_Write_Bits(bs, (value < 0) ? 1 : 0, 1);
+
+	if (state->kp < 6)
+		state->kp = 0;
+	else
+		state->kp -= 6;
+
+	if (numBits == 1)
+		return;
+
+	mag = (UINT32)((value < 0) ? -value : value);
+	max = (1 << numBits) - 1;
+
+	for (; mag > 1; mag--)
+		BitStream_Write_Bits(bs, 0, 1);
+
+	if ((UINT32)((value < 0) ? -value : value) < max)
+		BitStream_Write_Bits(bs, 1, 1);
+}
+
+static INLINE void progressive_rfx_upgrade_block_encode(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+                                                        const INT16* coeffs, UINT32 length,
+                                                        UINT32 prevProg, UINT32 prog)
+{
+	UINT32 index;
+	UINT32 mask;
+	const UINT32 numBits = prevProg - prog;
+
+	if (!numBits)
+		return;
+
+	mask = (1 << numBits) - 1;
+
+	if (!state->nonLL)
+	{
+		for (index = 0; index < length; index++)
+			BitStream_Write_Bits(state->raw, (UINT32)(coeffs[index] >> prog) & mask, numBits);
+
+		return;
+	}
+
+	for (index = 0; index < length; index++)
+	{
+		const INT32 value = coeffs[index];
+		const UINT32 mag = (UINT32)((value < 0) ? -value : value);
+
+		if ((mag >> prevProg) != 0)
+		{
+			/* sign already known to the decoder, send the raw magnitude bits */
+			BitStream_Write_Bits(state->raw, (mag >> prog) & mask, numBits);
+		}
+		else
+		{
+			const INT16 input = (INT16)(mag >> prog);
+			progressive_rfx_srl_write(state, (value < 0) ? -input : input, numBits);
+		}
+	}
+}
+
+static BOOL progressive_encode_upgrade_component(const INT16* coeffs,
+                                                 const RFX_COMPONENT_CODEC_QUANT* prevQuant,
+                                                 const RFX_COMPONENT_CODEC_QUANT* progQuant,
+                                                 BYTE* srlData, UINT16* srlLen, BYTE* rawData,
+                                                 UINT16* rawLen)
+{
+	size_t band;
+	size_t aSrlLen, aRawLen;
+	BYTE prevBands[10];
+	BYTE bands[10];
+	wBitStream s_srl = { 0 };
+	wBitStream s_raw = { 0 };
+	RFX_PROGRESSIVE_UPGRADE_STATE state = { 0 };
+
+	progressive_encode_quant_bands(prevQuant, prevBands);
+	progressive_encode_quant_bands(progQuant, bands);
+
+	state.kp = 8;
+	state.srl = &s_srl;
+	state.raw = &s_raw;
+	BitStream_Attach(state.srl, srlData, PROGRESSIVE_ENCODE_SRL_SIZE);
+	BitStream_Attach(state.raw, rawData, PROGRESSIVE_ENCODE_RAW_SIZE);
+
+	for (band = 0; band < ARRAYSIZE(bands); band++)
+	{
+		const UINT32 offset = progressive_encode_band_offset[band];
+		const UINT32 length = progressive_encode_band_offset[band + 1] - offset;
+
+		state.nonLL = (band < 9);
+		progressive_rfx_upgrade_block_encode(&state, &coeffs[offset], length, prevBands[band],
+		                                     bands[band]);
+	}
+
+	/* terminate a pending zero run, the decoder only consumes what it needs */
+	if (state.nz > 0)
+		BitStream_Write_Bits(state.srl, 0, 1);
+
+	BitStream_Flush(state.srl);
+	BitStream_Flush(state.raw);
+	aSrlLen = (state.srl->position + 7) / 8;
+	aRawLen = (state.raw->position + 7) / 8;
+
+	if ((aSrlLen > PROGRESSIVE_ENCODE_SRL_SIZE) || (aRawLen > PROGRESSIVE_ENCODE_RAW_SIZE))
+		return FALSE;
+
+	*srlLen = (UINT16)aSrlLen;
+	*rawLen = (UINT16)aRawLen;
+	return TRUE;
+}
+
+static BOOL progressive_encode_tile_upgrade(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                            RFX_PROGRESSIVE_ENCODE_TILE* tile, UINT16 xIdx,
+                                            UINT16 yIdx)
+{
+	size_t i;
+	UINT32 blockLen = 26;
+	BYTE quality, prevQuality;
+	UINT16 srlLen[3] = { 0 };
+	UINT16 rawLen[3] = { 0 };
+	BYTE* srlData[3];
+	BYTE* rawData[3];
+	const RFX_PROGRESSIVE_CODEC_QUANT* prevQuantProg;
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg;
+
+	WINPR_ASSERT(tile->coeffs);
+	prevQuantProg = progressive_encode_get_quant_prog(progressive, tile->pass - 1, &prevQuality);
+	quantProg = progressive_encode_get_quant_prog(progressive, tile->pass, &quality);
+
+	for (i = 0; i < 3; i++)
+	{
+		const RFX_COMPONENT_CODEC_QUANT* prevQuant = (i == 0)   ? &prevQuantProg->yQuantValues
+		                                             : (i == 1) ? &prevQuantProg->cbQuantValues
+		                                                        : &prevQuantProg->crQuantValues;
+		const RFX_COMPONENT_CODEC_QUANT* progQuant = (i == 0)   ? &quantProg->yQuantValues
+		                                             : (i == 1) ? &quantProg->cbQuantValues
+		                                                        : &quantProg->crQuantValues;
+
+		srlData[i] = &progressive->srl[i * PROGRESSIVE_ENCODE_SRL_SIZE];
+		rawData[i] = &progressive->raw[i * PROGRESSIVE_ENCODE_RAW_SIZE];
+
+		if (!progressive_encode_upgrade_component(&tile->coeffs[i * 4096], prevQuant, progQuant,
+		                                          srlData[i], &srlLen[i], rawData[i],
+		                                          &rawLen[i]))
+		{
+			WLog_Print(progressive->log, WLOG_ERROR, "SRL/RAW encoding failed");
+			return FALSE;
+		}
+
+		blockLen += srlLen[i] + rawLen[i];
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, blockLen))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_UPGRADE); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, blockLen);                     /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, xIdx);                         /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, yIdx);                         /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, quality);                       /* quality (1 byte) */
+	Stream_Write_UINT16(s, srlLen[0]);                    /* ySrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[0]);                    /* yRawLen (2 bytes) */
+	Stream_Write_UINT16(s, srlLen[1]);                    /* cbSrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[1]);                    /* cbRawLen (2 bytes) */
+	Stream_Write_UINT16(s, srlLen[2]);                    /* crSrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[2]);                    /* crRawLen (2 bytes) */
+
+	for (i = 0; i < 3; i++)
+	{
+		Stream_Write(s, srlData[i], srlLen[i]);
+		Stream_Write(s, rawData[i], rawLen[i]);
+	}
+
+	tile->pass++;
+
+	/* Full quality reached, the coefficients are no longer needed */
+	if (tile->pass >= progressive->numPasses)
+	{
+		free(tile->coeffs);
+		tile->coeffs = NULL;
+	}
+
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_region_progressive(PROGRESSIVE_CONTEXT* progressive,
+                                                        wStream* s, const REGION16* region,
+                                                        UINT16 numTiles, wStream* tiles)
+{
+	/* RFX_PROGRESSIVE_REGION */
+	UINT32 i;
+	UINT32 numRects;
+	UINT32 blockLen = 18;
+	const RECTANGLE_16* rects;
+	const BYTE numProgQuant = ARRAYSIZE(progressive_encode_quant_prog);
+	const size_t tilesDataSize = Stream_GetPosition(tiles);
+
+	WINPR_ASSERT(progressive);
+	WINPR_ASSERT(s);
+	WINPR_ASSERT(region);
+
+	rects = region16_rects(region, &numRects);
+	if ((numRects == 0) || (numRects > UINT16_MAX) || (tilesDataSize > UINT32_MAX / 2))
+		return FALSE;
+
+	blockLen += numRects * 8;
+	blockLen += 5;
+	blockLen += numProgQuant * 16;
+	blockLen += (UINT32)tilesDataSize;
+
+	if (!Stream_EnsureRemainingCapacity(s, blockLen))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_REGION);    /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, blockLen);                  /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 64);                         /* tileSize (1 byte) */
+	Stream_Write_UINT16(s, (UINT16)numRects);          /* numRects (2 bytes) */
+	Stream_Write_UINT8(s, 1);                          /* numQuant (1 byte) */
+	Stream_Write_UINT8(s, numProgQuant);               /* numProgQuant (1 byte) */
+	Stream_Write_UINT8(s, RFX_DWT_REDUCE_EXTRAPOLATE); /* flags (1 byte) */
+	Stream_Write_UINT16(s, numTiles);                  /* numTiles (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)tilesDataSize);     /* tilesDataSize (4 bytes) */
+
+	for (i = 0; i < numRects; i++)
+	{
+		/* TS_RFX_RECT */
+		Stream_Write_UINT16(s, rects[i].left);                  /* x (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].top);                   /* y (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].right - rects[i].left); /* width (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].bottom - rects[i].top); /* height (2 bytes) */
+	}
+
+	/* RFX_COMPONENT_CODEC_QUANT */
+	progressive_component_codec_quant_write(s, &progressive_encode_quant);
+
+	for (i = 0; i < numProgQuant; i++)
+	{
+		/* RFX_PROGRESSIVE_CODEC_QUANT */
+		const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = &progressive_encode_quant_prog[i];
+		Stream_Write_UINT8(s, quantProgVal->quality); /* quality (1 byte) */
+		progressive_component_codec_quant_write(s, &quantProgVal->yQuantValues);
+		progressive_component_codec_quant_write(s, &quantProgVal->cbQuantValues);
+		progressive_component_codec_quant_write(s, &quantProgVal->crQuantValues);
+	}
+
+	Stream_Write(s, Stream_Buffer(tiles), tilesDataSize);
+	return TRUE;
+}
+
+/**
+ * Encode a frame with quality passes: tiles whose content changed are sent as
+ * RFX_PROGRESSIVE_TILE_FIRST at coarse quality, tiles that stayed static since
+ * are refined with one RFX_PROGRESSIVE_TILE_UPGRADE per call until they reach
+ * full quality.
+ */
+static int progressive_compress_passes(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
+                                       UINT32 SrcFormat, UINT32 Width, UINT32 Height,
+                                       UINT32 ScanLine, const REGION16* invalidRegion,
+                                       BYTE** ppDstData, UINT32* pDstSize)
+{
+	int res = -6;
+	UINT32 x, y;
+	UINT16 numTiles = 0;
+	REGION16 updateRegion;
+	wStream* s = progressive->buffer;
+	wStream* tiles = progressive->tiles;
+
+	if ((Width > UINT16_MAX) || (Height > UINT16_MAX) ||
+	    (((Width + 63) / 64) * ((Height + 63) / 64) > UINT16_MAX))
+		return -3;
+
+	if (!progressive_encode_tiles_resize(progressive, Width, Height))
+		return -5;
+
+	region16_init(&updateRegion);
+	Stream_SetPosition(tiles, 0);
+
+	for (y = 0; y < progressive->encodeGridHeight; y++)
+	{
+		for (x = 0; x < progressive->encodeGridWidth; x++)
+		{
+			BOOL rc;
+			BOOL changed = FALSE;
+			RECTANGLE_16 rect;
+			RFX_PROGRESSIVE_ENCODE_TILE* tile =
+			    &progressive->encodeTiles[y * progressive->encodeGridWidth + x];
+
+			rect.left = (UINT16)(x * 64);
+			rect.top = (UINT16)(y * 64);
+			rect.right = (UINT16)MIN(x * 64 + 64, Width);
+			rect.bottom = (UINT16)MIN(y * 64 + 64, Height);
+
+			if (!invalidRegion || region16_intersects_rect(invalidRegion, &rect))
+			{
+				if (!progressive_encode_tile_update(progressive, tile, pSrcData, SrcFormat,
+				                                    ScanLine, &rect, &changed))
+					goto fail;
+			}
+
+			if (changed)
+				rc = progressive_encode_tile_first(progressive, tiles, tile, (UINT16)x, (UINT16)y);
+			else if ((tile->pass > 0) && (tile->pass < progressive->numPasses))
+				rc = progressive_encode_tile_upgrade(progressive, tiles, tile, (UINT16)x,
+				                                     (UINT16)y);
+			else
+				continue;
+
+			if (!rc)
+				goto fail;
+
+			numTiles++;
+			if (!region16_union_rect(&updateRegion, &updateRegion, &rect))
+				goto fail;
+		}
+	}
+
+	if (numTiles == 0)
+	{
+		res = 0;
+		goto fail;
+	}
+
+	Stream_SetPosition(s, 0);
+
+	if (!progressive_write_wb_sync(progressive, s))
+		goto fail;
+
+	if (!progressive_write_wb_context(progressive, s, RFX_SUBBAND_DIFFING))
+		goto fail;
+
+	if (!progressive_write_frame_begin(progressive, s, progressive->frameIndex++))
+		goto fail;
+
+	if (!progressive_write_region_progressive(progressive, s, &updateRegion, numTiles, tiles))
+		goto fail;
+
+	if (!progressive_write_frame_end(progressive, s))
+		goto fail;
+
+	*pDstSize = Stream_GetPosition(s);
+	*ppDstData = Stream_Buffer(s);
+	res = 1;
+fail:
+	region16_uninit(&updateRegion);
+	return res;
+}
+
 static BOOL progressive_rfx_write_message_progressive_simple(PROGRESSIVE_CONTEXT* progressive,
                                                              wStream* s, const RFX_MESSAGE* msg)
 {
@@ -2601,10 +3425,10 @@ static BOOL progressive_rfx_write_message_progressive_simple(PROGRESSIVE_CONTEXT
 	if (!progressive_write_wb_sync(progressive, s))
 		return FALSE;
 
-	if (!progressive_write_wb_context(progressive, s))
+	if (!progressive_write_wb_context(progressive, s, 0))
 		return FALSE;
 
-	if (!progressive_write_frame_begin(progressive, s, msg))
+	if (!progressive_write_frame_begin(progressive, s, msg->frameIdx))
 		return FALSE;
 
 	if (!progressive_write_region(progressive, s, msg))
@@ -2662,6 +3486,10 @@ int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
 	if (SrcSize < Height * ScanLine)
 		return -4;
 
+	if (progressive->numPasses > 1)
+		return progressive_compress_passes(progressive, pSrcData, SrcFormat, Width, Height,
+		                                   ScanLine, invalidRegion, ppDstData, pDstSize);
+
 	if (!invalidRegion)
 	{
 		numRects = (Width + 63) / 64;
@@ -2750,6 +3578,102 @@ BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
 	if (!progressive)
 		return FALSE;
 
+	progressive_encode_tiles_free(progressive);
+	return TRUE;
+}
+
+BOOL progressive_context_set_quality_passes(PROGRESSIVE_CONTEXT* progressive, UINT32 passes)
+{
+	if (!progressive || !progressive->Compressor)
+		return FALSE;
+
+	if ((passes < 1) || (passes > PROGRESSIVE_ENCODE_MAX_PASSES))
+		return FALSE;
+
+	if ((passes > 1) && !progressive->tiles)
+	{
+		progressive->tiles = Stream_New(NULL, 1024);
+		progressive->srl = (BYTE*)calloc(3, PROGRESSIVE_ENCODE_SRL_SIZE);
+		progressive->raw = (BYTE*)calloc(3, PROGRESSIVE_ENCODE_RAW_SIZE);
+
+		if (!progressive->tiles || !progressive->srl || !progressive->raw)
+		{
+			Stream_Free(progressive->tiles, TRUE);
+			free(progressive->srl);
+			free(progressive->raw);
+			progressive->tiles = NULL;
+			progressive->srl = NULL;
+			progressive->raw = NULL;
+			return FALSE;
+		}
+	}
+
+	if (progressive->numPasses != passes)
+		progressive_encode_tiles_free(progressive);
+
+	progressive->numPasses = passes;
+	return TRUE;
+}
+
+BOOL progressive_context_has_pending_upgrades(PROGRESSIVE_CONTEXT* progressive)
+{
+	size_t index;
+	size_t count;
+
+	if (!progressive || !progressive->encodeTiles)
+		return FALSE;
+
+	count = progressive->encodeGridWidth * progressive->encodeGridHeight;
+	for (index = 0; index < count; index++)
+	{
+		const RFX_PROGRESSIVE_ENCODE_TILE* tile = &progressive->encodeTiles[index];
+
+		if ((tile->pass > 0) && (tile->pass < progressive->numPasses))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL progressive_context_invalidate_region(PROGRESSIVE_CONTEXT* progressive,
+                                           const REGION16* region, REGION16* pending)
+{
+	UINT32 x, y;
+
+	if (!progressive || !region)
+		return FALSE;
+
+	if (!progressive->encodeTiles)
+		return TRUE;
+
+	for (y = 0; y < progressive->encodeGridHeight; y++)
+	{
+		for (x = 0; x < progressive->encodeGridWidth; x++)
+		{
+			RECTANGLE_16 rect;
+			RFX_PROGRESSIVE_ENCODE_TILE* tile =
+			    &progressive->encodeTiles[y * progressive->encodeGridWidth + x];
+
+			if (tile->pass == 0)
+				continue;
+
+			rect.left = (UINT16)(x * 64);
+			rect.top = (UINT16)(y * 64);
+			rect.right = (UINT16)MIN(x * 64 + 64, progressive->encodeWidth);
+			rect.bottom = (UINT16)MIN(y * 64 + 64, progressive->encodeHeight);
+
+			if (!region16_intersects_rect(region, &rect))
+				continue;
+
+			/* The client never got the final quality of this tile, encode it again */
+			if (pending && (tile->pass < progressive->numPasses) &&
+			    !region16_union_rect(pending, pending, &rect))
+				return FALSE;
+
+			tile->pass = 0;
+		}
+	}
+
 	return TRUE;
 }
 
@@ -2761,6 +3685,7 @@ PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
 		return NULL;
 
 	progressive->Compressor = Compressor;
+	progressive->numPasses = 1;
 	progressive->quantProgValFull.quality = 100;
 	progressive->log = WLog_Get(TAG);
 	if (!progressive->log)
@@ -2801,6 +3726,11 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 	Stream_Free(progressive->rects, TRUE);
 	rfx_context_free(progressive->rfx_context);
 
+	progressive_encode_tiles_free(progressive);
+	Stream_Free(progressive->tiles, TRUE);
+	free(progressive->srl);
+	free(progressive->raw);
+
 	BufferPool_Free(progressive->bufferPool);
 	HashTable_Free(progressive->SurfaceContexts);
 
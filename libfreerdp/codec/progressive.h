@@ -197,6 +197,13 @@ typedef struct
 	UINT32* updatedTileIndices;
 } PROGRESSIVE_SURFACE_CONTEXT;
 
+typedef struct
+{
+	UINT16 pass;
+	BYTE* data;
+	INT16* coeffs;
+} RFX_PROGRESSIVE_ENCODE_TILE;
+
 typedef enum
 {
 	FLAG_WBT_SYNC = 0x01,
@@ -224,6 +231,17 @@ struct S_PROGRESSIVE_CONTEXT
 	wStream* buffer;
 	wStream* rects;
 	RFX_CONTEXT* rfx_context;
+
+	UINT32 numPasses;
+	UINT32 frameIndex;
+	UINT32 encodeWidth;
+	UINT32 encodeHeight;
+	UINT32 encodeGridWidth;
+	UINT32 encodeGridHeight;
+	RFX_PROGRESSIVE_ENCODE_TILE* encodeTiles;
+	wStream* tiles;
+	BYTE* srl;
+	BYTE* raw;
 };
 
 #endif /* INTERNAL_CODEC_PROGRESSIVE_H */
@@ -29,6 +29,7 @@
 #include <winpr/crt.h>
 #include <winpr/tchar.h>
 #include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 #include <winpr/registry.h>
 #include <winpr/tchar.h>
 
@@ -49,6 +50,7 @@
 #include "rfx_rlgr.h"
 
 #include "rfx_sse2.h"
+#include "rfx_avx2.h"
 #include "rfx_neon.h"
 
 #define TAG FREERDP_TAG("codec")
@@ -347,6 +349,9 @@ RFX_CONTEXT* rfx_context_new_ex(BOOL encoder, UINT32 ThreadingFlags)
 	context->rlgr_decode = rfx_rlgr_decode;
 	context->rlgr_encode = rfx_rlgr_encode;
 	RFX_INIT_SIMD(context);
+#ifdef WITH_AVX2
+	rfx_init_avx2(context);
+#endif
 	context->state = RFX_STATE_SEND_HEADERS;
 	context->expectedDataBlockType = WBT_FRAME_BEGIN;
 	return context;
@@ -381,8 +386,6 @@ void rfx_context_free(RFX_CONTEXT* context)
 			if (priv->ThreadPool)
 				CloseThreadpool(priv->ThreadPool);
 			DestroyThreadpoolEnvironment(&priv->ThreadPoolEnv);
-			free(priv->workObjects);
-			free(priv->tileWorkParams);
 #ifdef WITH_PROFILER
 			WLog_VRB(
 			    TAG,
@@ -391,6 +394,7 @@ void rfx_context_free(RFX_CONTEXT* context)
 		}
 
 		BufferPool_Free(priv->BufferPool);
+		winpr_aligned_free(priv->EncodeScratch);
 		free(priv);
 	}
 	free(context);
@@ -417,6 +421,25 @@ void rfx_context_set_pixel_format(RFX_CONTEXT* context, UINT32 pixel_format)
 	context->bits_per_pixel = FreeRDPGetBitsPerPixel(pixel_format);
 }
 
+BOOL rfx_context_set_quantization(RFX_CONTEXT* context, const UINT32* quantVals, UINT32 numQuant)
+{
+	void* pmem;
+
+	if (!context || !quantVals || (numQuant < 1) || (numQuant > UINT8_MAX))
+		return FALSE;
+
+	if (!(pmem = realloc((void*)context->quants, numQuant * 10 * sizeof(UINT32))))
+		return FALSE;
+
+	context->quants = (UINT32*)pmem;
+	CopyMemory(context->quants, quantVals, numQuant * 10 * sizeof(UINT32));
+	context->numQuant = (BYTE)numQuant;
+	context->quantIdxY = 0;
+	context->quantIdxCb = 0;
+	context->quantIdxCr = 0;
+	return TRUE;
+}
+
 BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height)
 {
 	if (!context)
@@ -966,7 +989,6 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* messa
 					break;
 				}
 
-				SubmitThreadpoolWork(work_objects[i]);
 				close_cnt = i + 1;
 			}
 			else
@@ -978,11 +1000,12 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* messa
 
 	if (context->priv->UseThreads)
 	{
+		/* submit all tiles at once to wake the workers with a single signal */
+		winpr_SubmitThreadpoolWorkBatch(work_objects, close_cnt);
+		winpr_WaitForThreadpoolWorkBatchCallbacks(work_objects, close_cnt, FALSE);
+
 		for (i = 0; i < close_cnt; i++)
-		{
-			WaitForThreadpoolWorkCallbacks(work_objects[i], FALSE);
 			CloseThreadpoolWork(work_objects[i]);
-		}
 	}
 
 	free(work_objects);
@@ -1227,6 +1250,35 @@ UINT16 rfx_message_get_rect_count(RFX_MESSAGE* message)
 	return message->numRects;
 }
 
+struct S_RFX_ENCODE_WORK
+{
+	RFX_CONTEXT* context;
+	RFX_MESSAGE* message;
+	PTP_WORK work;
+	BYTE* scratch; /* RFX_ENCODE_SCRATCH_SIZE for every submitted callback */
+	LONG nextScratch;
+	LONG nextTile;
+	LONG failed;
+};
+
+/* returns FALSE if a tile of the message failed to encode */
+static BOOL rfx_encode_message_wait(RFX_MESSAGE* message)
+{
+	BOOL rc;
+	RFX_ENCODE_WORK* encodeWork = message->encodeWork;
+
+	if (!encodeWork)
+		return TRUE;
+
+	WaitForThreadpoolWorkCallbacks(encodeWork->work, FALSE);
+	rc = (encodeWork->failed == 0);
+	CloseThreadpoolWork(encodeWork->work);
+	winpr_aligned_free(encodeWork->scratch);
+	free(encodeWork);
+	message->encodeWork = NULL;
+	return rc;
+}
+
 void rfx_message_free(RFX_CONTEXT* context, RFX_MESSAGE* message)
 {
 	int i;
@@ -1234,6 +1286,8 @@ void rfx_message_free(RFX_CONTEXT* context, RFX_MESSAGE* message)
 
 	if (message)
 	{
+		rfx_encode_message_wait(message);
+
 		if ((message->rects) && (message->freeRects))
 		{
 			free(message->rects);
@@ -1363,17 +1417,21 @@ static BOOL rfx_write_tile(RFX_CONTEXT* context, wStream* s, RFX_TILE* tile)
 	return TRUE;
 }
 
-struct S_RFX_TILE_COMPOSE_WORK_PARAM
-{
-	RFX_TILE* tile;
-	RFX_CONTEXT* context;
-};
-
 static void CALLBACK rfx_compose_message_tile_work_callback(PTP_CALLBACK_INSTANCE instance,
                                                             void* context, PTP_WORK work)
 {
-	RFX_TILE_COMPOSE_WORK_PARAM* param = (RFX_TILE_COMPOSE_WORK_PARAM*)context;
-	rfx_encode_rgb(param->context, param->tile);
+	LONG index;
+	RFX_ENCODE_WORK* param = (RFX_ENCODE_WORK*)context;
+	RFX_MESSAGE* message = param->message;
+	const LONG slot = InterlockedIncrement(&param->nextScratch) - 1;
+	BYTE* scratch = &param->scratch[1ull * slot * RFX_ENCODE_SCRATCH_SIZE];
+
+	/* every callback keeps taking tiles until the message is done */
+	while ((index = InterlockedIncrement(&param->nextTile) - 1) < message->numTiles)
+	{
+		if (!rfx_encode_rgb(param->context, message->tiles[index], scratch))
+			InterlockedExchange(&param->failed, 1);
+	}
 }
 
 static BOOL computeRegion(const RFX_RECT* rects, int numRects, REGION16* region, int width,
@@ -1400,29 +1458,89 @@ static BOOL computeRegion(const RFX_RECT* rects, int numRects, REGION16* region,
 
 #define TILE_NO(v) ((v) / 64)
 
-static BOOL setupWorkers(RFX_CONTEXT* context, int nbTiles)
+static BOOL rfx_encode_message_submit(RFX_CONTEXT* context, RFX_MESSAGE* message)
 {
-	RFX_CONTEXT_PRIV* priv = context->priv;
-	void* pmem;
+	UINT32 index;
+	UINT32 count = context->priv->MinThreadCount;
+	RFX_ENCODE_WORK* encodeWork;
 
-	if (!context->priv->UseThreads)
-		return TRUE;
+	if (!(encodeWork = (RFX_ENCODE_WORK*)calloc(1, sizeof(RFX_ENCODE_WORK))))
+		return FALSE;
+
+	encodeWork->context = context;
+	encodeWork->message = message;
 
-	if (!(pmem = realloc((void*)priv->workObjects, sizeof(PTP_WORK) * nbTiles)))
+	if ((count == 0) || (count > message->numTiles))
+		count = message->numTiles;
+
+	/* one scratch buffer per callback, reused for all the tiles it encodes */
+	if (!(encodeWork->scratch =
+	          (BYTE*)winpr_aligned_malloc(1ull * count * RFX_ENCODE_SCRATCH_SIZE, 16)))
+	{
+		free(encodeWork);
 		return FALSE;
+	}
+
+	if (!(encodeWork->work = CreateThreadpoolWork(rfx_compose_message_tile_work_callback,
+	                                              (void*)encodeWork,
+	                                              &context->priv->ThreadPoolEnv)))
+	{
+		winpr_aligned_free(encodeWork->scratch);
+		free(encodeWork);
+		return FALSE;
+	}
 
-	priv->workObjects = (PTP_WORK*)pmem;
+	message->encodeWork = encodeWork;
+
+	for (index = 0; index < count; index++)
+		SubmitThreadpoolWork(encodeWork->work);
+
+	return TRUE;
+}
+
+BOOL rfx_encode_message_end(RFX_CONTEXT* context, RFX_MESSAGE* message)
+{
+	UINT32 i;
 
-	if (!(pmem =
-	          realloc((void*)priv->tileWorkParams, sizeof(RFX_TILE_COMPOSE_WORK_PARAM) * nbTiles)))
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(message);
+
+	if (!rfx_encode_message_wait(message))
+	{
+		WLog_ERR(TAG, "%s: failed to encode tiles", __FUNCTION__);
 		return FALSE;
+	}
+
+	message->tilesDataSize = 0;
+
+	for (i = 0; i < message->numTiles; i++)
+		message->tilesDataSize += rfx_tile_length(message->tiles[i]);
 
-	priv->tileWorkParams = (RFX_TILE_COMPOSE_WORK_PARAM*)pmem;
 	return TRUE;
 }
 
 RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, size_t numRects,
-                                const BYTE* data, UINT32 w, UINT32 h, size_t s)
+                                const BYTE* data, UINT32 width, UINT32 height, size_t scanline)
+{
+	RFX_MESSAGE* message;
+
+	if (!(message = rfx_encode_message_begin(context, rects, numRects, data, width, height,
+	                                         scanline)))
+		return NULL;
+
+	if (!rfx_encode_message_end(context, message))
+	{
+		message->freeRects = TRUE;
+		rfx_message_free(context, message);
+		return NULL;
+	}
+
+	return message;
+}
+
+RFX_MESSAGE* rfx_encode_message_begin(RFX_CONTEXT* context, const RFX_RECT* rects,
+                                      size_t numRects, const BYTE* data, UINT32 w, UINT32 h,
+                                      size_t s)
 {
 	const UINT32 width = (UINT32)w;
 	const UINT32 height = (UINT32)h;
@@ -1433,8 +1551,6 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 	RFX_TILE* tile;
 	RFX_RECT* rfxRect;
 	RFX_MESSAGE* message = NULL;
-	PTP_WORK* workObject = NULL;
-	RFX_TILE_COMPOSE_WORK_PARAM* workParam = NULL;
 	BOOL success = FALSE;
 	REGION16 rectsRegion, tilesRegion;
 	RECTANGLE_16 currentTileRect;
@@ -1488,15 +1604,12 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 	if (!(message->tiles = calloc(maxNbTiles, sizeof(RFX_TILE*))))
 		goto skip_encoding_loop;
 
-	if (!setupWorkers(context, maxNbTiles))
+	/* the tiles encoded on this thread all share one scratch buffer */
+	if (!context->priv->UseThreads && !context->priv->EncodeScratch &&
+	    !(context->priv->EncodeScratch =
+	          (BYTE*)winpr_aligned_malloc(RFX_ENCODE_SCRATCH_SIZE, 16)))
 		goto skip_encoding_loop;
 
-	if (context->priv->UseThreads)
-	{
-		workObject = context->priv->workObjects;
-		workParam = context->priv->tileWorkParams;
-	}
-
 	regionRect = region16_rects(&rectsRegion, &regionNbRects);
 
 	if (!(message->rects = calloc(regionNbRects, sizeof(RFX_RECT))))
@@ -1582,26 +1695,9 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 				message->tiles[message->numTiles] = tile;
 				message->numTiles++;
 
-				if (context->priv->UseThreads)
-				{
-					workParam->context = context;
-					workParam->tile = tile;
-
-					if (!(*workObject = CreateThreadpoolWork(rfx_compose_message_tile_work_callback,
-					                                         (void*)workParam,
-					                                         &context->priv->ThreadPoolEnv)))
-					{
-						goto skip_encoding_loop;
-					}
-
-					SubmitThreadpoolWork(*workObject);
-					workObject++;
-					workParam++;
-				}
-				else
-				{
-					rfx_encode_rgb(context, tile);
-				}
+				if (!context->priv->UseThreads &&
+				    !rfx_encode_rgb(context, tile, context->priv->EncodeScratch))
+					goto skip_encoding_loop;
 
 				if (!region16_union_rect(&tilesRegion, &tilesRegion, &currentTileRect))
 					goto skip_encoding_loop;
@@ -1627,30 +1723,12 @@ skip_encoding_loop:
 			success = FALSE;
 	}
 
-	/* when using threads ensure all computations are done */
+	/* the tiles are encoded in the background until rfx_encode_message_end */
+	if (success && context->priv->UseThreads)
+		success = rfx_encode_message_submit(context, message);
+
 	if (success)
 	{
-		message->tilesDataSize = 0;
-		workObject = context->priv->workObjects;
-
-		for (i = 0; i < message->numTiles; i++)
-		{
-			tile = message->tiles[i];
-
-			if (context->priv->UseThreads)
-			{
-				if (*workObject)
-				{
-					WaitForThreadpoolWorkCallbacks(*workObject, FALSE);
-					CloseThreadpoolWork(*workObject);
-				}
-
-				workObject++;
-			}
-
-			message->tilesDataSize += rfx_tile_length(tile);
-		}
-
 		region16_uninit(&tilesRegion);
 		region16_uninit(&rectsRegion);
 
@@ -1843,7 +1921,7 @@ static BOOL rfx_write_message_frame_end(RFX_CONTEXT* context, wStream* s,
 	return TRUE;
 }
 
-BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* message)
+BOOL rfx_write_message_header(RFX_CONTEXT* context, wStream* s)
 {
 	if (context->state == RFX_STATE_SEND_HEADERS)
 	{
@@ -1853,6 +1931,11 @@ BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* mess
 		context->state = RFX_STATE_SEND_FRAME_DATA;
 	}
 
+	return TRUE;
+}
+
+BOOL rfx_write_message_frame(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* message)
+{
 	if (!rfx_write_message_frame_begin(context, s, message) ||
 	    !rfx_write_message_region(context, s, message) ||
 	    !rfx_write_message_tileset(context, s, message) ||
@@ -1864,6 +1947,11 @@ BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* mess
 	return TRUE;
 }
 
+BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* message)
+{
+	return rfx_write_message_header(context, s) && rfx_write_message_frame(context, s, message);
+}
+
 BOOL rfx_compose_message(RFX_CONTEXT* context, wStream* s, const RFX_RECT* rects, size_t numRects,
                          const BYTE* data, UINT32 width, UINT32 height, UINT32 scanline)
 {
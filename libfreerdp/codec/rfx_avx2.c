@@ -0,0 +1,401 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RemoteFX Codec Library - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+
+#include <immintrin.h>
+
+#include "rfx_types.h"
+#include "rfx_avx2.h"
+
+/*
+ * The routines below produce the same results as the SSE2 versions in rfx_sse2.c, all
+ * arithmetic is done on 16 bit lanes. Buffers are only guaranteed to be 16 byte aligned,
+ * so unaligned loads and stores are used throughout.
+ *
+ * The horizontal DWT passes work on 16 coefficients at a time. For sub-bands 16 or 32 wide
+ * these are consecutive coefficients of one row, for the 8 wide sub-band each 128 bit lane
+ * holds one row and two rows are processed at once.
+ */
+
+#define LOAD(_p) _mm256_loadu_si256((const __m256i*)(_p))
+#define STORE(_p, _v) _mm256_storeu_si256((__m256i*)(_p), (_v))
+
+static INLINE void rfx_quantization_decode_block_avx2(INT16* buffer, const int buffer_size,
+                                                      const UINT32 factor)
+{
+	int i;
+	const __m128i count = _mm_cvtsi32_si128((int)factor);
+
+	if (factor == 0)
+		return;
+
+	for (i = 0; i < buffer_size; i += 16)
+		STORE(&buffer[i], _mm256_sll_epi16(LOAD(&buffer[i]), count));
+}
+
+static void rfx_quantization_decode_avx2(INT16* buffer, const UINT32* quantVals)
+{
+	rfx_quantization_decode_block_avx2(&buffer[0], 1024, quantVals[8] - 1);    /* HL1 */
+	rfx_quantization_decode_block_avx2(&buffer[1024], 1024, quantVals[7] - 1); /* LH1 */
+	rfx_quantization_decode_block_avx2(&buffer[2048], 1024, quantVals[9] - 1); /* HH1 */
+	rfx_quantization_decode_block_avx2(&buffer[3072], 256, quantVals[5] - 1);  /* HL2 */
+	rfx_quantization_decode_block_avx2(&buffer[3328], 256, quantVals[4] - 1);  /* LH2 */
+	rfx_quantization_decode_block_avx2(&buffer[3584], 256, quantVals[6] - 1);  /* HH2 */
+	rfx_quantization_decode_block_avx2(&buffer[3840], 64, quantVals[2] - 1);   /* HL3 */
+	rfx_quantization_decode_block_avx2(&buffer[3904], 64, quantVals[1] - 1);   /* LH3 */
+	rfx_quantization_decode_block_avx2(&buffer[3968], 64, quantVals[3] - 1);   /* HH3 */
+	rfx_quantization_decode_block_avx2(&buffer[4032], 64, quantVals[0] - 1);   /* LL3 */
+}
+
+static INLINE void rfx_quantization_encode_block_avx2(INT16* buffer, const int buffer_size,
+                                                      const UINT32 factor)
+{
+	int i;
+	__m256i half;
+	const __m128i count = _mm_cvtsi32_si128((int)factor);
+
+	if (factor == 0)
+		return;
+
+	half = _mm256_set1_epi16((INT16)(1 << (factor - 1)));
+
+	for (i = 0; i < buffer_size; i += 16)
+	{
+		__m256i a = LOAD(&buffer[i]);
+		a = _mm256_add_epi16(a, half);
+		a = _mm256_sra_epi16(a, count);
+		STORE(&buffer[i], a);
+	}
+}
+
+static void rfx_quantization_encode_avx2(INT16* buffer, const UINT32* quantization_values)
+{
+	rfx_quantization_encode_block_avx2(buffer, 1024, quantization_values[8] - 6);        /* HL1 */
+	rfx_quantization_encode_block_avx2(buffer + 1024, 1024, quantization_values[7] - 6); /* LH1 */
+	rfx_quantization_encode_block_avx2(buffer + 2048, 1024, quantization_values[9] - 6); /* HH1 */
+	rfx_quantization_encode_block_avx2(buffer + 3072, 256, quantization_values[5] - 6);  /* HL2 */
+	rfx_quantization_encode_block_avx2(buffer + 3328, 256, quantization_values[4] - 6);  /* LH2 */
+	rfx_quantization_encode_block_avx2(buffer + 3584, 256, quantization_values[6] - 6);  /* HH2 */
+	rfx_quantization_encode_block_avx2(buffer + 3840, 64, quantization_values[2] - 6);   /* HL3 */
+	rfx_quantization_encode_block_avx2(buffer + 3904, 64, quantization_values[1] - 6);   /* LH3 */
+	rfx_quantization_encode_block_avx2(buffer + 3968, 64, quantization_values[3] - 6);   /* HH3 */
+	rfx_quantization_encode_block_avx2(buffer + 4032, 64, quantization_values[0] - 6);   /* LL3 */
+	rfx_quantization_encode_block_avx2(buffer, 4096, 5);
+}
+
+/* Split 32 consecutive coefficients into the 16 even and the 16 odd ones */
+static INLINE void rfx_dwt_deinterleave_avx2(const INT16* src, __m256i* even, __m256i* odd)
+{
+	const __m256i mask = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15, 0,
+	                                      1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+	__m256i a = _mm256_shuffle_epi8(LOAD(src), mask);
+	__m256i b = _mm256_shuffle_epi8(LOAD(src + 16), mask);
+	a = _mm256_permute4x64_epi64(a, 0xD8);
+	b = _mm256_permute4x64_epi64(b, 0xD8);
+	*even = _mm256_permute2x128_si256(a, b, 0x20);
+	*odd = _mm256_permute2x128_si256(a, b, 0x31);
+}
+
+/* Merge 16 even and 16 odd coefficients into 32 consecutive ones */
+static INLINE void rfx_dwt_interleave_avx2(INT16* dst, __m256i even, __m256i odd)
+{
+	const __m256i lo = _mm256_unpacklo_epi16(even, odd);
+	const __m256i hi = _mm256_unpackhi_epi16(even, odd);
+	STORE(dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+	STORE(dst + 16, _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+/* v[i + 1] for a row of 16, next is the value following the row */
+static INLINE __m256i rfx_dwt_next_avx2(__m256i v, INT16 next)
+{
+	const __m256i t = _mm256_permute2x128_si256(v, _mm256_set1_epi16(next), 0x21);
+	return _mm256_alignr_epi8(t, v, 2);
+}
+
+/* v[i - 1] for a row of 16, prev holds the value preceding the row in its last element */
+static INLINE __m256i rfx_dwt_prev_avx2(__m256i v, __m256i prev)
+{
+	const __m256i t = _mm256_permute2x128_si256(v, prev, 0x03);
+	return _mm256_alignr_epi8(v, t, 14);
+}
+
+/* v[i + 1] for two rows of 8, the last element of each row is mirrored */
+static INLINE __m256i rfx_dwt_next8_avx2(__m256i v)
+{
+	const __m256i mask = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 14, 15, 2,
+	                                      3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 14, 15);
+	return _mm256_shuffle_epi8(v, mask);
+}
+
+/* v[i - 1] for two rows of 8, the first element of each row is mirrored */
+static INLINE __m256i rfx_dwt_prev8_avx2(__m256i v)
+{
+	const __m256i mask = _mm256_setr_epi8(0, 1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1,
+	                                      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13);
+	return _mm256_shuffle_epi8(v, mask);
+}
+
+static INLINE __m256i rfx_dwt_first_avx2(__m256i v)
+{
+	return _mm256_broadcastw_epi16(_mm256_castsi256_si128(v));
+}
+
+static INLINE void rfx_dwt_2d_decode_block_horiz_avx2(const INT16* l, const INT16* h, INT16* dst,
+                                                      int subband_width)
+{
+	int y, n;
+	const __m256i one = _mm256_set1_epi16(1);
+
+	for (y = 0; y < subband_width; y++)
+	{
+		__m256i h_prev = _mm256_setzero_si256();
+
+		for (n = 0; n < subband_width; n += 16)
+		{
+			__m256i h_n_m, dst_n, dst_n_p, tmp_n;
+			const __m256i l_n = LOAD(l);
+			const __m256i h_n = LOAD(h);
+
+			if (subband_width == 8)
+				h_n_m = rfx_dwt_prev8_avx2(h_n);
+			else
+				h_n_m = rfx_dwt_prev_avx2(h_n, (n == 0) ? rfx_dwt_first_avx2(h_n) : h_prev);
+
+			/* dst[2n] = l[n] - ((h[n-1] + h[n] + 1) >> 1); */
+			tmp_n = _mm256_add_epi16(_mm256_add_epi16(h_n_m, h_n), one);
+			dst_n = _mm256_sub_epi16(l_n, _mm256_srai_epi16(tmp_n, 1));
+
+			if (subband_width == 8)
+				dst_n_p = rfx_dwt_next8_avx2(dst_n);
+			else if (n + 16 < subband_width)
+			{
+				/* dst[2n + 2] of the next 16 coefficients */
+				const INT16 sum = (INT16)(h[15] + h[16] + 1);
+				dst_n_p = rfx_dwt_next_avx2(dst_n, (INT16)(l[16] - (sum >> 1)));
+			}
+			else
+				dst_n_p = rfx_dwt_next_avx2(dst_n, (INT16)_mm256_extract_epi16(dst_n, 15));
+
+			/* dst[2n + 1] = (h[n] << 1) + ((dst[2n] + dst[2n + 2]) >> 1); */
+			tmp_n = _mm256_srai_epi16(_mm256_add_epi16(dst_n, dst_n_p), 1);
+			tmp_n = _mm256_add_epi16(tmp_n, _mm256_slli_epi16(h_n, 1));
+			rfx_dwt_interleave_avx2(dst, dst_n, tmp_n);
+			h_prev = h_n;
+			l += 16;
+			h += 16;
+			dst += 32;
+		}
+
+		/* two rows were done at once */
+		if (subband_width == 8)
+			y++;
+	}
+}
+
+static INLINE void rfx_dwt_2d_decode_block_vert_avx2(const INT16* l, const INT16* h, INT16* dst,
+                                                     int subband_width)
+{
+	int x, n;
+	const int total_width = subband_width + subband_width;
+	const __m256i one = _mm256_set1_epi16(1);
+
+	/* Even coefficients */
+	for (n = 0; n < subband_width; n++)
+	{
+		INT16* dst_ptr = &dst[2 * n * total_width];
+		const INT16* l_ptr = &l[n * total_width];
+		const INT16* h_ptr = &h[n * total_width];
+
+		for (x = 0; x < total_width; x += 16)
+		{
+			/* dst[2n] = l[n] - ((h[n-1] + h[n] + 1) >> 1); */
+			const __m256i h_n = LOAD(&h_ptr[x]);
+			const __m256i h_n_m = (n == 0) ? h_n : LOAD(&h_ptr[x - total_width]);
+			__m256i tmp_n = _mm256_add_epi16(_mm256_add_epi16(h_n_m, h_n), one);
+			tmp_n = _mm256_sub_epi16(LOAD(&l_ptr[x]), _mm256_srai_epi16(tmp_n, 1));
+			STORE(&dst_ptr[x], tmp_n);
+		}
+	}
+
+	/* Odd coefficients */
+	for (n = 0; n < subband_width; n++)
+	{
+		INT16* dst_ptr = &dst[(2 * n + 1) * total_width];
+		const INT16* h_ptr = &h[n * total_width];
+
+		for (x = 0; x < total_width; x += 16)
+		{
+			/* dst[2n + 1] = (h[n] << 1) + ((dst[2n] + dst[2n + 2]) >> 1); */
+			const __m256i dst_n_m = LOAD(&dst_ptr[x - total_width]);
+			const __m256i dst_n_p =
+			    (n == subband_width - 1) ? dst_n_m : LOAD(&dst_ptr[x + total_width]);
+			__m256i tmp_n = _mm256_srai_epi16(_mm256_add_epi16(dst_n_m, dst_n_p), 1);
+			tmp_n = _mm256_add_epi16(tmp_n, _mm256_slli_epi16(LOAD(&h_ptr[x]), 1));
+			STORE(&dst_ptr[x], tmp_n);
+		}
+	}
+}
+
+static INLINE void rfx_dwt_2d_decode_block_avx2(INT16* buffer, INT16* idwt, int subband_width)
+{
+	INT16 *hl, *lh, *hh, *ll;
+	INT16 *l_dst, *h_dst;
+	/* Inverse DWT in horizontal direction, results in 2 sub-bands in L, H order in tmp buffer idwt.
+	 */
+	/* The 4 sub-bands are stored in HL(0), LH(1), HH(2), LL(3) order. */
+	/* The lower part L uses LL(3) and HL(0). */
+	/* The higher part H uses LH(1) and HH(2). */
+	ll = buffer + subband_width * subband_width * 3;
+	hl = buffer;
+	l_dst = idwt;
+	rfx_dwt_2d_decode_block_horiz_avx2(ll, hl, l_dst, subband_width);
+	lh = buffer + subband_width * subband_width;
+	hh = buffer + subband_width * subband_width * 2;
+	h_dst = idwt + subband_width * subband_width * 2;
+	rfx_dwt_2d_decode_block_horiz_avx2(lh, hh, h_dst, subband_width);
+	/* Inverse DWT in vertical direction, results are stored in original buffer. */
+	rfx_dwt_2d_decode_block_vert_avx2(l_dst, h_dst, buffer, subband_width);
+}
+
+static void rfx_dwt_2d_decode_avx2(INT16* buffer, INT16* dwt_buffer)
+{
+	rfx_dwt_2d_decode_block_avx2(&buffer[3840], dwt_buffer, 8);
+	rfx_dwt_2d_decode_block_avx2(&buffer[3072], dwt_buffer, 16);
+	rfx_dwt_2d_decode_block_avx2(&buffer[0], dwt_buffer, 32);
+}
+
+static INLINE void rfx_dwt_2d_encode_block_vert_avx2(const INT16* src, INT16* l, INT16* h,
+                                                     int subband_width)
+{
+	int x, n;
+	const int total_width = subband_width << 1;
+
+	for (n = 0; n < subband_width; n++)
+	{
+		const INT16* src_ptr = &src[2 * n * total_width];
+		INT16* l_ptr = &l[n * total_width];
+		INT16* h_ptr = &h[n * total_width];
+
+		for (x = 0; x < total_width; x += 16)
+		{
+			__m256i h_n, h_n_m, l_n;
+			const __m256i src_2n = LOAD(&src_ptr[x]);
+			const __m256i src_2n_1 = LOAD(&src_ptr[x + total_width]);
+			const __m256i src_2n_2 =
+			    (n < subband_width - 1) ? LOAD(&src_ptr[x + 2 * total_width]) : src_2n;
+
+			/* h[n] = (src[2n + 1] - ((src[2n] + src[2n + 2]) >> 1)) >> 1 */
+			h_n = _mm256_srai_epi16(_mm256_add_epi16(src_2n, src_2n_2), 1);
+			h_n = _mm256_srai_epi16(_mm256_sub_epi16(src_2n_1, h_n), 1);
+			STORE(&h_ptr[x], h_n);
+
+			/* l[n] = src[2n] + ((h[n - 1] + h[n]) >> 1) */
+			h_n_m = (n == 0) ? h_n : LOAD(&h_ptr[x - total_width]);
+			l_n = _mm256_srai_epi16(_mm256_add_epi16(h_n_m, h_n), 1);
+			STORE(&l_ptr[x], _mm256_add_epi16(l_n, src_2n));
+		}
+	}
+}
+
+static INLINE void rfx_dwt_2d_encode_block_horiz_avx2(const INT16* src, INT16* l, INT16* h,
+                                                      int subband_width)
+{
+	int y, n;
+
+	for (y = 0; y < subband_width; y++)
+	{
+		__m256i h_prev = _mm256_setzero_si256();
+
+		for (n = 0; n < subband_width; n += 16)
+		{
+			__m256i src_2n, src_2n_1, src_2n_2, h_n, h_n_m, l_n;
+			rfx_dwt_deinterleave_avx2(src, &src_2n, &src_2n_1);
+
+			if (subband_width == 8)
+				src_2n_2 = rfx_dwt_next8_avx2(src_2n);
+			else
+				src_2n_2 = rfx_dwt_next_avx2(src_2n, (n + 16 < subband_width) ? src[32] : src[30]);
+
+			/* h[n] = (src[2n + 1] - ((src[2n] + src[2n + 2]) >> 1)) >> 1 */
+			h_n = _mm256_srai_epi16(_mm256_add_epi16(src_2n, src_2n_2), 1);
+			h_n = _mm256_srai_epi16(_mm256_sub_epi16(src_2n_1, h_n), 1);
+			STORE(h, h_n);
+
+			if (subband_width == 8)
+				h_n_m = rfx_dwt_prev8_avx2(h_n);
+			else
+				h_n_m = rfx_dwt_prev_avx2(h_n, (n == 0) ? rfx_dwt_first_avx2(h_n) : h_prev);
+
+			/* l[n] = src[2n] + ((h[n - 1] + h[n]) >> 1) */
+			l_n = _mm256_srai_epi16(_mm256_add_epi16(h_n_m, h_n), 1);
+			STORE(l, _mm256_add_epi16(l_n, src_2n));
+			h_prev = h_n;
+			src += 32;
+			l += 16;
+			h += 16;
+		}
+
+		/* two rows were done at once */
+		if (subband_width == 8)
+			y++;
+	}
+}
+
+static INLINE void rfx_dwt_2d_encode_block_avx2(INT16* buffer, INT16* dwt, int subband_width)
+{
+	INT16 *hl, *lh, *hh, *ll;
+	INT16 *l_src, *h_src;
+	/* DWT in vertical direction, results in 2 sub-bands in L, H order in tmp buffer dwt. */
+	l_src = dwt;
+	h_src = dwt + subband_width * subband_width * 2;
+	rfx_dwt_2d_encode_block_vert_avx2(buffer, l_src, h_src, subband_width);
+	/* DWT in horizontal direction, results in 4 sub-bands in HL(0), LH(1), HH(2), LL(3) order,
+	 * stored in original buffer. */
+	/* The lower part L generates LL(3) and HL(0). */
+	/* The higher part H generates LH(1) and HH(2). */
+	ll = buffer + subband_width * subband_width * 3;
+	hl = buffer;
+	lh = buffer + subband_width * subband_width;
+	hh = buffer + subband_width * subband_width * 2;
+	rfx_dwt_2d_encode_block_horiz_avx2(l_src, ll, hl, subband_width);
+	rfx_dwt_2d_encode_block_horiz_avx2(h_src, lh, hh, subband_width);
+}
+
+static void rfx_dwt_2d_encode_avx2(INT16* buffer, INT16* dwt_buffer)
+{
+	rfx_dwt_2d_encode_block_avx2(buffer, dwt_buffer, 32);
+	rfx_dwt_2d_encode_block_avx2(buffer + 3072, dwt_buffer, 16);
+	rfx_dwt_2d_encode_block_avx2(buffer + 3840, dwt_buffer, 8);
+}
+
+void rfx_init_avx2(RFX_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return;
+
+	PROFILER_RENAME(context->priv->prof_rfx_quantization_decode, "rfx_quantization_decode_avx2")
+	PROFILER_RENAME(context->priv->prof_rfx_quantization_encode, "rfx_quantization_encode_avx2")
+	PROFILER_RENAME(context->priv->prof_rfx_dwt_2d_decode, "rfx_dwt_2d_decode_avx2")
+	PROFILER_RENAME(context->priv->prof_rfx_dwt_2d_encode, "rfx_dwt_2d_encode_avx2")
+	context->quantization_decode = rfx_quantization_decode_avx2;
+	context->quantization_encode = rfx_quantization_encode_avx2;
+	context->dwt_2d_decode = rfx_dwt_2d_decode_avx2;
+	context->dwt_2d_encode = rfx_dwt_2d_encode_avx2;
+}
@@ -230,11 +230,10 @@ static void rfx_encode_format_rgb(const BYTE* rgb_data, int width, int height, i
 
 /* rfx_encode_rgb_to_ycbcr code now resides in the primitives library. */
 
-static void rfx_encode_component(RFX_CONTEXT* context, const UINT32* quantization_values,
-                                 INT16* data, BYTE* buffer, int buffer_size, int* size)
+static BOOL rfx_encode_component(RFX_CONTEXT* context, const UINT32* quantization_values,
+                                 INT16* data, INT16* dwt_buffer, BYTE* buffer, int buffer_size,
+                                 int* size)
 {
-	INT16* dwt_buffer;
-	dwt_buffer = BufferPool_Take(context->priv->BufferPool, -1); /* dwt_buffer */
 	PROFILER_ENTER(context->priv->prof_rfx_encode_component)
 	PROFILER_ENTER(context->priv->prof_rfx_dwt_2d_encode)
 	context->dwt_2d_encode(data, dwt_buffer);
@@ -249,33 +248,37 @@ static void rfx_encode_component(RFX_CONTEXT* context, const UINT32* quantizatio
 	*size = context->rlgr_encode(context->mode, data, 4096, buffer, buffer_size);
 	PROFILER_EXIT(context->priv->prof_rfx_rlgr_encode)
 	PROFILER_EXIT(context->priv->prof_rfx_encode_component)
-	BufferPool_Return(context->priv->BufferPool, dwt_buffer);
+
+	/* the encoder truncates its output to the buffer, a full buffer means it overflowed */
+	return (*size > 0) && (*size < buffer_size);
 }
 
-void rfx_encode_rgb(RFX_CONTEXT* context, RFX_TILE* tile)
+/* scratch holds RFX_ENCODE_SCRATCH_SIZE bytes, it is reused for every tile of a worker */
+BOOL rfx_encode_rgb(RFX_CONTEXT* context, RFX_TILE* tile, BYTE* scratch)
 {
 	union
 	{
 		const INT16** cpv;
 		INT16** pv;
 	} cnv;
-	BYTE* pBuffer;
+	BOOL rc = FALSE;
 	INT16* pSrcDst[3];
+	INT16* dwt_buffer;
 	int YLen, CbLen, CrLen;
 	UINT32 *YQuant, *CbQuant, *CrQuant;
 	primitives_t* prims = primitives_get();
 	static const prim_size_t roi_64x64 = { 64, 64 };
 
-	if (!(pBuffer = (BYTE*)BufferPool_Take(context->priv->BufferPool, -1)))
-		return;
+	WINPR_ASSERT(scratch);
 
 	YLen = CbLen = CrLen = 0;
 	YQuant = context->quants + (tile->quantIdxY * 10);
 	CbQuant = context->quants + (tile->quantIdxCb * 10);
 	CrQuant = context->quants + (tile->quantIdxCr * 10);
-	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* y_r_buffer */
-	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* cb_g_buffer */
-	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* cr_b_buffer */
+	pSrcDst[0] = (INT16*)((BYTE*)(&scratch[((8192 + 32) * 0) + 16])); /* y_r_buffer */
+	pSrcDst[1] = (INT16*)((BYTE*)(&scratch[((8192 + 32) * 1) + 16])); /* cb_g_buffer */
+	pSrcDst[2] = (INT16*)((BYTE*)(&scratch[((8192 + 32) * 2) + 16])); /* cr_b_buffer */
+	dwt_buffer = (INT16*)((BYTE*)(&scratch[((8192 + 32) * 3) + 16]));
 	PROFILER_ENTER(context->priv->prof_rfx_encode_rgb)
 	PROFILER_ENTER(context->priv->prof_rfx_encode_format_rgb)
 	rfx_encode_format_rgb(tile->data, tile->width, tile->height, tile->scanline,
@@ -288,19 +291,20 @@ void rfx_encode_rgb(RFX_CONTEXT* context, RFX_TILE* tile)
 	prims->RGBToYCbCr_16s16s_P3P3(cnv.cpv, 64 * sizeof(INT16), pSrcDst, 64 * sizeof(INT16),
 	                              &roi_64x64);
 	PROFILER_EXIT(context->priv->prof_rfx_rgb_to_ycbcr)
-	/**
-	 * We need to clear the buffers as the RLGR encoder expects it to be initialized to zero.
-	 * This allows simplifying and improving the performance of the encoding process.
-	 */
-	ZeroMemory(tile->YData, 4096);
-	ZeroMemory(tile->CbData, 4096);
-	ZeroMemory(tile->CrData, 4096);
-	rfx_encode_component(context, YQuant, pSrcDst[0], tile->YData, 4096, &YLen);
-	rfx_encode_component(context, CbQuant, pSrcDst[1], tile->CbData, 4096, &CbLen);
-	rfx_encode_component(context, CrQuant, pSrcDst[2], tile->CrData, 4096, &CrLen);
+
+	if (!rfx_encode_component(context, YQuant, pSrcDst[0], dwt_buffer, tile->YData, 4096,
+	                          &YLen) ||
+	    !rfx_encode_component(context, CbQuant, pSrcDst[1], dwt_buffer, tile->CbData, 4096,
+	                          &CbLen) ||
+	    !rfx_encode_component(context, CrQuant, pSrcDst[2], dwt_buffer, tile->CrData, 4096,
+	                          &CrLen))
+		goto fail;
+
 	tile->YLen = (UINT16)YLen;
 	tile->CbLen = (UINT16)CbLen;
 	tile->CrLen = (UINT16)CrLen;
+	rc = TRUE;
+fail:
 	PROFILER_EXIT(context->priv->prof_rfx_encode_rgb)
-	BufferPool_Return(context->priv->BufferPool, pBuffer);
+	return rc;
 }
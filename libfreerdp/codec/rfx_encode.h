@@ -23,6 +23,9 @@
 #include <freerdp/codec/rfx.h>
 #include <freerdp/api.h>
 
-FREERDP_LOCAL void rfx_encode_rgb(RFX_CONTEXT* context, RFX_TILE* tile);
+/* y_r, cb_g, cr_b and dwt buffers of a tile, 16 byte aligned like the buffer pool ones */
+#define RFX_ENCODE_SCRATCH_SIZE ((8192 + 32) * 4)
+
+FREERDP_LOCAL BOOL rfx_encode_rgb(RFX_CONTEXT* context, RFX_TILE* tile, BYTE* scratch);
 
 #endif /* FREERDP_LIB_CODEC_RFX_ENCODE_H */
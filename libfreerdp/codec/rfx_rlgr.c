@@ -34,8 +34,6 @@
 #include <winpr/bitstream.h>
 #include <winpr/intrin.h>
 
-#include "rfx_bitstream.h"
-
 #include "rfx_rlgr.h"
 
 /* Constants used in RLGR1/RLGR3 algorithm */
@@ -46,19 +44,6 @@
 #define UQ_GR (3)  /* increase in kp after nonzero symbol in GR mode */
 #define DQ_GR (3)  /* decrease in kp after zero symbol in GR mode */
 
-/* Returns the least number of bits required to represent a given value */
-#define GetMinBits(_val, _nbits) \
-	do                           \
-	{                            \
-		UINT32 _v = _val;        \
-		_nbits = 0;              \
-		while (_v)               \
-		{                        \
-			_v >>= 1;            \
-			_nbits++;            \
-		}                        \
-	} while (0)
-
 /*
  * Update the passed parameter and clamp it to the range [0, KPMAX]
  * Return the value of parameter right-shifted by LSGR
@@ -556,56 +541,114 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 	return 1;
 }
 
-/* Returns the next coefficient (a signed int) to encode, from the input stream */
-#define GetNextInput(_n)   \
-	do                     \
-	{                      \
-		if (data_size > 0) \
-		{                  \
-			_n = *data++;  \
-			data_size--;   \
-		}                  \
-		else               \
-		{                  \
-			_n = 0;        \
-		}                  \
-	} while (0)
+/* Output bit writer, bits are collected MSB first in an accumulator and stored as whole bytes */
+typedef struct
+{
+	BYTE* buffer;
+	UINT32 size;
+	UINT32 pos;
+	UINT32 bits;
+	UINT64 acc;
+} RFX_RLGR_WRITER;
+
+static INLINE void rfx_rlgr_store_bytes(RFX_RLGR_WRITER* bw)
+{
+	if ((bw->bits >= 32) && (bw->pos <= bw->size) && (bw->size - bw->pos >= 4))
+	{
+		const UINT32 v = (UINT32)(bw->acc >> (bw->bits - 32));
+		BYTE* dst = &bw->buffer[bw->pos];
+		dst[0] = (BYTE)(v >> 24);
+		dst[1] = (BYTE)(v >> 16);
+		dst[2] = (BYTE)(v >> 8);
+		dst[3] = (BYTE)v;
+		bw->pos += 4;
+		bw->bits -= 32;
+	}
 
-/* Emit bitPattern to the output bitstream */
-#define OutputBits(numBits, bitPattern) rfx_bitstream_put_bits(bs, bitPattern, numBits)
-
-/* Emit a bit (0 or 1), count number of times, to the output bitstream */
-#define OutputBit(count, bit)                                    \
-	do                                                           \
-	{                                                            \
-		UINT16 _b = (bit ? 0xFFFF : 0);                          \
-		int _c = (count);                                        \
-		for (; _c > 0; _c -= 16)                                 \
-			rfx_bitstream_put_bits(bs, _b, (_c > 16 ? 16 : _c)); \
-	} while (0)
+	while (bw->bits >= 8)
+	{
+		bw->bits -= 8;
+
+		/* bits exceeding the buffer are dropped, the result is truncated to its size */
+		if (bw->pos < bw->size)
+			bw->buffer[bw->pos] = (BYTE)(bw->acc >> bw->bits);
+
+		bw->pos++;
+	}
+}
+
+/* Emit the lower nbits (at most 32) of bits, the caller guarantees no higher bits are set */
+static INLINE void rfx_rlgr_put_bits(RFX_RLGR_WRITER* bw, UINT32 bits, UINT32 nbits)
+{
+	bw->acc = (bw->acc << nbits) | bits;
+	bw->bits += nbits;
+
+	if (bw->bits >= 32)
+		rfx_rlgr_store_bytes(bw);
+}
+
+/* Emit count one bits followed by a zero bit */
+static INLINE void rfx_rlgr_put_unary(RFX_RLGR_WRITER* bw, UINT32 count)
+{
+	while (count >= 31)
+	{
+		rfx_rlgr_put_bits(bw, 0x7FFFFFFF, 31);
+		count -= 31;
+	}
+
+	rfx_rlgr_put_bits(bw, ((1u << count) - 1u) << 1, count + 1);
+}
+
+static INLINE int rfx_rlgr_flush(RFX_RLGR_WRITER* bw)
+{
+	if (bw->bits % 8)
+		rfx_rlgr_put_bits(bw, 0, 8 - (bw->bits % 8));
+
+	rfx_rlgr_store_bytes(bw);
+	return (int)MIN(bw->pos, bw->size);
+}
+
+/* Returns the length of the zero run starting at data, the run ends at the first nonzero
+ * coefficient or at the last one */
+static INLINE UINT32 rfx_rlgr_zero_run(const INT16* data, UINT32 data_size)
+{
+	UINT32 n = 0;
+
+	/* test 4 coefficients at once */
+	while (n + 4 < data_size)
+	{
+		UINT64 v;
+		memcpy(&v, &data[n], sizeof(v));
+
+		if (v)
+			break;
+
+		n += 4;
+	}
+
+	while ((n + 1 < data_size) && (data[n] == 0))
+		n++;
+
+	return n;
+}
 
 /* Converts the input value to (2 * abs(input) - sign(input)), where sign(input) = (input < 0 ? 1 :
  * 0) and returns it */
 #define Get2MagSign(input) ((input) >= 0 ? 2 * (input) : -2 * (input)-1)
 
 /* Outputs the Golomb/Rice encoding of a non-negative integer */
-#define CodeGR(krp, val) rfx_rlgr_code_gr(bs, krp, val)
-
-static void rfx_rlgr_code_gr(RFX_BITSTREAM* bs, int* krp, UINT32 val)
+static INLINE void rfx_rlgr_code_gr(RFX_RLGR_WRITER* bw, int* krp, UINT32 val)
 {
 	int kr = *krp >> LSGR;
 
 	/* unary part of GR code */
 
 	UINT32 vk = (val) >> kr;
-	OutputBit(vk, 1);
-	OutputBit(1, 0);
+	rfx_rlgr_put_unary(bw, vk);
 
 	/* remainder part of GR code, if needed */
 	if (kr)
-	{
-		OutputBits(kr, val & ((1 << kr) - 1));
-	}
+		rfx_rlgr_put_bits(bw, val & ((1u << kr) - 1), (UINT32)kr);
 
 	/* update krp, only if it is not equal to 1 */
 	if (vk == 0)
@@ -624,13 +667,12 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 	int k;
 	int kp;
 	int krp;
-	RFX_BITSTREAM* bs;
-	int processed_size;
+	RFX_RLGR_WRITER bw = { 0 };
 
-	if (!(bs = (RFX_BITSTREAM*)calloc(1, sizeof(RFX_BITSTREAM))))
-		return 0;
+	InitOnceExecuteOnce(&rfx_rlgr_init_once, rfx_rlgr_init, NULL, NULL);
 
-	rfx_bitstream_attach(bs, buffer, buffer_size);
+	bw.buffer = buffer;
+	bw.size = buffer_size;
 
 	/* initialize the parameters */
 	k = 1;
@@ -644,37 +686,31 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 
 		if (k)
 		{
-			int numZeros;
-			int runmax;
+			UINT32 numZeros;
+			UINT32 runmax;
 			int mag;
 			int sign;
 
 			/* RUN-LENGTH MODE */
 
 			/* collect the run of zeros in the input stream */
-			numZeros = 0;
-			GetNextInput(input);
-			while (input == 0 && data_size > 0)
-			{
-				numZeros++;
-				GetNextInput(input);
-			}
+			numZeros = rfx_rlgr_zero_run(data, data_size);
+			input = data[numZeros];
+			data += numZeros + 1;
+			data_size -= numZeros + 1;
 
 			// emit output zeros
-			runmax = 1 << k;
+			runmax = 1u << k;
 			while (numZeros >= runmax)
 			{
-				OutputBit(1, 0); /* output a zero bit */
+				rfx_rlgr_put_bits(&bw, 0, 1); /* output a zero bit */
 				numZeros -= runmax;
 				UpdateParam(kp, UP_GR, k); /* update kp, k */
-				runmax = 1 << k;
+				runmax = 1u << k;
 			}
 
-			/* output a 1 to terminate runs */
-			OutputBit(1, 1);
-
-			/* output the remaining run length using k bits */
-			OutputBits(k, numZeros);
+			/* output a 1 to terminate runs, then the remaining run length using k bits */
+			rfx_rlgr_put_bits(&bw, (1u << k) | numZeros, (UINT32)k + 1);
 
 			/* note: when we reach here and the last byte being encoded is 0, we still
 			   need to output the last two bits, otherwise mstsc will crash */
@@ -683,8 +719,9 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 			mag = (input < 0 ? -input : input); /* absolute value of input coefficient */
 			sign = (input < 0 ? 1 : 0);         /* sign of input coefficient */
 
-			OutputBit(1, sign);              /* output the sign bit */
-			CodeGR(&krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
+			rfx_rlgr_put_bits(&bw, (UINT32)sign, 1); /* output the sign bit */
+			/* output GR code for (mag - 1) */
+			rfx_rlgr_code_gr(&bw, &krp, mag ? (UINT32)mag - 1 : 0);
 
 			UpdateParam(kp, -DN_GR, k);
 		}
@@ -699,9 +736,10 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 				/* RLGR1 variant */
 
 				/* convert input to (2*magnitude - sign), encode using GR code */
-				GetNextInput(input);
+				input = *data++;
+				data_size--;
 				twoMs = Get2MagSign(input);
-				CodeGR(&krp, twoMs);
+				rfx_rlgr_code_gr(&bw, &krp, twoMs);
 
 				/* update k, kp */
 				/* NOTE: as of Aug 2011, the algorithm is still wrongly documented
@@ -718,26 +756,33 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 			else /* mode == RLGR3 */
 			{
 				UINT32 twoMs1;
-				UINT32 twoMs2;
+				UINT32 twoMs2 = 0;
 				UINT32 sum2Ms;
 				UINT32 nIdx;
 
 				/* RLGR3 variant */
 
 				/* convert the next two input values to (2*magnitude - sign) and */
-				/* encode their sum using GR code */
+				/* encode their sum using GR code, a missing second value counts as 0 */
 
-				GetNextInput(input);
+				input = *data++;
+				data_size--;
 				twoMs1 = Get2MagSign(input);
-				GetNextInput(input);
-				twoMs2 = Get2MagSign(input);
+
+				if (data_size > 0)
+				{
+					input = *data++;
+					data_size--;
+					twoMs2 = Get2MagSign(input);
+				}
+
 				sum2Ms = twoMs1 + twoMs2;
 
-				CodeGR(&krp, sum2Ms);
+				rfx_rlgr_code_gr(&bw, &krp, sum2Ms);
 
 				/* encode binary representation of the first input (twoMs1). */
-				GetMinBits(sum2Ms, nIdx);
-				OutputBits(nIdx, twoMs1);
+				nIdx = 32 - lzcnt_s(sum2Ms);
+				rfx_rlgr_put_bits(&bw, twoMs1, nIdx);
 
 				/* update k,kp for the two input values */
 
@@ -753,9 +798,5 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 		}
 	}
 
-	rfx_bitstream_flush(bs);
-	processed_size = rfx_bitstream_get_processed_bytes(bs);
-	free(bs);
-
-	return processed_size;
+	return rfx_rlgr_flush(&bw);
 }
@@ -40,16 +40,12 @@
 	} while (0)
 #endif
 
-typedef struct S_RFX_TILE_COMPOSE_WORK_PARAM RFX_TILE_COMPOSE_WORK_PARAM;
-
 struct S_RFX_CONTEXT_PRIV
 {
 	wLog* log;
 	wObjectPool* TilePool;
 
 	BOOL UseThreads;
-	PTP_WORK* workObjects;
-	RFX_TILE_COMPOSE_WORK_PARAM* tileWorkParams;
 
 	DWORD MinThreadCount;
 	DWORD MaxThreadCount;
@@ -58,6 +54,7 @@ struct S_RFX_CONTEXT_PRIV
 	TP_CALLBACK_ENVIRON ThreadPoolEnv;
 
 	wBufferPool* BufferPool;
+	BYTE* EncodeScratch; /* RFX_ENCODE_SCRATCH_SIZE, for encoding without threads */
 
 	/* profilers */
 	PROFILER_DEFINE(prof_rfx_decode_rgb)
@@ -71,6 +71,100 @@ fail:
 	return rc;
 }
 
+static void test_ClearFillImage(BYTE* data, UINT32 width, UINT32 height, UINT32 seed)
+{
+	UINT32 x, y;
+	const UINT32 palette[] = { 0xFFFFFFFF, 0xFF000000, 0xFF3A90DB, 0xFFB66666, 0xFFDBFFFF };
+
+	/* Window background with a title bar, text-like strokes and a noisy icon */
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			UINT32 color = palette[0];
+
+			if (y < 12)
+				color = palette[2];
+			else if ((y > 20) && (y < 60) && ((x / 3 + y / 7 + seed) % 5 == 0))
+				color = palette[1 + (x + y) % 2];
+			else if ((y > 70) && (y < 90) && (x > 10) && (x < 40))
+				color = 0xFF000000 | ((x * 2654435761u + y * 40503u + seed) & 0xFFFFFF);
+			else if ((y > 100) && ((x + seed) % 17 == 0))
+				color = palette[3 + (y % 2)];
+
+			*(UINT32*)&data[(y * width + x) * 4] = color;
+		}
+	}
+}
+
+static BOOL test_ClearCompressFrame(CLEAR_CONTEXT* encoder, CLEAR_CONTEXT* decoder,
+                                    const BYTE* pSrcData, UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	BYTE* pDstData = NULL;
+	UINT32 DstSize = 0;
+	BYTE* pOutData = calloc(width * height, 4);
+
+	if (!pOutData)
+		return FALSE;
+
+	if (clear_compress(encoder, pSrcData, width * height * 4, PIXEL_FORMAT_BGRX32, width, height,
+	                   width * 4, &pDstData, &DstSize) < 0)
+		goto fail;
+
+	printf("clear_compress %" PRIu32 "x%" PRIu32 ": %" PRIu32 " -> %" PRIu32 " bytes\n", width,
+	       height, width * height * 3, DstSize);
+
+	if (clear_decompress(decoder, pDstData, DstSize, width, height, pOutData, PIXEL_FORMAT_BGRX32,
+	                     width * 4, 0, 0, width, height, NULL) < 0)
+		goto fail;
+
+	if (memcmp(pSrcData, pOutData, width * height * 4) != 0)
+	{
+		printf("clear round trip mismatch for %" PRIu32 "x%" PRIu32 "\n", width, height);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(pDstData);
+	free(pOutData);
+	return rc;
+}
+
+static BOOL test_ClearCompress(void)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	const UINT32 width = 192;
+	const UINT32 height = 128;
+	BYTE* pSrcData = calloc(width * height, 4);
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!pSrcData || !encoder || !decoder)
+		goto fail;
+
+	/* Repeated frames exercise the vBar and glyph cache hits on both sides */
+	for (i = 0; i < 3; i++)
+	{
+		test_ClearFillImage(pSrcData, width, height, i / 2);
+
+		if (!test_ClearCompressFrame(encoder, decoder, pSrcData, width, height))
+			goto fail;
+
+		if (!test_ClearCompressFrame(encoder, decoder, &pSrcData[20 * width * 4], 24, 16))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	free(pSrcData);
+	return rc;
+}
+
 int TestFreeRDPCodecClear(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -90,5 +184,8 @@ int TestFreeRDPCodecClear(int argc, char* argv[])
 	if (!test_ClearDecompressExample(4, 7, 15, TEST_CLEAR_EXAMPLE_4, sizeof(TEST_CLEAR_EXAMPLE_4)))
 		return -1;
 
+	if (!test_ClearCompress())
+		return -1;
+
 	return 0;
 }
@@ -1,9 +1,16 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/crypto.h>
+#include <winpr/sysinfo.h>
 
+#include <freerdp/config.h>
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/rfx.h>
 
+#include "../rfx_dwt.h"
+#include "../rfx_quantization.h"
+#include "../rfx_rlgr.h"
+
 static BYTE encodeHeaderSample[] = {
 	/* as in 4.2.2 */
 	0xc0, 0xcc, 0x0c, 0x00, 0x00, 0x00, 0xca, 0xac, 0xcc, 0xca, 0x00, 0x01, 0xc3, 0xcc, 0x0d, 0x00,
@@ -843,6 +850,438 @@ static BOOL fuzzyCompareImage(const UINT32* crefImage, const BYTE* img, size_t n
 	return TRUE;
 }
 
+#define ENC_WIDTH 320
+#define ENC_HEIGHT 200
+#define ENC_FRAMES 3
+
+static void fillEncodeFrame(BYTE* data, UINT32 frame)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < ENC_HEIGHT; y++)
+	{
+		UINT32* line = (UINT32*)&data[y * ENC_WIDTH * FORMAT_SIZE];
+
+		for (x = 0; x < ENC_WIDTH; x++)
+			line[x] = ((x * (frame + 1)) & 0xFF) << 16 | ((y * 3 + frame) & 0xFF) << 8 |
+			          ((x ^ y) & 0xFF);
+	}
+}
+
+/* frames encoded while the previous one is still in flight must match a synchronous encode */
+static BOOL test_encode_pipelined(void)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	RFX_CONTEXT* syncContext = NULL;
+	RFX_CONTEXT* asyncContext = NULL;
+	RFX_MESSAGE* messages[ENC_FRAMES] = { 0 };
+	BYTE* frames[ENC_FRAMES] = { 0 };
+	wStream* syncStream = Stream_New(NULL, 1024);
+	wStream* asyncStream = Stream_New(NULL, 1024);
+	const RFX_RECT rect = { 0, 0, ENC_WIDTH, ENC_HEIGHT };
+	const size_t stride = ENC_WIDTH * FORMAT_SIZE;
+
+	syncContext = rfx_context_new_ex(TRUE, THREADING_FLAGS_DISABLE_THREADS);
+	asyncContext = rfx_context_new(TRUE);
+
+	if (!syncStream || !asyncStream || !syncContext || !asyncContext)
+		goto fail;
+
+	for (i = 0; i < ENC_FRAMES; i++)
+	{
+		if (!(frames[i] = calloc(ENC_HEIGHT, stride)))
+			goto fail;
+
+		fillEncodeFrame(frames[i], i);
+	}
+
+	rfx_context_set_pixel_format(syncContext, FORMAT);
+	rfx_context_set_pixel_format(asyncContext, FORMAT);
+
+	if (!rfx_context_reset(syncContext, ENC_WIDTH, ENC_HEIGHT) ||
+	    !rfx_context_reset(asyncContext, ENC_WIDTH, ENC_HEIGHT))
+		goto fail;
+
+	for (i = 0; i < ENC_FRAMES; i++)
+	{
+		if (!rfx_compose_message(syncContext, syncStream, &rect, 1, frames[i], ENC_WIDTH,
+		                         ENC_HEIGHT, stride))
+			goto fail;
+	}
+
+	for (i = 0; i < ENC_FRAMES; i++)
+	{
+		if (!(messages[i] = rfx_encode_message_begin(asyncContext, &rect, 1, frames[i],
+		                                             ENC_WIDTH, ENC_HEIGHT, stride)))
+			goto fail;
+
+		if (i == 0)
+			continue;
+
+		if (!rfx_encode_message_end(asyncContext, messages[i - 1]) ||
+		    !rfx_write_message(asyncContext, asyncStream, messages[i - 1]))
+			goto fail;
+	}
+
+	if (!rfx_encode_message_end(asyncContext, messages[ENC_FRAMES - 1]) ||
+	    !rfx_write_message(asyncContext, asyncStream, messages[ENC_FRAMES - 1]))
+		goto fail;
+
+	if ((Stream_GetPosition(syncStream) != Stream_GetPosition(asyncStream)) ||
+	    (memcmp(Stream_Buffer(syncStream), Stream_Buffer(asyncStream),
+	            Stream_GetPosition(syncStream)) != 0))
+	{
+		printf("pipelined RemoteFX encoding differs from synchronous encoding\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	for (i = 0; i < ENC_FRAMES; i++)
+	{
+		if (messages[i])
+		{
+			messages[i]->freeRects = TRUE;
+			rfx_message_free(asyncContext, messages[i]);
+		}
+
+		free(frames[i]);
+	}
+
+	rfx_context_free(syncContext);
+	rfx_context_free(asyncContext);
+	Stream_Free(syncStream, TRUE);
+	Stream_Free(asyncStream, TRUE);
+	return rc;
+}
+
+/* frames encoded once and written to a stream with the headers of another context must
+ * match an encode for that stream alone */
+static BOOL test_encode_shared(void)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	BYTE* frame = NULL;
+	RFX_CONTEXT* syncContext = NULL;
+	RFX_CONTEXT* sharedContext = NULL;
+	RFX_CONTEXT* streamContext = NULL;
+	wStream* syncStream = Stream_New(NULL, 1024);
+	wStream* sharedStream = Stream_New(NULL, 1024);
+	const RFX_RECT rect = { 0, 0, ENC_WIDTH, ENC_HEIGHT };
+	const size_t stride = ENC_WIDTH * FORMAT_SIZE;
+
+	syncContext = rfx_context_new_ex(TRUE, THREADING_FLAGS_DISABLE_THREADS);
+	sharedContext = rfx_context_new(TRUE);
+	streamContext = rfx_context_new_ex(TRUE, THREADING_FLAGS_DISABLE_THREADS);
+	frame = calloc(ENC_HEIGHT, stride);
+
+	if (!syncStream || !sharedStream || !syncContext || !sharedContext || !streamContext ||
+	    !frame)
+		goto fail;
+
+	rfx_context_set_pixel_format(syncContext, FORMAT);
+	rfx_context_set_pixel_format(sharedContext, FORMAT);
+
+	if (!rfx_context_reset(syncContext, ENC_WIDTH, ENC_HEIGHT) ||
+	    !rfx_context_reset(sharedContext, ENC_WIDTH, ENC_HEIGHT) ||
+	    !rfx_context_reset(streamContext, ENC_WIDTH, ENC_HEIGHT))
+		goto fail;
+
+	for (i = 0; i < ENC_FRAMES; i++)
+	{
+		BOOL written;
+		RFX_MESSAGE* message;
+
+		fillEncodeFrame(frame, i);
+
+		if (!rfx_compose_message(syncContext, syncStream, &rect, 1, frame, ENC_WIDTH, ENC_HEIGHT,
+		                         stride))
+			goto fail;
+
+		if (!(message = rfx_encode_message(sharedContext, &rect, 1, frame, ENC_WIDTH,
+		                                   ENC_HEIGHT, stride)))
+			goto fail;
+
+		written = rfx_write_message_header(streamContext, sharedStream) &&
+		          rfx_write_message_frame(sharedContext, sharedStream, message);
+		message->freeRects = TRUE;
+		rfx_message_free(sharedContext, message);
+
+		if (!written)
+			goto fail;
+	}
+
+	if ((Stream_GetPosition(syncStream) != Stream_GetPosition(sharedStream)) ||
+	    (memcmp(Stream_Buffer(syncStream), Stream_Buffer(sharedStream),
+	            Stream_GetPosition(syncStream)) != 0))
+	{
+		printf("shared RemoteFX encoding differs from encoding per stream\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(frame);
+	rfx_context_free(syncContext);
+	rfx_context_free(sharedContext);
+	rfx_context_free(streamContext);
+	Stream_Free(syncStream, TRUE);
+	Stream_Free(sharedStream, TRUE);
+	return rc;
+}
+
+/* an encoder that always fills its buffer, as if the tile did not fit */
+static int test_rlgr_encode_overflow(RLGR_MODE mode, const INT16* data, UINT32 data_size,
+                                     BYTE* buffer, UINT32 buffer_size)
+{
+	WINPR_UNUSED(mode);
+	WINPR_UNUSED(data);
+	WINPR_UNUSED(data_size);
+	WINPR_UNUSED(buffer);
+	return (int)buffer_size;
+}
+
+/* a tile that fails to encode must fail the message, with and without threads */
+static BOOL test_encode_failure(void)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	BYTE* frame = NULL;
+	RFX_CONTEXT* contexts[2] = { 0 };
+	const RFX_RECT rect = { 0, 0, ENC_WIDTH, ENC_HEIGHT };
+	const size_t stride = ENC_WIDTH * FORMAT_SIZE;
+
+	contexts[0] = rfx_context_new_ex(TRUE, THREADING_FLAGS_DISABLE_THREADS);
+	contexts[1] = rfx_context_new(TRUE);
+	frame = calloc(ENC_HEIGHT, stride);
+
+	if (!contexts[0] || !contexts[1] || !frame)
+		goto fail;
+
+	fillEncodeFrame(frame, 0);
+
+	for (i = 0; i < ARRAYSIZE(contexts); i++)
+	{
+		RFX_MESSAGE* message;
+
+		rfx_context_set_pixel_format(contexts[i], FORMAT);
+
+		if (!rfx_context_reset(contexts[i], ENC_WIDTH, ENC_HEIGHT))
+			goto fail;
+
+		contexts[i]->rlgr_encode = test_rlgr_encode_overflow;
+
+		if ((message = rfx_encode_message(contexts[i], &rect, 1, frame, ENC_WIDTH, ENC_HEIGHT,
+		                                  stride)))
+		{
+			printf("RemoteFX message with a failed tile was encoded\n");
+			message->freeRects = TRUE;
+			rfx_message_free(contexts[i], message);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(frame);
+
+	for (i = 0; i < ARRAYSIZE(contexts); i++)
+		rfx_context_free(contexts[i]);
+
+	return rc;
+}
+
+#define RLGR_TILE_SIZE 4096
+#define RLGR_BUFFER_SIZE (RLGR_TILE_SIZE * 8)
+
+/* fills a tile with small coefficients, runs of zeros and a few values up to 12 bits, like
+ * a quantized tile */
+static void fillRlgrTile(INT16* tile)
+{
+	size_t i;
+	BYTE rnd[RLGR_TILE_SIZE * 2];
+
+	winpr_RAND(rnd, sizeof(rnd));
+
+	for (i = 0; i < RLGR_TILE_SIZE; i++)
+	{
+		const BYTE kind = rnd[2 * i] & 0x07;
+
+		if (kind < 3)
+			tile[i] = 0;
+		else if (kind < 7)
+			tile[i] = (INT16)((INT8)rnd[2 * i + 1] >> 3);
+		else
+			tile[i] = (INT16)((((rnd[2 * i] << 8) | rnd[2 * i + 1]) & 0x0FFF) - 0x0800);
+	}
+
+	/* see test_rlgr_roundtrip for a trailing zero */
+	if (tile[RLGR_TILE_SIZE - 1] == 0)
+		tile[RLGR_TILE_SIZE - 1] = -1;
+}
+
+static BOOL test_rlgr_roundtrip_mode(RLGR_MODE mode, const INT16* tile, const INT16* expected,
+                                     const char* name)
+{
+	int len, small;
+	INT16 decoded[RLGR_TILE_SIZE];
+	BYTE* full = calloc(RLGR_BUFFER_SIZE, 1);
+	BYTE* part = calloc(RLGR_BUFFER_SIZE, 1);
+	BOOL rc = FALSE;
+
+	if (!full || !part)
+		goto fail;
+
+	len = rfx_rlgr_encode(mode, tile, RLGR_TILE_SIZE, full, RLGR_BUFFER_SIZE);
+
+	if ((len <= 0) || (len >= RLGR_BUFFER_SIZE))
+	{
+		printf("RLGR%d %s: encoding returned %d\n", mode == RLGR1 ? 1 : 3, name, len);
+		goto fail;
+	}
+
+	if ((rfx_rlgr_decode(mode, full, (UINT32)len, decoded, RLGR_TILE_SIZE) < 0) ||
+	    (memcmp(decoded, expected, sizeof(decoded)) != 0))
+	{
+		printf("RLGR%d %s: decoded tile differs\n", mode == RLGR1 ? 1 : 3, name);
+		goto fail;
+	}
+
+	/* a destination too small gets the truncated stream and nothing is written past it */
+	for (small = len - 1; small > 0; small /= 2)
+	{
+		memset(part, 0xA5, RLGR_BUFFER_SIZE);
+
+		if ((rfx_rlgr_encode(mode, tile, RLGR_TILE_SIZE, part, (UINT32)small) != small) ||
+		    (memcmp(part, full, (size_t)small) != 0) || (part[small] != 0xA5))
+		{
+			printf("RLGR%d %s: encoding into %d of %d bytes failed\n", mode == RLGR1 ? 1 : 3,
+			       name, small, len);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(full);
+	free(part);
+	return rc;
+}
+
+/* RLGR1 and RLGR3 encoded tiles must decode to the original coefficients */
+static BOOL test_rlgr_roundtrip(void)
+{
+	int i;
+	INT16 tile[RLGR_TILE_SIZE];
+	INT16 expected[RLGR_TILE_SIZE];
+
+	/*
+	 * A zero run is always terminated by a coded value, as in the reference encoder of
+	 * MS-RDPRFX. A run reaching the end of the tile codes its last zero as magnitude 1.
+	 */
+	ZeroMemory(tile, sizeof(tile));
+	ZeroMemory(expected, sizeof(expected));
+	expected[RLGR_TILE_SIZE - 1] = 1;
+
+	if (!test_rlgr_roundtrip_mode(RLGR1, tile, expected, "zero") ||
+	    !test_rlgr_roundtrip_mode(RLGR3, tile, expected, "zero"))
+		return FALSE;
+
+	for (i = 0; i < 16; i++)
+	{
+		fillRlgrTile(tile);
+
+		if (!test_rlgr_roundtrip_mode(RLGR1, tile, tile, "random") ||
+		    !test_rlgr_roundtrip_mode(RLGR3, tile, tile, "random"))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* the AVX2 DWT and quantization must match the generic routines bit for bit */
+static BOOL test_avx2_exact(void)
+{
+#if defined(WITH_AVX2)
+	BOOL rc = FALSE;
+	int i;
+	size_t j;
+	UINT32 quants[10];
+	BYTE rnd[RLGR_TILE_SIZE * 2];
+	RFX_CONTEXT* context;
+	DECLSPEC_ALIGN(32) INT16 generic[RLGR_TILE_SIZE];
+	DECLSPEC_ALIGN(32) INT16 simd[RLGR_TILE_SIZE];
+	DECLSPEC_ALIGN(32) INT16 dwt_buffer[RLGR_TILE_SIZE];
+
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+	{
+		printf("AVX2 not available, skipping the AVX2 comparison\n");
+		return TRUE;
+	}
+
+	if (!(context = rfx_context_new_ex(TRUE, THREADING_FLAGS_DISABLE_THREADS)))
+		return FALSE;
+
+	for (i = 0; i < 16; i++)
+	{
+		winpr_RAND(rnd, sizeof(rnd));
+
+		/* the range of the YCbCr values rfx_encode_rgb feeds in */
+		for (j = 0; j < RLGR_TILE_SIZE; j++)
+			generic[j] = (INT16)((((rnd[2 * j] << 8) | rnd[2 * j + 1]) & 0x1FFF) - 0x1000);
+
+		for (j = 0; j < ARRAYSIZE(quants); j++)
+			quants[j] = 6 + (rnd[j] % 10);
+
+		CopyMemory(simd, generic, sizeof(simd));
+		rfx_dwt_2d_encode(generic, dwt_buffer);
+		context->dwt_2d_encode(simd, dwt_buffer);
+
+		if (memcmp(generic, simd, sizeof(simd)) != 0)
+		{
+			printf("AVX2 DWT encode differs from the generic one\n");
+			goto fail;
+		}
+
+		rfx_quantization_encode(generic, quants);
+		context->quantization_encode(simd, quants);
+
+		if (memcmp(generic, simd, sizeof(simd)) != 0)
+		{
+			printf("AVX2 quantization encode differs from the generic one\n");
+			goto fail;
+		}
+
+		rfx_quantization_decode(generic, quants);
+		context->quantization_decode(simd, quants);
+
+		if (memcmp(generic, simd, sizeof(simd)) != 0)
+		{
+			printf("AVX2 quantization decode differs from the generic one\n");
+			goto fail;
+		}
+
+		rfx_dwt_2d_decode(generic, dwt_buffer);
+		context->dwt_2d_decode(simd, dwt_buffer);
+
+		if (memcmp(generic, simd, sizeof(simd)) != 0)
+		{
+			printf("AVX2 DWT decode differs from the generic one\n");
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	rfx_context_free(context);
+	return rc;
+#else
+	return TRUE;
+#endif
+}
+
 int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 {
 	int rc = -1;
@@ -884,6 +1323,21 @@ int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 	if (!fuzzyCompareImage(srefImage, dest, IMG_WIDTH * IMG_HEIGHT))
 		goto fail;
 
+	if (!test_encode_pipelined())
+		goto fail;
+
+	if (!test_encode_shared())
+		goto fail;
+
+	if (!test_encode_failure())
+		goto fail;
+
+	if (!test_rlgr_roundtrip())
+		goto fail;
+
+	if (!test_avx2_exact())
+		goto fail;
+
 	rc = 0;
 fail:
 	region16_uninit(&region);
@@ -1,6 +1,7 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/bitstream.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/zgfx.h>
@@ -253,6 +254,88 @@ fail:
 	return rc;
 }
 
+static void fill_benchmark_data(BYTE* data, size_t size)
+{
+	size_t x;
+	UINT32 seed = 0x12345678;
+
+	/* Screen like content: repeated rows of pixels with sparse noise and some text runs */
+	for (x = 0; x < size; x++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if ((seed >> 16) % 61 == 0)
+			data[x] = (BYTE)(seed >> 24);
+		else if ((x / 4096) % 3 == 0)
+			data[x] = TEST_FOX_DATA[x % (sizeof(TEST_FOX_DATA) - 1)];
+		else
+			data[x] = (BYTE)((x % 4 == 3) ? 0xFF : ((x / 64) & 0x3F));
+	}
+}
+
+static int test_ZGfxCompressBenchmark(void)
+{
+	int rc = -1;
+	UINT32 level;
+	const UINT32 SrcSize = 1024 * 1024;
+	BYTE* pSrcData = malloc(SrcSize);
+
+	if (!pSrcData)
+		return -1;
+
+	fill_benchmark_data(pSrcData, SrcSize);
+
+	for (level = ZGFX_COMPRESSION_LEVEL_NONE; level <= ZGFX_COMPRESSION_LEVEL_BEST; level++)
+	{
+		UINT32 Flags = 0;
+		UINT32 DstSize = 0;
+		UINT32 OutSize = 0;
+		BYTE* pDstData = NULL;
+		BYTE* pOutData = NULL;
+		UINT64 start;
+		UINT64 end;
+		BOOL valid;
+		ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+		ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+		if (!compressor || !decompressor)
+		{
+			zgfx_context_free(compressor);
+			zgfx_context_free(decompressor);
+			goto fail;
+		}
+
+		zgfx_context_set_compression_level(compressor, level);
+		start = GetTickCount64();
+		valid = zgfx_compress(compressor, pSrcData, SrcSize, &pDstData, &DstSize, &Flags) >= 0;
+		end = GetTickCount64();
+
+		if (valid)
+			valid = zgfx_decompress(decompressor, pDstData, DstSize, &pOutData, &OutSize, 0) >= 0;
+
+		if (valid)
+			valid = (OutSize == SrcSize) && (memcmp(pOutData, pSrcData, SrcSize) == 0);
+
+		printf("level %" PRIu32 ": %" PRIu32 " -> %" PRIu32 " bytes (%.2f%%) in %" PRIu64 " ms\n",
+		       level, SrcSize, DstSize, 100.0 * DstSize / SrcSize, end - start);
+		free(pDstData);
+		free(pOutData);
+		zgfx_context_free(compressor);
+		zgfx_context_free(decompressor);
+
+		if (!valid)
+		{
+			printf("test_ZGfxCompressBenchmark: round trip failed at level %" PRIu32 "\n", level);
+			goto fail;
+		}
+	}
+
+	rc = 0;
+fail:
+	free(pSrcData);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -270,5 +353,8 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	if (test_ZGfxCompressBenchmark() < 0)
+		return -1;
+
 	return 0;
 }
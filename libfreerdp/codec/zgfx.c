@@ -49,9 +49,42 @@ typedef struct
 	UINT32 valueBase;
 } ZGFX_TOKEN;
 
+#define ZGFX_HISTORY_SIZE 2500000
+#define ZGFX_MIN_MATCH 3
+#define ZGFX_HASH_BITS 16
+#define ZGFX_HASH_SIZE (1 << ZGFX_HASH_BITS)
+#define ZGFX_CHAIN_BITS 18
+#define ZGFX_CHAIN_SIZE (1 << ZGFX_CHAIN_BITS)
+#define ZGFX_CHAIN_MASK (ZGFX_CHAIN_SIZE - 1)
+#define ZGFX_WINDOW_SIZE (2 * ZGFX_HISTORY_SIZE)
+
+typedef struct
+{
+	UINT32 maxChain;
+	UINT32 niceLength;
+	BOOL lazy;
+} ZGFX_LEVEL_CONFIG;
+
+static const ZGFX_LEVEL_CONFIG ZGFX_LEVEL_TABLE[] = {
+	{ 0, 0, FALSE },    /* ZGFX_COMPRESSION_LEVEL_NONE */
+	{ 4, 32, FALSE },   /* ZGFX_COMPRESSION_LEVEL_FAST */
+	{ 32, 128, TRUE },  /* ZGFX_COMPRESSION_LEVEL_DEFAULT */
+	{ 256, 1024, TRUE } /* ZGFX_COMPRESSION_LEVEL_BEST */
+};
+
+typedef struct
+{
+	BYTE* pbOutput;
+	UINT32 cbOutput;
+	UINT32 OutputIndex;
+	UINT64 Accumulator;
+	UINT32 cAccumulated;
+} ZGFX_BIT_WRITER;
+
 struct S_ZGFX_CONTEXT
 {
 	BOOL Compressor;
+	UINT32 CompressionLevel;
 
 	const BYTE* pbInputCurrent;
 	const BYTE* pbInputEnd;
@@ -64,9 +97,17 @@ struct S_ZGFX_CONTEXT
 	BYTE OutputBuffer[65536];
 	UINT32 OutputCount;
 
-	BYTE HistoryBuffer[2500000];
+	BYTE HistoryBuffer[ZGFX_HISTORY_SIZE];
 	UINT32 HistoryIndex;
 	UINT32 HistoryBufferSize;
+
+	/* Compressor state: a linear window mirroring the decoder history, hash chains over it */
+	BYTE* Window;
+	UINT32 WindowFill;
+	UINT32* HashHead;
+	UINT32* HashChain;
+	UINT16 LiteralCode[256];
+	BYTE LiteralBits[256];
 };
 
 static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] = {
@@ -460,19 +501,329 @@ fail:
 	return status;
 }
 
+static INLINE BOOL zgfx_bit_writer_put(ZGFX_BIT_WRITER* bw, UINT32 value, UINT32 nbits)
+{
+	bw->Accumulator = (bw->Accumulator << nbits) | (value & ((1ULL << nbits) - 1));
+	bw->cAccumulated += nbits;
+
+	while (bw->cAccumulated >= 8)
+	{
+		if (bw->OutputIndex >= bw->cbOutput)
+			return FALSE;
+
+		bw->cAccumulated -= 8;
+		bw->pbOutput[bw->OutputIndex++] = (BYTE)(bw->Accumulator >> bw->cAccumulated);
+	}
+
+	return TRUE;
+}
+
+static INLINE BOOL zgfx_bit_writer_finish(ZGFX_BIT_WRITER* bw)
+{
+	const UINT32 padding = (8 - bw->cAccumulated) % 8;
+
+	if (padding && !zgfx_bit_writer_put(bw, 0, padding))
+		return FALSE;
+
+	/* The last byte holds the number of unused bits in the preceding byte */
+	if (bw->OutputIndex >= bw->cbOutput)
+		return FALSE;
+
+	bw->pbOutput[bw->OutputIndex++] = (BYTE)padding;
+	return TRUE;
+}
+
+static const ZGFX_TOKEN* zgfx_match_token(UINT32 distance)
+{
+	size_t index;
+
+	for (index = 0; ZGFX_TOKEN_TABLE[index].prefixLength != 0; index++)
+	{
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[index];
+
+		if (token->tokenType != 1)
+			continue;
+
+		if ((distance >= token->valueBase) &&
+		    (distance - token->valueBase < (1UL << token->valueBits)))
+			return token;
+	}
+
+	return NULL;
+}
+
+static INLINE UINT32 zgfx_match_length_bits(UINT32 count)
+{
+	UINT32 extra = 2;
+	UINT32 base = 4;
+
+	if (count == 3)
+		return 1;
+
+	while (count >= base * 2)
+	{
+		base *= 2;
+		extra++;
+	}
+
+	/* leading 1, (extra - 2) continuation ones, terminating 0 and extra value bits */
+	return 1 + (extra - 2) + 1 + extra;
+}
+
+static BOOL zgfx_write_match(ZGFX_BIT_WRITER* bw, UINT32 distance, UINT32 count)
+{
+	UINT32 extra = 2;
+	UINT32 base = 4;
+	const ZGFX_TOKEN* token = zgfx_match_token(distance);
+
+	if (!token)
+		return FALSE;
+
+	if (!zgfx_bit_writer_put(bw, token->prefixCode, token->prefixLength) ||
+	    !zgfx_bit_writer_put(bw, distance - token->valueBase, token->valueBits))
+		return FALSE;
+
+	if (count == 3)
+		return zgfx_bit_writer_put(bw, 0, 1);
+
+	if (!zgfx_bit_writer_put(bw, 1, 1))
+		return FALSE;
+
+	while (count >= base * 2)
+	{
+		if (!zgfx_bit_writer_put(bw, 1, 1))
+			return FALSE;
+
+		base *= 2;
+		extra++;
+	}
+
+	if (!zgfx_bit_writer_put(bw, 0, 1))
+		return FALSE;
+
+	return zgfx_bit_writer_put(bw, count - base, extra);
+}
+
+static INLINE UINT32 zgfx_hash(const BYTE* p)
+{
+	const UINT32 v = ((UINT32)p[0] << 16) | ((UINT32)p[1] << 8) | p[2];
+	return (UINT32)(v * 2654435761u) >> (32 - ZGFX_HASH_BITS);
+}
+
+static INLINE void zgfx_insert_hash(ZGFX_CONTEXT* zgfx, UINT32 pos)
+{
+	const UINT32 h = zgfx_hash(&zgfx->Window[pos]);
+	zgfx->HashChain[pos & ZGFX_CHAIN_MASK] = zgfx->HashHead[h];
+	zgfx->HashHead[h] = pos + 1;
+}
+
+static UINT32 zgfx_find_match(ZGFX_CONTEXT* zgfx, UINT32 pos, UINT32 end, UINT32* pDistance)
+{
+	const ZGFX_LEVEL_CONFIG* config = &ZGFX_LEVEL_TABLE[zgfx->CompressionLevel];
+	const BYTE* window = zgfx->Window;
+	const UINT32 maxLength = end - pos;
+	UINT32 chain = config->maxChain;
+	UINT32 bestLength = 0;
+	UINT32 candidate = zgfx->HashHead[zgfx_hash(&window[pos])];
+
+	while (candidate && chain--)
+	{
+		UINT32 length = 0;
+		const UINT32 cand = candidate - 1;
+		const UINT32 distance = pos - cand;
+
+		if ((distance == 0) || (distance >= ZGFX_HISTORY_SIZE))
+			break;
+
+		if ((window[cand + bestLength] == window[pos + bestLength]) && (window[cand] == window[pos]))
+		{
+			while ((length < maxLength) && (window[cand + length] == window[pos + length]))
+				length++;
+
+			if (length > bestLength)
+			{
+				bestLength = length;
+				*pDistance = distance;
+
+				if ((length >= config->niceLength) || (length == maxLength))
+					break;
+			}
+		}
+
+		/* Chain entries older than the chain ring have been overwritten */
+		if (distance >= ZGFX_CHAIN_SIZE)
+			break;
+
+		candidate = zgfx->HashChain[cand & ZGFX_CHAIN_MASK];
+	}
+
+	return (bestLength >= ZGFX_MIN_MATCH) ? bestLength : 0;
+}
+
+static INLINE BOOL zgfx_match_is_profitable(const ZGFX_CONTEXT* zgfx, UINT32 pos, UINT32 distance,
+                                            UINT32 length)
+{
+	UINT32 index;
+	UINT32 literalBits = 0;
+	const ZGFX_TOKEN* token;
+
+	/* Long matches always win, short far matches may cost more than plain literals */
+	if (length > 8)
+		return TRUE;
+
+	token = zgfx_match_token(distance);
+
+	if (!token)
+		return FALSE;
+
+	for (index = 0; index < length; index++)
+		literalBits += zgfx->LiteralBits[zgfx->Window[pos + index]];
+
+	return (token->prefixLength + token->valueBits + zgfx_match_length_bits(length)) < literalBits;
+}
+
+static void zgfx_window_slide(ZGFX_CONTEXT* zgfx)
+{
+	UINT32 index;
+	UINT32 delta;
+
+	if (zgfx->WindowFill <= ZGFX_HISTORY_SIZE)
+		return;
+
+	/* Keep the chain ring aligned by sliding in multiples of its size */
+	delta = (zgfx->WindowFill - ZGFX_HISTORY_SIZE) & ~ZGFX_CHAIN_MASK;
+
+	if (delta == 0)
+		return;
+
+	MoveMemory(zgfx->Window, &zgfx->Window[delta], zgfx->WindowFill - delta);
+	zgfx->WindowFill -= delta;
+
+	for (index = 0; index < ZGFX_HASH_SIZE; index++)
+		zgfx->HashHead[index] = (zgfx->HashHead[index] > delta) ? zgfx->HashHead[index] - delta : 0;
+
+	for (index = 0; index < ZGFX_CHAIN_SIZE; index++)
+		zgfx->HashChain[index] =
+		    (zgfx->HashChain[index] > delta) ? zgfx->HashChain[index] - delta : 0;
+}
+
+static BOOL zgfx_compress_window(ZGFX_CONTEXT* zgfx, UINT32 start, UINT32 end,
+                                 ZGFX_BIT_WRITER* bw, UINT32* pHashed)
+{
+	UINT32 pos = start;
+	const BOOL lazy = ZGFX_LEVEL_TABLE[zgfx->CompressionLevel].lazy;
+
+	while (pos < end)
+	{
+		UINT32 length = 0;
+		UINT32 distance = 0;
+
+		if (end - pos >= ZGFX_MIN_MATCH)
+		{
+			length = zgfx_find_match(zgfx, pos, end, &distance);
+
+			if (length && !zgfx_match_is_profitable(zgfx, pos, distance, length))
+				length = 0;
+
+			zgfx_insert_hash(zgfx, pos);
+			*pHashed = pos + 1;
+
+			/* Defer the match by one byte if the next position yields a longer one */
+			if (length && lazy && (pos + 1 + ZGFX_MIN_MATCH <= end))
+			{
+				UINT32 nextDistance = 0;
+				const UINT32 nextLength = zgfx_find_match(zgfx, pos + 1, end, &nextDistance);
+
+				if (nextLength > length + 1)
+					length = 0;
+			}
+		}
+
+		if (length)
+		{
+			UINT32 index;
+
+			if (!zgfx_write_match(bw, distance, length))
+				return FALSE;
+
+			for (index = 1; index < length; index++)
+			{
+				if (pos + index + ZGFX_MIN_MATCH <= end)
+					zgfx_insert_hash(zgfx, pos + index);
+			}
+
+			pos += length;
+			*pHashed = pos;
+		}
+		else
+		{
+			const BYTE c = zgfx->Window[pos];
+
+			if (!zgfx_bit_writer_put(bw, zgfx->LiteralCode[c], zgfx->LiteralBits[c]))
+				return FALSE;
+
+			pos++;
+		}
+	}
+
+	*pHashed = end;
+	return zgfx_bit_writer_finish(bw);
+}
+
 static BOOL zgfx_compress_segment(ZGFX_CONTEXT* zgfx, wStream* s, const BYTE* pSrcData,
                                   UINT32 SrcSize, UINT32* pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
+	UINT32 start = 0;
+	UINT32 hashed = 0;
+	BYTE header = ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
+	ZGFX_BIT_WRITER bw = { 0 };
+
 	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return FALSE;
 	}
 
-	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags));         /* header (1 byte) */
-	Stream_Write(s, pSrcData, SrcSize);
+	if (zgfx->Window && (zgfx->CompressionLevel != ZGFX_COMPRESSION_LEVEL_NONE) &&
+	    (SrcSize > ZGFX_MIN_MATCH))
+	{
+		if (zgfx->WindowFill + SrcSize > ZGFX_WINDOW_SIZE)
+			zgfx_window_slide(zgfx);
+
+		start = hashed = zgfx->WindowFill;
+		CopyMemory(&zgfx->Window[start], pSrcData, SrcSize);
+		zgfx->WindowFill += SrcSize;
+
+		/* Only keep the compressed form if it is actually smaller than the raw data */
+		bw.pbOutput = zgfx->OutputBuffer;
+		bw.cbOutput = SrcSize;
+
+		if (zgfx_compress_window(zgfx, start, start + SrcSize, &bw, &hashed))
+			header |= PACKET_COMPRESSED;
+		else
+		{
+			/* Positions not visited by the aborted pass still need to be hashed */
+			for (; hashed + ZGFX_MIN_MATCH <= start + SrcSize; hashed++)
+				zgfx_insert_hash(zgfx, hashed);
+		}
+	}
+	else if (zgfx->Window)
+	{
+		if (zgfx->WindowFill + SrcSize > ZGFX_WINDOW_SIZE)
+			zgfx_window_slide(zgfx);
+
+		CopyMemory(&zgfx->Window[zgfx->WindowFill], pSrcData, SrcSize);
+		zgfx->WindowFill += SrcSize;
+	}
+
+	(*pFlags) |= header;
+	Stream_Write_UINT8(s, header); /* header (1 byte) */
+
+	if (header & PACKET_COMPRESSED)
+		Stream_Write(s, zgfx->OutputBuffer, bw.OutputIndex);
+	else
+		Stream_Write(s, pSrcData, SrcSize);
+
 	return TRUE;
 }
 
@@ -573,6 +924,46 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush)
 {
 	zgfx->HistoryIndex = 0;
+	zgfx->WindowFill = 0;
+
+	if (zgfx->HashHead)
+		ZeroMemory(zgfx->HashHead, ZGFX_HASH_SIZE * sizeof(UINT32));
+
+	if (zgfx->HashChain)
+		ZeroMemory(zgfx->HashChain, ZGFX_CHAIN_SIZE * sizeof(UINT32));
+}
+
+void zgfx_context_set_compression_level(ZGFX_CONTEXT* zgfx, UINT32 CompressionLevel)
+{
+	WINPR_ASSERT(zgfx);
+
+	if (CompressionLevel > ZGFX_COMPRESSION_LEVEL_BEST)
+		CompressionLevel = ZGFX_COMPRESSION_LEVEL_BEST;
+
+	zgfx->CompressionLevel = CompressionLevel;
+}
+
+static void zgfx_init_literal_table(ZGFX_CONTEXT* zgfx)
+{
+	size_t index;
+
+	/* Default literal encoding: prefix '0' followed by the 8 bit value */
+	for (index = 0; index < 256; index++)
+	{
+		zgfx->LiteralCode[index] = (UINT16)index;
+		zgfx->LiteralBits[index] = 9;
+	}
+
+	for (index = 0; ZGFX_TOKEN_TABLE[index].prefixLength != 0; index++)
+	{
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[index];
+
+		if ((token->tokenType == 0) && (token->valueBits == 0))
+		{
+			zgfx->LiteralCode[token->valueBase] = (UINT16)token->prefixCode;
+			zgfx->LiteralBits[token->valueBase] = (BYTE)token->prefixLength;
+		}
+	}
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
@@ -584,6 +975,23 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 	{
 		zgfx->Compressor = Compressor;
 		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
+
+		if (Compressor)
+		{
+			zgfx->CompressionLevel = ZGFX_COMPRESSION_LEVEL_DEFAULT;
+			zgfx->Window = (BYTE*)malloc(ZGFX_WINDOW_SIZE);
+			zgfx->HashHead = (UINT32*)calloc(ZGFX_HASH_SIZE, sizeof(UINT32));
+			zgfx->HashChain = (UINT32*)calloc(ZGFX_CHAIN_SIZE, sizeof(UINT32));
+
+			if (!zgfx->Window || !zgfx->HashHead || !zgfx->HashChain)
+			{
+				zgfx_context_free(zgfx);
+				return NULL;
+			}
+
+			zgfx_init_literal_table(zgfx);
+		}
+
 		zgfx_context_reset(zgfx, FALSE);
 	}
 
@@ -592,5 +1000,11 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 
 void zgfx_context_free(ZGFX_CONTEXT* zgfx)
 {
+	if (!zgfx)
+		return;
+
+	free(zgfx->Window);
+	free(zgfx->HashHead);
+	free(zgfx->HashChain);
 	free(zgfx);
 }
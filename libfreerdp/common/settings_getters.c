@@ -81,9 +81,15 @@ BOOL freerdp_settings_get_bool(const rdpSettings* settings, size_t id)
 		case FreeRDP_BitmapCacheEnabled:
 			return settings->BitmapCacheEnabled;
 
+		case FreeRDP_BitmapCachePersistCompress:
+			return settings->BitmapCachePersistCompress;
+
 		case FreeRDP_BitmapCachePersistEnabled:
 			return settings->BitmapCachePersistEnabled;
 
+		case FreeRDP_BitmapCachePersistStore:
+			return settings->BitmapCachePersistStore;
+
 		case FreeRDP_BitmapCacheV3Enabled:
 			return settings->BitmapCacheV3Enabled;
 
@@ -513,6 +519,9 @@ BOOL freerdp_settings_get_bool(const rdpSettings* settings, size_t id)
 		case FreeRDP_TcpKeepAlive:
 			return settings->TcpKeepAlive;
 
+		case FreeRDP_TlsKernelOffload:
+			return settings->TlsKernelOffload;
+
 		case FreeRDP_TlsSecurity:
 			return settings->TlsSecurity;
 
@@ -639,10 +648,18 @@ BOOL freerdp_settings_set_bool(rdpSettings* settings, size_t id, BOOL val)
 			settings->BitmapCacheEnabled = cnv.c;
 			break;
 
+		case FreeRDP_BitmapCachePersistCompress:
+			settings->BitmapCachePersistCompress = cnv.c;
+			break;
+
 		case FreeRDP_BitmapCachePersistEnabled:
 			settings->BitmapCachePersistEnabled = cnv.c;
 			break;
 
+		case FreeRDP_BitmapCachePersistStore:
+			settings->BitmapCachePersistStore = cnv.c;
+			break;
+
 		case FreeRDP_BitmapCacheV3Enabled:
 			settings->BitmapCacheV3Enabled = cnv.c;
 			break;
@@ -1215,6 +1232,10 @@ BOOL freerdp_settings_set_bool(rdpSettings* settings, size_t id, BOOL val)
 			settings->TcpKeepAlive = cnv.c;
 			break;
 
+		case FreeRDP_TlsKernelOffload:
+			settings->TlsKernelOffload = cnv.c;
+			break;
+
 		case FreeRDP_TlsSecurity:
 			settings->TlsSecurity = cnv.c;
 			break;
@@ -47,8 +47,12 @@ static const struct settings_str_entry settings_map[] = {
 	{ FreeRDP_AutoReconnectionEnabled, FREERDP_SETTINGS_TYPE_BOOL,
 	  "FreeRDP_AutoReconnectionEnabled" },
 	{ FreeRDP_BitmapCacheEnabled, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_BitmapCacheEnabled" },
+	{ FreeRDP_BitmapCachePersistCompress, FREERDP_SETTINGS_TYPE_BOOL,
+	  "FreeRDP_BitmapCachePersistCompress" },
 	{ FreeRDP_BitmapCachePersistEnabled, FREERDP_SETTINGS_TYPE_BOOL,
 	  "FreeRDP_BitmapCachePersistEnabled" },
+	{ FreeRDP_BitmapCachePersistStore, FREERDP_SETTINGS_TYPE_BOOL,
+	  "FreeRDP_BitmapCachePersistStore" },
 	{ FreeRDP_BitmapCacheV3Enabled, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_BitmapCacheV3Enabled" },
 	{ FreeRDP_BitmapCompressionDisabled, FREERDP_SETTINGS_TYPE_BOOL,
 	  "FreeRDP_BitmapCompressionDisabled" },
@@ -225,6 +229,7 @@ static const struct settings_str_entry settings_map[] = {
 	  "FreeRDP_SurfaceFrameMarkerEnabled" },
 	{ FreeRDP_SuspendInput, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_SuspendInput" },
 	{ FreeRDP_TcpKeepAlive, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_TcpKeepAlive" },
+	{ FreeRDP_TlsKernelOffload, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_TlsKernelOffload" },
 	{ FreeRDP_TlsSecurity, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_TlsSecurity" },
 	{ FreeRDP_ToggleFullscreen, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_ToggleFullscreen" },
 	{ FreeRDP_TransportDump, FREERDP_SETTINGS_TYPE_BOOL, "FreeRDP_TransportDump" },
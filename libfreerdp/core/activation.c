@@ -21,6 +21,8 @@
 
 #include <winpr/assert.h>
 
+#include <freerdp/cache/cache.h>
+
 #include "activation.h"
 #include "display.h"
 
@@ -270,6 +272,61 @@ static BOOL rdp_write_client_persistent_key_list_pdu(wStream* s, RDP_BITMAP_PERS
 	return TRUE;
 }
 
+static UINT32 rdp_load_persistent_store_key_list(rdpRdp* rdp, UINT64** pKeyList)
+{
+	size_t index;
+	size_t count;
+	UINT64* keyList = NULL;
+	PERSISTENT_CACHE_ENTRY* entries = NULL;
+	rdpPersistentStore* store = NULL;
+	rdpPersistentStore* tmp = NULL;
+	rdpSettings* settings = rdp->settings;
+
+	/* on reactivation the bitmap cache may already have the store open */
+	if (rdp->context && rdp->context->cache && rdp->context->cache->bitmap)
+		store = rdp->context->cache->bitmap->store;
+
+	if (!store)
+	{
+		tmp = persistent_store_open(settings->BitmapCachePersistFile, 0);
+		store = tmp;
+	}
+
+	if (!store)
+		return 0;
+
+	count = persistent_store_get_count(store);
+
+	if (count > UINT32_MAX)
+		count = UINT32_MAX;
+
+	if (count < 1)
+		goto out;
+
+	entries = (PERSISTENT_CACHE_ENTRY*)calloc(count, sizeof(PERSISTENT_CACHE_ENTRY));
+	keyList = (UINT64*)calloc(count, sizeof(UINT64));
+
+	if (!entries || !keyList)
+	{
+		free(keyList);
+		keyList = NULL;
+		count = 0;
+		goto out;
+	}
+
+	/* the index alone is enough, most recently used keys come first */
+	count = persistent_store_get_entries(store, entries, count);
+
+	for (index = 0; index < count; index++)
+		keyList[index] = entries[index].key64;
+
+	*pKeyList = keyList;
+out:
+	free(entries);
+	persistent_store_close(tmp);
+	return (UINT32)count;
+}
+
 static UINT32 rdp_load_persistent_key_list(rdpRdp* rdp, UINT64** pKeyList)
 {
 	int index;
@@ -288,6 +345,9 @@ static UINT32 rdp_load_persistent_key_list(rdpRdp* rdp, UINT64** pKeyList)
 	if (!settings->BitmapCachePersistFile)
 		return 0;
 
+	if (settings->BitmapCachePersistStore)
+		return rdp_load_persistent_store_key_list(rdp, pKeyList);
+
 	persistent = persistent_cache_new();
 
 	if (!persistent)
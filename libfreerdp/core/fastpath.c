@@ -292,8 +292,7 @@ static BOOL fastpath_recv_update_common(rdpFastPath* fastpath, wStream* s)
 			if (!bitmap_update)
 				return FALSE;
 
-			rc = IFCALLRESULT(defaultReturn, update->BitmapUpdate, context, bitmap_update);
-			free_bitmap_update(context, bitmap_update);
+			rc = update_dispatch_bitmap_update(update, bitmap_update, defaultReturn);
 		}
 		break;
 
@@ -304,8 +303,7 @@ static BOOL fastpath_recv_update_common(rdpFastPath* fastpath, wStream* s)
 			if (!palette_update)
 				return FALSE;
 
-			rc = IFCALLRESULT(defaultReturn, update->Palette, context, palette_update);
-			free_palette_update(context, palette_update);
+			rc = update_dispatch_palette(update, palette_update, defaultReturn);
 		}
 		break;
 
@@ -358,6 +356,13 @@ static int fastpath_recv_update(rdpFastPath* fastpath, BYTE updateCode, wStream*
 	          fastpath_update_to_string(updateCode), updateCode, Stream_GetRemainingLength(s));
 #endif
 
+	/* forwarded as is, e.g. by a proxy */
+	if (update->FastPathUpdate)
+	{
+		rc = update->FastPathUpdate(context, updateCode, s);
+		goto out;
+	}
+
 	defaultReturn = freerdp_settings_get_bool(context->settings, FreeRDP_DeactivateClientDecoding);
 	switch (updateCode)
 	{
@@ -463,6 +468,7 @@ static int fastpath_recv_update(rdpFastPath* fastpath, BYTE updateCode, wStream*
 			break;
 	}
 
+out:
 	Stream_SetPosition(s, 0);
 	if (!rc)
 	{
@@ -1065,6 +1071,7 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 	UINT16 maxLength;
 	UINT32 totalLength;
 	BOOL status = TRUE;
+	BOOL corked;
 	wStream* fs = NULL;
 	rdpSettings* settings;
 	rdpRdp* rdp;
@@ -1122,6 +1129,9 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			rdp->sec_flags |= SEC_SECURE_CHECKSUM;
 	}
 
+	/* fragments of one update are sent together */
+	corked = (totalLength > maxLength) && transport_cork(rdp->transport);
+
 	for (fragment = 0; (totalLength > 0) || (fragment == 0); fragment++)
 	{
 		const BYTE* pSrcData;
@@ -1203,7 +1213,11 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		fastpath_write_update_header(fs, &fpUpdateHeader);
 
 		if (Stream_GetRemainingCapacity(fs) < (size_t)DstSize + pad)
-			return FALSE;
+		{
+			status = FALSE;
+			break;
+		}
+
 		Stream_Write(fs, pDstData, DstSize);
 
 		if (pad)
@@ -1217,7 +1231,10 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			if (rdp->settings->EncryptionMethods == ENCRYPTION_METHOD_FIPS)
 			{
 				if (!security_hmac_signature(data, dataSize - pad, pSignature, rdp))
-					return FALSE;
+				{
+					status = FALSE;
+					break;
+				}
 
 				security_fips_encrypt(data, dataSize, rdp);
 			}
@@ -1229,7 +1246,10 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 					status = security_mac_signature(rdp, data, dataSize, pSignature);
 
 				if (!status || !security_encrypt(data, dataSize, rdp))
-					return FALSE;
+				{
+					status = FALSE;
+					break;
+				}
 			}
 		}
 
@@ -1244,6 +1264,9 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		Stream_Seek(s, SrcSize);
 	}
 
+	if (corked && !transport_uncork(rdp->transport))
+		status = FALSE;
+
 	rdp->sec_flags = 0;
 	return status;
 }
@@ -1037,6 +1037,20 @@ ULONG freerdp_get_transport_sent(rdpContext* context, BOOL resetCount)
 	return transport_get_bytes_sent(context->rdp->transport, resetCount);
 }
 
+BOOL freerdp_transport_cork(rdpContext* context)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->rdp);
+	return transport_cork(context->rdp->transport);
+}
+
+BOOL freerdp_transport_uncork(rdpContext* context)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->rdp);
+	return transport_uncork(context->rdp->transport);
+}
+
 BOOL freerdp_nla_impersonate(rdpContext* context)
 {
 	rdpNla* nla;
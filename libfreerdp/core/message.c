@@ -43,6 +43,164 @@
 
 #define TAG FREERDP_TAG("core.message")
 
+/* Orders are copied into arenas instead of individual allocations. Every allocation holds a
+ * reference on its arena, the receiving thread holds one on the arena it currently fills and
+ * drops it at the end of each update PDU. Arenas no longer referenced are recycled. */
+#define UPDATE_BATCH_SIZE (64 * 1024)
+
+struct s_rdp_update_batch
+{
+	volatile LONG refs;
+	wObjectPool* pool;
+	size_t size;
+	size_t used;
+	BYTE* data;
+};
+
+typedef union
+{
+	rdpUpdateBatch* batch;
+	UINT64 align[2];
+} UPDATE_BATCH_HEADER;
+
+static rdpUpdateBatch* update_batch_new(size_t size, wObjectPool* pool)
+{
+	rdpUpdateBatch* batch = (rdpUpdateBatch*)calloc(1, sizeof(rdpUpdateBatch));
+
+	if (!batch)
+		return NULL;
+
+	batch->refs = 1;
+	batch->pool = pool;
+	batch->size = size;
+	batch->data = (BYTE*)malloc(size);
+
+	if (!batch->data)
+	{
+		free(batch);
+		return NULL;
+	}
+
+	return batch;
+}
+
+static void update_batch_free(void* obj)
+{
+	rdpUpdateBatch* batch = (rdpUpdateBatch*)obj;
+
+	if (!batch)
+		return;
+
+	free(batch->data);
+	free(batch);
+}
+
+static void* update_batch_pool_new(const void* val)
+{
+	WINPR_UNUSED(val);
+	return update_batch_new(UPDATE_BATCH_SIZE, NULL);
+}
+
+static void update_batch_release(rdpUpdateBatch* batch)
+{
+	if (!batch || (InterlockedDecrement(&batch->refs) > 0))
+		return;
+
+	if (batch->pool)
+	{
+		batch->refs = 1;
+		batch->used = 0;
+		ObjectPool_Return(batch->pool, batch);
+	}
+	else
+		update_batch_free(batch);
+}
+
+static void* update_message_alloc(rdp_update_internal* up, size_t size)
+{
+	UPDATE_BATCH_HEADER* header;
+	rdpUpdateBatch* batch = up->batch;
+	const size_t length = sizeof(UPDATE_BATCH_HEADER) + ((size + 15) & ~(size_t)15);
+
+	if (length > UPDATE_BATCH_SIZE / 4)
+	{
+		/* large payloads get an arena of their own, the allocation takes its reference */
+		batch = update_batch_new(length, NULL);
+
+		if (!batch)
+			return NULL;
+	}
+	else
+	{
+		if (!batch || (batch->used + length > batch->size))
+		{
+			if (!up->batches)
+			{
+				up->batches = ObjectPool_New(TRUE);
+
+				if (!up->batches)
+					return NULL;
+
+				ObjectPool_Object(up->batches)->fnObjectNew = update_batch_pool_new;
+				ObjectPool_Object(up->batches)->fnObjectFree = update_batch_free;
+			}
+
+			update_batch_release(batch);
+			batch = up->batch = (rdpUpdateBatch*)ObjectPool_Take(up->batches);
+
+			if (!batch)
+				return NULL;
+
+			batch->pool = up->batches;
+		}
+
+		InterlockedIncrement(&batch->refs);
+	}
+
+	header = (UPDATE_BATCH_HEADER*)&batch->data[batch->used];
+	header->batch = batch;
+	batch->used += length;
+	return &header[1];
+}
+
+static void* update_message_copy(rdp_update_internal* up, const void* data, size_t size)
+{
+	void* copy = update_message_alloc(up, size);
+
+	if (copy && (size > 0))
+		CopyMemory(copy, data, size);
+
+	return copy;
+}
+
+static void update_message_release(void* data)
+{
+	const UPDATE_BATCH_HEADER* header = (const UPDATE_BATCH_HEADER*)data;
+
+	if (header)
+		update_batch_release(header[-1].batch);
+}
+
+/* an update or order handed over by the receiver is queued as is */
+static BOOL update_message_take(rdp_update_internal* up, const void* data)
+{
+	if (up->handoff != data)
+		return FALSE;
+
+	up->handoff = NULL;
+	return TRUE;
+}
+
+void update_message_batches_free(rdpUpdate* update)
+{
+	rdp_update_internal* up = update_cast(update);
+
+	update_batch_release(up->batch);
+	up->batch = NULL;
+	ObjectPool_Free(up->batches);
+	up->batches = NULL;
+}
+
 /* Update */
 
 static BOOL update_message_BeginPaint(rdpContext* context)
@@ -65,6 +223,11 @@ static BOOL update_message_EndPaint(rdpContext* context)
 		return FALSE;
 
 	up = update_cast(context->update);
+
+	/* the next update PDU starts a new arena */
+	update_batch_release(up->batch);
+	up->batch = NULL;
+
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, EndPaint), NULL,
 	                         NULL);
 }
@@ -77,17 +240,16 @@ static BOOL update_message_SetBounds(rdpContext* context, const rdpBounds* bound
 	if (!context || !context->update)
 		return FALSE;
 
+	up = update_cast(context->update);
+
 	if (bounds)
 	{
-		wParam = (rdpBounds*)malloc(sizeof(rdpBounds));
+		wParam = (rdpBounds*)update_message_copy(up, bounds, sizeof(rdpBounds));
 
 		if (!wParam)
 			return FALSE;
-
-		CopyMemory(wParam, bounds, sizeof(rdpBounds));
 	}
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, SetBounds),
 	                         (void*)wParam, NULL);
 }
@@ -124,14 +286,24 @@ static BOOL update_message_BitmapUpdate(rdpContext* context, const BITMAP_UPDATE
 	if (!context || !context->update || !bitmap)
 		return FALSE;
 
-	wParam = copy_bitmap_update(context, bitmap);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, bitmap))
+		wParam = (BITMAP_UPDATE*)bitmap;
+	else
+		wParam = copy_bitmap_update(context, bitmap);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, BitmapUpdate),
-	                         (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, BitmapUpdate),
+	                       (void*)wParam, NULL))
+	{
+		free_bitmap_update(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_Palette(rdpContext* context, const PALETTE_UPDATE* palette)
@@ -142,14 +314,24 @@ static BOOL update_message_Palette(rdpContext* context, const PALETTE_UPDATE* pa
 	if (!context || !context->update || !palette)
 		return FALSE;
 
-	wParam = copy_palette_update(context, palette);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, palette))
+		wParam = (PALETTE_UPDATE*)palette;
+	else
+		wParam = copy_palette_update(context, palette);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, Palette),
-	                         (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, Palette),
+	                       (void*)wParam, NULL))
+	{
+		free_palette_update(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_PlaySound(rdpContext* context, const PLAY_SOUND_UPDATE* playSound)
@@ -326,14 +508,12 @@ static BOOL update_message_DstBlt(rdpContext* context, const DSTBLT_ORDER* dstBl
 	if (!context || !context->update || !dstBlt)
 		return FALSE;
 
-	wParam = (DSTBLT_ORDER*)malloc(sizeof(DSTBLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (DSTBLT_ORDER*)update_message_copy(up, dstBlt, sizeof(DSTBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, dstBlt, sizeof(DSTBLT_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, DstBlt),
 	                         (void*)wParam, NULL);
 }
@@ -346,15 +526,13 @@ static BOOL update_message_PatBlt(rdpContext* context, PATBLT_ORDER* patBlt)
 	if (!context || !context->update || !patBlt)
 		return FALSE;
 
-	wParam = (PATBLT_ORDER*)malloc(sizeof(PATBLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (PATBLT_ORDER*)update_message_copy(up, patBlt, sizeof(PATBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, patBlt, sizeof(PATBLT_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, PatBlt),
 	                         (void*)wParam, NULL);
 }
@@ -367,14 +545,12 @@ static BOOL update_message_ScrBlt(rdpContext* context, const SCRBLT_ORDER* scrBl
 	if (!context || !context->update || !scrBlt)
 		return FALSE;
 
-	wParam = (SCRBLT_ORDER*)malloc(sizeof(SCRBLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (SCRBLT_ORDER*)update_message_copy(up, scrBlt, sizeof(SCRBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, scrBlt, sizeof(SCRBLT_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, ScrBlt),
 	                         (void*)wParam, NULL);
 }
@@ -387,14 +563,12 @@ static BOOL update_message_OpaqueRect(rdpContext* context, const OPAQUE_RECT_ORD
 	if (!context || !context->update || !opaqueRect)
 		return FALSE;
 
-	wParam = (OPAQUE_RECT_ORDER*)malloc(sizeof(OPAQUE_RECT_ORDER));
+	up = update_cast(context->update);
+	wParam = (OPAQUE_RECT_ORDER*)update_message_copy(up, opaqueRect, sizeof(OPAQUE_RECT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, opaqueRect, sizeof(OPAQUE_RECT_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, OpaqueRect),
 	                         (void*)wParam, NULL);
 }
@@ -408,14 +582,13 @@ static BOOL update_message_DrawNineGrid(rdpContext* context,
 	if (!context || !context->update || !drawNineGrid)
 		return FALSE;
 
-	wParam = (DRAW_NINE_GRID_ORDER*)malloc(sizeof(DRAW_NINE_GRID_ORDER));
+	up = update_cast(context->update);
+	wParam = (DRAW_NINE_GRID_ORDER*)update_message_copy(up, drawNineGrid,
+	                                                    sizeof(DRAW_NINE_GRID_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, drawNineGrid, sizeof(DRAW_NINE_GRID_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, DrawNineGrid),
 	                         (void*)wParam, NULL);
 }
@@ -428,14 +601,12 @@ static BOOL update_message_MultiDstBlt(rdpContext* context, const MULTI_DSTBLT_O
 	if (!context || !context->update || !multiDstBlt)
 		return FALSE;
 
-	wParam = (MULTI_DSTBLT_ORDER*)malloc(sizeof(MULTI_DSTBLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (MULTI_DSTBLT_ORDER*)update_message_copy(up, multiDstBlt, sizeof(MULTI_DSTBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, multiDstBlt, sizeof(MULTI_DSTBLT_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MultiDstBlt),
 	                         (void*)wParam, NULL);
 }
@@ -448,15 +619,13 @@ static BOOL update_message_MultiPatBlt(rdpContext* context, const MULTI_PATBLT_O
 	if (!context || !context->update || !multiPatBlt)
 		return FALSE;
 
-	wParam = (MULTI_PATBLT_ORDER*)malloc(sizeof(MULTI_PATBLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (MULTI_PATBLT_ORDER*)update_message_copy(up, multiPatBlt, sizeof(MULTI_PATBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, multiPatBlt, sizeof(MULTI_PATBLT_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MultiPatBlt),
 	                         (void*)wParam, NULL);
 }
@@ -469,14 +638,12 @@ static BOOL update_message_MultiScrBlt(rdpContext* context, const MULTI_SCRBLT_O
 	if (!context || !context->update || !multiScrBlt)
 		return FALSE;
 
-	wParam = (MULTI_SCRBLT_ORDER*)malloc(sizeof(MULTI_SCRBLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (MULTI_SCRBLT_ORDER*)update_message_copy(up, multiScrBlt, sizeof(MULTI_SCRBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, multiScrBlt, sizeof(MULTI_SCRBLT_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MultiScrBlt),
 	                         (void*)wParam, NULL);
 }
@@ -490,14 +657,13 @@ static BOOL update_message_MultiOpaqueRect(rdpContext* context,
 	if (!context || !context->update || !multiOpaqueRect)
 		return FALSE;
 
-	wParam = (MULTI_OPAQUE_RECT_ORDER*)malloc(sizeof(MULTI_OPAQUE_RECT_ORDER));
+	up = update_cast(context->update);
+	wParam = (MULTI_OPAQUE_RECT_ORDER*)update_message_copy(up, multiOpaqueRect,
+	                                                       sizeof(MULTI_OPAQUE_RECT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, multiOpaqueRect, sizeof(MULTI_OPAQUE_RECT_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(PrimaryUpdate, MultiOpaqueRect), (void*)wParam, NULL);
 }
@@ -511,15 +677,14 @@ static BOOL update_message_MultiDrawNineGrid(rdpContext* context,
 	if (!context || !context->update || !multiDrawNineGrid)
 		return FALSE;
 
-	wParam = (MULTI_DRAW_NINE_GRID_ORDER*)malloc(sizeof(MULTI_DRAW_NINE_GRID_ORDER));
+	up = update_cast(context->update);
+	wParam = (MULTI_DRAW_NINE_GRID_ORDER*)update_message_copy(up, multiDrawNineGrid,
+	                                                          sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, multiDrawNineGrid, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(PrimaryUpdate, MultiDrawNineGrid), (void*)wParam, NULL);
 }
@@ -532,14 +697,12 @@ static BOOL update_message_LineTo(rdpContext* context, const LINE_TO_ORDER* line
 	if (!context || !context->update || !lineTo)
 		return FALSE;
 
-	wParam = (LINE_TO_ORDER*)malloc(sizeof(LINE_TO_ORDER));
+	up = update_cast(context->update);
+	wParam = (LINE_TO_ORDER*)update_message_copy(up, lineTo, sizeof(LINE_TO_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, lineTo, sizeof(LINE_TO_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, LineTo),
 	                         (void*)wParam, NULL);
 }
@@ -552,23 +715,20 @@ static BOOL update_message_Polyline(rdpContext* context, const POLYLINE_ORDER* p
 	if (!context || !context->update || !polyline)
 		return FALSE;
 
-	wParam = (POLYLINE_ORDER*)malloc(sizeof(POLYLINE_ORDER));
+	up = update_cast(context->update);
+	wParam = (POLYLINE_ORDER*)update_message_copy(up, polyline, sizeof(POLYLINE_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, polyline, sizeof(POLYLINE_ORDER));
-	wParam->points = (DELTA_POINT*)calloc(wParam->numDeltaEntries, sizeof(DELTA_POINT));
+	wParam->points = (DELTA_POINT*)update_message_copy(
+	    up, polyline->points, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_release(wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->points, polyline->points, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, Polyline),
 	                         (void*)wParam, NULL);
 }
@@ -581,14 +741,12 @@ static BOOL update_message_MemBlt(rdpContext* context, MEMBLT_ORDER* memBlt)
 	if (!context || !context->update || !memBlt)
 		return FALSE;
 
-	wParam = (MEMBLT_ORDER*)malloc(sizeof(MEMBLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (MEMBLT_ORDER*)update_message_copy(up, memBlt, sizeof(MEMBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, memBlt, sizeof(MEMBLT_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MemBlt),
 	                         (void*)wParam, NULL);
 }
@@ -601,15 +759,13 @@ static BOOL update_message_Mem3Blt(rdpContext* context, MEM3BLT_ORDER* mem3Blt)
 	if (!context || !context->update || !mem3Blt)
 		return FALSE;
 
-	wParam = (MEM3BLT_ORDER*)malloc(sizeof(MEM3BLT_ORDER));
+	up = update_cast(context->update);
+	wParam = (MEM3BLT_ORDER*)update_message_copy(up, mem3Blt, sizeof(MEM3BLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, mem3Blt, sizeof(MEM3BLT_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, Mem3Blt),
 	                         (void*)wParam, NULL);
 }
@@ -622,14 +778,12 @@ static BOOL update_message_SaveBitmap(rdpContext* context, const SAVE_BITMAP_ORD
 	if (!context || !context->update || !saveBitmap)
 		return FALSE;
 
-	wParam = (SAVE_BITMAP_ORDER*)malloc(sizeof(SAVE_BITMAP_ORDER));
+	up = update_cast(context->update);
+	wParam = (SAVE_BITMAP_ORDER*)update_message_copy(up, saveBitmap, sizeof(SAVE_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, saveBitmap, sizeof(SAVE_BITMAP_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, SaveBitmap),
 	                         (void*)wParam, NULL);
 }
@@ -642,15 +796,13 @@ static BOOL update_message_GlyphIndex(rdpContext* context, GLYPH_INDEX_ORDER* gl
 	if (!context || !context->update || !glyphIndex)
 		return FALSE;
 
-	wParam = (GLYPH_INDEX_ORDER*)malloc(sizeof(GLYPH_INDEX_ORDER));
+	up = update_cast(context->update);
+	wParam = (GLYPH_INDEX_ORDER*)update_message_copy(up, glyphIndex, sizeof(GLYPH_INDEX_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, glyphIndex, sizeof(GLYPH_INDEX_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, GlyphIndex),
 	                         (void*)wParam, NULL);
 }
@@ -663,14 +815,12 @@ static BOOL update_message_FastIndex(rdpContext* context, const FAST_INDEX_ORDER
 	if (!context || !context->update || !fastIndex)
 		return FALSE;
 
-	wParam = (FAST_INDEX_ORDER*)malloc(sizeof(FAST_INDEX_ORDER));
+	up = update_cast(context->update);
+	wParam = (FAST_INDEX_ORDER*)update_message_copy(up, fastIndex, sizeof(FAST_INDEX_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, fastIndex, sizeof(FAST_INDEX_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, FastIndex),
 	                         (void*)wParam, NULL);
 }
@@ -683,31 +833,28 @@ static BOOL update_message_FastGlyph(rdpContext* context, const FAST_GLYPH_ORDER
 	if (!context || !context->update || !fastGlyph)
 		return FALSE;
 
-	wParam = (FAST_GLYPH_ORDER*)malloc(sizeof(FAST_GLYPH_ORDER));
+	up = update_cast(context->update);
+	wParam = (FAST_GLYPH_ORDER*)update_message_copy(up, fastGlyph, sizeof(FAST_GLYPH_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, fastGlyph, sizeof(FAST_GLYPH_ORDER));
-
 	if (wParam->cbData > 1)
 	{
-		wParam->glyphData.aj = (BYTE*)malloc(fastGlyph->glyphData.cb);
+		wParam->glyphData.aj =
+		    (BYTE*)update_message_copy(up, fastGlyph->glyphData.aj, fastGlyph->glyphData.cb);
 
 		if (!wParam->glyphData.aj)
 		{
-			free(wParam);
+			update_message_release(wParam);
 			return FALSE;
 		}
-
-		CopyMemory(wParam->glyphData.aj, fastGlyph->glyphData.aj, fastGlyph->glyphData.cb);
 	}
 	else
 	{
 		wParam->glyphData.aj = NULL;
 	}
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, FastGlyph),
 	                         (void*)wParam, NULL);
 }
@@ -720,23 +867,20 @@ static BOOL update_message_PolygonSC(rdpContext* context, const POLYGON_SC_ORDER
 	if (!context || !context->update || !polygonSC)
 		return FALSE;
 
-	wParam = (POLYGON_SC_ORDER*)malloc(sizeof(POLYGON_SC_ORDER));
+	up = update_cast(context->update);
+	wParam = (POLYGON_SC_ORDER*)update_message_copy(up, polygonSC, sizeof(POLYGON_SC_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, polygonSC, sizeof(POLYGON_SC_ORDER));
-	wParam->points = (DELTA_POINT*)calloc(wParam->numPoints, sizeof(DELTA_POINT));
+	wParam->points = (DELTA_POINT*)update_message_copy(up, polygonSC->points,
+	                                                   sizeof(DELTA_POINT) * wParam->numPoints);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_release(wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->points, polygonSC, sizeof(DELTA_POINT) * wParam->numPoints);
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, PolygonSC),
 	                         (void*)wParam, NULL);
 }
@@ -749,24 +893,21 @@ static BOOL update_message_PolygonCB(rdpContext* context, POLYGON_CB_ORDER* poly
 	if (!context || !context->update || !polygonCB)
 		return FALSE;
 
-	wParam = (POLYGON_CB_ORDER*)malloc(sizeof(POLYGON_CB_ORDER));
+	up = update_cast(context->update);
+	wParam = (POLYGON_CB_ORDER*)update_message_copy(up, polygonCB, sizeof(POLYGON_CB_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, polygonCB, sizeof(POLYGON_CB_ORDER));
-	wParam->points = (DELTA_POINT*)calloc(wParam->numPoints, sizeof(DELTA_POINT));
+	wParam->points = (DELTA_POINT*)update_message_copy(up, polygonCB->points,
+	                                                   sizeof(DELTA_POINT) * wParam->numPoints);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_release(wParam);
 		return FALSE;
 	}
-
-	CopyMemory(wParam->points, polygonCB, sizeof(DELTA_POINT) * wParam->numPoints);
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, PolygonCB),
 	                         (void*)wParam, NULL);
 }
@@ -779,14 +920,12 @@ static BOOL update_message_EllipseSC(rdpContext* context, const ELLIPSE_SC_ORDER
 	if (!context || !context->update || !ellipseSC)
 		return FALSE;
 
-	wParam = (ELLIPSE_SC_ORDER*)malloc(sizeof(ELLIPSE_SC_ORDER));
+	up = update_cast(context->update);
+	wParam = (ELLIPSE_SC_ORDER*)update_message_copy(up, ellipseSC, sizeof(ELLIPSE_SC_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, ellipseSC, sizeof(ELLIPSE_SC_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, EllipseSC),
 	                         (void*)wParam, NULL);
 }
@@ -799,15 +938,13 @@ static BOOL update_message_EllipseCB(rdpContext* context, const ELLIPSE_CB_ORDER
 	if (!context || !context->update || !ellipseCB)
 		return FALSE;
 
-	wParam = (ELLIPSE_CB_ORDER*)malloc(sizeof(ELLIPSE_CB_ORDER));
+	up = update_cast(context->update);
+	wParam = (ELLIPSE_CB_ORDER*)update_message_copy(up, ellipseCB, sizeof(ELLIPSE_CB_ORDER));
 
 	if (!wParam)
 		return FALSE;
-
-	CopyMemory(wParam, ellipseCB, sizeof(ELLIPSE_CB_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, EllipseCB),
 	                         (void*)wParam, NULL);
 }
@@ -823,14 +960,24 @@ static BOOL update_message_CacheBitmap(rdpContext* context,
 	if (!context || !context->update || !cacheBitmapOrder)
 		return FALSE;
 
-	wParam = copy_cache_bitmap_order(context, cacheBitmapOrder);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, cacheBitmapOrder))
+		wParam = (CACHE_BITMAP_ORDER*)cacheBitmapOrder;
+	else
+		wParam = copy_cache_bitmap_order(context, cacheBitmapOrder);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBitmap),
-	                         (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBitmap),
+	                       (void*)wParam, NULL))
+	{
+		free_cache_bitmap_order(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_CacheBitmapV2(rdpContext* context,
@@ -842,14 +989,24 @@ static BOOL update_message_CacheBitmapV2(rdpContext* context,
 	if (!context || !context->update || !cacheBitmapV2Order)
 		return FALSE;
 
-	wParam = copy_cache_bitmap_v2_order(context, cacheBitmapV2Order);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, cacheBitmapV2Order))
+		wParam = (CACHE_BITMAP_V2_ORDER*)cacheBitmapV2Order;
+	else
+		wParam = copy_cache_bitmap_v2_order(context, cacheBitmapV2Order);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheBitmapV2), (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBitmapV2),
+	                       (void*)wParam, NULL))
+	{
+		free_cache_bitmap_v2_order(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_CacheBitmapV3(rdpContext* context,
@@ -861,14 +1018,24 @@ static BOOL update_message_CacheBitmapV3(rdpContext* context,
 	if (!context || !context->update || !cacheBitmapV3Order)
 		return FALSE;
 
-	wParam = copy_cache_bitmap_v3_order(context, cacheBitmapV3Order);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, cacheBitmapV3Order))
+		wParam = (CACHE_BITMAP_V3_ORDER*)cacheBitmapV3Order;
+	else
+		wParam = copy_cache_bitmap_v3_order(context, cacheBitmapV3Order);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheBitmapV3), (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBitmapV3),
+	                       (void*)wParam, NULL))
+	{
+		free_cache_bitmap_v3_order(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_CacheColorTable(rdpContext* context,
@@ -880,14 +1047,24 @@ static BOOL update_message_CacheColorTable(rdpContext* context,
 	if (!context || !context->update || !cacheColorTableOrder)
 		return FALSE;
 
-	wParam = copy_cache_color_table_order(context, cacheColorTableOrder);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, cacheColorTableOrder))
+		wParam = (CACHE_COLOR_TABLE_ORDER*)cacheColorTableOrder;
+	else
+		wParam = copy_cache_color_table_order(context, cacheColorTableOrder);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheColorTable), (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context,
+	                       MakeMessageId(SecondaryUpdate, CacheColorTable), (void*)wParam, NULL))
+	{
+		free_cache_color_table_order(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_CacheGlyph(rdpContext* context, const CACHE_GLYPH_ORDER* cacheGlyphOrder)
@@ -898,14 +1075,24 @@ static BOOL update_message_CacheGlyph(rdpContext* context, const CACHE_GLYPH_ORD
 	if (!context || !context->update || !cacheGlyphOrder)
 		return FALSE;
 
-	wParam = copy_cache_glyph_order(context, cacheGlyphOrder);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, cacheGlyphOrder))
+		wParam = (CACHE_GLYPH_ORDER*)cacheGlyphOrder;
+	else
+		wParam = copy_cache_glyph_order(context, cacheGlyphOrder);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheGlyph),
-	                         (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheGlyph),
+	                       (void*)wParam, NULL))
+	{
+		free_cache_glyph_order(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_CacheGlyphV2(rdpContext* context,
@@ -917,14 +1104,24 @@ static BOOL update_message_CacheGlyphV2(rdpContext* context,
 	if (!context || !context->update || !cacheGlyphV2Order)
 		return FALSE;
 
-	wParam = copy_cache_glyph_v2_order(context, cacheGlyphV2Order);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, cacheGlyphV2Order))
+		wParam = (CACHE_GLYPH_V2_ORDER*)cacheGlyphV2Order;
+	else
+		wParam = copy_cache_glyph_v2_order(context, cacheGlyphV2Order);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheGlyphV2), (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheGlyphV2),
+	                       (void*)wParam, NULL))
+	{
+		free_cache_glyph_v2_order(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static BOOL update_message_CacheBrush(rdpContext* context, const CACHE_BRUSH_ORDER* cacheBrushOrder)
@@ -935,18 +1132,30 @@ static BOOL update_message_CacheBrush(rdpContext* context, const CACHE_BRUSH_ORD
 	if (!context || !context->update || !cacheBrushOrder)
 		return FALSE;
 
-	wParam = copy_cache_brush_order(context, cacheBrushOrder);
+	up = update_cast(context->update);
+
+	if (update_message_take(up, cacheBrushOrder))
+		wParam = (CACHE_BRUSH_ORDER*)cacheBrushOrder;
+	else
+		wParam = copy_cache_brush_order(context, cacheBrushOrder);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBrush),
-	                         (void*)wParam, NULL);
+	if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBrush),
+	                       (void*)wParam, NULL))
+	{
+		free_cache_brush_order(context, wParam);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 /* Alternate Secondary Update */
 
+/* unlike secondary orders these are kept in the parser and reused, so they are copied */
+
 static BOOL
 update_message_CreateOffscreenBitmap(rdpContext* context,
                                      const CREATE_OFFSCREEN_BITMAP_ORDER* createOffscreenBitmap)
@@ -957,26 +1166,24 @@ update_message_CreateOffscreenBitmap(rdpContext* context,
 	if (!context || !context->update || !createOffscreenBitmap)
 		return FALSE;
 
-	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*)malloc(sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
+	up = update_cast(context->update);
+	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*)update_message_copy(
+	    up, createOffscreenBitmap, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, createOffscreenBitmap, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
-	wParam->deleteList.cIndices = createOffscreenBitmap->deleteList.cIndices;
 	wParam->deleteList.sIndices = wParam->deleteList.cIndices;
-	wParam->deleteList.indices = (UINT16*)calloc(wParam->deleteList.cIndices, sizeof(UINT16));
+	wParam->deleteList.indices = (UINT16*)update_message_copy(
+	    up, createOffscreenBitmap->deleteList.indices,
+	    sizeof(UINT16) * wParam->deleteList.cIndices);
 
 	if (!wParam->deleteList.indices)
 	{
-		free(wParam);
+		update_message_release(wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->deleteList.indices, createOffscreenBitmap->deleteList.indices,
-	           wParam->deleteList.cIndices);
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, CreateOffscreenBitmap), (void*)wParam,
 	                         NULL);
@@ -991,14 +1198,13 @@ static BOOL update_message_SwitchSurface(rdpContext* context,
 	if (!context || !context->update || !switchSurface)
 		return FALSE;
 
-	wParam = (SWITCH_SURFACE_ORDER*)malloc(sizeof(SWITCH_SURFACE_ORDER));
+	up = update_cast(context->update);
+	wParam = (SWITCH_SURFACE_ORDER*)update_message_copy(up, switchSurface,
+	                                                    sizeof(SWITCH_SURFACE_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, switchSurface, sizeof(SWITCH_SURFACE_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(AltSecUpdate, SwitchSurface),
 	                         (void*)wParam, NULL);
 }
@@ -1013,14 +1219,13 @@ update_message_CreateNineGridBitmap(rdpContext* context,
 	if (!context || !context->update || !createNineGridBitmap)
 		return FALSE;
 
-	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*)malloc(sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
+	up = update_cast(context->update);
+	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*)update_message_copy(
+	    up, createNineGridBitmap, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, createNineGridBitmap, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, CreateNineGridBitmap), (void*)wParam,
 	                         NULL);
@@ -1034,14 +1239,12 @@ static BOOL update_message_FrameMarker(rdpContext* context, const FRAME_MARKER_O
 	if (!context || !context->update || !frameMarker)
 		return FALSE;
 
-	wParam = (FRAME_MARKER_ORDER*)malloc(sizeof(FRAME_MARKER_ORDER));
+	up = update_cast(context->update);
+	wParam = (FRAME_MARKER_ORDER*)update_message_copy(up, frameMarker, sizeof(FRAME_MARKER_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, frameMarker, sizeof(FRAME_MARKER_ORDER));
-
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(AltSecUpdate, FrameMarker),
 	                         (void*)wParam, NULL);
 }
@@ -1055,15 +1258,15 @@ static BOOL update_message_StreamBitmapFirst(rdpContext* context,
 	if (!context || !context->update || !streamBitmapFirst)
 		return FALSE;
 
-	wParam = (STREAM_BITMAP_FIRST_ORDER*)malloc(sizeof(STREAM_BITMAP_FIRST_ORDER));
+	up = update_cast(context->update);
+	wParam = (STREAM_BITMAP_FIRST_ORDER*)update_message_copy(up, streamBitmapFirst,
+	                                                         sizeof(STREAM_BITMAP_FIRST_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, streamBitmapFirst, sizeof(STREAM_BITMAP_FIRST_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, StreamBitmapFirst), (void*)wParam, NULL);
 }
@@ -1077,15 +1280,15 @@ static BOOL update_message_StreamBitmapNext(rdpContext* context,
 	if (!context || !context->update || !streamBitmapNext)
 		return FALSE;
 
-	wParam = (STREAM_BITMAP_NEXT_ORDER*)malloc(sizeof(STREAM_BITMAP_NEXT_ORDER));
+	up = update_cast(context->update);
+	wParam = (STREAM_BITMAP_NEXT_ORDER*)update_message_copy(up, streamBitmapNext,
+	                                                        sizeof(STREAM_BITMAP_NEXT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, streamBitmapNext, sizeof(STREAM_BITMAP_NEXT_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, StreamBitmapNext), (void*)wParam, NULL);
 }
@@ -1099,14 +1302,15 @@ static BOOL update_message_DrawGdiPlusFirst(rdpContext* context,
 	if (!context || !context->update || !drawGdiPlusFirst)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_FIRST_ORDER*)malloc(sizeof(DRAW_GDIPLUS_FIRST_ORDER));
+	up = update_cast(context->update);
+	wParam = (DRAW_GDIPLUS_FIRST_ORDER*)update_message_copy(up, drawGdiPlusFirst,
+	                                                        sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, drawGdiPlusFirst, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 	/* TODO: complete copy */
-	up = update_cast(context->update);
+
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, DrawGdiPlusFirst), (void*)wParam, NULL);
 }
@@ -1120,15 +1324,15 @@ static BOOL update_message_DrawGdiPlusNext(rdpContext* context,
 	if (!context || !context->update || !drawGdiPlusNext)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_NEXT_ORDER*)malloc(sizeof(DRAW_GDIPLUS_NEXT_ORDER));
+	up = update_cast(context->update);
+	wParam = (DRAW_GDIPLUS_NEXT_ORDER*)update_message_copy(up, drawGdiPlusNext,
+	                                                       sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, drawGdiPlusNext, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, DrawGdiPlusNext), (void*)wParam, NULL);
 }
@@ -1142,15 +1346,15 @@ static BOOL update_message_DrawGdiPlusEnd(rdpContext* context,
 	if (!context || !context->update || !drawGdiPlusEnd)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_END_ORDER*)malloc(sizeof(DRAW_GDIPLUS_END_ORDER));
+	up = update_cast(context->update);
+	wParam = (DRAW_GDIPLUS_END_ORDER*)update_message_copy(up, drawGdiPlusEnd,
+	                                                      sizeof(DRAW_GDIPLUS_END_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, drawGdiPlusEnd, sizeof(DRAW_GDIPLUS_END_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(AltSecUpdate, DrawGdiPlusEnd),
 	                         (void*)wParam, NULL);
 }
@@ -1165,15 +1369,15 @@ update_message_DrawGdiPlusCacheFirst(rdpContext* context,
 	if (!context || !context->update || !drawGdiPlusCacheFirst)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*)malloc(sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
+	up = update_cast(context->update);
+	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*)update_message_copy(
+	    up, drawGdiPlusCacheFirst, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, drawGdiPlusCacheFirst, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheFirst), (void*)wParam,
 	                         NULL);
@@ -1189,15 +1393,15 @@ update_message_DrawGdiPlusCacheNext(rdpContext* context,
 	if (!context || !context->update || !drawGdiPlusCacheNext)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*)malloc(sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
+	up = update_cast(context->update);
+	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*)update_message_copy(
+	    up, drawGdiPlusCacheNext, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, drawGdiPlusCacheNext, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheNext), (void*)wParam,
 	                         NULL);
@@ -1213,15 +1417,15 @@ update_message_DrawGdiPlusCacheEnd(rdpContext* context,
 	if (!context || !context->update || !drawGdiPlusCacheEnd)
 		return FALSE;
 
-	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*)malloc(sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
+	up = update_cast(context->update);
+	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*)update_message_copy(
+	    up, drawGdiPlusCacheEnd, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
-	CopyMemory(wParam, drawGdiPlusCacheEnd, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
 	return MessageQueue_Post(up->queue, (void*)context,
 	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheEnd), (void*)wParam, NULL);
 }
@@ -1699,7 +1903,7 @@ static BOOL update_message_free_update_class(wMessage* msg, int type)
 			break;
 
 		case Update_SetBounds:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case Update_Synchronize:
@@ -1865,107 +2069,107 @@ static BOOL update_message_free_primary_update_class(wMessage* msg, int type)
 	switch (type)
 	{
 		case PrimaryUpdate_DstBlt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_PatBlt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_ScrBlt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_OpaqueRect:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_DrawNineGrid:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDstBlt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiPatBlt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiScrBlt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiOpaqueRect:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDrawNineGrid:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_LineTo:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_Polyline:
 		{
 			POLYLINE_ORDER* wParam = (POLYLINE_ORDER*)msg->wParam;
-			free(wParam->points);
-			free(wParam);
+			update_message_release(wParam->points);
+			update_message_release(wParam);
 		}
 		break;
 
 		case PrimaryUpdate_MemBlt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_Mem3Blt:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_SaveBitmap:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_GlyphIndex:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastIndex:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastGlyph:
 		{
 			FAST_GLYPH_ORDER* wParam = (FAST_GLYPH_ORDER*)msg->wParam;
-			free(wParam->glyphData.aj);
-			free(wParam);
+			update_message_release(wParam->glyphData.aj);
+			update_message_release(wParam);
 		}
 		break;
 
 		case PrimaryUpdate_PolygonSC:
 		{
 			POLYGON_SC_ORDER* wParam = (POLYGON_SC_ORDER*)msg->wParam;
-			free(wParam->points);
-			free(wParam);
+			update_message_release(wParam->points);
+			update_message_release(wParam);
 		}
 		break;
 
 		case PrimaryUpdate_PolygonCB:
 		{
 			POLYGON_CB_ORDER* wParam = (POLYGON_CB_ORDER*)msg->wParam;
-			free(wParam->points);
-			free(wParam);
+			update_message_release(wParam->points);
+			update_message_release(wParam);
 		}
 		break;
 
 		case PrimaryUpdate_EllipseSC:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case PrimaryUpdate_EllipseCB:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		default:
@@ -2187,53 +2391,53 @@ static BOOL update_message_free_altsec_update_class(wMessage* msg, int type)
 		case AltSecUpdate_CreateOffscreenBitmap:
 		{
 			CREATE_OFFSCREEN_BITMAP_ORDER* wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*)msg->wParam;
-			free(wParam->deleteList.indices);
-			free(wParam);
+			update_message_release(wParam->deleteList.indices);
+			update_message_release(wParam);
 		}
 		break;
 
 		case AltSecUpdate_SwitchSurface:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_CreateNineGridBitmap:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_FrameMarker:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapFirst:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapNext:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusFirst:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusNext:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusEnd:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheFirst:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheNext:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheEnd:
-			free(msg->wParam);
+			update_message_release(msg->wParam);
 			break;
 
 		default:
@@ -136,6 +136,8 @@ FREERDP_LOCAL int update_message_queue_process_pending_messages(rdpUpdate* updat
 FREERDP_LOCAL rdpUpdateProxy* update_message_proxy_new(rdpUpdate* update);
 FREERDP_LOCAL void update_message_proxy_free(rdpUpdateProxy* message);
 
+FREERDP_LOCAL void update_message_batches_free(rdpUpdate* update);
+
 /**
  * Input Message Queue
  */
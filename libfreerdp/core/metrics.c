@@ -55,3 +55,12 @@ void metrics_free(rdpMetrics* metrics)
 {
 	free(metrics);
 }
+
+void metrics_set_decompression_stopwatch(rdpMetrics* metrics, STOPWATCH* stopwatch)
+{
+	WINPR_ASSERT(metrics);
+	WINPR_ASSERT(metrics->context);
+	WINPR_ASSERT(metrics->context->rdp);
+
+	bulk_set_stopwatch(metrics->context->rdp->bulk, stopwatch);
+}
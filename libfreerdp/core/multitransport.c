@@ -19,33 +19,113 @@
 
 #include <freerdp/config.h>
 
+#include <winpr/assert.h>
+
 #include "multitransport.h"
 
 #include <freerdp/log.h>
 
 #define TAG FREERDP_TAG("core.multitransport")
 
-int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s)
+static const char* multitransport_protocol_string(UINT16 requestedProtocol)
+{
+	switch (requestedProtocol)
+	{
+		case INITITATE_REQUEST_PROTOCOL_UDPFECR:
+			return "UDPFECR";
+		case INITITATE_REQUEST_PROTOCOL_UDPFECL:
+			return "UDPFECL";
+		default:
+			return "unknown";
+	}
+}
+
+/**
+ * The tunnel itself needs RDP-UDP secured with DTLS and bound with MS-RDPEMT, which is not
+ * available yet. Declining tells a server doing soft sync to keep everything on TCP right away
+ * instead of waiting for a tunnel that never comes.
+ */
+int multitransport_client_recv_request(rdpMultitransport* multitransport, wStream* s)
 {
-	UINT32 requestId;
-	UINT16 requestedProtocol;
 	UINT16 reserved;
-	BYTE securityCookie[16];
+	rdpSettings* settings;
+
+	WINPR_ASSERT(multitransport);
+	WINPR_ASSERT(multitransport->rdp);
+
+	settings = multitransport->rdp->settings;
+	WINPR_ASSERT(settings);
 
 	if (!Stream_CheckAndLogRequiredLength(TAG, s, 24))
 		return -1;
 
-	Stream_Read_UINT32(s, requestId);         /* requestId (4 bytes) */
-	Stream_Read_UINT16(s, requestedProtocol); /* requestedProtocol (2 bytes) */
-	Stream_Read_UINT16(s, reserved);          /* reserved (2 bytes) */
-	Stream_Read(s, securityCookie, 16);       /* securityCookie (16 bytes) */
+	Stream_Read_UINT32(s, multitransport->requestId);         /* requestId (4 bytes) */
+	Stream_Read_UINT16(s, multitransport->requestedProtocol); /* requestedProtocol (2 bytes) */
+	Stream_Read_UINT16(s, reserved);                          /* reserved (2 bytes) */
+	Stream_Read(s, multitransport->securityCookie, 16);       /* securityCookie (16 bytes) */
+
+	WLog_DBG(TAG, "Initiate Multitransport Request %" PRIu32 " for %s declined",
+	         multitransport->requestId,
+	         multitransport_protocol_string(multitransport->requestedProtocol));
+
+	if (!(settings->MultitransportFlags & SOFTSYNC_TCP_TO_UDP))
+		return 0;
+
+	if (!multitransport_client_send_response(multitransport, multitransport->requestId, E_ABORT))
+		return -1;
+
+	return 0;
+}
+
+BOOL multitransport_client_send_response(rdpMultitransport* multitransport, UINT32 requestId,
+                                         HRESULT hr)
+{
+	wStream* s;
+
+	WINPR_ASSERT(multitransport);
+
+	s = rdp_message_channel_pdu_init(multitransport->rdp);
+
+	if (!s)
+		return FALSE;
+
+	Stream_Write_UINT32(s, requestId);  /* requestId (4 bytes) */
+	Stream_Write_UINT32(s, (UINT32)hr); /* hrResponse (4 bytes) */
+	return rdp_send_message_channel_pdu(multitransport->rdp, s, SEC_TRANSPORT_RSP);
+}
+
+int multitransport_server_recv_response(rdpMultitransport* multitransport, wStream* s)
+{
+	UINT32 requestId;
+	UINT32 hrResponse;
+
+	WINPR_ASSERT(multitransport);
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 8))
+		return -1;
+
+	Stream_Read_UINT32(s, requestId);  /* requestId (4 bytes) */
+	Stream_Read_UINT32(s, hrResponse); /* hrResponse (4 bytes) */
 
+	multitransport->requestId = requestId;
+	multitransport->hrResponse = (HRESULT)hrResponse;
+	WLog_DBG(TAG, "Initiate Multitransport Response %" PRIu32 ": 0x%08" PRIX32, requestId,
+	         hrResponse);
 	return 0;
 }
 
-rdpMultitransport* multitransport_new(void)
+rdpMultitransport* multitransport_new(rdpRdp* rdp)
 {
-	return (rdpMultitransport*)calloc(1, sizeof(rdpMultitransport));
+	rdpMultitransport* multitransport;
+
+	WINPR_ASSERT(rdp);
+
+	multitransport = (rdpMultitransport*)calloc(1, sizeof(rdpMultitransport));
+
+	if (multitransport)
+		multitransport->rdp = rdp;
+
+	return multitransport;
 }
 
 void multitransport_free(rdpMultitransport* multitransport)
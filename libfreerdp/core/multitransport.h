@@ -29,14 +29,35 @@ typedef struct rdp_multitransport rdpMultitransport;
 
 #include <winpr/stream.h>
 
+/* TS_UD_CS_MULTITRANSPORT / TS_UD_SC_MULTITRANSPORT flags */
+#define TRANSPORTTYPE_UDPFECR 0x00000001
+#define TRANSPORTTYPE_UDPFECL 0x00000004
+#define TRANSPORTTYPE_UDP_PREFERRED 0x00000100
+#define SOFTSYNC_TCP_TO_UDP 0x00000200
+
+/* Initiate Multitransport Request requestedProtocol */
+#define INITITATE_REQUEST_PROTOCOL_UDPFECR 0x0001
+#define INITITATE_REQUEST_PROTOCOL_UDPFECL 0x0002
+
 struct rdp_multitransport
 {
-	UINT32 placeholder;
+	rdpRdp* rdp;
+
+	UINT32 requestId;
+	UINT16 requestedProtocol;
+	BYTE securityCookie[16];
+	HRESULT hrResponse;
 };
 
-FREERDP_LOCAL int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s);
+FREERDP_LOCAL int multitransport_client_recv_request(rdpMultitransport* multitransport,
+                                                     wStream* s);
+FREERDP_LOCAL BOOL multitransport_client_send_response(rdpMultitransport* multitransport,
+                                                       UINT32 requestId, HRESULT hr);
+
+FREERDP_LOCAL int multitransport_server_recv_response(rdpMultitransport* multitransport,
+                                                      wStream* s);
 
-FREERDP_LOCAL rdpMultitransport* multitransport_new(void);
+FREERDP_LOCAL rdpMultitransport* multitransport_new(rdpRdp* rdp);
 FREERDP_LOCAL void multitransport_free(rdpMultitransport* multitransport);
 
 #endif /* FREERDP_LIB_CORE_MULTITRANSPORT_H */
@@ -3836,8 +3836,11 @@ static BOOL update_recv_secondary_order(rdpUpdate* update, wStream* s, BYTE flag
 
 			if (order)
 			{
+				update_handoff_begin(update, order);
 				rc = IFCALLRESULT(defaultReturn, secondary->CacheBitmap, context, order);
-				free_cache_bitmap_order(context, order);
+
+				if (update_handoff_end(update, order))
+					free_cache_bitmap_order(context, order);
 			}
 		}
 		break;
@@ -3851,8 +3854,11 @@ static BOOL update_recv_secondary_order(rdpUpdate* update, wStream* s, BYTE flag
 
 			if (order)
 			{
+				update_handoff_begin(update, order);
 				rc = IFCALLRESULT(defaultReturn, secondary->CacheBitmapV2, context, order);
-				free_cache_bitmap_v2_order(context, order);
+
+				if (update_handoff_end(update, order))
+					free_cache_bitmap_v2_order(context, order);
 			}
 		}
 		break;
@@ -3863,8 +3869,11 @@ static BOOL update_recv_secondary_order(rdpUpdate* update, wStream* s, BYTE flag
 
 			if (order)
 			{
+				update_handoff_begin(update, order);
 				rc = IFCALLRESULT(defaultReturn, secondary->CacheBitmapV3, context, order);
-				free_cache_bitmap_v3_order(context, order);
+
+				if (update_handoff_end(update, order))
+					free_cache_bitmap_v3_order(context, order);
 			}
 		}
 		break;
@@ -3876,8 +3885,11 @@ static BOOL update_recv_secondary_order(rdpUpdate* update, wStream* s, BYTE flag
 
 			if (order)
 			{
+				update_handoff_begin(update, order);
 				rc = IFCALLRESULT(defaultReturn, secondary->CacheColorTable, context, order);
-				free_cache_color_table_order(context, order);
+
+				if (update_handoff_end(update, order))
+					free_cache_color_table_order(context, order);
 			}
 		}
 		break;
@@ -3893,8 +3905,11 @@ static BOOL update_recv_secondary_order(rdpUpdate* update, wStream* s, BYTE flag
 
 					if (order)
 					{
+						update_handoff_begin(update, order);
 						rc = IFCALLRESULT(defaultReturn, secondary->CacheGlyph, context, order);
-						free_cache_glyph_order(context, order);
+
+						if (update_handoff_end(update, order))
+							free_cache_glyph_order(context, order);
 					}
 				}
 				break;
@@ -3906,8 +3921,11 @@ static BOOL update_recv_secondary_order(rdpUpdate* update, wStream* s, BYTE flag
 
 					if (order)
 					{
+						update_handoff_begin(update, order);
 						rc = IFCALLRESULT(defaultReturn, secondary->CacheGlyphV2, context, order);
-						free_cache_glyph_v2_order(context, order);
+
+						if (update_handoff_end(update, order))
+							free_cache_glyph_v2_order(context, order);
 					}
 				}
 				break;
@@ -3926,8 +3944,11 @@ static BOOL update_recv_secondary_order(rdpUpdate* update, wStream* s, BYTE flag
 
 				if (order)
 				{
+					update_handoff_begin(update, order);
 					rc = IFCALLRESULT(defaultReturn, secondary->CacheBrush, context, order);
-					free_cache_brush_order(context, order);
+
+					if (update_handoff_end(update, order))
+						free_cache_brush_order(context, order);
 				}
 			}
 			break;
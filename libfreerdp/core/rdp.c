@@ -1194,7 +1194,13 @@ int rdp_recv_message_channel_pdu(rdpRdp* rdp, wStream* s, UINT16 securityFlags)
 	if (securityFlags & SEC_TRANSPORT_REQ)
 	{
 		/* Initiate Multitransport Request PDU */
-		return rdp_recv_multitransport_packet(rdp, s);
+		return multitransport_client_recv_request(rdp->multitransport, s);
+	}
+
+	if (securityFlags & SEC_TRANSPORT_RSP)
+	{
+		/* Initiate Multitransport Response PDU */
+		return multitransport_server_recv_response(rdp->multitransport, s);
 	}
 
 	return -1;
@@ -1968,7 +1974,7 @@ rdpRdp* rdp_new(rdpContext* context)
 	if (!rdp->heartbeat)
 		goto fail;
 
-	rdp->multitransport = multitransport_new();
+	rdp->multitransport = multitransport_new(rdp);
 
 	if (!rdp->multitransport)
 		goto fail;
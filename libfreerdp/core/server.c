@@ -569,6 +569,7 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen
 {
 	wMessage message;
 	BOOL status = TRUE;
+	BOOL corked = FALSE;
 	WTSVirtualChannelManager* vcm;
 
 	if (!hServer || hServer == INVALID_HANDLE_VALUE)
@@ -582,6 +583,11 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen
 			return FALSE;
 	}
 
+	/* channel PDUs queued together, e.g. the graphics of a frame, leave in one write */
+	WINPR_ASSERT(vcm->rdp);
+	if (MessageQueue_Size(vcm->queue) > 1)
+		corked = transport_cork(vcm->rdp->transport);
+
 	while (MessageQueue_Peek(vcm->queue, &message, TRUE))
 	{
 		BYTE* buffer;
@@ -604,6 +610,9 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen
 			break;
 	}
 
+	if (corked && !transport_uncork(vcm->rdp->transport))
+		status = FALSE;
+
 	return status;
 }
 
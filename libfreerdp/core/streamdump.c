@@ -25,11 +25,14 @@
 #include <winpr/path.h>
 #include <winpr/string.h>
 
+#include <freerdp/log.h>
 #include <freerdp/streamdump.h>
 #include <freerdp/transport_io.h>
 
 #include "streamdump.h"
 
+#define TAG FREERDP_TAG("core.streamdump")
+
 struct stream_dump_context
 {
 	rdpTransportIo io;
@@ -37,6 +40,9 @@ struct stream_dump_context
 	size_t readDumpOffset;
 	size_t replayOffset;
 	UINT64 replayTime;
+	FILE* replayFile;
+	BOOL replayPaced;
+	BOOL replayFinished;
 	CONNECTION_STATE state;
 	BOOL isServer;
 };
@@ -318,7 +324,7 @@ static int stream_dump_replay_transport_write(rdpTransport* transport, wStream*
 	WINPR_ASSERT(s);
 
 	size = Stream_Length(s);
-	WLog_ERR("abc", "replay write %" PRIuz, size);
+	WLog_DBG(TAG, "replay write %" PRIuz, size);
 	// TODO: Compare with write file
 
 	return 1;
@@ -337,10 +343,25 @@ static int stream_dump_replay_transport_read(rdpTransport* transport, wStream* s
 	WINPR_ASSERT(ctx->dump);
 	WINPR_ASSERT(s);
 
+	/* the recording stays open, reopening it for every PDU would dominate a fast replay */
+	if (!ctx->dump->replayFile)
+	{
+		ctx->dump->replayFile = stream_dump_get_file(ctx->settings, "rb");
+		if (!ctx->dump->replayFile)
+			return -1;
+	}
+
 	do
 	{
-		if (stream_dump_get(ctx, &flags, s, &ctx->dump->replayOffset, &ts) < 0)
+		Stream_SetPosition(s, 0);
+		if (!stream_dump_read_line(ctx->dump->replayFile, s, &ts, &ctx->dump->replayOffset,
+		                           &flags))
+		{
+			ctx->dump->replayFinished = feof(ctx->dump->replayFile) != 0;
+			if (ctx->dump->replayFinished)
+				WLog_DBG(TAG, "end of recording reached");
 			return -1;
+		}
 	} while (flags & STREAM_MSG_SRV_RX);
 
 	if ((ctx->dump->replayTime > 0) && (ts > ctx->dump->replayTime))
@@ -349,9 +370,9 @@ static int stream_dump_replay_transport_read(rdpTransport* transport, wStream* s
 
 	size = Stream_Length(s);
 	Stream_SetPosition(s, 0);
-	WLog_ERR("abc", "replay read %" PRIuz, size);
+	WLog_DBG(TAG, "replay read %" PRIuz, size);
 
-	if (slp > 0)
+	if (ctx->dump->replayPaced && (slp > 0))
 		Sleep(slp);
 
 	return 1;
@@ -419,8 +440,25 @@ BOOL stream_dump_register_handlers(rdpContext* context, CONNECTION_STATE state,
 	return stream_dump_register_read_handlers(context);
 }
 
+void stream_dump_set_replay_pacing(rdpContext* context, BOOL paced)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->dump);
+	context->dump->replayPaced = paced;
+}
+
+BOOL stream_dump_replay_finished(const rdpContext* context)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->dump);
+	return context->dump->replayFinished;
+}
+
 void stream_dump_free(rdpStreamDumpContext* dump)
 {
+	if (dump && dump->replayFile)
+		fclose(dump->replayFile);
+
 	free(dump);
 }
 
@@ -430,5 +468,6 @@ rdpStreamDumpContext* stream_dump_new(void)
 	if (!dump)
 		return NULL;
 
+	dump->replayPaced = TRUE;
 	return dump;
 }
@@ -83,6 +83,31 @@
 #include "tcp.h"
 #include "../crypto/opensslcompat.h"
 
+#if defined(WITH_KERNEL_TLS)
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/* OpenSSL only exports the queries, these are sent down the write BIO by libssl itself */
+#ifndef BIO_CTRL_SET_KTLS
+#define BIO_CTRL_SET_KTLS 72
+#endif
+
+#ifndef BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG
+#define BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG 74
+#endif
+
+#ifndef BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG
+#define BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG 75
+#endif
+#endif
+
 #define TAG FREERDP_TAG("core")
 
 /* Simple Socket BIO */
@@ -91,6 +116,10 @@ typedef struct
 {
 	SOCKET socket;
 	HANDLE hEvent;
+#if defined(WITH_KERNEL_TLS)
+	BOOL ktlsSend;
+	int ktlsRecordType;
+#endif
 } WINPR_BIO_SIMPLE_SOCKET;
 
 static int transport_bio_simple_init(BIO* bio, SOCKET socket, int shutdown);
@@ -102,6 +131,105 @@ static long transport_bio_simple_callback(BIO* bio, int mode, const char* argp,
 	return 1;
 }
 
+#if defined(WITH_KERNEL_TLS)
+static size_t transport_bio_simple_ktls_info_length(const struct tls_crypto_info* info)
+{
+	switch (info->cipher_type)
+	{
+		case TLS_CIPHER_AES_GCM_128:
+			return sizeof(struct tls12_crypto_info_aes_gcm_128);
+#ifdef TLS_CIPHER_AES_GCM_256
+		case TLS_CIPHER_AES_GCM_256:
+			return sizeof(struct tls12_crypto_info_aes_gcm_256);
+#endif
+#ifdef TLS_CIPHER_AES_CCM_128
+		case TLS_CIPHER_AES_CCM_128:
+			return sizeof(struct tls12_crypto_info_aes_ccm_128);
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+		case TLS_CIPHER_CHACHA20_POLY1305:
+			return sizeof(struct tls12_crypto_info_chacha20_poly1305);
+#endif
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Called by libssl once the keys are known. Only sending is moved to the kernel, libssl
+ * keeps decrypting what is received if this is refused.
+ */
+static long transport_bio_simple_set_ktls(WINPR_BIO_SIMPLE_SOCKET* ptr, BOOL send,
+                                          const void* info)
+{
+	size_t length;
+	const int sockfd = (int)ptr->socket;
+
+	if (!send || !info)
+		return 0;
+
+	length = transport_bio_simple_ktls_info_length((const struct tls_crypto_info*)info);
+
+	if (length == 0)
+		return 0;
+
+	if ((setsockopt(sockfd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) && (errno != EEXIST))
+	{
+		WLog_DBG(TAG, "kernel TLS is not available: %s", strerror(errno));
+		return 0;
+	}
+
+	if (setsockopt(sockfd, SOL_TLS, TLS_TX, info, (socklen_t)length) != 0)
+	{
+		WLog_DBG(TAG, "kernel TLS does not support the cipher: %s", strerror(errno));
+		return 0;
+	}
+
+	ptr->ktlsSend = TRUE;
+	return 1;
+}
+
+/* records other than application data are sent with their type alongside */
+static int transport_bio_simple_send_record(WINPR_BIO_SIMPLE_SOCKET* ptr, const char* buf,
+                                            int size)
+{
+	int status;
+	struct iovec iov;
+	struct msghdr msg = { 0 };
+	struct cmsghdr* cmsg;
+	char control[CMSG_SPACE(sizeof(unsigned char))] = { 0 };
+	const unsigned char type = (unsigned char)ptr->ktlsRecordType;
+
+	iov.iov_base = (void*)buf;
+	iov.iov_len = (size_t)size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(type));
+	memcpy(CMSG_DATA(cmsg), &type, sizeof(type));
+	msg.msg_controllen = cmsg->cmsg_len;
+	status = (int)sendmsg((int)ptr->socket, &msg, 0);
+
+	if (status > 0)
+		ptr->ktlsRecordType = 0;
+
+	return status;
+}
+#endif
+
+static int transport_bio_simple_send(WINPR_BIO_SIMPLE_SOCKET* ptr, const char* buf, int size)
+{
+#if defined(WITH_KERNEL_TLS)
+	if (ptr->ktlsRecordType != 0)
+		return transport_bio_simple_send_record(ptr, buf, size);
+#endif
+	return _send(ptr->socket, buf, size, 0);
+}
+
 static int transport_bio_simple_write(BIO* bio, const char* buf, int size)
 {
 	int error;
@@ -112,7 +240,7 @@ static int transport_bio_simple_write(BIO* bio, const char* buf, int size)
 		return 0;
 
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE);
-	status = _send(ptr->socket, buf, size, 0);
+	status = transport_bio_simple_send(ptr, buf, size);
 
 	if (status <= 0)
 	{
@@ -337,6 +465,26 @@ static long transport_bio_simple_ctrl(BIO* bio, int cmd, long arg1, void* arg2)
 			status = 1;
 			break;
 
+#if defined(WITH_KERNEL_TLS)
+		case BIO_CTRL_SET_KTLS:
+			status = (int)transport_bio_simple_set_ktls(ptr, arg1 != 0, arg2);
+			break;
+
+		case BIO_CTRL_GET_KTLS_SEND:
+			status = ptr->ktlsSend ? 1 : 0;
+			break;
+
+		case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+			ptr->ktlsRecordType = (int)arg1;
+			status = 1;
+			break;
+
+		case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+			ptr->ktlsRecordType = 0;
+			status = 1;
+			break;
+#endif
+
 		default:
 			status = 0;
 			break;
@@ -349,6 +497,10 @@ static int transport_bio_simple_init(BIO* bio, SOCKET socket, int shutdown)
 {
 	WINPR_BIO_SIMPLE_SOCKET* ptr = (WINPR_BIO_SIMPLE_SOCKET*)BIO_get_data(bio);
 	ptr->socket = socket;
+#if defined(WITH_KERNEL_TLS)
+	ptr->ktlsSend = FALSE;
+	ptr->ktlsRecordType = 0;
+#endif
 	BIO_set_shutdown(bio, shutdown);
 	BIO_set_flags(bio, BIO_FLAGS_SHOULD_RETRY);
 	BIO_set_init(bio, 1);
@@ -453,6 +605,9 @@ typedef struct
 	BOOL readBlocked;
 	BOOL writeBlocked;
 	RingBuffer xmitBuffer;
+#if defined(WITH_KERNEL_TLS)
+	BOOL ktlsRecord;
+#endif
 } WINPR_BIO_BUFFERED_SOCKET;
 
 static long transport_bio_buffered_callback(BIO* bio, int mode, const char* argp, int argi,
@@ -461,6 +616,49 @@ static long transport_bio_buffered_callback(BIO* bio, int mode, const char* argp
 	return 1;
 }
 
+static int transport_bio_buffered_write(BIO* bio, const char* buf, int num);
+
+#if defined(WITH_KERNEL_TLS)
+/* a record the kernel frames with its own type is neither queued nor sent after queued data */
+static int transport_bio_buffered_write_record(BIO* bio, const char* buf, int num)
+{
+	int status;
+	WINPR_BIO_BUFFERED_SOCKET* ptr = (WINPR_BIO_BUFFERED_SOCKET*)BIO_get_data(bio);
+	BIO* next_bio = BIO_next(bio);
+
+	if (ringbuffer_used(&ptr->xmitBuffer))
+	{
+		if (transport_bio_buffered_write(bio, NULL, 0) < 0)
+			return -1;
+
+		if (ringbuffer_used(&ptr->xmitBuffer))
+		{
+			BIO_set_flags(bio, BIO_FLAGS_WRITE | BIO_FLAGS_SHOULD_RETRY);
+			return -1;
+		}
+	}
+
+	ERR_clear_error();
+	status = BIO_write(next_bio, buf, num);
+
+	if (status <= 0)
+	{
+		if (BIO_should_retry(next_bio))
+		{
+			BIO_set_flags(bio, BIO_FLAGS_WRITE | BIO_FLAGS_SHOULD_RETRY);
+			ptr->writeBlocked = TRUE;
+		}
+		else
+			BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+
+		return -1;
+	}
+
+	ptr->ktlsRecord = FALSE;
+	return status;
+}
+#endif
+
 static int transport_bio_buffered_write(BIO* bio, const char* buf, int num)
 {
 	int i, ret;
@@ -473,6 +671,36 @@ static int transport_bio_buffered_write(BIO* bio, const char* buf, int num)
 	ret = num;
 	ptr->writeBlocked = FALSE;
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE);
+	next_bio = BIO_next(bio);
+
+#if defined(WITH_KERNEL_TLS)
+	if (ptr->ktlsRecord && buf && num)
+		return transport_bio_buffered_write_record(bio, buf, num);
+#endif
+
+	/* with nothing queued the data is written without a copy, only the rest is kept */
+	if (buf && num && !ringbuffer_used(&ptr->xmitBuffer))
+	{
+		ERR_clear_error();
+		status = BIO_write(next_bio, buf, num);
+
+		if (status >= num)
+			return ret;
+
+		if (status <= 0)
+		{
+			if (!BIO_should_retry(next_bio))
+			{
+				BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+				return -1;
+			}
+
+			status = 0;
+		}
+
+		buf += status;
+		num -= status;
+	}
 
 	/* we directly append extra bytes in the xmit buffer, this could be prevented
 	 * but for now it makes the code more simple.
@@ -485,7 +713,6 @@ static int transport_bio_buffered_write(BIO* bio, const char* buf, int num)
 
 	committedBytes = 0;
 	nchunks = ringbuffer_peek(&ptr->xmitBuffer, chunks, ringbuffer_used(&ptr->xmitBuffer));
-	next_bio = BIO_next(bio);
 
 	for (i = 0; i < nchunks; i++)
 	{
@@ -595,6 +822,27 @@ static long transport_bio_buffered_ctrl(BIO* bio, int cmd, long arg1, void* arg2
 			status = (int)ptr->writeBlocked;
 			break;
 
+#if defined(WITH_KERNEL_TLS)
+		case BIO_CTRL_SET_KTLS:
+			/* what is still queued was encrypted by libssl */
+			if (ringbuffer_used(&ptr->xmitBuffer))
+				status = 0;
+			else
+				status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
+
+			break;
+
+		case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+			ptr->ktlsRecord = TRUE;
+			status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
+			break;
+
+		case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+			ptr->ktlsRecord = FALSE;
+			status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
+			break;
+#endif
+
 		default:
 			status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
 			break;
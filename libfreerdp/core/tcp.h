@@ -35,9 +35,16 @@
 #include <winpr/crypto.h>
 
 #include <openssl/bio.h>
+#include <openssl/ssl.h>
 
 #include <freerdp/utils/ringbuffer.h>
 
+/* the socket BIO can take over the record layer of libssl, see tls_prepare */
+#if defined(__linux__) && defined(HAVE_LINUX_TLS_H) && defined(SSL_OP_ENABLE_KTLS) && \
+    !defined(OPENSSL_NO_KTLS)
+#define WITH_KERNEL_TLS
+#endif
+
 #define BIO_TYPE_TSG 65
 #define BIO_TYPE_SIMPLE 66
 #define BIO_TYPE_BUFFERED 67
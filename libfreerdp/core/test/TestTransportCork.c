@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <freerdp/freerdp.h>
+
+#include "../rdp.h"
+#include "../transport.h"
+
+#define TEST_PDU_SIZE 100
+#define TEST_LARGE_SIZE 70000
+
+static wStream* test_pdu(size_t size, BYTE value)
+{
+	wStream* s = Stream_New(NULL, size);
+
+	if (!s)
+		return NULL;
+
+	memset(Stream_Buffer(s), value, size);
+	Stream_Seek(s, size);
+	return s;
+}
+
+static BOOL test_receive(int fd, size_t size, BYTE first)
+{
+	size_t x;
+	size_t received = 0;
+	BYTE* buffer = (BYTE*)malloc(size);
+	BOOL rc = FALSE;
+
+	if (!buffer)
+		return FALSE;
+
+	while (received < size)
+	{
+		const ssize_t status = recv(fd, &buffer[received], size - received, 0);
+
+		if (status <= 0)
+			goto fail;
+
+		received += (size_t)status;
+	}
+
+	/* every pdu in order, each filled with its own value */
+	for (x = 0; x < size; x++)
+	{
+		if (buffer[x] != (BYTE)(first + x / TEST_PDU_SIZE))
+		{
+			fprintf(stderr, "unexpected byte at %" PRIuz "\n", x);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(buffer);
+	return rc;
+}
+
+static BOOL test_nothing_sent(int fd)
+{
+	BYTE tmp;
+
+	if ((recv(fd, &tmp, sizeof(tmp), MSG_DONTWAIT) >= 0) ||
+	    ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+	{
+		fprintf(stderr, "data sent while corked\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_transport(rdpTransport* transport, int fd)
+{
+	size_t x;
+	BOOL rc = FALSE;
+	wStream* pdus[3] = { 0 };
+	wStream* large = NULL;
+
+	for (x = 0; x < ARRAYSIZE(pdus); x++)
+	{
+		if (!(pdus[x] = test_pdu(TEST_PDU_SIZE, (BYTE)x)))
+			goto fail;
+	}
+
+	/* nested corks only write when the outermost is released */
+	if (!transport_cork(transport) || !transport_cork(transport))
+		goto fail;
+
+	for (x = 0; x < ARRAYSIZE(pdus); x++)
+	{
+		if (transport_write(transport, pdus[x]) < 0)
+			goto fail;
+	}
+
+	if (!transport_uncork(transport) || !test_nothing_sent(fd))
+		goto fail;
+
+	if (!transport_uncork(transport) || !test_receive(fd, ARRAYSIZE(pdus) * TEST_PDU_SIZE, 0))
+		goto fail;
+
+	if ((transport_write_many(transport, pdus, ARRAYSIZE(pdus)) !=
+	     ARRAYSIZE(pdus) * TEST_PDU_SIZE) ||
+	    !test_receive(fd, ARRAYSIZE(pdus) * TEST_PDU_SIZE, 0))
+		goto fail;
+
+	/* more than is collected while corked goes out right away, after what came before */
+	if (!(large = Stream_New(NULL, TEST_LARGE_SIZE)))
+		goto fail;
+
+	for (x = 0; x < TEST_LARGE_SIZE; x++)
+		Stream_Write_UINT8(large, (BYTE)(1 + x / TEST_PDU_SIZE));
+
+	if (!transport_cork(transport) || (transport_write(transport, pdus[0]) < 0) ||
+	    (transport_write(transport, large) < 0) || !transport_uncork(transport))
+		goto fail;
+
+	if (!test_receive(fd, TEST_PDU_SIZE, 0) || !test_receive(fd, TEST_LARGE_SIZE, 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	for (x = 0; x < ARRAYSIZE(pdus); x++)
+		Stream_Free(pdus[x], TRUE);
+
+	Stream_Free(large, TRUE);
+	return rc;
+}
+
+int TestTransportCork(int argc, char* argv[])
+{
+	int rc = -1;
+	int fds[2] = { -1, -1 };
+	rdpTransport* transport;
+	freerdp* instance = freerdp_new();
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!instance || !freerdp_context_new(instance))
+		goto fail;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		goto fail;
+
+	transport = instance->context->rdp->transport;
+
+	/* the transport owns the socket from now on */
+	if (!transport_attach(transport, fds[0]))
+		goto fail;
+
+	fds[0] = -1;
+
+	if (test_transport(transport, fds[1]))
+		rc = 0;
+
+fail:
+	if (fds[0] >= 0)
+		close(fds[0]);
+
+	if (fds[1] >= 0)
+		close(fds[1]);
+
+	if (instance)
+		freerdp_context_free(instance);
+
+	freerdp_free(instance);
+	return rc;
+}
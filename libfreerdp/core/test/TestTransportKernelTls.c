@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/stream.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <freerdp/freerdp.h>
+
+#include "../rdp.h"
+#include "../transport.h"
+
+#define TEST_PDU_SIZE 0x4000
+#define TEST_PDUS 2048
+
+typedef struct
+{
+	freerdp* instance;
+	rdpTransport* transport;
+	BOOL success;
+} test_peer;
+
+static char* test_pem(BIO* bio)
+{
+	char* data = NULL;
+	char* pem = NULL;
+	const long length = BIO_get_mem_data(bio, &data);
+
+	if ((length > 0) && (pem = (char*)calloc((size_t)length + 1, sizeof(char))))
+		memcpy(pem, data, (size_t)length);
+
+	BIO_free_all(bio);
+	return pem;
+}
+
+/* a throwaway self signed certificate for the accepting side */
+static BOOL test_certificate(char** certificate, char** key)
+{
+	BOOL rc = FALSE;
+	BIO* bio;
+	EVP_PKEY* pkey = NULL;
+	X509* x509 = NULL;
+	X509_NAME* name;
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+
+	if (!ctx || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+	    (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0) || (EVP_PKEY_keygen(ctx, &pkey) <= 0))
+		goto fail;
+
+	if (!(x509 = X509_new()))
+		goto fail;
+
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 60 * 60);
+	X509_set_pubkey(x509, pkey);
+	name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1,
+	                           -1, 0);
+	X509_set_issuer_name(x509, name);
+
+	if (!X509_sign(x509, pkey, EVP_sha256()))
+		goto fail;
+
+	if (!(bio = BIO_new(BIO_s_mem())) || !PEM_write_bio_X509(bio, x509))
+		goto fail;
+
+	*certificate = test_pem(bio);
+
+	if (!(bio = BIO_new(BIO_s_mem())) ||
+	    !PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0, NULL, NULL))
+		goto fail;
+
+	*key = test_pem(bio);
+	rc = *certificate && *key;
+fail:
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+	EVP_PKEY_CTX_free(ctx);
+	return rc;
+}
+
+/* kernel TLS needs a real TCP connection */
+static BOOL test_connection(int* client, int* server)
+{
+	BOOL rc = FALSE;
+	struct sockaddr_in addr = { 0 };
+	socklen_t length = sizeof(addr);
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listener < 0)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+	    (listen(listener, 1) != 0) ||
+	    (getsockname(listener, (struct sockaddr*)&addr, &length) != 0))
+		goto fail;
+
+	if ((*client = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		goto fail;
+
+	if (connect(*client, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		goto fail;
+
+	if ((*server = accept(listener, NULL, NULL)) < 0)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	close(listener);
+	return rc;
+}
+
+static BOOL test_peer_new(test_peer* peer, BOOL offload, const char* certificate, const char* key)
+{
+	rdpSettings* settings;
+
+	if (!(peer->instance = freerdp_new()) || !freerdp_context_new(peer->instance))
+		return FALSE;
+
+	settings = peer->instance->context->settings;
+	peer->transport = peer->instance->context->rdp->transport;
+
+	if (!freerdp_settings_set_bool(settings, FreeRDP_TlsKernelOffload, offload) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_IgnoreCertificate, TRUE) ||
+	    !freerdp_settings_set_string(settings, FreeRDP_ServerHostname, "localhost"))
+		return FALSE;
+
+	if (!certificate)
+		return TRUE;
+
+	return freerdp_settings_set_string(settings, FreeRDP_CertificateContent, certificate) &&
+	       freerdp_settings_set_string(settings, FreeRDP_PrivateKeyContent, key);
+}
+
+static void test_peer_free(test_peer* peer)
+{
+	if (peer->instance)
+		freerdp_context_free(peer->instance);
+
+	freerdp_free(peer->instance);
+}
+
+static DWORD WINAPI test_accept(LPVOID arg)
+{
+	test_peer* peer = (test_peer*)arg;
+	peer->success = transport_accept_tls(peer->transport);
+	return 0;
+}
+
+/* the accepting side sends, like a server sending screen updates */
+static DWORD WINAPI test_send(LPVOID arg)
+{
+	size_t x;
+	test_peer* peer = (test_peer*)arg;
+	wStream* s = Stream_New(NULL, TEST_PDU_SIZE);
+
+	if (!s)
+		return 0;
+
+	for (x = 0; x < TEST_PDUS; x++)
+	{
+		size_t y;
+		Stream_SetPosition(s, 0);
+		Stream_Write_UINT8(s, 3);
+		Stream_Write_UINT8(s, 0);
+		Stream_Write_UINT16_BE(s, TEST_PDU_SIZE);
+
+		for (y = 4; y < TEST_PDU_SIZE; y++)
+			Stream_Write_UINT8(s, (BYTE)(x + y));
+
+		if (transport_write(peer->transport, s) < 0)
+			goto fail;
+	}
+
+	peer->success = TRUE;
+fail:
+	Stream_Free(s, TRUE);
+	return 0;
+}
+
+static BOOL test_receive(test_peer* peer)
+{
+	size_t x;
+	BOOL rc = FALSE;
+	wStream* s = Stream_New(NULL, TEST_PDU_SIZE);
+
+	if (!s)
+		return FALSE;
+
+	for (x = 0; x < TEST_PDUS; x++)
+	{
+		size_t y;
+		const BYTE* data;
+
+		Stream_SetPosition(s, 0);
+
+		if (transport_read_pdu(peer->transport, s) != TEST_PDU_SIZE)
+		{
+			fprintf(stderr, "pdu %" PRIuz " not received\n", x);
+			goto fail;
+		}
+
+		data = Stream_Buffer(s);
+
+		for (y = 4; y < TEST_PDU_SIZE; y++)
+		{
+			if (data[y] != (BYTE)(x + y))
+			{
+				fprintf(stderr, "pdu %" PRIuz " is corrupt\n", x);
+				goto fail;
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	Stream_Free(s, TRUE);
+	return rc;
+}
+
+static BOOL test_is_offloaded(test_peer* peer)
+{
+#if defined(WITH_KERNEL_TLS)
+	rdpTls* tls = transport_get_tls(peer->transport);
+	return tls && BIO_get_ktls_send(SSL_get_wbio(tls->ssl));
+#else
+	WINPR_UNUSED(peer);
+	return FALSE;
+#endif
+}
+
+static BOOL test_transfer(BOOL offload, const char* certificate, const char* key)
+{
+	BOOL rc = FALSE;
+	int fds[2] = { -1, -1 };
+	HANDLE thread = NULL;
+	UINT64 start;
+	UINT64 duration;
+	test_peer client = { 0 };
+	test_peer server = { 0 };
+
+	if (!test_peer_new(&client, offload, NULL, NULL) ||
+	    !test_peer_new(&server, offload, certificate, key))
+		goto fail;
+
+	if (!test_connection(&fds[0], &fds[1]))
+		goto fail;
+
+	/* the transports own the sockets from now on */
+	if (!transport_attach(client.transport, fds[0]))
+		goto fail;
+
+	fds[0] = -1;
+
+	if (!transport_attach(server.transport, fds[1]))
+		goto fail;
+
+	fds[1] = -1;
+
+	if (!(thread = CreateThread(NULL, 0, test_accept, &server, 0, NULL)))
+		goto fail;
+
+	client.success = transport_connect_tls(client.transport);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+
+	if (!client.success || !server.success)
+	{
+		fprintf(stderr, "TLS handshake failed\n");
+		goto fail;
+	}
+
+	server.success = FALSE;
+	start = GetTickCount64();
+
+	if (!(thread = CreateThread(NULL, 0, test_send, &server, 0, NULL)))
+		goto fail;
+
+	client.success = test_receive(&client);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	duration = GetTickCount64() - start;
+
+	if (!client.success || !server.success)
+		goto fail;
+
+	printf("kernel TLS %s: %s, %" PRIu64 " MiB/s\n", offload ? "requested" : "off",
+	       test_is_offloaded(&server) ? "offloaded" : "user space",
+	       (UINT64)TEST_PDUS * TEST_PDU_SIZE * 1000 / 1024 / 1024 / (duration ? duration : 1));
+	rc = TRUE;
+fail:
+	if (fds[0] >= 0)
+		close(fds[0]);
+
+	if (fds[1] >= 0)
+		close(fds[1]);
+
+	test_peer_free(&client);
+	test_peer_free(&server);
+	return rc;
+}
+
+int TestTransportKernelTls(int argc, char* argv[])
+{
+	int rc = -1;
+	char* certificate = NULL;
+	char* key = NULL;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_certificate(&certificate, &key))
+		goto fail;
+
+	/* without kernel support the transfer silently stays in user space */
+	if (!test_transfer(FALSE, certificate, key) || !test_transfer(TRUE, certificate, key))
+		goto fail;
+
+	rc = 0;
+fail:
+	free(certificate);
+	free(key);
+	return rc;
+}
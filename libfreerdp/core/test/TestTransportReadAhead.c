@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <freerdp/freerdp.h>
+
+#include "../rdp.h"
+#include "../transport.h"
+
+#define TEST_PDUS 64
+#define TEST_LARGE_SIZE 0x7000
+
+static UINT32 received = 0;
+static BOOL failed = FALSE;
+
+/* fast-path pdus of the given size, filled with their index */
+static size_t test_pdu(BYTE* data, size_t size, BYTE index)
+{
+	if (size < 0x80)
+	{
+		data[0] = 0;
+		data[1] = (BYTE)size;
+		memset(&data[2], index, size - 2);
+	}
+	else
+	{
+		data[0] = 0;
+		data[1] = 0x80 | (BYTE)(size >> 8);
+		data[2] = (BYTE)size;
+		memset(&data[3], index, size - 3);
+	}
+
+	return size;
+}
+
+static size_t test_pdu_size(UINT32 index)
+{
+	if (index == TEST_PDUS / 2)
+		return TEST_LARGE_SIZE;
+
+	return 3 + (index * 53) % 300;
+}
+
+static int test_recv(rdpTransport* transport, wStream* s, void* extra)
+{
+	size_t x;
+	const size_t size = test_pdu_size(received);
+	const size_t header = (size < 0x80) ? 2 : 3;
+	const BYTE* data = Stream_Buffer(s);
+
+	WINPR_UNUSED(transport);
+	WINPR_UNUSED(extra);
+
+	if (Stream_Length(s) != size)
+	{
+		fprintf(stderr, "pdu %" PRIu32 " has %" PRIuz " bytes\n", received, Stream_Length(s));
+		failed = TRUE;
+	}
+	else
+	{
+		for (x = header; x < size; x++)
+		{
+			if (data[x] != (BYTE)received)
+			{
+				fprintf(stderr, "pdu %" PRIu32 " is corrupt\n", received);
+				failed = TRUE;
+				break;
+			}
+		}
+	}
+
+	received++;
+	return 0;
+}
+
+static BOOL test_send(int fd, const BYTE* data, size_t length)
+{
+	while (length > 0)
+	{
+		const ssize_t status = send(fd, data, length, 0);
+
+		if (status <= 0)
+			return FALSE;
+
+		data += status;
+		length -= (size_t)status;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_transport(rdpTransport* transport, int fd)
+{
+	UINT32 x;
+	size_t length = 0;
+	size_t split;
+	BOOL rc = FALSE;
+	BYTE* data = (BYTE*)malloc(TEST_PDUS * 300 + TEST_LARGE_SIZE);
+
+	if (!data)
+		return FALSE;
+
+	for (x = 0; x < TEST_PDUS; x++)
+		length += test_pdu(&data[length], test_pdu_size(x), (BYTE)x);
+
+	/* the last pdu arrives in two parts */
+	split = length - test_pdu_size(TEST_PDUS - 1) / 2;
+
+	if (!test_send(fd, data, split))
+		goto fail;
+
+	/* everything complete is dispatched at once */
+	if ((transport_check_fds(transport) != 0) || (received != TEST_PDUS - 1))
+	{
+		fprintf(stderr, "%" PRIu32 " pdus received\n", received);
+		goto fail;
+	}
+
+	if (transport_have_more_bytes_to_read(transport))
+	{
+		fprintf(stderr, "bytes left over after all complete pdus were dispatched\n");
+		goto fail;
+	}
+
+	if (!test_send(fd, &data[split], length - split))
+		goto fail;
+
+	if ((transport_check_fds(transport) != 0) || (received != TEST_PDUS) || failed)
+	{
+		fprintf(stderr, "%" PRIu32 " pdus received\n", received);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(data);
+	return rc;
+}
+
+int TestTransportReadAhead(int argc, char* argv[])
+{
+	int rc = -1;
+	int fds[2] = { -1, -1 };
+	rdpTransport* transport;
+	freerdp* instance = freerdp_new();
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!instance || !freerdp_context_new(instance))
+		goto fail;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		goto fail;
+
+	transport = instance->context->rdp->transport;
+
+	/* the transport owns the socket from now on */
+	if (!transport_attach(transport, fds[0]))
+		goto fail;
+
+	fds[0] = -1;
+
+	if (!transport_set_blocking_mode(transport, FALSE) ||
+	    !transport_set_recv_callbacks(transport, test_recv, NULL))
+		goto fail;
+
+	if (test_transport(transport, fds[1]))
+		rc = 0;
+
+fail:
+	if (fds[0] >= 0)
+		close(fds[0]);
+
+	if (fds[1] >= 0)
+		close(fds[1]);
+
+	if (instance)
+		freerdp_context_free(instance);
+
+	freerdp_free(instance);
+	return rc;
+}
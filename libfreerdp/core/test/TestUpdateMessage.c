@@ -0,0 +1,217 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include <freerdp/freerdp.h>
+
+#include "../update.h"
+#include "../../cache/bitmap.h"
+
+#define TEST_ROUNDS 200
+#define TEST_BITMAP_SIZE 4096
+
+static BOOL failed = FALSE;
+static UINT32 polylines = 0;
+static UINT32 bitmaps = 0;
+static UINT32 brushes = 0;
+
+static BOOL test_polyline(rdpContext* context, const POLYLINE_ORDER* polyline)
+{
+	UINT32 x;
+
+	WINPR_UNUSED(context);
+
+	for (x = 0; x < polyline->numDeltaEntries; x++)
+	{
+		if ((polyline->points[x].x != polyline->xStart) || (polyline->points[x].y != (INT32)x))
+		{
+			fprintf(stderr, "polyline %" PRId32 " point %" PRIu32 " is corrupt\n",
+			        polyline->xStart, x);
+			failed = TRUE;
+			break;
+		}
+	}
+
+	polylines++;
+	return TRUE;
+}
+
+static BOOL test_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bitmap)
+{
+	UINT32 x;
+	const BITMAP_DATA* data = &bitmap->rectangles[0];
+
+	WINPR_UNUSED(context);
+
+	for (x = 0; x < data->bitmapLength; x++)
+	{
+		if (data->bitmapDataStream[x] != (BYTE)data->destLeft)
+		{
+			fprintf(stderr, "bitmap update %" PRIu32 " is corrupt\n", data->destLeft);
+			failed = TRUE;
+			break;
+		}
+	}
+
+	bitmaps++;
+	return TRUE;
+}
+
+static BOOL test_cache_brush(rdpContext* context, const CACHE_BRUSH_ORDER* brush)
+{
+	UINT32 x;
+
+	WINPR_UNUSED(context);
+
+	for (x = 0; x < brush->length; x++)
+	{
+		if (brush->data[x] != (BYTE)brush->index)
+		{
+			fprintf(stderr, "cache brush %" PRIu32 " is corrupt\n", brush->index);
+			failed = TRUE;
+			break;
+		}
+	}
+
+	brushes++;
+	return TRUE;
+}
+
+static BITMAP_UPDATE* test_bitmap_new(UINT32 seed)
+{
+	BITMAP_UPDATE* bitmap = (BITMAP_UPDATE*)calloc(1, sizeof(BITMAP_UPDATE));
+
+	if (!bitmap)
+		return NULL;
+
+	bitmap->number = 1;
+	bitmap->rectangles = (BITMAP_DATA*)calloc(1, sizeof(BITMAP_DATA));
+
+	if (!bitmap->rectangles)
+		goto fail;
+
+	bitmap->rectangles[0].destLeft = seed;
+	bitmap->rectangles[0].bitmapLength = TEST_BITMAP_SIZE;
+	bitmap->rectangles[0].bitmapDataStream = (BYTE*)malloc(TEST_BITMAP_SIZE);
+
+	if (!bitmap->rectangles[0].bitmapDataStream)
+		goto fail;
+
+	memset(bitmap->rectangles[0].bitmapDataStream, (BYTE)seed, TEST_BITMAP_SIZE);
+	return bitmap;
+fail:
+	free(bitmap->rectangles);
+	free(bitmap);
+	return NULL;
+}
+
+static BOOL test_round(rdpUpdate* update, UINT32 round)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	POLYLINE_ORDER polyline = { 0 };
+	BITMAP_UPDATE* bitmap = test_bitmap_new(round);
+	CACHE_BRUSH_ORDER* brush = (CACHE_BRUSH_ORDER*)calloc(1, sizeof(CACHE_BRUSH_ORDER));
+
+	/* sizes from a few bytes up to more than an arena holds */
+	polyline.xStart = (INT32)round;
+	polyline.numDeltaEntries = (round * 37) % 5000;
+	polyline.points = (DELTA_POINT*)calloc(polyline.numDeltaEntries + 1, sizeof(DELTA_POINT));
+
+	if (!bitmap || !brush || !polyline.points)
+		goto fail;
+
+	brush->index = round;
+	brush->length = sizeof(brush->data);
+	memset(brush->data, (BYTE)round, sizeof(brush->data));
+
+	for (x = 0; x < polyline.numDeltaEntries; x++)
+	{
+		polyline.points[x].x = (INT32)round;
+		polyline.points[x].y = (INT32)x;
+	}
+
+	if (!update_begin_paint(update))
+		goto fail;
+
+	/* orders are reused by the receiver and must be copied */
+	if (!update->primary->Polyline(update->context, &polyline))
+		goto fail;
+
+	memset(polyline.points, 0xFF, sizeof(DELTA_POINT) * polyline.numDeltaEntries);
+
+	/* a bitmap update handed over by the receiver is queued as is */
+	rc = update_dispatch_bitmap_update(update, bitmap, FALSE);
+	bitmap = NULL;
+
+	/* so are secondary orders */
+	update_handoff_begin(update, brush);
+
+	if (!update->secondary->CacheBrush(update->context, brush))
+		rc = FALSE;
+
+	if (!update_handoff_end(update, brush))
+		brush = NULL;
+
+	if (!update_end_paint(update))
+		rc = FALSE;
+
+fail:
+	free_bitmap_update(update->context, bitmap);
+	free(brush);
+	free(polyline.points);
+	return rc;
+}
+
+int TestUpdateMessage(int argc, char* argv[])
+{
+	int rc = -1;
+	UINT32 x;
+	rdpUpdate* update;
+	freerdp* instance = freerdp_new();
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!instance || !freerdp_context_new(instance))
+		goto fail;
+
+	if (!freerdp_settings_set_bool(instance->context->settings, FreeRDP_AsyncUpdate, TRUE))
+		goto fail;
+
+	update = instance->context->update;
+	update->primary->Polyline = test_polyline;
+	update->BitmapUpdate = test_bitmap_update;
+	update->secondary->CacheBrush = test_cache_brush;
+
+	if (!update_post_connect(update))
+		goto fail;
+
+	for (x = 0; x < TEST_ROUNDS; x++)
+	{
+		if (!test_round(update, x))
+		{
+			fprintf(stderr, "round %" PRIu32 " failed\n", x);
+			break;
+		}
+	}
+
+	/* processes everything queued before it returns */
+	update_post_disconnect(update);
+
+	if (!failed && (x == TEST_ROUNDS) && (polylines == TEST_ROUNDS) && (bitmaps == TEST_ROUNDS) &&
+	    (brushes == TEST_ROUNDS))
+		rc = 0;
+	else
+		fprintf(stderr,
+		        "%" PRIu32 " polylines, %" PRIu32 " bitmap updates and %" PRIu32
+		        " brushes processed\n",
+		        polylines, bitmaps, brushes);
+
+fail:
+	if (instance)
+		freerdp_context_free(instance);
+
+	freerdp_free(instance);
+	return rc;
+}
@@ -19,7 +19,9 @@ static const size_t bool_list_indices[] = {
 	FreeRDP_AutoLogonEnabled,
 	FreeRDP_AutoReconnectionEnabled,
 	FreeRDP_BitmapCacheEnabled,
+	FreeRDP_BitmapCachePersistCompress,
 	FreeRDP_BitmapCachePersistEnabled,
+	FreeRDP_BitmapCachePersistStore,
 	FreeRDP_BitmapCacheV3Enabled,
 	FreeRDP_BitmapCompressionDisabled,
 	FreeRDP_CertificateCallbackPreferPEM,
@@ -163,6 +165,7 @@ static const size_t bool_list_indices[] = {
 	FreeRDP_SurfaceFrameMarkerEnabled,
 	FreeRDP_SuspendInput,
 	FreeRDP_TcpKeepAlive,
+	FreeRDP_TlsKernelOffload,
 	FreeRDP_TlsSecurity,
 	FreeRDP_ToggleFullscreen,
 	FreeRDP_TransportDump,
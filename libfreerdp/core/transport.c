@@ -57,6 +57,12 @@
 
 #define BUFFER_SIZE 16384
 
+/* data collected while corked before it is written anyway, a few full TLS records */
+#define CORK_BUFFER_SIZE (4 * BUFFER_SIZE)
+
+/* data read from the layer at once, a full TLS record */
+#define READ_AHEAD_SIZE BUFFER_SIZE
+
 struct rdp_transport
 {
 	TRANSPORT_LAYER layer;
@@ -76,6 +82,9 @@ struct rdp_transport
 	BOOL GatewayEnabled;
 	CRITICAL_SECTION ReadLock;
 	CRITICAL_SECTION WriteLock;
+	DWORD corked;
+	wStream* CorkBuffer;
+	wStream* ReadBuffer;
 	ULONG written;
 	HANDLE rereadEvent;
 	BOOL haveMoreBytesToRead;
@@ -560,11 +569,18 @@ static void transport_bio_error_log(rdpTransport* transport, LPCSTR biofunc, BIO
 	}
 }
 
+/**
+ * Non blocking reads pull as much as the layer has, up to READ_AHEAD_SIZE, and serve the
+ * following reads from that buffer. A burst of small PDUs then costs a single read from the
+ * socket or TLS layer. Blocking reads are only used while the connection is negotiated and
+ * never read past what was asked for, the layer below might change right after.
+ */
 static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t bytes)
 {
 	SSIZE_T read = 0;
 	rdpRdp* rdp;
 	rdpContext* context;
+	wStream* buffer;
 
 	WINPR_ASSERT(transport);
 
@@ -574,6 +590,9 @@ static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t
 	rdp = context->rdp;
 	WINPR_ASSERT(rdp);
 
+	buffer = transport->ReadBuffer;
+	WINPR_ASSERT(buffer);
+
 	if (!transport->frontBio || (bytes > SSIZE_MAX))
 	{
 		transport->layer = TRANSPORT_LAYER_CLOSED;
@@ -583,10 +602,37 @@ static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t
 
 	while (read < (SSIZE_T)bytes)
 	{
-		const SSIZE_T tr = (SSIZE_T)bytes - read;
-		int r = (int)((tr > INT_MAX) ? INT_MAX : tr);
+		int r;
+		int status;
+		BYTE* target;
+		size_t length;
+		const size_t missing = bytes - (size_t)read;
+		const size_t buffered = Stream_GetRemainingLength(buffer);
+
+		if (buffered > 0)
+		{
+			const size_t count = MIN(buffered, missing);
+
+			Stream_Read(buffer, data + read, count);
+			read += (SSIZE_T)count;
+			continue;
+		}
+
+		/* what does not fit the buffer anyway is read directly */
+		if (transport->blocking || (missing >= Stream_Capacity(buffer)))
+		{
+			target = data + read;
+			length = missing;
+		}
+		else
+		{
+			target = Stream_Buffer(buffer);
+			length = Stream_Capacity(buffer);
+		}
+
+		r = (int)((length > INT_MAX) ? INT_MAX : length);
 		ERR_clear_error();
-		int status = BIO_read(transport->frontBio, data + read, r);
+		status = BIO_read(transport->frontBio, target, r);
 
 		if (freerdp_shall_disconnect_context(context))
 			return -1;
@@ -624,10 +670,24 @@ static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t
 		}
 
 #ifdef HAVE_VALGRIND_MEMCHECK_H
-		VALGRIND_MAKE_MEM_DEFINED(data + read, bytes - read);
+		VALGRIND_MAKE_MEM_DEFINED(target, (size_t)status);
 #endif
-		read += status;
 		rdp->inBytes += status;
+
+		if (target == data + read)
+			read += status;
+		else
+		{
+			Stream_SetPosition(buffer, 0);
+			Stream_SetLength(buffer, (size_t)status);
+		}
+	}
+
+	/* the socket might stay quiet, what is left over must not wait for it */
+	if (Stream_GetRemainingLength(buffer) > 0)
+	{
+		transport->haveMoreBytesToRead = TRUE;
+		SetEvent(transport->rereadEvent);
 	}
 
 	return read;
@@ -867,44 +927,18 @@ int transport_write(rdpTransport* transport, wStream* s)
 	return IFCALLRESULT(-1, transport->io.WritePdu, transport, s);
 }
 
-static int transport_default_write(rdpTransport* transport, wStream* s)
+static int transport_write_layer(rdpTransport* transport, const BYTE* data, size_t length)
 {
-	size_t length;
-	int status = -1;
-	int writtenlength = 0;
-	rdpRdp* rdp;
+	int status = 0;
 	rdpContext* context = transport_get_context(transport);
 
 	WINPR_ASSERT(transport);
 	WINPR_ASSERT(context);
 
-	if (!s)
-		return -1;
-
-	Stream_AddRef(s);
-
-	rdp = context->rdp;
-	if (!rdp)
-		goto fail;
-
-	EnterCriticalSection(&(transport->WriteLock));
-	if (!transport->frontBio)
-		goto out_cleanup;
-
-	length = Stream_GetPosition(s);
-	writtenlength = length;
-	Stream_SetPosition(s, 0);
-
-	if (length > 0)
-	{
-		rdp->outBytes += length;
-		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length, WLOG_PACKET_OUTBOUND);
-	}
-
 	while (length > 0)
 	{
 		ERR_clear_error();
-		status = BIO_write(transport->frontBio, Stream_Pointer(s), length);
+		status = BIO_write(transport->frontBio, data, length);
 
 		if (status <= 0)
 		{
@@ -915,21 +949,20 @@ static int transport_default_write(rdpTransport* transport, wStream* s)
 			if (!BIO_should_retry(transport->frontBio))
 			{
 				WLog_ERR_BIO(transport, "BIO_should_retry", transport->frontBio);
-				goto out_cleanup;
+				return -1;
 			}
 
 			/* non-blocking can live with blocked IOs */
 			if (!transport->blocking)
 			{
 				WLog_ERR_BIO(transport, "BIO_write", transport->frontBio);
-				goto out_cleanup;
+				return -1;
 			}
 
 			if (BIO_wait_write(transport->frontBio, 100) < 0)
 			{
 				WLog_ERR_BIO(transport, "BIO_wait_write", transport->frontBio);
-				status = -1;
-				goto out_cleanup;
+				return -1;
 			}
 
 			continue;
@@ -943,39 +976,182 @@ static int transport_default_write(rdpTransport* transport, wStream* s)
 				if (BIO_wait_write(transport->frontBio, 100) < 0)
 				{
 					WLog_Print(transport->log, WLOG_ERROR, "error when selecting for write");
-					status = -1;
-					goto out_cleanup;
+					return -1;
 				}
 
 				if (BIO_flush(transport->frontBio) < 1)
 				{
 					WLog_Print(transport->log, WLOG_ERROR, "error when flushing outputBuffer");
-					status = -1;
-					goto out_cleanup;
+					return -1;
 				}
 			}
 		}
 
 		length -= status;
-		Stream_Seek(s, status);
+		data += status;
 	}
 
-	transport->written += writtenlength;
-out_cleanup:
+	return status;
+}
 
-	if (status < 0)
+static int transport_write_corked(rdpTransport* transport, const BYTE* data, size_t length)
+{
+	wStream* s = transport->CorkBuffer;
+
+	if (!s)
 	{
-		/* A write error indicates that the peer has dropped the connection */
-		transport->layer = TRANSPORT_LAYER_CLOSED;
-		freerdp_set_last_error_if_not(context, FREERDP_ERROR_CONNECT_TRANSPORT_FAILED);
+		if (!(s = Stream_New(NULL, CORK_BUFFER_SIZE)))
+			return -1;
+
+		transport->CorkBuffer = s;
+	}
+
+	/* whatever does not fit in goes out together with what was collected before */
+	if (Stream_GetRemainingCapacity(s) < length)
+	{
+		if (transport_write_layer(transport, Stream_Buffer(s), Stream_GetPosition(s)) < 0)
+			return -1;
+
+		Stream_SetPosition(s, 0);
 	}
 
+	if (length >= Stream_Capacity(s))
+		return transport_write_layer(transport, data, length);
+
+	Stream_Write(s, data, length);
+	return (int)length;
+}
+
+static void transport_write_failed(rdpTransport* transport)
+{
+	/* A write error indicates that the peer has dropped the connection */
+	transport->layer = TRANSPORT_LAYER_CLOSED;
+	freerdp_set_last_error_if_not(transport_get_context(transport),
+	                              FREERDP_ERROR_CONNECT_TRANSPORT_FAILED);
+}
+
+static int transport_default_write(rdpTransport* transport, wStream* s)
+{
+	size_t length;
+	int status = -1;
+	rdpRdp* rdp;
+	rdpContext* context = transport_get_context(transport);
+
+	WINPR_ASSERT(transport);
+	WINPR_ASSERT(context);
+
+	if (!s)
+		return -1;
+
+	Stream_AddRef(s);
+
+	rdp = context->rdp;
+	if (!rdp)
+		goto fail;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	if (!transport->frontBio)
+		goto out_cleanup;
+
+	length = Stream_GetPosition(s);
+
+	if (length > 0)
+	{
+		rdp->outBytes += length;
+		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length, WLOG_PACKET_OUTBOUND);
+	}
+
+	if (transport->corked)
+		status = transport_write_corked(transport, Stream_Buffer(s), length);
+	else
+		status = transport_write_layer(transport, Stream_Buffer(s), length);
+
+	if (status >= 0)
+		transport->written += length;
+
+out_cleanup:
+
+	if (status < 0)
+		transport_write_failed(transport);
+
 	LeaveCriticalSection(&(transport->WriteLock));
 fail:
 	Stream_Release(s);
 	return status;
 }
 
+int transport_write_many(rdpTransport* transport, wStream** streams, size_t count)
+{
+	size_t x;
+	int status = 0;
+
+	if (!transport || (!streams && (count > 0)))
+		return -1;
+
+	/* every stream still passes the io callbacks, the data is packed below them */
+	if (!transport_cork(transport))
+		return -1;
+
+	for (x = 0; x < count; x++)
+	{
+		if (transport_write(transport, streams[x]) < 0)
+		{
+			status = -1;
+			break;
+		}
+
+		status += (int)Stream_GetPosition(streams[x]);
+	}
+
+	if (!transport_uncork(transport))
+		status = -1;
+
+	return status;
+}
+
+BOOL transport_cork(rdpTransport* transport)
+{
+	if (!transport)
+		return FALSE;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	transport->corked++;
+	LeaveCriticalSection(&(transport->WriteLock));
+	return TRUE;
+}
+
+BOOL transport_uncork(rdpTransport* transport)
+{
+	BOOL rc = TRUE;
+	wStream* s;
+
+	if (!transport)
+		return FALSE;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	WINPR_ASSERT(transport->corked > 0);
+
+	if (--transport->corked > 0)
+		goto out;
+
+	s = transport->CorkBuffer;
+
+	if (!s || (Stream_GetPosition(s) == 0))
+		goto out;
+
+	if (!transport->frontBio ||
+	    (transport_write_layer(transport, Stream_Buffer(s), Stream_GetPosition(s)) < 0))
+	{
+		transport_write_failed(transport);
+		rc = FALSE;
+	}
+
+	Stream_SetPosition(s, 0);
+out:
+	LeaveCriticalSection(&(transport->WriteLock));
+	return rc;
+}
+
 DWORD transport_get_event_handles(rdpTransport* transport, HANDLE* events, DWORD count)
 {
 	DWORD nCount = 1; /* always the reread Event */
@@ -1144,6 +1320,14 @@ int transport_check_fds(rdpTransport* transport)
 				WLog_Print(transport->log, WLOG_DEBUG,
 				           "transport_check_fds: transport_read_pdu() - %i", status);
 
+			/* everything read ahead was consumed, wait for the layer again */
+			if ((status == 0) && transport->haveMoreBytesToRead &&
+			    (Stream_GetRemainingLength(transport->ReadBuffer) == 0))
+			{
+				transport->haveMoreBytesToRead = FALSE;
+				ResetEvent(transport->rereadEvent);
+			}
+
 			return status;
 		}
 
@@ -1249,6 +1433,16 @@ static BOOL transport_default_disconnect(rdpTransport* transport)
 		transport->rdg = NULL;
 	}
 
+	/* nothing collected for the old connection goes out on a new one */
+	if (transport->CorkBuffer)
+		Stream_SetPosition(transport->CorkBuffer, 0);
+
+	if (transport->ReadBuffer)
+	{
+		Stream_SetPosition(transport->ReadBuffer, 0);
+		Stream_SetLength(transport->ReadBuffer, 0);
+	}
+
 	transport->frontBio = NULL;
 	transport->layer = TRANSPORT_LAYER_TCP;
 	return status;
@@ -1289,6 +1483,13 @@ rdpTransport* transport_new(rdpContext* context)
 	if (!transport->ReceiveBuffer)
 		goto fail;
 
+	transport->ReadBuffer = Stream_New(NULL, READ_AHEAD_SIZE);
+
+	if (!transport->ReadBuffer)
+		goto fail;
+
+	Stream_SetLength(transport->ReadBuffer, 0);
+
 	transport->connectedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	if (!transport->connectedEvent || transport->connectedEvent == INVALID_HANDLE_VALUE)
@@ -1326,6 +1527,9 @@ void transport_free(rdpTransport* transport)
 	if (transport->ReceiveBuffer)
 		Stream_Release(transport->ReceiveBuffer);
 
+	Stream_Free(transport->CorkBuffer, TRUE);
+	Stream_Free(transport->ReadBuffer, TRUE);
+
 	nla_free(transport->nla);
 	StreamPool_Free(transport->ReceivePool);
 	CloseHandle(transport->connectedEvent);
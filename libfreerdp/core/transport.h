@@ -66,6 +66,11 @@ FREERDP_LOCAL BOOL transport_accept_nla(rdpTransport* transport);
 
 FREERDP_LOCAL int transport_read_pdu(rdpTransport* transport, wStream* s);
 FREERDP_LOCAL int transport_write(rdpTransport* transport, wStream* s);
+FREERDP_LOCAL int transport_write_many(rdpTransport* transport, wStream** streams, size_t count);
+
+/* while corked, written data is collected and sent in as few TLS records as possible */
+FREERDP_LOCAL BOOL transport_cork(rdpTransport* transport);
+FREERDP_LOCAL BOOL transport_uncork(rdpTransport* transport);
 
 #if defined(WITH_FREERDP_DEPRECATED)
 FREERDP_LOCAL void transport_get_fds(rdpTransport* transport, void** rfds, int* rcount);
@@ -292,6 +292,52 @@ fail:
 	return NULL;
 }
 
+/**
+ * Offer a parsed update or order to the next callback, which may keep it instead of making a
+ * copy. update_handoff_end returns TRUE if the caller still owns it and has to free it.
+ */
+void update_handoff_begin(rdpUpdate* update, const void* data)
+{
+	rdp_update_internal* up = update_cast(update);
+	up->handoff = data;
+}
+
+BOOL update_handoff_end(rdpUpdate* update, const void* data)
+{
+	rdp_update_internal* up = update_cast(update);
+	const BOOL owned = (up->handoff == data);
+
+	up->handoff = NULL;
+	return owned;
+}
+
+BOOL update_dispatch_bitmap_update(rdpUpdate* update, BITMAP_UPDATE* bitmap_update,
+                                   BOOL defaultReturn)
+{
+	BOOL rc;
+
+	update_handoff_begin(update, bitmap_update);
+	rc = IFCALLRESULT(defaultReturn, update->BitmapUpdate, update->context, bitmap_update);
+
+	if (update_handoff_end(update, bitmap_update))
+		free_bitmap_update(update->context, bitmap_update);
+
+	return rc;
+}
+
+BOOL update_dispatch_palette(rdpUpdate* update, PALETTE_UPDATE* palette_update, BOOL defaultReturn)
+{
+	BOOL rc;
+
+	update_handoff_begin(update, palette_update);
+	rc = IFCALLRESULT(defaultReturn, update->Palette, update->context, palette_update);
+
+	if (update_handoff_end(update, palette_update))
+		free_palette_update(update->context, palette_update);
+
+	return rc;
+}
+
 static BOOL update_read_synchronize(rdpUpdate* update, wStream* s)
 {
 	WINPR_UNUSED(update);
@@ -818,8 +864,7 @@ BOOL update_recv(rdpUpdate* update, wStream* s)
 				goto fail;
 			}
 
-			rc = IFCALLRESULT(FALSE, update->BitmapUpdate, context, bitmap_update);
-			free_bitmap_update(context, bitmap_update);
+			rc = update_dispatch_bitmap_update(update, bitmap_update, FALSE);
 		}
 		break;
 
@@ -833,8 +878,7 @@ BOOL update_recv(rdpUpdate* update, wStream* s)
 				goto fail;
 			}
 
-			rc = IFCALLRESULT(FALSE, update->Palette, context, palette_update);
-			free_palette_update(context, palette_update);
+			rc = update_dispatch_palette(update, palette_update, FALSE);
 		}
 		break;
 
@@ -1425,6 +1469,21 @@ static BOOL update_send_synchronize(rdpContext* context)
 	return ret;
 }
 
+static BOOL update_send_fastpath_update(rdpContext* context, BYTE updateCode, wStream* s)
+{
+	BOOL ret;
+	WINPR_ASSERT(context);
+	rdpRdp* rdp = context->rdp;
+
+	WINPR_ASSERT(rdp);
+	WINPR_ASSERT(s);
+
+	Stream_SetPosition(s, Stream_Length(s));
+	ret = fastpath_send_update_pdu(rdp->fastpath, updateCode, s, FALSE);
+	Stream_SetPosition(s, 0);
+	return ret;
+}
+
 static BOOL update_send_desktop_resize(rdpContext* context)
 {
 	WINPR_ASSERT(context);
@@ -3128,6 +3187,7 @@ void update_register_server_callbacks(rdpUpdate* update)
 	update->SetKeyboardImeStatus = update_send_set_keyboard_ime_status;
 	update->SaveSessionInfo = rdp_send_save_session_info;
 	update->ServerStatusInfo = rdp_send_server_status_info;
+	update->FastPathUpdate = update_send_fastpath_update;
 	update->primary->DstBlt = update_send_dstblt;
 	update->primary->PatBlt = update_send_patblt;
 	update->primary->ScrBlt = update_send_scrblt;
@@ -3292,6 +3352,7 @@ void update_free(rdpUpdate* update)
 		}
 
 		MessageQueue_Free(up->queue);
+		update_message_batches_free(update);
 		DeleteCriticalSection(&up->mux);
 		free(update);
 	}
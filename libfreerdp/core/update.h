@@ -38,6 +38,8 @@
 #define BITMAP_COMPRESSION 0x0001
 #define NO_BITMAP_COMPRESSION_HDR 0x0400
 
+typedef struct s_rdp_update_batch rdpUpdateBatch;
+
 typedef struct
 {
 	rdpUpdate common;
@@ -52,6 +54,11 @@ typedef struct
 	BOOL asynchronous;
 	rdpUpdateProxy* proxy;
 	wMessageQueue* queue;
+	wObjectPool* batches;
+	rdpUpdateBatch* batch;
+
+	/* a parsed update the callback may keep instead of copying, the receiver frees it otherwise */
+	const void* handoff;
 
 	wStream* us;
 	UINT16 numberOrders;
@@ -179,6 +186,12 @@ FREERDP_LOCAL BOOL update_recv(rdpUpdate* update, wStream* s);
 
 FREERDP_LOCAL BITMAP_UPDATE* update_read_bitmap_update(rdpUpdate* update, wStream* s);
 FREERDP_LOCAL PALETTE_UPDATE* update_read_palette(rdpUpdate* update, wStream* s);
+FREERDP_LOCAL void update_handoff_begin(rdpUpdate* update, const void* data);
+FREERDP_LOCAL BOOL update_handoff_end(rdpUpdate* update, const void* data);
+FREERDP_LOCAL BOOL update_dispatch_bitmap_update(rdpUpdate* update, BITMAP_UPDATE* bitmap_update,
+                                                 BOOL defaultReturn);
+FREERDP_LOCAL BOOL update_dispatch_palette(rdpUpdate* update, PALETTE_UPDATE* palette_update,
+                                           BOOL defaultReturn);
 
 FREERDP_LOCAL POINTER_SYSTEM_UPDATE* update_read_pointer_system(rdpUpdate* update, wStream* s);
 FREERDP_LOCAL POINTER_POSITION_UPDATE* update_read_pointer_position(rdpUpdate* update, wStream* s);
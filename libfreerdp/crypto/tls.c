@@ -673,6 +673,17 @@ static void SSLCTX_keylog_cb(const SSL* ssl, const char* line)
 	}
 }
 
+#if defined(WITH_KERNEL_TLS)
+/* kernel TLS needs the socket BIOs of tcp.c directly below the TLS BIO, not a gateway tunnel */
+static BOOL tls_can_offload(BIO* underlying)
+{
+	if (BIO_method_type(underlying) == BIO_TYPE_BUFFERED)
+		underlying = BIO_next(underlying);
+
+	return underlying && (BIO_method_type(underlying) == BIO_TYPE_SIMPLE);
+}
+#endif
+
 #if OPENSSL_VERSION_NUMBER >= 0x010000000L
 static BOOL tls_prepare(rdpTls* tls, BIO* underlying, const SSL_METHOD* method, int options,
                         BOOL clientMode)
@@ -695,6 +706,19 @@ static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method, int op
 	SSL_CTX_set_mode(tls->ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
 	SSL_CTX_set_options(tls->ctx, options);
 	SSL_CTX_set_read_ahead(tls->ctx, 1);
+
+	if (freerdp_settings_get_bool(settings, FreeRDP_TlsKernelOffload))
+	{
+#if defined(WITH_KERNEL_TLS)
+		if (tls_can_offload(underlying))
+			SSL_CTX_set_options(tls->ctx, SSL_OP_ENABLE_KTLS);
+		else
+			WLog_DBG(TAG, "kernel TLS offload is not possible through a gateway");
+#else
+		WLog_WARN(TAG, "kernel TLS offload is not supported by this build");
+#endif
+	}
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	UINT16 version = freerdp_settings_get_uint16(settings, FreeRDP_TLSMinVersion);
 	if (!SSL_CTX_set_min_proto_version(tls->ctx, version))
@@ -836,6 +860,17 @@ static int tls_do_handshake(rdpTls* tls, BOOL clientMode)
 #endif
 	} while (TRUE);
 
+#if defined(WITH_KERNEL_TLS)
+	if (SSL_get_options(tls->ssl) & SSL_OP_ENABLE_KTLS)
+	{
+		if (BIO_get_ktls_send(SSL_get_wbio(tls->ssl)))
+			WLog_INFO(TAG, "kernel TLS offload enabled for sending");
+		else
+			WLog_INFO(TAG, "kernel TLS offload not available for %s, encrypting in user space",
+			          SSL_get_cipher_name(tls->ssl));
+	}
+#endif
+
 	cert = tls_get_certificate(tls, clientMode);
 
 	if (!cert)
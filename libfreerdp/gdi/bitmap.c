@@ -25,6 +25,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <winpr/assert.h>
+
 #include <freerdp/api.h>
 #include <freerdp/freerdp.h>
 #include <freerdp/gdi/gdi.h>
@@ -169,177 +171,303 @@ HGDI_BITMAP gdi_CreateCompatibleBitmap(HGDI_DC hdc, UINT32 nWidth, UINT32 nHeigh
 	return hBitmap;
 }
 
-static BOOL op_not(UINT32* stack, UINT32* stackp)
+/**
+ * Raster operations are compiled once per blit into a short program working on whole rows.
+ * Rows hold pixels as they are stored in the destination format, the bitwise operators
+ * give the same result on the stored bytes as on the colors read from them.
+ */
+
+#define ROP_MAX_DEPTH 10
+#define ROP_MAX_OPS 32
+
+/* rows an operation reads */
+#define ROP_ROW_DST 0
+#define ROP_ROW_SRC 1
+#define ROP_ROW_PAT 2
+#define ROP_ROW_BLACK 3
+#define ROP_ROW_WHITE 4
+#define ROP_ROW_COUNT 5
+#define ROP_ROW_STACK 0xFF
+
+typedef enum
 {
-	if (!stack || !stackp)
-		return FALSE;
+	ROP_OP_PUSH,
+	ROP_OP_NOT,
+	ROP_OP_AND,
+	ROP_OP_OR,
+	ROP_OP_XOR
+} gdiRopOpcode;
+
+typedef struct
+{
+	BYTE opcode;
+	BYTE row; /* operand of a push or the row combined with the top of the stack */
+} gdiRopOp;
 
-	if (*stackp < 1)
-		return FALSE;
+typedef struct
+{
+	gdiRopOp ops[ROP_MAX_OPS];
+	size_t count;
+	size_t depth;
+	BOOL useSrc;
+	BOOL usePat;
+} gdiRopProgram;
+
+static BOOL rop_operand(char c, BYTE* row)
+{
+	switch (c)
+	{
+		case 'D':
+			*row = ROP_ROW_DST;
+			return TRUE;
 
-	stack[(*stackp) - 1] = ~stack[(*stackp) - 1];
-	return TRUE;
+		case 'S':
+			*row = ROP_ROW_SRC;
+			return TRUE;
+
+		case 'P':
+			*row = ROP_ROW_PAT;
+			return TRUE;
+
+		case '0':
+			*row = ROP_ROW_BLACK;
+			return TRUE;
+
+		case '1':
+			*row = ROP_ROW_WHITE;
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
 }
 
-static BOOL op_and(UINT32* stack, UINT32* stackp)
+static BOOL rop_operator(char c, BYTE* opcode)
 {
-	if (!stack || !stackp)
-		return FALSE;
+	switch (c)
+	{
+		case 'a':
+			*opcode = ROP_OP_AND;
+			return TRUE;
 
-	if (*stackp < 2)
-		return FALSE;
+		case 'o':
+			*opcode = ROP_OP_OR;
+			return TRUE;
 
-	(*stackp)--;
-	stack[(*stackp) - 1] &= stack[(*stackp)];
-	return TRUE;
+		case 'x':
+			*opcode = ROP_OP_XOR;
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
 }
 
-static BOOL op_or(UINT32* stack, UINT32* stackp)
+static BOOL rop_compile(const char* rop, gdiRopProgram* program)
 {
-	if (!stack || !stackp)
-		return FALSE;
+	size_t depth = 0;
 
-	if (*stackp < 2)
+	WINPR_ASSERT(program);
+
+	if (!rop)
 		return FALSE;
 
-	(*stackp)--;
-	stack[(*stackp) - 1] |= stack[(*stackp)];
-	return TRUE;
+	ZeroMemory(program, sizeof(gdiRopProgram));
+
+	while (*rop != '\0')
+	{
+		BYTE row;
+		BYTE opcode;
+		gdiRopOp* op = &program->ops[program->count];
+
+		if (program->count >= ROP_MAX_OPS)
+			return FALSE;
+
+		if (rop_operand(*rop, &row))
+		{
+			rop++;
+
+			if (row == ROP_ROW_SRC)
+				program->useSrc = TRUE;
+			else if (row == ROP_ROW_PAT)
+				program->usePat = TRUE;
+
+			/* an operand combined right away is not pushed */
+			if ((depth > 0) && rop_operator(*rop, &opcode))
+			{
+				rop++;
+				op->opcode = opcode;
+			}
+			else
+			{
+				if (++depth > ROP_MAX_DEPTH)
+					return FALSE;
+
+				op->opcode = ROP_OP_PUSH;
+				program->depth = MAX(program->depth, depth);
+			}
+
+			op->row = row;
+		}
+		else if (*rop == 'n')
+		{
+			rop++;
+
+			if (depth < 1)
+				return FALSE;
+
+			op->opcode = ROP_OP_NOT;
+		}
+		else if (rop_operator(*rop, &opcode))
+		{
+			rop++;
+
+			if (depth < 2)
+				return FALSE;
+
+			depth--;
+			op->opcode = opcode;
+			op->row = ROP_ROW_STACK;
+		}
+		else
+		{
+			rop++;
+			continue;
+		}
+
+		program->count++;
+	}
+
+	return depth == 1;
 }
 
-static BOOL op_xor(UINT32* stack, UINT32* stackp)
+static INLINE void rop_row_not(BYTE* dst, size_t length)
 {
-	if (!stack || !stackp)
-		return FALSE;
+	size_t x;
 
-	if (*stackp < 2)
-		return FALSE;
+	for (x = 0; x < length; x++)
+		dst[x] = ~dst[x];
+}
 
-	(*stackp)--;
-	stack[(*stackp) - 1] ^= stack[(*stackp)];
-	return TRUE;
+static INLINE void rop_row_and(BYTE* dst, const BYTE* src, size_t length)
+{
+	size_t x;
+
+	for (x = 0; x < length; x++)
+		dst[x] &= src[x];
 }
 
-static UINT32 process_rop(UINT32 src, UINT32 dst, UINT32 pat, const char* rop, UINT32 format)
+static INLINE void rop_row_or(BYTE* dst, const BYTE* src, size_t length)
 {
-	UINT32 stack[10] = { 0 };
-	UINT32 stackp = 0;
+	size_t x;
 
-	while (*rop != '\0')
-	{
-		char op = *rop++;
+	for (x = 0; x < length; x++)
+		dst[x] |= src[x];
+}
 
-		switch (op)
-		{
-			case '0':
-				stack[stackp++] = FreeRDPGetColor(format, 0, 0, 0, 0xFF);
-				break;
+static INLINE void rop_row_xor(BYTE* dst, const BYTE* src, size_t length)
+{
+	size_t x;
 
-			case '1':
-				stack[stackp++] = FreeRDPGetColor(format, 0xFF, 0xFF, 0xFF, 0xFF);
-				break;
+	for (x = 0; x < length; x++)
+		dst[x] ^= src[x];
+}
 
-			case 'D':
-				stack[stackp++] = dst;
-				break;
+static void rop_run(const gdiRopProgram* program, BYTE** stack, const BYTE** rows, size_t length)
+{
+	size_t x;
+	size_t sp = 0;
 
-			case 'S':
-				stack[stackp++] = src;
-				break;
+	for (x = 0; x < program->count; x++)
+	{
+		const BYTE* src;
+		const gdiRopOp* op = &program->ops[x];
 
-			case 'P':
-				stack[stackp++] = pat;
-				break;
+		if (op->opcode == ROP_OP_PUSH)
+		{
+			memcpy(stack[sp++], rows[op->row], length);
+			continue;
+		}
 
-			case 'x':
-				op_xor(stack, &stackp);
-				break;
+		if (op->opcode == ROP_OP_NOT)
+		{
+			rop_row_not(stack[sp - 1], length);
+			continue;
+		}
+
+		if (op->row == ROP_ROW_STACK)
+			src = stack[--sp];
+		else
+			src = rows[op->row];
 
-			case 'a':
-				op_and(stack, &stackp);
+		switch (op->opcode)
+		{
+			case ROP_OP_AND:
+				rop_row_and(stack[sp - 1], src, length);
 				break;
 
-			case 'o':
-				op_or(stack, &stackp);
+			case ROP_OP_OR:
+				rop_row_or(stack[sp - 1], src, length);
 				break;
 
-			case 'n':
-				op_not(stack, &stackp);
+			case ROP_OP_XOR:
+				rop_row_xor(stack[sp - 1], src, length);
 				break;
 
 			default:
 				break;
 		}
 	}
-
-	return stack[0];
 }
 
-static INLINE BOOL BitBlt_write(HGDI_DC hdcDest, HGDI_DC hdcSrc, INT32 nXDest, INT32 nYDest,
-                                INT32 nXSrc, INT32 nYSrc, INT32 x, INT32 y, BOOL useSrc,
-                                BOOL usePat, UINT32 style, const char* rop,
-                                const gdiPalette* palette)
+/* fills a row with copies of its first pixel */
+static void rop_row_repeat(BYTE* row, size_t bpp, size_t width)
 {
-	UINT32 dstColor;
-	UINT32 colorA;
-	UINT32 colorB = 0;
-	UINT32 colorC = 0;
-	const INT32 dstX = nXDest + x;
-	const INT32 dstY = nYDest + y;
-	BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, dstX, dstY);
-
-	if (!dstp)
+	size_t done = 1;
+
+	while (done < width)
 	{
-		WLog_ERR(TAG, "dstp=%p", (const void*)dstp);
-		return FALSE;
+		const size_t count = MIN(done, width - done);
+
+		memcpy(&row[done * bpp], row, count * bpp);
+		done += count;
 	}
+}
 
-	colorA = FreeRDPReadColor(dstp, hdcDest->format);
+static BOOL rop_row_color(BYTE* row, UINT32 format, UINT32 color, size_t width)
+{
+	if (!FreeRDPWriteColor(row, format, color))
+		return FALSE;
 
-	if (useSrc)
-	{
-		const BYTE* srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc + x, nYSrc + y);
+	rop_row_repeat(row, FreeRDPGetBytesPerPixel(format), width);
+	return TRUE;
+}
 
-		if (!srcp)
-		{
-			WLog_ERR(TAG, "srcp=%p", (const void*)srcp);
-			return FALSE;
-		}
+static BOOL rop_row_pattern(HGDI_DC hdcDest, BYTE* row, INT32 nXDest, INT32 nYDest, size_t width)
+{
+	size_t x;
+	const HGDI_BITMAP hBmpBrush = hdcDest->brush->pattern;
+	const size_t bpp = FreeRDPGetBytesPerPixel(hdcDest->format);
+	const size_t period = MIN(width, (size_t)hBmpBrush->width);
 
-		colorC = FreeRDPReadColor(srcp, hdcSrc->format);
-		colorC = FreeRDPConvertColor(colorC, hdcSrc->format, hdcDest->format, palette);
-	}
+	if (period == 0)
+		return FALSE;
 
-	if (usePat)
+	/* the brush repeats every brush width pixels */
+	for (x = 0; x < period; x++)
 	{
-		switch (style)
-		{
-			case GDI_BS_SOLID:
-				colorB = hdcDest->brush->color;
-				break;
-
-			case GDI_BS_HATCHED:
-			case GDI_BS_PATTERN:
-			{
-				const BYTE* patp = gdi_get_brush_pointer(hdcDest, nXDest + x, nYDest + y);
+		const BYTE* patp = gdi_get_brush_pointer(hdcDest, nXDest + x, nYDest);
 
-				if (!patp)
-				{
-					WLog_ERR(TAG, "patp=%p", (const void*)patp);
-					return FALSE;
-				}
-
-				colorB = FreeRDPReadColor(patp, hdcDest->format);
-			}
-			break;
+		if (!patp)
+			return FALSE;
 
-			default:
-				break;
-		}
+		memcpy(&row[x * bpp], patp, bpp);
 	}
 
-	dstColor = process_rop(colorC, colorA, colorB, rop, hdcDest->format);
-	return FreeRDPWriteColor(dstp, hdcDest->format, dstColor);
+	for (x = period; x < width; x += period)
+		memcpy(&row[x * bpp], row, MIN(period, width - x) * bpp);
+
+	return TRUE;
 }
 
 static BOOL adjust_src_coordinates(HGDI_DC hdcSrc, INT32 nWidth, INT32 nHeight, INT32* px,
@@ -451,45 +579,48 @@ static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest, INT32 nW
                            HGDI_DC hdcSrc, INT32 nXSrc, INT32 nYSrc, const char* rop,
                            const gdiPalette* palette)
 {
-	INT32 x, y;
+	INT32 y;
+	size_t x;
+	size_t bpp;
+	size_t length;
 	UINT32 style = 0;
-	BOOL useSrc = FALSE;
-	BOOL usePat = FALSE;
-	const char* iter = rop;
-
-	while (*iter != '\0')
-	{
-		switch (*iter++)
-		{
-			case 'P':
-				usePat = TRUE;
-				break;
-
-			case 'S':
-				useSrc = TRUE;
-				break;
-
-			default:
-				break;
-		}
-	}
+	BOOL rc = FALSE;
+	BOOL mask15 = FALSE;
+	BYTE* buffer = NULL;
+	BYTE local[4096];
+	BYTE* stack[ROP_MAX_DEPTH] = { 0 };
+	const BYTE* rows[ROP_ROW_COUNT] = { 0 };
+	BYTE* srcRow = NULL;
+	BYTE* patRow = NULL;
+	BYTE* blackRow;
+	BYTE* whiteRow;
+	HGDI_BITMAP hSrcBmp = NULL;
+	gdiRopProgram program;
 
 	if (!hdcDest)
 		return FALSE;
 
+	if (!rop_compile(rop, &program))
+	{
+		WLog_ERR(TAG, "invalid raster operation %s", rop ? rop : "(null)");
+		return FALSE;
+	}
+
 	if (!adjust_src_dst_coordinates(hdcDest, &nXSrc, &nYSrc, &nXDest, &nYDest, &nWidth, &nHeight))
 		return FALSE;
 
-	if (useSrc && !hdcSrc)
+	if (program.useSrc && !hdcSrc)
 		return FALSE;
 
-	if (useSrc)
+	if (program.useSrc)
 	{
 		if (!adjust_src_coordinates(hdcSrc, nWidth, nHeight, &nXSrc, &nYSrc))
 			return FALSE;
+
+		hSrcBmp = (HGDI_BITMAP)hdcSrc->selectedObject;
 	}
 
-	if (usePat)
+	if (program.usePat)
 	{
 		style = gdi_GetBrushStyle(hdcDest);
 
@@ -506,56 +637,91 @@ static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest, INT32 nW
 		}
 	}
 
-	if ((nXDest > nXSrc) && (nYDest > nYSrc))
+	if ((nWidth <= 0) || (nHeight <= 0))
+		return TRUE;
+
+	bpp = FreeRDPGetBytesPerPixel(hdcDest->format);
+
+	if (bpp == 0)
+		return FALSE;
+
+	/* the unused top bit is cleared when written */
+	mask15 = (FreeRDPGetBitsPerPixel(hdcDest->format) == 15) &&
+	         !FreeRDPColorHasAlpha(hdcDest->format);
+	length = (size_t)nWidth * bpp;
+
+	/* stack, source, pattern and the two constant rows */
+	if ((program.depth + 4) * length <= sizeof(local))
+		buffer = local;
+	else if (!(buffer = (BYTE*)malloc((program.depth + 4) * length)))
+		return FALSE;
+
+	for (x = 0; x < program.depth; x++)
+		stack[x] = &buffer[x * length];
+
+	srcRow = &buffer[program.depth * length];
+	patRow = srcRow + length;
+	blackRow = patRow + length;
+	whiteRow = blackRow + length;
+
+	if (!rop_row_color(blackRow, hdcDest->format, FreeRDPGetColor(hdcDest->format, 0, 0, 0, 0xFF),
+	                   (size_t)nWidth) ||
+	    !rop_row_color(whiteRow, hdcDest->format,
+	                   FreeRDPGetColor(hdcDest->format, 0xFF, 0xFF, 0xFF, 0xFF), (size_t)nWidth))
+		goto fail;
+
+	if (program.usePat && (style == GDI_BS_SOLID))
 	{
-		for (y = nHeight - 1; y >= 0; y--)
-		{
-			for (x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
-		}
+		if (!rop_row_color(patRow, hdcDest->format, hdcDest->brush->color, (size_t)nWidth))
+			goto fail;
 	}
-	else if (nXDest > nXSrc)
+
+	rows[ROP_ROW_SRC] = srcRow;
+	rows[ROP_ROW_PAT] = patRow;
+	rows[ROP_ROW_BLACK] = blackRow;
+	rows[ROP_ROW_WHITE] = whiteRow;
+
+	for (y = 0; y < nHeight; y++)
 	{
-		for (y = 0; y < nHeight; y++)
+		/* source rows are read before they are overwritten */
+		const INT32 row = (nYDest > nYSrc) ? nHeight - 1 - y : y;
+		BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + row);
+
+		if (!dstp)
+			goto fail;
+
+		rows[ROP_ROW_DST] = dstp;
+
+		if (program.useSrc)
 		{
-			for (x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+			if (!freerdp_image_copy(srcRow, hdcDest->format, (UINT32)length, 0, 0, (UINT32)nWidth, 1,
+			                        hSrcBmp->data, hSrcBmp->format, hSrcBmp->scanline, nXSrc,
+			                        nYSrc + row, palette, FREERDP_FLIP_NONE))
+				goto fail;
 		}
-	}
-	else if (nYDest > nYSrc)
-	{
-		for (y = nHeight - 1; y >= 0; y--)
+
+		if (program.usePat && (style != GDI_BS_SOLID))
 		{
-			for (x = 0; x < nWidth; x++)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+			if (!rop_row_pattern(hdcDest, patRow, nXDest, nYDest + row, (size_t)nWidth))
+				goto fail;
 		}
-	}
-	else
-	{
-		for (y = 0; y < nHeight; y++)
+
+		rop_run(&program, stack, rows, length);
+		memcpy(dstp, stack[0], length);
+
+		if (mask15)
 		{
-			for (x = 0; x < nWidth; x++)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+			for (x = 1; x < length; x += 2)
+				dstp[x] &= 0x7F;
 		}
 	}
 
-	return TRUE;
+	rc = TRUE;
+fail:
+	if (buffer != local)
+		free(buffer);
+
+	return rc;
 }
 
 /**
@@ -1353,7 +1353,8 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 	cacheEntry->width = (UINT32)(rect->right - rect->left);
 	cacheEntry->height = (UINT32)(rect->bottom - rect->top);
 	cacheEntry->format = surface->format;
-	cacheEntry->scanline = gfx_align_scanline(cacheEntry->width * 4, 16);
+	/* packed, ExportCacheEntry hands out the lines as one block */
+	cacheEntry->scanline = cacheEntry->width * 4;
 	cacheEntry->data = (BYTE*)calloc(cacheEntry->height, cacheEntry->scanline);
 
 	if (!cacheEntry->data)
@@ -1508,7 +1509,7 @@ static UINT gdi_ImportCacheEntry(RdpgfxClientContext* context, UINT16 cacheSlot,
 	cacheEntry->width = (UINT32)importCacheEntry->width;
 	cacheEntry->height = (UINT32)importCacheEntry->height;
 	cacheEntry->format = PIXEL_FORMAT_BGRX32;
-	cacheEntry->scanline = (cacheEntry->width + (cacheEntry->width % 4)) * 4;
+	cacheEntry->scanline = cacheEntry->width * 4;
 	cacheEntry->data = (BYTE*)calloc(cacheEntry->height, cacheEntry->scanline);
 
 	if (!cacheEntry->data)
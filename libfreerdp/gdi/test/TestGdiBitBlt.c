@@ -7,6 +7,7 @@
 #include <freerdp/gdi/bitmap.h>
 
 #include <winpr/crt.h>
+#include <winpr/crypto.h>
 
 #include "line.h"
 #include "brush.h"
@@ -535,6 +536,156 @@ fail:
 	return TRUE; // rc;
 }
 
+#define TEST_ROP3_WIDTH 37
+#define TEST_ROP3_HEIGHT 5
+#define TEST_ROP3_BRUSH 8
+
+static BYTE test_rop3_byte(BYTE code, BYTE d, BYTE s, BYTE p)
+{
+	UINT32 bit;
+	BYTE result = 0;
+
+	/* the rop3 code is the truth table of pattern, source and destination */
+	for (bit = 0; bit < 8; bit++)
+	{
+		const UINT32 index =
+		    (((p >> bit) & 1) << 2) | (((s >> bit) & 1) << 1) | ((d >> bit) & 1);
+
+		if ((code >> index) & 1)
+			result |= (1 << bit);
+	}
+
+	return result;
+}
+
+static BOOL test_rop3_pixels(UINT32 code, UINT32 format, HGDI_DC hdcDst, HGDI_BITMAP hBmpSrc,
+                             HGDI_BITMAP hBmpDst, HGDI_BITMAP hBmpPat, const BYTE* dst)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < TEST_ROP3_HEIGHT; y++)
+	{
+		for (x = 0; x < TEST_ROP3_WIDTH; x++)
+		{
+			BYTE rd, gd, bd, rs, gs, bs, rp, gp, bp, r, g, b;
+			const BYTE* d = &dst[(y * TEST_ROP3_WIDTH + x) * 4];
+			const BYTE* s = &hBmpSrc->data[y * hBmpSrc->scanline + x * 4];
+			const BYTE* o = &hBmpDst->data[y * hBmpDst->scanline + x * 4];
+			UINT32 pat = hdcDst->brush->color;
+
+			if (hBmpPat)
+				pat = FreeRDPReadColor(&hBmpPat->data[(y % TEST_ROP3_BRUSH) * hBmpPat->scanline +
+				                                      (x % TEST_ROP3_BRUSH) * 4],
+				                       format);
+
+			FreeRDPSplitColor(FreeRDPReadColor(d, format), format, &rd, &gd, &bd, NULL, NULL);
+			FreeRDPSplitColor(FreeRDPReadColor(s, format), format, &rs, &gs, &bs, NULL, NULL);
+			FreeRDPSplitColor(pat, format, &rp, &gp, &bp, NULL, NULL);
+			FreeRDPSplitColor(FreeRDPReadColor(o, format), format, &r, &g, &b, NULL, NULL);
+
+			if ((r != test_rop3_byte(code, rd, rs, rp)) ||
+			    (g != test_rop3_byte(code, gd, gs, gp)) || (b != test_rop3_byte(code, bd, bs, bp)))
+			{
+				fprintf(stderr, "rop3 0x%02" PRIX32 " %s: wrong pixel at %" PRIu32 "x%" PRIu32 "\n",
+				        code, gdi_rop3_code_string((BYTE)code), x, y);
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static HGDI_BITMAP test_rop3_bitmap(UINT32 format, UINT32 width, UINT32 height)
+{
+	BYTE* data = winpr_aligned_malloc(width * height * 4ULL, 16);
+	HGDI_BITMAP hBmp;
+
+	if (!data)
+		return NULL;
+
+	winpr_RAND(data, width * height * 4ULL);
+
+	if (!(hBmp = gdi_CreateBitmap(width, height, format, data)))
+		winpr_aligned_free(data);
+
+	return hBmp;
+}
+
+/* every raster operation against the truth table encoded in its code */
+static BOOL test_gdi_BitBlt_rop3(BOOL pattern)
+{
+	UINT32 code;
+	BOOL rc = FALSE;
+	const UINT32 format = PIXEL_FORMAT_BGRX32;
+	const size_t size = TEST_ROP3_WIDTH * TEST_ROP3_HEIGHT * 4;
+	BYTE* dst = NULL;
+	HGDI_DC hdcSrc = NULL;
+	HGDI_DC hdcDst = NULL;
+	HGDI_BITMAP hBmpSrc = NULL;
+	HGDI_BITMAP hBmpDst = NULL;
+	HGDI_BITMAP hBmpPat = NULL;
+	HGDI_BRUSH brush = NULL;
+
+	if (!(hdcSrc = gdi_GetDC()) || !(hdcDst = gdi_GetDC()))
+		goto fail;
+
+	hdcSrc->format = format;
+	hdcDst->format = format;
+	hBmpSrc = test_rop3_bitmap(format, TEST_ROP3_WIDTH, TEST_ROP3_HEIGHT);
+	hBmpDst = test_rop3_bitmap(format, TEST_ROP3_WIDTH, TEST_ROP3_HEIGHT);
+	dst = malloc(size);
+
+	if (!hBmpSrc || !hBmpDst || !dst)
+		goto fail;
+
+	if (pattern)
+	{
+		if (!(hBmpPat = test_rop3_bitmap(format, TEST_ROP3_BRUSH, TEST_ROP3_BRUSH)))
+			goto fail;
+
+		brush = gdi_CreatePatternBrush(hBmpPat);
+	}
+	else
+		brush = gdi_CreateSolidBrush(FreeRDPGetColor(format, 0x12, 0x34, 0x56, 0xFF));
+
+	if (!brush)
+		goto fail;
+
+	gdi_SelectObject(hdcSrc, (HGDIOBJECT)hBmpSrc);
+	gdi_SelectObject(hdcDst, (HGDIOBJECT)hBmpDst);
+	gdi_SelectObject(hdcDst, (HGDIOBJECT)brush);
+
+	for (code = 0; code < 256; code++)
+	{
+		memcpy(dst, hBmpDst->data, size);
+
+		if (!gdi_BitBlt(hdcDst, 0, 0, TEST_ROP3_WIDTH, TEST_ROP3_HEIGHT, hdcSrc, 0, 0,
+		                gdi_rop3_code((BYTE)code), NULL))
+		{
+			fprintf(stderr, "rop3 0x%02" PRIX32 " failed\n", code);
+			goto fail;
+		}
+
+		if (!test_rop3_pixels(code, format, hdcDst, hBmpSrc, hBmpDst, hBmpPat, dst))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (hdcDst)
+		gdi_SelectObject(hdcDst, NULL);
+
+	gdi_DeleteObject((HGDIOBJECT)brush);
+	gdi_DeleteObject((HGDIOBJECT)hBmpPat);
+	gdi_DeleteObject((HGDIOBJECT)hBmpSrc);
+	gdi_DeleteObject((HGDIOBJECT)hBmpDst);
+	gdi_DeleteDC(hdcSrc);
+	gdi_DeleteDC(hdcDst);
+	free(dst);
+	return rc;
+}
+
 int TestGdiBitBlt(int argc, char* argv[])
 {
 	int rc = 0;
@@ -564,5 +715,8 @@ int TestGdiBitBlt(int argc, char* argv[])
 		}
 	}
 
+	if (!test_gdi_BitBlt_rop3(FALSE) || !test_gdi_BitBlt_rop3(TRUE))
+		rc = -1;
+
 	return rc;
 }
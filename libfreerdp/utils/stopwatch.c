@@ -34,6 +34,11 @@ static void stopwatch_set_time(UINT64* usecs)
 {
 #ifdef _WIN32
 	LARGE_INTEGER perfcount;
+
+	/* stopwatches embedded in other structures never went through stopwatch_create */
+	if (stopwatch_freq.QuadPart == 0)
+		QueryPerformanceFrequency(&stopwatch_freq);
+
 	QueryPerformanceCounter(&perfcount);
 	*usecs = (perfcount.QuadPart * 1000000) / stopwatch_freq.QuadPart;
 #else
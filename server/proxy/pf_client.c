@@ -548,6 +548,9 @@ static BOOL pf_client_post_connect(freerdp* instance)
 
 	pf_client_register_update_callbacks(update);
 
+	if (config->PassthroughUpdates && !config->DecodeGFX)
+		pf_client_register_passthrough_update_callbacks(update);
+
 	/* virtual channels receive data hook */
 	pc->client_receive_channel_data_original = instance->ReceiveChannelData;
 	instance->ReceiveChannelData = pf_client_receive_channel_data_hook;
@@ -666,6 +669,7 @@ static void pf_client_set_security_settings(pClientContext* pc)
 	freerdp_settings_set_bool(settings, FreeRDP_RdpSecurity, config->ClientRdpSecurity);
 	freerdp_settings_set_bool(settings, FreeRDP_TlsSecurity, config->ClientTlsSecurity);
 	freerdp_settings_set_bool(settings, FreeRDP_NlaSecurity, config->ClientNlaSecurity);
+	freerdp_settings_set_bool(settings, FreeRDP_TlsKernelOffload, config->TlsKernelOffload);
 
 	/* Smartcard authentication currently does not work with NLA */
 	if (pf_client_use_proxy_smartcard_auth(settings))
@@ -749,6 +753,79 @@ out:
 	return rc;
 }
 
+static BOOL pf_client_connect_target(pClientContext* pc)
+{
+	proxyData* pdata;
+
+	WINPR_ASSERT(pc);
+
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+
+	if (!pf_modules_run_hook(pdata->module, HOOK_TYPE_CLIENT_INIT_CONNECT, pdata, pc))
+	{
+		proxy_data_abort_connect(pdata);
+		return FALSE;
+	}
+
+	if (!pf_client_connect(pc->context.instance))
+	{
+		proxy_data_abort_connect(pdata);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+DWORD pf_client_get_event_handles(pClientContext* pc, HANDLE* handles, DWORD count)
+{
+	DWORD tmp;
+	DWORD nCount = 0;
+
+	WINPR_ASSERT(pc);
+	WINPR_ASSERT(handles);
+
+	if (count < 1)
+		return 0;
+
+	handles[nCount++] = Queue_Event(pc->cached_server_channel_data);
+
+	tmp = freerdp_get_event_handles(&pc->context, &handles[nCount], count - nCount);
+	if (tmp == 0)
+	{
+		PROXY_LOG_ERR(TAG, pc, "freerdp_get_event_handles failed!");
+		return 0;
+	}
+
+	return nCount + tmp;
+}
+
+BOOL pf_client_check_event_handles(pClientContext* pc)
+{
+	rdpContext* context;
+
+	WINPR_ASSERT(pc);
+
+	context = &pc->context;
+
+	if (freerdp_shall_disconnect_context(context))
+		return FALSE;
+
+	if (proxy_data_shall_disconnect(pc->pdata))
+		return FALSE;
+
+	if (!freerdp_check_event_handles(context))
+	{
+		if (freerdp_get_last_error(context) == FREERDP_ERROR_SUCCESS)
+			WLog_ERR(TAG, "Failed to check FreeRDP event handles");
+
+		return FALSE;
+	}
+
+	sendQueuedChannelData(pc);
+	return TRUE;
+}
+
 /**
  * RDP main loop.
  * Connects RDP, loops while running and handles event and dispatch, cleans up
@@ -761,6 +838,7 @@ static DWORD WINAPI pf_client_thread_proc(pClientContext* pc)
 	DWORD nCount = 0;
 	DWORD status;
 	HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	WINPR_WAIT_SET* waitSet = NULL;
 
 	WINPR_ASSERT(pc);
 
@@ -778,36 +856,31 @@ static DWORD WINAPI pf_client_thread_proc(pClientContext* pc)
 	 */
 	handles[nCount++] = pdata->abort_event;
 
-	if (!pf_modules_run_hook(pdata->module, HOOK_TYPE_CLIENT_INIT_CONNECT, pdata, pc))
-	{
-		proxy_data_abort_connect(pdata);
+	if (!pf_client_connect_target(pc))
 		goto end;
-	}
 
-	if (!pf_client_connect(instance))
-	{
-		proxy_data_abort_connect(pdata);
-		goto end;
-	}
-	handles[nCount++] = Queue_Event(pc->cached_server_channel_data);
+	waitSet = CreateWaitSet();
+	if (!waitSet)
+		goto disconnect;
 
 	while (!freerdp_shall_disconnect_context(instance->context))
 	{
-		UINT32 tmp = freerdp_get_event_handles(instance->context, &handles[nCount],
-		                                       ARRAYSIZE(handles) - nCount);
+		DWORD tmp = pf_client_get_event_handles(pc, &handles[nCount], ARRAYSIZE(handles) - nCount);
 
 		if (tmp == 0)
-		{
-			PROXY_LOG_ERR(TAG, pc, "freerdp_get_event_handles failed!");
 			break;
-		}
 
-		status = WaitForMultipleObjects(nCount + tmp, handles, FALSE, INFINITE);
+		/* A redirection replaces the transport handles while the loop runs and the new
+		 * ones may reuse the addresses of the old ones. The wait set tells them apart by
+		 * their handle id and only compares an unchanged list. */
+		if (!SetWaitSetHandles(waitSet, nCount + tmp, handles))
+			break;
+
+		status = WaitForWaitSet(waitSet, INFINITE);
 
 		if (status == WAIT_FAILED)
 		{
-			WLog_ERR(TAG, "%s: WaitForMultipleObjects failed with %" PRIu32 "", __FUNCTION__,
-			         status);
+			WLog_ERR(TAG, "%s: WaitForWaitSet failed with %" PRIu32 "", __FUNCTION__, status);
 			break;
 		}
 
@@ -815,22 +888,13 @@ static DWORD WINAPI pf_client_thread_proc(pClientContext* pc)
 		if (status == WAIT_OBJECT_0)
 			break;
 
-		if (freerdp_shall_disconnect_context(instance->context))
+		if (!pf_client_check_event_handles(pc))
 			break;
-
-		if (proxy_data_shall_disconnect(pdata))
-			break;
-
-		if (!freerdp_check_event_handles(instance->context))
-		{
-			if (freerdp_get_last_error(instance->context) == FREERDP_ERROR_SUCCESS)
-				WLog_ERR(TAG, "Failed to check FreeRDP event handles");
-
-			break;
-		}
-		sendQueuedChannelData(pc);
 	}
 
+	FreeWaitSet(waitSet);
+
+disconnect:
 	freerdp_disconnect(instance);
 
 end:
@@ -1044,3 +1108,50 @@ DWORD WINAPI pf_client_start(LPVOID arg)
 	freerdp_client_stop(&pc->context);
 	return rc;
 }
+
+/**
+ * Connects towards target server and returns, leaving the connection to the event loop
+ * that polls it with pf_client_check_event_handles and ends it with pf_client_stop_detached.
+ *
+ * @return 0 if the client is connected
+ */
+DWORD WINAPI pf_client_start_detached(LPVOID arg)
+{
+	pClientContext* pc = (pClientContext*)arg;
+	proxyData* pdata;
+
+	WINPR_ASSERT(pc);
+
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+
+	if (freerdp_client_start(&pc->context) != 0)
+	{
+		proxy_data_abort_connect(pdata);
+		freerdp_client_stop(&pc->context);
+		return 1;
+	}
+
+	if (!pf_client_connect_target(pc))
+	{
+		pf_modules_run_hook(pdata->module, HOOK_TYPE_CLIENT_UNINIT_CONNECT, pdata, pc);
+		freerdp_client_stop(&pc->context);
+		return 1;
+	}
+
+	return 0;
+}
+
+void pf_client_stop_detached(pClientContext* pc)
+{
+	proxyData* pdata;
+
+	WINPR_ASSERT(pc);
+
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+
+	freerdp_disconnect(pc->context.instance);
+	pf_modules_run_hook(pdata->module, HOOK_TYPE_CLIENT_UNINIT_CONNECT, pdata, pc);
+	freerdp_client_stop(&pc->context);
+}
@@ -23,9 +23,17 @@
 #define FREERDP_SERVER_PROXY_PFCLIENT_H
 
 #include <freerdp/freerdp.h>
+#include <freerdp/server/proxy/proxy_context.h>
 #include <winpr/wtypes.h>
 
 int RdpClientEntry(RDP_CLIENT_ENTRY_POINTS* pEntryPoints);
 DWORD WINAPI pf_client_start(LPVOID arg);
 
+/* event loop mode, the connection sequence blocks and runs in its own thread */
+DWORD WINAPI pf_client_start_detached(LPVOID arg);
+void pf_client_stop_detached(pClientContext* pc);
+
+DWORD pf_client_get_event_handles(pClientContext* pc, HANDLE* handles, DWORD count);
+BOOL pf_client_check_event_handles(pClientContext* pc);
+
 #endif /* FREERDP_SERVER_PROXY_PFCLIENT_H */
@@ -183,6 +183,9 @@ static BOOL pf_config_load_server(wIniFile* ini, proxyConfig* config)
 	if (!pf_config_get_uint16(ini, "Server", "Port", &config->Port, TRUE))
 		return FALSE;
 
+	if (!pf_config_get_uint32(ini, "Server", "Workers", &config->Workers, FALSE))
+		return FALSE;
+
 	return TRUE;
 }
 
@@ -277,6 +280,7 @@ static BOOL pf_config_load_security(wIniFile* ini, proxyConfig* config)
 	config->ClientRdpSecurity = pf_config_get_bool(ini, "Security", "ClientRdpSecurity", TRUE);
 	config->ClientAllowFallbackToTls =
 	    pf_config_get_bool(ini, "Security", "ClientAllowFallbackToTls", TRUE);
+	config->TlsKernelOffload = pf_config_get_bool(ini, "Security", "TlsKernelOffload", FALSE);
 	return TRUE;
 }
 
@@ -311,6 +315,8 @@ static BOOL pf_config_load_gfx_settings(wIniFile* ini, proxyConfig* config)
 {
 	WINPR_ASSERT(config);
 	config->DecodeGFX = pf_config_get_bool(ini, "GFXSettings", "DecodeGFX", FALSE);
+	config->PassthroughUpdates =
+	    pf_config_get_bool(ini, "GFXSettings", "PassthroughUpdates", FALSE);
 	return TRUE;
 }
 
@@ -446,6 +452,8 @@ BOOL pf_server_config_dump(const char* file)
 		goto fail;
 	if (IniFile_SetKeyValueInt(ini, "Server", "Port", 3389) < 0)
 		goto fail;
+	if (IniFile_SetKeyValueInt(ini, "Server", "Workers", 0) < 0)
+		goto fail;
 
 	/* Target configuration */
 	if (IniFile_SetKeyValueString(ini, "Target", "Host", "somehost.example.com") < 0)
@@ -506,6 +514,8 @@ BOOL pf_server_config_dump(const char* file)
 		goto fail;
 	if (IniFile_SetKeyValueString(ini, "Security", "ClientAllowFallbackToTls", "true") < 0)
 		goto fail;
+	if (IniFile_SetKeyValueString(ini, "Security", "TlsKernelOffload", "false") < 0)
+		goto fail;
 
 	/* Module configuration */
 	if (IniFile_SetKeyValueString(ini, "Plugins", "Modules", "module1,module2,...") < 0)
@@ -522,6 +532,8 @@ BOOL pf_server_config_dump(const char* file)
 	/* GFX configuration */
 	if (IniFile_SetKeyValueString(ini, "GFXSettings", "DecodeGFX", "false") < 0)
 		goto fail;
+	if (IniFile_SetKeyValueString(ini, "GFXSettings", "PassthroughUpdates", "false") < 0)
+		goto fail;
 
 	/* Certificate configuration */
 	if (IniFile_SetKeyValueString(ini, "Certificates", "CertificateFile",
@@ -616,6 +628,7 @@ void pf_server_config_print(const proxyConfig* config)
 	CONFIG_PRINT_SECTION("Server");
 	CONFIG_PRINT_STR(config, Host);
 	CONFIG_PRINT_UINT16(config, Port);
+	CONFIG_PRINT_UINT32(config, Workers);
 
 	if (config->FixedTarget)
 	{
@@ -643,6 +656,7 @@ void pf_server_config_print(const proxyConfig* config)
 	CONFIG_PRINT_BOOL(config, ClientTlsSecurity);
 	CONFIG_PRINT_BOOL(config, ClientRdpSecurity);
 	CONFIG_PRINT_BOOL(config, ClientAllowFallbackToTls);
+	CONFIG_PRINT_BOOL(config, TlsKernelOffload);
 
 	CONFIG_PRINT_SECTION("Channels");
 	CONFIG_PRINT_BOOL(config, GFX);
@@ -675,6 +689,7 @@ void pf_server_config_print(const proxyConfig* config)
 
 	CONFIG_PRINT_SECTION("GFXSettings");
 	CONFIG_PRINT_BOOL(config, DecodeGFX);
+	CONFIG_PRINT_BOOL(config, PassthroughUpdates);
 
 	/* modules */
 	CONFIG_PRINT_SECTION("Plugins/Modules");
@@ -0,0 +1,610 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * FreeRDP Proxy Server Event Loop
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
+
+#include <freerdp/server/proxy/proxy_log.h>
+
+#if defined(HAVE_SYS_EPOLL_H)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
+
+#include "pf_loop.h"
+
+#define TAG PROXY_TAG("loop")
+
+#if defined(HAVE_SYS_EPOLL_H)
+
+/* Every source is checked at least this often, like the thread per session loops do */
+#define PF_LOOP_POLL_INTERVAL 1000
+#define PF_LOOP_MAX_EVENTS 256
+
+typedef struct
+{
+	void* context;
+	pfLoopGetEventHandles getEventHandles;
+	pfLoopCheckEventHandles checkEventHandles;
+	pfLoopClose closeSource;
+
+	/* descriptors currently registered with the epoll set of the worker */
+	DWORD count;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	int fds[MAXIMUM_WAIT_OBJECTS];
+
+	BOOL ready;
+} proxyLoopSource;
+
+typedef struct
+{
+	HANDLE thread;
+	HANDLE wakeup;
+	int epfd;
+	LONG load;
+
+	CRITICAL_SECTION lock;
+	BOOL stop;
+	wArrayList* added; /* sources not yet picked up by the worker */
+
+	wArrayList* sources; /* only accessed by the worker thread */
+
+	/* the source each descriptor in the epoll set was registered for, indexed by descriptor */
+	proxyLoopSource** owners;
+	size_t ownersCount;
+} proxyLoopWorker;
+
+struct proxy_loop
+{
+	CRITICAL_SECTION lock;
+	BOOL stopped;
+
+	size_t count;
+	proxyLoopWorker* workers;
+};
+
+static BOOL pf_loop_source_has(const HANDLE* handles, const int* fds, DWORD count, HANDLE handle,
+                               int fd)
+{
+	DWORD i;
+
+	for (i = 0; i < count; i++)
+	{
+		if ((handles[i] == handle) && (fds[i] == fd))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static BOOL pf_loop_worker_add_fd(proxyLoopWorker* worker, proxyLoopSource* source, int fd)
+{
+	struct epoll_event event = { 0 };
+
+	if ((size_t)fd >= worker->ownersCount)
+	{
+		size_t i;
+		const size_t count = (size_t)fd + 64;
+		proxyLoopSource** owners =
+		    (proxyLoopSource**)realloc(worker->owners, count * sizeof(proxyLoopSource*));
+
+		if (!owners)
+			return FALSE;
+
+		for (i = worker->ownersCount; i < count; i++)
+			owners[i] = NULL;
+
+		worker->owners = owners;
+		worker->ownersCount = count;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = source;
+
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl failed with %s [%d]", strerror(errno), errno);
+		return FALSE;
+	}
+
+	worker->owners[fd] = source;
+	return TRUE;
+}
+
+/**
+ * The handle behind a registered descriptor may have been closed by the source since, the
+ * kernel then dropped it from the set already and the number may now belong to a descriptor
+ * another source registered. Only descriptors still registered for this source are removed.
+ */
+static void pf_loop_worker_del_fd(proxyLoopWorker* worker, proxyLoopSource* source, int fd)
+{
+	if (((size_t)fd >= worker->ownersCount) || (worker->owners[fd] != source))
+		return;
+
+	epoll_ctl(worker->epfd, EPOLL_CTL_DEL, fd, NULL);
+	worker->owners[fd] = NULL;
+}
+
+static void pf_loop_source_unregister(proxyLoopWorker* worker, proxyLoopSource* source)
+{
+	DWORD i;
+
+	for (i = 0; i < source->count; i++)
+		pf_loop_worker_del_fd(worker, source, source->fds[i]);
+
+	source->count = 0;
+}
+
+/**
+ * Brings the registrations of a source in line with the handles it currently waits on.
+ * Sessions add and drop handles while running, e.g. when channels are set up or the
+ * transport reconnects, so this runs after every check.
+ */
+static BOOL pf_loop_source_update(proxyLoopWorker* worker, proxyLoopSource* source)
+{
+	DWORD i, j;
+	DWORD nCount;
+	DWORD count = 0;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	int fds[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	HANDLE registered[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	int registeredFds[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	DWORD registeredCount = 0;
+	BOOL rc = TRUE;
+
+	nCount = source->getEventHandles(source->context, handles, ARRAYSIZE(handles));
+	if (nCount == 0)
+	{
+		WLog_ERR(TAG, "Failed to get event handles");
+		return FALSE;
+	}
+
+	for (i = 0; i < nCount; i++)
+	{
+		const int fd = GetEventFileDescriptor(handles[i]);
+
+		if (fd < 0)
+		{
+			WLog_ERR(TAG, "Event handle without file descriptor can not be polled");
+			return FALSE;
+		}
+
+		/* epoll accepts every descriptor only once */
+		for (j = 0; j < count; j++)
+		{
+			if (fds[j] == fd)
+				break;
+		}
+
+		if (j < count)
+			continue;
+
+		handles[count] = handles[i];
+		fds[count++] = fd;
+	}
+
+	for (i = 0; i < source->count; i++)
+	{
+		if (pf_loop_source_has(handles, fds, count, source->handles[i], source->fds[i]))
+		{
+			registered[registeredCount] = source->handles[i];
+			registeredFds[registeredCount++] = source->fds[i];
+		}
+		else
+			pf_loop_worker_del_fd(worker, source, source->fds[i]);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (pf_loop_source_has(source->handles, source->fds, source->count, handles[i], fds[i]))
+			continue;
+
+		if (!pf_loop_worker_add_fd(worker, source, fds[i]))
+		{
+			rc = FALSE;
+			break;
+		}
+
+		registered[registeredCount] = handles[i];
+		registeredFds[registeredCount++] = fds[i];
+	}
+
+	memcpy(source->handles, registered, registeredCount * sizeof(HANDLE));
+	memcpy(source->fds, registeredFds, registeredCount * sizeof(int));
+	source->count = registeredCount;
+	return rc;
+}
+
+static void pf_loop_source_close(proxyLoopWorker* worker, proxyLoopSource* source)
+{
+	pf_loop_source_unregister(worker, source);
+	ArrayList_Remove(worker->sources, source);
+	InterlockedDecrement(&worker->load);
+
+	source->closeSource(source->context);
+	free(source);
+}
+
+static void pf_loop_source_check(proxyLoopWorker* worker, proxyLoopSource* source)
+{
+	if (!source->checkEventHandles(source->context) || !pf_loop_source_update(worker, source))
+		pf_loop_source_close(worker, source);
+}
+
+/* Picks up the sources added by other threads, returns FALSE when the loop stops */
+static BOOL pf_loop_worker_take_added(proxyLoopWorker* worker)
+{
+	BOOL stop;
+
+	EnterCriticalSection(&worker->lock);
+	ResetEvent(worker->wakeup);
+	stop = worker->stop;
+	LeaveCriticalSection(&worker->lock);
+
+	while (1)
+	{
+		proxyLoopSource* source = NULL;
+
+		EnterCriticalSection(&worker->lock);
+		if (ArrayList_Count(worker->added) > 0)
+		{
+			source = ArrayList_GetItem(worker->added, 0);
+			ArrayList_RemoveAt(worker->added, 0);
+		}
+		LeaveCriticalSection(&worker->lock);
+
+		if (!source)
+			break;
+
+		if (!ArrayList_Append(worker->sources, source))
+		{
+			InterlockedDecrement(&worker->load);
+			source->closeSource(source->context);
+			free(source);
+			continue;
+		}
+
+		if (!pf_loop_source_update(worker, source))
+			pf_loop_source_close(worker, source);
+	}
+
+	return !stop;
+}
+
+static void pf_loop_worker_check_all(proxyLoopWorker* worker)
+{
+	size_t i = ArrayList_Count(worker->sources);
+
+	/* backwards, checking a source may remove it */
+	while (i-- > 0)
+	{
+		proxyLoopSource* source = ArrayList_GetItem(worker->sources, i);
+		pf_loop_source_check(worker, source);
+	}
+}
+
+static DWORD WINAPI pf_loop_worker_thread(LPVOID arg)
+{
+	size_t i;
+	UINT64 lastPoll = GetTickCount64();
+	proxyLoopWorker* worker = (proxyLoopWorker*)arg;
+	struct epoll_event events[PF_LOOP_MAX_EVENTS] = { 0 };
+	proxyLoopSource* ready[PF_LOOP_MAX_EVENTS] = { 0 };
+
+	WINPR_ASSERT(worker);
+
+	while (1)
+	{
+		int x;
+		int status;
+		size_t readyCount = 0;
+		BOOL wakeup = FALSE;
+		UINT64 now = GetTickCount64();
+		const UINT64 elapsed = now - lastPoll;
+		const int timeout =
+		    (elapsed >= PF_LOOP_POLL_INTERVAL) ? 0 : (int)(PF_LOOP_POLL_INTERVAL - elapsed);
+
+		status = epoll_wait(worker->epfd, events, ARRAYSIZE(events), timeout);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_ERR(TAG, "epoll_wait failed with %s [%d]", strerror(errno), errno);
+			break;
+		}
+
+		for (x = 0; x < status; x++)
+		{
+			proxyLoopSource* source = events[x].data.ptr;
+
+			if (!source)
+				wakeup = TRUE;
+			else if (!source->ready)
+			{
+				source->ready = TRUE;
+				ready[readyCount++] = source;
+			}
+		}
+
+		for (i = 0; i < readyCount; i++)
+		{
+			ready[i]->ready = FALSE;
+			pf_loop_source_check(worker, ready[i]);
+		}
+
+		if (wakeup && !pf_loop_worker_take_added(worker))
+			break;
+
+		now = GetTickCount64();
+		if (now - lastPoll >= PF_LOOP_POLL_INTERVAL)
+		{
+			pf_loop_worker_check_all(worker);
+			lastPoll = now;
+		}
+	}
+
+	pf_loop_worker_take_added(worker);
+
+	while (ArrayList_Count(worker->sources) > 0)
+	{
+		proxyLoopSource* source = ArrayList_GetItem(worker->sources, 0);
+		pf_loop_source_close(worker, source);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static BOOL pf_loop_worker_init(proxyLoopWorker* worker)
+{
+	struct epoll_event event = { 0 };
+
+	WINPR_ASSERT(worker);
+
+	worker->epfd = -1;
+
+	if (!InitializeCriticalSectionAndSpinCount(&worker->lock, 4000))
+		return FALSE;
+
+	worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (worker->epfd < 0)
+	{
+		WLog_ERR(TAG, "epoll_create1 failed with %s [%d]", strerror(errno), errno);
+		return FALSE;
+	}
+
+	worker->added = ArrayList_New(FALSE);
+	if (!worker->added)
+		return FALSE;
+
+	worker->sources = ArrayList_New(FALSE);
+	if (!worker->sources)
+		return FALSE;
+
+	worker->wakeup = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!worker->wakeup)
+		return FALSE;
+
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, GetEventFileDescriptor(worker->wakeup), &event) <
+	    0)
+		return FALSE;
+
+	worker->thread = CreateThread(NULL, 0, pf_loop_worker_thread, worker, 0, NULL);
+	return worker->thread != NULL;
+}
+
+static void pf_loop_worker_uninit(proxyLoopWorker* worker)
+{
+	WINPR_ASSERT(worker);
+	WINPR_ASSERT(!worker->thread);
+
+	if (worker->wakeup)
+		CloseHandle(worker->wakeup);
+
+	if (worker->epfd >= 0)
+		close(worker->epfd);
+
+	ArrayList_Free(worker->sources);
+	ArrayList_Free(worker->added);
+	free(worker->owners);
+	DeleteCriticalSection(&worker->lock);
+}
+
+proxyLoop* pf_loop_new(size_t workers)
+{
+	proxyLoop* loop;
+
+	WINPR_ASSERT(workers > 0);
+
+	loop = (proxyLoop*)calloc(1, sizeof(proxyLoop));
+	if (!loop)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&loop->lock, 4000))
+	{
+		free(loop);
+		return NULL;
+	}
+
+	loop->workers = (proxyLoopWorker*)calloc(workers, sizeof(proxyLoopWorker));
+	if (!loop->workers)
+		goto fail;
+
+	for (loop->count = 0; loop->count < workers; loop->count++)
+	{
+		if (!pf_loop_worker_init(&loop->workers[loop->count]))
+		{
+			loop->count++;
+			goto fail;
+		}
+	}
+
+	WLog_INFO(TAG, "running sessions on %" PRIuz " event loop threads", loop->count);
+	return loop;
+
+fail:
+	WLog_ERR(TAG, "failed to start the event loop threads");
+	pf_loop_free(loop);
+	return NULL;
+}
+
+void pf_loop_stop(proxyLoop* loop)
+{
+	size_t i;
+
+	if (!loop)
+		return;
+
+	EnterCriticalSection(&loop->lock);
+	loop->stopped = TRUE;
+	LeaveCriticalSection(&loop->lock);
+
+	for (i = 0; i < loop->count; i++)
+	{
+		proxyLoopWorker* worker = &loop->workers[i];
+
+		if (!worker->thread)
+			continue;
+
+		EnterCriticalSection(&worker->lock);
+		worker->stop = TRUE;
+		LeaveCriticalSection(&worker->lock);
+
+		SetEvent(worker->wakeup);
+		WaitForSingleObject(worker->thread, INFINITE);
+		CloseHandle(worker->thread);
+		worker->thread = NULL;
+	}
+}
+
+void pf_loop_free(proxyLoop* loop)
+{
+	size_t i;
+
+	if (!loop)
+		return;
+
+	pf_loop_stop(loop);
+
+	for (i = 0; i < loop->count; i++)
+		pf_loop_worker_uninit(&loop->workers[i]);
+
+	free(loop->workers);
+	DeleteCriticalSection(&loop->lock);
+	free(loop);
+}
+
+/**
+ * Runs a source on the least loaded worker until its check fails or the loop stops.
+ * On success the worker owns the source and calls close once done with it.
+ */
+BOOL pf_loop_add(proxyLoop* loop, void* context, pfLoopGetEventHandles getEventHandles,
+                 pfLoopCheckEventHandles checkEventHandles, pfLoopClose closeSource)
+{
+	size_t i;
+	BOOL rc = FALSE;
+	proxyLoopWorker* worker;
+	proxyLoopSource* source;
+
+	WINPR_ASSERT(loop);
+	WINPR_ASSERT(getEventHandles);
+	WINPR_ASSERT(checkEventHandles);
+	WINPR_ASSERT(closeSource);
+
+	source = (proxyLoopSource*)calloc(1, sizeof(proxyLoopSource));
+	if (!source)
+		return FALSE;
+
+	source->context = context;
+	source->getEventHandles = getEventHandles;
+	source->checkEventHandles = checkEventHandles;
+	source->closeSource = closeSource;
+
+	EnterCriticalSection(&loop->lock);
+
+	if (loop->stopped)
+		goto out;
+
+	worker = &loop->workers[0];
+	for (i = 1; i < loop->count; i++)
+	{
+		if (loop->workers[i].load < worker->load)
+			worker = &loop->workers[i];
+	}
+
+	EnterCriticalSection(&worker->lock);
+	rc = ArrayList_Append(worker->added, source);
+	LeaveCriticalSection(&worker->lock);
+
+	if (rc)
+	{
+		InterlockedIncrement(&worker->load);
+		SetEvent(worker->wakeup);
+	}
+
+out:
+	LeaveCriticalSection(&loop->lock);
+
+	if (!rc)
+		free(source);
+
+	return rc;
+}
+
+#else
+
+proxyLoop* pf_loop_new(size_t workers)
+{
+	WINPR_UNUSED(workers);
+	WLog_ERR(TAG, "event loop mode is not supported on this platform");
+	return NULL;
+}
+
+void pf_loop_free(proxyLoop* loop)
+{
+	WINPR_UNUSED(loop);
+}
+
+BOOL pf_loop_add(proxyLoop* loop, void* context, pfLoopGetEventHandles getEventHandles,
+                 pfLoopCheckEventHandles checkEventHandles, pfLoopClose closeSource)
+{
+	WINPR_UNUSED(loop);
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(getEventHandles);
+	WINPR_UNUSED(checkEventHandles);
+	WINPR_UNUSED(closeSource);
+	return FALSE;
+}
+
+void pf_loop_stop(proxyLoop* loop)
+{
+	WINPR_UNUSED(loop);
+}
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * FreeRDP Proxy Server Event Loop
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_PROXY_PFLOOP_H
+#define FREERDP_SERVER_PROXY_PFLOOP_H
+
+#include <winpr/wtypes.h>
+
+/*
+ * A fixed number of worker threads, each one waiting on the handles of many sources
+ * with a single epoll set. A source is only ever run by the worker it was added to.
+ */
+typedef struct proxy_loop proxyLoop;
+
+/* Returns the number of handles written to handles, 0 on failure */
+typedef DWORD (*pfLoopGetEventHandles)(void* context, HANDLE* handles, DWORD count);
+/* Called when one of the handles is signaled and once a second, FALSE ends the source */
+typedef BOOL (*pfLoopCheckEventHandles)(void* context);
+/* Called on the worker when the source ended or the loop is stopped */
+typedef void (*pfLoopClose)(void* context);
+
+proxyLoop* pf_loop_new(size_t workers);
+void pf_loop_free(proxyLoop* loop);
+
+BOOL pf_loop_add(proxyLoop* loop, void* context, pfLoopGetEventHandles getEventHandles,
+                 pfLoopCheckEventHandles checkEventHandles, pfLoopClose closeSource);
+void pf_loop_stop(proxyLoop* loop);
+
+#endif /* FREERDP_SERVER_PROXY_PFLOOP_H */
@@ -52,6 +52,7 @@
 #include "pf_update.h"
 #include "proxy_modules.h"
 #include "pf_utils.h"
+#include "pf_loop.h"
 #include "channels/pf_channel_drdynvc.h"
 #include "channels/pf_channel_rdpdr.h"
 
@@ -61,6 +62,7 @@ typedef struct
 {
 	HANDLE thread;
 	freerdp_peer* client;
+	BOOL clientDetached; /* the event loop runs the peer and the proxy's client */
 } peer_thread_args;
 
 static BOOL pf_server_parse_target_from_routing_token(rdpContext* context, char** target,
@@ -271,9 +273,14 @@ static BOOL pf_server_post_connect(freerdp_peer* peer)
 	rdpSettings* client_settings;
 	proxyData* pdata;
 	rdpSettings* frontSettings;
+	proxyServer* server;
+	LPTHREAD_START_ROUTINE client_start;
 
 	WINPR_ASSERT(peer);
 
+	server = (proxyServer*)peer->ContextExtra;
+	WINPR_ASSERT(server);
+
 	ps = (pServerContext*)peer->context;
 	WINPR_ASSERT(ps);
 
@@ -314,8 +321,9 @@ static BOOL pf_server_post_connect(freerdp_peer* peer)
 	if (!pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_POST_CONNECT, pdata, peer))
 		return FALSE;
 
-	/* Start a proxy's client in it's own thread */
-	if (!(pdata->client_thread = CreateThread(NULL, 0, pf_client_start, pc, 0, NULL)))
+	/* Start a proxy's client in it's own thread, in event loop mode only to connect */
+	client_start = server->loop ? pf_client_start_detached : pf_client_start;
+	if (!(pdata->client_thread = CreateThread(NULL, 0, client_start, pc, 0, NULL)))
 	{
 		PROXY_LOG_ERR(TAG, ps, "failed to create client thread");
 		return FALSE;
@@ -518,6 +526,8 @@ static BOOL pf_server_initialize_peer_connection(freerdp_peer* peer)
 		return FALSE;
 	if (!freerdp_settings_set_bool(settings, FreeRDP_NlaSecurity, config->ServerNlaSecurity))
 		return FALSE;
+	if (!freerdp_settings_set_bool(settings, FreeRDP_TlsKernelOffload, config->TlsKernelOffload))
+		return FALSE;
 
 	settings->EncryptionLevel = ENCRYPTION_LEVEL_CLIENT_COMPATIBLE;
 	if (!freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, 32))
@@ -547,163 +557,170 @@ static BOOL pf_server_initialize_peer_connection(freerdp_peer* peer)
 	return TRUE;
 }
 
-/**
- * Handles an incoming client connection, to be run in it's own thread.
- *
- * arg is a pointer to a freerdp_peer representing the client.
- */
-static DWORD WINAPI pf_server_handle_peer(LPVOID arg)
+static DWORD pf_server_get_event_handles(void* context, HANDLE* handles, DWORD count)
 {
-	HANDLE eventHandles[MAXIMUM_WAIT_OBJECTS] = { 0 };
 	DWORD tmp;
-	DWORD status;
-	pServerContext* ps = NULL;
-	proxyData* pdata = NULL;
+	DWORD nCount;
+	HANDLE ChannelEvent;
+	pServerContext* ps;
+	proxyData* pdata;
+	peer_thread_args* args = context;
 	freerdp_peer* client;
-	proxyServer* server;
-	size_t count;
-	peer_thread_args* args = arg;
 
 	WINPR_ASSERT(args);
+	WINPR_ASSERT(handles);
 
 	client = args->client;
 	WINPR_ASSERT(client);
 
-	server = (proxyServer*)client->ContextExtra;
-	WINPR_ASSERT(server);
-
-	count = ArrayList_Count(server->peer_list);
-
-	if (!pf_context_init_server_context(client))
-		goto out_free_peer;
-
-	if (!pf_server_initialize_peer_connection(client))
-		goto out_free_peer;
-
 	ps = (pServerContext*)client->context;
 	WINPR_ASSERT(ps);
-	PROXY_LOG_DBG(TAG, ps, "Added peer, %" PRIuz " connected", count);
 
 	pdata = ps->pdata;
 	WINPR_ASSERT(pdata);
 
-	pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_SESSION_INITIALIZE, pdata, client);
+	WINPR_ASSERT(client->GetEventHandles);
+	nCount = client->GetEventHandles(client, handles, count);
 
-	WINPR_ASSERT(client->Initialize);
-	client->Initialize(client);
+	if ((nCount == 0) || (count - nCount < 2))
+	{
+		WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
+		return 0;
+	}
 
-	PROXY_LOG_INFO(TAG, ps, "new connection: proxy address: %s, client address: %s",
-	               pdata->config->Host, client->hostname);
+	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
 
-	pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_SESSION_STARTED, pdata, client);
+	WINPR_ASSERT(ChannelEvent && (ChannelEvent != INVALID_HANDLE_VALUE));
+	WINPR_ASSERT(pdata->abort_event && (pdata->abort_event != INVALID_HANDLE_VALUE));
+	handles[nCount++] = ChannelEvent;
+	handles[nCount++] = pdata->abort_event;
 
-	while (1)
+	/* In event loop mode both sides of the session are waited on together */
+	if (args->clientDetached)
 	{
-		HANDLE ChannelEvent = INVALID_HANDLE_VALUE;
-		DWORD eventCount = 0;
-		{
-			WINPR_ASSERT(client->GetEventHandles);
-			tmp = client->GetEventHandles(client, &eventHandles[eventCount],
-			                              ARRAYSIZE(eventHandles) - eventCount);
+		tmp = pf_client_get_event_handles(pdata->pc, &handles[nCount], count - nCount);
+		if (tmp == 0)
+			return 0;
 
-			if (tmp == 0)
-			{
-				WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
-				break;
-			}
+		nCount += tmp;
+	}
 
-			eventCount += tmp;
-		}
-		/* Main client event handling loop */
-		ChannelEvent = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
+	return nCount;
+}
 
-		WINPR_ASSERT(ChannelEvent && (ChannelEvent != INVALID_HANDLE_VALUE));
-		WINPR_ASSERT(pdata->abort_event && (pdata->abort_event != INVALID_HANDLE_VALUE));
-		eventHandles[eventCount++] = ChannelEvent;
-		eventHandles[eventCount++] = pdata->abort_event;
-		eventHandles[eventCount++] = server->stopEvent;
+static BOOL pf_server_check_peer_event_handles(peer_thread_args* args)
+{
+	HANDLE ChannelEvent;
+	pServerContext* ps;
+	proxyData* pdata;
+	proxyServer* server;
+	freerdp_peer* client;
 
-		status = WaitForMultipleObjects(eventCount, eventHandles, FALSE,
-		                                1000); /* Do periodic polling to avoid client hang */
+	WINPR_ASSERT(args);
 
-		if (status == WAIT_FAILED)
+	client = args->client;
+	WINPR_ASSERT(client);
+
+	server = (proxyServer*)client->ContextExtra;
+	WINPR_ASSERT(server);
+
+	ps = (pServerContext*)client->context;
+	WINPR_ASSERT(ps);
+
+	pdata = ps->pdata;
+	WINPR_ASSERT(pdata);
+
+	WINPR_ASSERT(client->CheckFileDescriptor);
+	if (client->CheckFileDescriptor(client) != TRUE)
+		return FALSE;
+
+	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
+	if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
+	{
+		if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
 		{
-			WLog_ERR(TAG, "WaitForMultipleObjects failed (status: %" PRIu32 ")", status);
-			break;
+			WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
+			return FALSE;
 		}
+	}
 
-		WINPR_ASSERT(client->CheckFileDescriptor);
-		if (client->CheckFileDescriptor(client) != TRUE)
-			break;
+	/* only disconnect after checking client's and vcm's file descriptors  */
+	if (proxy_data_shall_disconnect(pdata))
+	{
+		WLog_INFO(TAG, "abort event is set, closing connection with peer %s", client->hostname);
+		return FALSE;
+	}
 
-		if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
-		{
+	if (WaitForSingleObject(server->stopEvent, 0) == WAIT_OBJECT_0)
+	{
+		WLog_INFO(TAG, "Server shutting down, terminating peer");
+		return FALSE;
+	}
+
+	switch (WTSVirtualChannelManagerGetDrdynvcState(ps->vcm))
+	{
+		/* Dynamic channel status may have been changed after processing */
+		case DRDYNVC_STATE_NONE:
+
+			/* Initialize drdynvc channel */
 			if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
 			{
-				WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
-				goto fail;
+				WLog_ERR(TAG, "Failed to initialize drdynvc channel");
+				return FALSE;
 			}
-		}
 
-		/* only disconnect after checking client's and vcm's file descriptors  */
-		if (proxy_data_shall_disconnect(pdata))
-		{
-			WLog_INFO(TAG, "abort event is set, closing connection with peer %s", client->hostname);
 			break;
-		}
 
-		if (WaitForSingleObject(server->stopEvent, 0) == WAIT_OBJECT_0)
-		{
-			WLog_INFO(TAG, "Server shutting down, terminating peer");
-			break;
-		}
+		case DRDYNVC_STATE_READY:
+			if (WaitForSingleObject(ps->dynvcReady, 0) == WAIT_TIMEOUT)
+			{
+				SetEvent(ps->dynvcReady);
+			}
 
-		switch (WTSVirtualChannelManagerGetDrdynvcState(ps->vcm))
-		{
-			/* Dynamic channel status may have been changed after processing */
-			case DRDYNVC_STATE_NONE:
+			break;
 
-				/* Initialize drdynvc channel */
-				if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
-				{
-					WLog_ERR(TAG, "Failed to initialize drdynvc channel");
-					goto fail;
-				}
+		default:
+			break;
+	}
 
-				break;
+	return TRUE;
+}
 
-			case DRDYNVC_STATE_READY:
-				if (WaitForSingleObject(ps->dynvcReady, 0) == WAIT_TIMEOUT)
-				{
-					SetEvent(ps->dynvcReady);
-				}
+static BOOL pf_server_check_event_handles(void* context)
+{
+	peer_thread_args* args = context;
+	pServerContext* ps;
 
-				break;
+	WINPR_ASSERT(args);
 
-			default:
-				break;
-		}
-	}
+	if (!pf_server_check_peer_event_handles(args))
+		return FALSE;
 
-fail:
+	if (!args->clientDetached)
+		return TRUE;
 
-	PROXY_LOG_INFO(TAG, ps, "starting shutdown of connection");
-	PROXY_LOG_INFO(TAG, ps, "stopping proxy's client");
+	ps = (pServerContext*)args->client->context;
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(ps->pdata);
 
-	/* Abort the client. */
-	proxy_data_abort_connect(pdata);
+	return pf_client_check_event_handles(ps->pdata->pc);
+}
 
-	pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_SESSION_END, pdata, client);
+static void pf_server_free_peer(peer_thread_args* args, proxyData* pdata)
+{
+	size_t count;
+	freerdp_peer* client;
+	proxyServer* server;
+	pServerContext* ps = pdata ? pdata->ps : NULL;
 
-	PROXY_LOG_INFO(TAG, ps, "freeing server's channels");
+	WINPR_ASSERT(args);
 
-	WINPR_ASSERT(client->Close);
-	client->Close(client);
+	client = args->client;
+	WINPR_ASSERT(client);
 
-	WINPR_ASSERT(client->Disconnect);
-	client->Disconnect(client);
+	server = (proxyServer*)client->ContextExtra;
+	WINPR_ASSERT(server);
 
-out_free_peer:
 	PROXY_LOG_INFO(TAG, ps, "freeing proxy data");
 
 	if (pdata && pdata->client_thread)
@@ -712,6 +729,9 @@ out_free_peer:
 		WaitForSingleObject(pdata->client_thread, INFINITE);
 	}
 
+	if (args->clientDetached)
+		pf_client_stop_detached(pdata->pc);
+
 	{
 		ArrayList_Lock(server->peer_list);
 		ArrayList_Remove(server->peer_list, args->thread);
@@ -727,6 +747,184 @@ out_free_peer:
 	DumpEventHandles();
 #endif
 	free(args);
+}
+
+static void pf_server_close_peer(void* context)
+{
+	peer_thread_args* args = context;
+	freerdp_peer* client;
+	pServerContext* ps;
+	proxyData* pdata;
+
+	WINPR_ASSERT(args);
+
+	client = args->client;
+	WINPR_ASSERT(client);
+
+	ps = (pServerContext*)client->context;
+	WINPR_ASSERT(ps);
+
+	pdata = ps->pdata;
+	WINPR_ASSERT(pdata);
+
+	PROXY_LOG_INFO(TAG, ps, "starting shutdown of connection");
+	PROXY_LOG_INFO(TAG, ps, "stopping proxy's client");
+
+	/* Abort the client. */
+	proxy_data_abort_connect(pdata);
+
+	pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_SESSION_END, pdata, client);
+
+	PROXY_LOG_INFO(TAG, ps, "freeing server's channels");
+
+	WINPR_ASSERT(client->Close);
+	client->Close(client);
+
+	WINPR_ASSERT(client->Disconnect);
+	client->Disconnect(client);
+
+	pf_server_free_peer(args, pdata);
+}
+
+/**
+ * In event loop mode the session is handed to the loop once the proxy's client connected,
+ * the connection sequences block and stay on their own threads.
+ *
+ * @return TRUE if the loop took over the session
+ */
+static BOOL pf_server_detach_peer(peer_thread_args* args, proxyData* pdata)
+{
+	DWORD exitCode = 1;
+	proxyServer* server;
+
+	WINPR_ASSERT(args);
+	WINPR_ASSERT(pdata);
+
+	server = (proxyServer*)args->client->ContextExtra;
+	WINPR_ASSERT(server);
+
+	if (!server->loop || !pdata->client_thread)
+		return FALSE;
+
+	if (WaitForSingleObject(pdata->client_thread, 0) != WAIT_OBJECT_0)
+		return FALSE;
+
+	if (!GetExitCodeThread(pdata->client_thread, &exitCode) || (exitCode != 0))
+		return FALSE;
+
+	args->clientDetached = TRUE;
+	return pf_loop_add(server->loop, args, pf_server_get_event_handles,
+	                   pf_server_check_event_handles, pf_server_close_peer);
+}
+
+/**
+ * Handles an incoming client connection, to be run in it's own thread.
+ *
+ * arg is a pointer to a freerdp_peer representing the client.
+ */
+static DWORD WINAPI pf_server_handle_peer(LPVOID arg)
+{
+	HANDLE eventHandles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	HANDLE waitHandles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	DWORD waitCount = 0;
+	WINPR_WAIT_SET* waitSet = NULL;
+	DWORD status;
+	pServerContext* ps = NULL;
+	proxyData* pdata = NULL;
+	freerdp_peer* client;
+	proxyServer* server;
+	size_t count;
+	peer_thread_args* args = arg;
+
+	WINPR_ASSERT(args);
+
+	client = args->client;
+	WINPR_ASSERT(client);
+
+	server = (proxyServer*)client->ContextExtra;
+	WINPR_ASSERT(server);
+
+	count = ArrayList_Count(server->peer_list);
+
+	if (!pf_context_init_server_context(client))
+		goto out_free_peer;
+
+	if (!pf_server_initialize_peer_connection(client))
+		goto out_free_peer;
+
+	ps = (pServerContext*)client->context;
+	WINPR_ASSERT(ps);
+	PROXY_LOG_DBG(TAG, ps, "Added peer, %" PRIuz " connected", count);
+
+	pdata = ps->pdata;
+	WINPR_ASSERT(pdata);
+
+	pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_SESSION_INITIALIZE, pdata, client);
+
+	WINPR_ASSERT(client->Initialize);
+	client->Initialize(client);
+
+	PROXY_LOG_INFO(TAG, ps, "new connection: proxy address: %s, client address: %s",
+	               pdata->config->Host, client->hostname);
+
+	pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_SESSION_STARTED, pdata, client);
+
+	waitSet = CreateWaitSet();
+
+	while (waitSet)
+	{
+		/* Main client event handling loop */
+		DWORD eventCount =
+		    pf_server_get_event_handles(args, eventHandles, ARRAYSIZE(eventHandles) - 2);
+
+		if (eventCount == 0)
+			break;
+
+		eventHandles[eventCount++] = server->stopEvent;
+
+		if (server->loop && pdata->client_thread)
+			eventHandles[eventCount++] = pdata->client_thread;
+
+		/* The peer handles live as long as the peer, only register a changed list */
+		if ((eventCount != waitCount) ||
+		    (memcmp(eventHandles, waitHandles, eventCount * sizeof(HANDLE)) != 0))
+		{
+			if (!SetWaitSetHandles(waitSet, eventCount, eventHandles))
+				break;
+
+			memcpy(waitHandles, eventHandles, eventCount * sizeof(HANDLE));
+			waitCount = eventCount;
+		}
+
+		status = WaitForWaitSet(waitSet, 1000); /* Do periodic polling to avoid client hang */
+
+		if (status == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitForWaitSet failed (status: %" PRIu32 ")", status);
+			break;
+		}
+
+		if (!pf_server_check_peer_event_handles(args))
+			break;
+
+		if (pf_server_detach_peer(args, pdata))
+		{
+			FreeWaitSet(waitSet);
+			ExitThread(0);
+			return 0;
+		}
+
+		if (args->clientDetached)
+			break;
+	}
+
+	FreeWaitSet(waitSet);
+	pf_server_close_peer(args);
+	ExitThread(0);
+	return 0;
+
+out_free_peer:
+	pf_server_free_peer(args, pdata);
 	ExitThread(0);
 	return 0;
 }
@@ -944,6 +1142,13 @@ proxyServer* pf_server_new(const proxyConfig* config)
 	if (!server->peer_list)
 		goto out;
 
+	if (server->config->Workers > 0)
+	{
+		server->loop = pf_loop_new(server->config->Workers);
+		if (!server->loop)
+			WLog_WARN(TAG, "event loop mode unavailable, running every session in own threads");
+	}
+
 	obj = ArrayList_Object(server->peer_list);
 	WINPR_ASSERT(obj);
 
@@ -1034,6 +1239,9 @@ void pf_server_free(proxyServer* server)
 
 	pf_server_stop(server);
 
+	/* closes the sessions the loop runs, the others notice the stop event */
+	pf_loop_stop(server->loop);
+
 	while (ArrayList_Count(server->peer_list) > 0)
 	{
 		/* pf_server_stop triggers the threads to shut down.
@@ -1046,6 +1254,7 @@ void pf_server_free(proxyServer* server)
 		Sleep(100);
 	}
 	ArrayList_Free(server->peer_list);
+	pf_loop_free(server->loop);
 	freerdp_listener_free(server->listener);
 
 	if (server->stopEvent)
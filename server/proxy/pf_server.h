@@ -29,6 +29,7 @@
 
 #include <freerdp/server/proxy/proxy_config.h>
 #include "proxy_modules.h"
+#include "pf_loop.h"
 
 struct proxy_server
 {
@@ -38,6 +39,7 @@ struct proxy_server
 	freerdp_listener* listener;
 	HANDLE stopEvent; /* an event used to signal the main thread to stop */
 	wArrayList* peer_list;
+	proxyLoop* loop; /* NULL unless sessions run in event loop mode */
 };
 
 #endif /* INT_FREERDP_SERVER_PROXY_SERVER_H */
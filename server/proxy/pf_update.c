@@ -585,6 +585,21 @@ static BOOL pf_client_non_monitored_desktop(rdpContext* context, const WINDOW_OR
 	return rc;
 }
 
+static BOOL pf_client_fastpath_update(rdpContext* context, BYTE updateCode, wStream* s)
+{
+	pClientContext* pc = (pClientContext*)context;
+	proxyData* pdata;
+	rdpContext* ps;
+	WINPR_ASSERT(pc);
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+	ps = (rdpContext*)pdata->ps;
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(ps->update);
+	WINPR_ASSERT(ps->update->FastPathUpdate);
+	return ps->update->FastPathUpdate(ps, updateCode, s);
+}
+
 void pf_server_register_update_callbacks(rdpUpdate* update)
 {
 	WINPR_ASSERT(update);
@@ -625,3 +640,12 @@ void pf_client_register_update_callbacks(rdpUpdate* update)
 	update->pointer->PointerNew = pf_client_send_pointer_new;
 	update->pointer->PointerCached = pf_client_send_pointer_cached;
 }
+
+/* Both connections negotiated the same capabilities, so the updates are valid on the
+ * front connection as they are. Slow-path updates are still decoded.
+ */
+void pf_client_register_passthrough_update_callbacks(rdpUpdate* update)
+{
+	WINPR_ASSERT(update);
+	update->FastPathUpdate = pf_client_fastpath_update;
+}
@@ -421,15 +421,22 @@ static void (^mac_capture_stream_handler)(
 	  count = ArrayList_Count(server->clients);
 	  shadow_subsystem_frame_update(&subsystem->common);
 
-	  if (count == 1)
+	  /* Capture as fast as the fastest client link, slower clients skip frames */
+	  if (count > 0)
 	  {
-		  rdpShadowClient* client;
-		  client = (rdpShadowClient*)ArrayList_GetItem(server->clients, 0);
+		  int index;
+		  UINT32 fps = 1;
 
-		  if (client)
+		  for (index = 0; index < count; index++)
 		  {
-			  subsystem->common.captureFrameRate = shadow_encoder_preferred_fps(client->encoder);
+			  rdpShadowClient* client;
+			  client = (rdpShadowClient*)ArrayList_GetItem(server->clients, index);
+
+			  if (client)
+				  fps = MAX(fps, shadow_encoder_preferred_fps(client->encoder));
 		  }
+
+		  subsystem->common.captureFrameRate = fps;
 	  }
 
 	  ArrayList_Unlock(server->clients);
@@ -754,14 +754,11 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	int rc = 0;
 	size_t count;
 	int status = -1;
-	int x, y;
-	int width, height;
 	XImage* image;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
+	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
 	server = subsystem->common.server;
 	surface = server->surface;
 	count = ArrayList_Count(server->clients);
@@ -776,6 +773,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	surfaceRect.bottom = surface->height;
 	LeaveCriticalSection(&surface->lock);
 
+	region16_init(&invalidRegion);
 	XLockDisplay(subsystem->display);
 	/*
 	 * Ignore BadMatch error during image capture. The screen size may be
@@ -790,9 +788,9 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
 
 		EnterCriticalSection(&surface->lock);
-		status = shadow_capture_compare(surface->data, surface->scanline, surface->width,
-		                                surface->height, (BYTE*)&(image->data[surface->width * 4]),
-		                                image->bytes_per_line, &invalidRect);
+		status = shadow_capture_compare_region(
+		    surface->data, surface->scanline, surface->width, surface->height,
+		    (BYTE*)&(image->data[surface->width * 4]), image->bytes_per_line, &invalidRegion);
 		LeaveCriticalSection(&surface->lock);
 	}
 	else
@@ -804,9 +802,10 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 
 		if (image)
 		{
-			status = shadow_capture_compare(surface->data, surface->scanline, surface->width,
-			                                surface->height, (BYTE*)image->data,
-			                                image->bytes_per_line, &invalidRect);
+			status = shadow_capture_compare_region(surface->data, surface->scanline,
+			                                       surface->width, surface->height,
+			                                       (BYTE*)image->data, image->bytes_per_line,
+			                                       &invalidRegion);
 		}
 		LeaveCriticalSection(&surface->lock);
 		if (!image)
@@ -824,50 +823,71 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
 
-	if (status)
+	if (status > 0)
 	{
 		BOOL empty;
+		UINT32 index;
+		UINT32 numRects = 0;
+		const RECTANGLE_16* rects;
 		EnterCriticalSection(&surface->lock);
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
+		rects = region16_rects(&invalidRegion, &numRects);
+
+		for (index = 0; index < numRects; index++)
+			region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+			                    &rects[index]);
+
 		region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion), &surfaceRect);
 		empty = region16_is_empty(&(surface->invalidRegion));
 		LeaveCriticalSection(&surface->lock);
 
 		if (!empty)
 		{
-			BOOL success;
+			BOOL success = TRUE;
 			EnterCriticalSection(&surface->lock);
-			extents = region16_extents(&(surface->invalidRegion));
-			x = extents->left;
-			y = extents->top;
-			width = extents->right - extents->left;
-			height = extents->bottom - extents->top;
+			rects = region16_rects(&(surface->invalidRegion), &numRects);
 			WINPR_ASSERT(image);
 			WINPR_ASSERT(image->bytes_per_line >= 0);
-			WINPR_ASSERT(width >= 0);
-			WINPR_ASSERT(height >= 0);
-			success = freerdp_image_copy(surface->data, surface->format, surface->scanline, x, y,
-			                             (UINT32)width, (UINT32)height, (BYTE*)image->data,
-			                             PIXEL_FORMAT_BGRX32, (UINT32)image->bytes_per_line, x, y,
-			                             NULL, FREERDP_FLIP_NONE);
+
+			/* Only copy the changed tiles, not their bounding box */
+			for (index = 0; success && (index < numRects); index++)
+			{
+				const RECTANGLE_16* rect = &rects[index];
+				success = freerdp_image_copy(
+				    surface->data, surface->format, surface->scanline, rect->left, rect->top,
+				    rect->right - rect->left, rect->bottom - rect->top, (BYTE*)image->data,
+				    PIXEL_FORMAT_BGRX32, (UINT32)image->bytes_per_line, rect->left, rect->top, NULL,
+				    FREERDP_FLIP_NONE);
+			}
 			LeaveCriticalSection(&surface->lock);
 			if (!success)
 				goto fail_capture;
 
 			// x11_shadow_blend_cursor(subsystem);
-			count = ArrayList_Count(server->clients);
 			shadow_subsystem_frame_update(&subsystem->common);
 
-			if (count == 1)
+			/* Capture as fast as the fastest client link, slower clients skip frames */
+			ArrayList_Lock(server->clients);
+			count = ArrayList_Count(server->clients);
+
+			if (count > 0)
 			{
-				rdpShadowClient* client;
-				client = (rdpShadowClient*)ArrayList_GetItem(server->clients, 0);
+				size_t x;
+				UINT32 fps = 1;
+
+				for (x = 0; x < count; x++)
+				{
+					rdpShadowClient* client =
+					    (rdpShadowClient*)ArrayList_GetItem(server->clients, x);
 
-				if (client)
-					subsystem->common.captureFrameRate =
-					    shadow_encoder_preferred_fps(client->encoder);
+					if (client)
+						fps = MAX(fps, shadow_encoder_preferred_fps(client->encoder));
+				}
+
+				subsystem->common.captureFrameRate = fps;
 			}
 
+			ArrayList_Unlock(server->clients);
+
 			EnterCriticalSection(&surface->lock);
 			region16_clear(&(surface->invalidRegion));
 			LeaveCriticalSection(&surface->lock);
@@ -876,6 +896,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 
 	rc = 1;
 fail_capture:
+	region16_uninit(&invalidRegion);
 	if (!subsystem->use_xshm && image)
 		XDestroyImage(image);
 
@@ -19,7 +19,9 @@
 #include <freerdp/config.h>
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
 
@@ -27,8 +29,20 @@
 
 #include "shadow_capture.h"
 
+#if defined(WITH_SSE2) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#include <emmintrin.h>
+#elif defined(WITH_NEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define TAG SERVER_TAG("shadow")
 
+#define SHADOW_CAPTURE_TILE_SIZE 16
+
+/* Frames from this size on are compared in parallel bands */
+#define SHADOW_CAPTURE_THREAD_MIN_AREA (1920 * 1080)
+#define SHADOW_CAPTURE_MAX_BANDS 8
+
 int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 {
 	int dx, dy;
@@ -77,151 +91,242 @@ int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 	return 1;
 }
 
-int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
-                           UINT32 nStep2, RECTANGLE_16* rect)
+typedef struct
 {
-	BOOL equal;
-	BOOL allEqual;
-	UINT32 tw, th;
-	UINT32 tx, ty, k;
-	UINT32 nrow, ncol;
-	UINT32 l, t, r, b;
-	BYTE *p1, *p2;
-	BOOL rows[1024];
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	BOOL cols[1024] = { FALSE };
-#endif
-	allEqual = TRUE;
-	ZeroMemory(rect, sizeof(RECTANGLE_16));
-	FillMemory(rows, sizeof(rows), 0xFF);
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	FillMemory(cols, sizeof(cols), 0xFF);
-#endif
-	nrow = (nHeight + 15) / 16;
-	ncol = (nWidth + 15) / 16;
-	l = ncol + 1;
-	r = 0;
-	t = nrow + 1;
-	b = 0;
+	const BYTE* pData1;
+	UINT32 nStep1;
+	const BYTE* pData2;
+	UINT32 nStep2;
+	UINT32 nWidth;
+	UINT32 nHeight;
+	UINT32 firstRow;
+	UINT32 lastRow;
+	BYTE* dirty;
+} SHADOW_CAPTURE_BAND;
+
+static INLINE BOOL shadow_capture_tile_equal(const BYTE* p1, UINT32 nStep1, const BYTE* p2,
+                                             UINT32 nStep2, UINT32 tw, UINT32 th)
+{
+	UINT32 k;
 
-	for (ty = 0; ty < nrow; ty++)
+#if defined(WITH_SSE2) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+	if (tw == SHADOW_CAPTURE_TILE_SIZE)
 	{
-		th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
-
-		if (!th)
-			th = 16;
+		for (k = 0; k < th; k++)
+		{
+			const __m128i* a = (const __m128i*)p1;
+			const __m128i* b = (const __m128i*)p2;
+			__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(&a[0]), _mm_loadu_si128(&b[0]));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi32(_mm_loadu_si128(&a[1]), _mm_loadu_si128(&b[1])));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi32(_mm_loadu_si128(&a[2]), _mm_loadu_si128(&b[2])));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi32(_mm_loadu_si128(&a[3]), _mm_loadu_si128(&b[3])));
+
+			if (_mm_movemask_epi8(eq) != 0xFFFF)
+				return FALSE;
+
+			p1 += nStep1;
+			p2 += nStep2;
+		}
 
-		for (tx = 0; tx < ncol; tx++)
+		return TRUE;
+	}
+#elif defined(WITH_NEON) && defined(__ARM_NEON)
+	if (tw == SHADOW_CAPTURE_TILE_SIZE)
+	{
+		for (k = 0; k < th; k++)
 		{
-			equal = TRUE;
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
+			const UINT32* a = (const UINT32*)p1;
+			const UINT32* b = (const UINT32*)p2;
+			uint32x4_t eq = vceqq_u32(vld1q_u32(&a[0]), vld1q_u32(&b[0]));
+			uint32x2_t r;
+			eq = vandq_u32(eq, vceqq_u32(vld1q_u32(&a[4]), vld1q_u32(&b[4])));
+			eq = vandq_u32(eq, vceqq_u32(vld1q_u32(&a[8]), vld1q_u32(&b[8])));
+			eq = vandq_u32(eq, vceqq_u32(vld1q_u32(&a[12]), vld1q_u32(&b[12])));
+			r = vand_u32(vget_low_u32(eq), vget_high_u32(eq));
+
+			if ((vget_lane_u32(r, 0) & vget_lane_u32(r, 1)) != 0xFFFFFFFF)
+				return FALSE;
+
+			p1 += nStep1;
+			p2 += nStep2;
+		}
 
-			if (!tw)
-				tw = 16;
+		return TRUE;
+	}
+#endif
 
-			p1 = &pData1[(ty * 16 * nStep1) + (tx * 16 * 4)];
-			p2 = &pData2[(ty * 16 * nStep2) + (tx * 16 * 4)];
+	for (k = 0; k < th; k++)
+	{
+		if (memcmp(p1, p2, tw * 4ull) != 0)
+			return FALSE;
 
-			for (k = 0; k < th; k++)
-			{
-				if (memcmp(p1, p2, tw * 4) != 0)
-				{
-					equal = FALSE;
-					break;
-				}
-
-				p1 += nStep1;
-				p2 += nStep2;
-			}
+		p1 += nStep1;
+		p2 += nStep2;
+	}
 
-			if (!equal)
-			{
-				rows[ty] = FALSE;
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-				cols[tx] = FALSE;
-#endif
+	return TRUE;
+}
 
-				if (l > tx)
-					l = tx;
+static void shadow_capture_compare_band(SHADOW_CAPTURE_BAND* band)
+{
+	UINT32 tx, ty;
+	const UINT32 ncol = (band->nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
 
-				if (r < tx)
-					r = tx;
-			}
-		}
+	for (ty = band->firstRow; ty < band->lastRow; ty++)
+	{
+		const UINT32 y = ty * SHADOW_CAPTURE_TILE_SIZE;
+		const UINT32 th = MIN(SHADOW_CAPTURE_TILE_SIZE, band->nHeight - y);
 
-		if (!rows[ty])
+		for (tx = 0; tx < ncol; tx++)
 		{
-			allEqual = FALSE;
+			const UINT32 x = tx * SHADOW_CAPTURE_TILE_SIZE;
+			const UINT32 tw = MIN(SHADOW_CAPTURE_TILE_SIZE, band->nWidth - x);
+			const BYTE* p1 = &band->pData1[1ull * y * band->nStep1 + 4ull * x];
+			const BYTE* p2 = &band->pData2[1ull * y * band->nStep2 + 4ull * x];
 
-			if (t > ty)
-				t = ty;
-
-			if (b < ty)
-				b = ty;
+			band->dirty[1ull * ty * ncol + tx] =
+			    !shadow_capture_tile_equal(p1, band->nStep1, p2, band->nStep2, tw, th);
 		}
 	}
+}
 
-	if (allEqual)
-		return 0;
-
-	WINPR_ASSERT(l * 16 <= UINT16_MAX);
-	WINPR_ASSERT(t * 16 <= UINT16_MAX);
-	WINPR_ASSERT((r + 1) * 16 <= UINT16_MAX);
-	WINPR_ASSERT((b + 1) * 16 <= UINT16_MAX);
-	rect->left = (UINT16)l * 16;
-	rect->top = (UINT16)t * 16;
-	rect->right = (UINT16)(r + 1) * 16;
-	rect->bottom = (UINT16)(b + 1) * 16;
+static void CALLBACK shadow_capture_compare_work_callback(PTP_CALLBACK_INSTANCE instance,
+                                                          void* context, PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	shadow_capture_compare_band((SHADOW_CAPTURE_BAND*)context);
+}
 
-	WINPR_ASSERT(nWidth <= UINT16_MAX);
-	if (rect->right > nWidth)
-		rect->right = (UINT16)nWidth;
+/* Large frames are split into bands of tile rows compared on the default thread pool */
+static UINT32 shadow_capture_compare_band_count(UINT32 nWidth, UINT32 nHeight, UINT32 nrow)
+{
+	SYSTEM_INFO sysinfo = { 0 };
 
-	WINPR_ASSERT(nHeight <= UINT16_MAX);
-	if (rect->bottom > nHeight)
-		rect->bottom = (UINT16)nHeight;
+	if ((1ull * nWidth * nHeight) < SHADOW_CAPTURE_THREAD_MIN_AREA)
+		return 1;
 
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	size_t size = ncol + 1;
-	char* col_str = calloc(size, sizeof(char));
+	GetNativeSystemInfo(&sysinfo);
+	return MAX(1, MIN(MIN(sysinfo.dwNumberOfProcessors, SHADOW_CAPTURE_MAX_BANDS), nrow));
+}
 
-	if (!col_str)
-	{
-		WLog_ERR(TAG, "calloc failed!");
-		return 1;
-	}
+int shadow_capture_compare_region(const BYTE* pData1, UINT32 nStep1, UINT32 nWidth,
+                                  UINT32 nHeight, const BYTE* pData2, UINT32 nStep2,
+                                  REGION16* region)
+{
+	int rc = -1;
+	UINT32 index;
+	UINT32 tx, ty;
+	UINT32 numBands;
+	BYTE* dirty = NULL;
+	PTP_WORK work[SHADOW_CAPTURE_MAX_BANDS] = { 0 };
+	SHADOW_CAPTURE_BAND bands[SHADOW_CAPTURE_MAX_BANDS] = { 0 };
+	const UINT32 nrow = (nHeight + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	const UINT32 ncol = (nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+
+	if (!pData1 || !pData2 || !region || (nWidth > UINT16_MAX) || (nHeight > UINT16_MAX))
+		return -1;
+
+	region16_clear(region);
+
+	if ((nWidth == 0) || (nHeight == 0))
+		return 0;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	dirty = (BYTE*)calloc(1ull * nrow * ncol, sizeof(BYTE));
+	if (!dirty)
+		return -1;
 
-	WLog_INFO(TAG, "%s", col_str);
+	numBands = shadow_capture_compare_band_count(nWidth, nHeight, nrow);
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+	for (index = 0; index < numBands; index++)
+	{
+		SHADOW_CAPTURE_BAND* band = &bands[index];
+		band->pData1 = pData1;
+		band->nStep1 = nStep1;
+		band->pData2 = pData2;
+		band->nStep2 = nStep2;
+		band->nWidth = nWidth;
+		band->nHeight = nHeight;
+		band->firstRow = nrow * index / numBands;
+		band->lastRow = nrow * (index + 1) / numBands;
+		band->dirty = dirty;
+
+		/* The calling thread takes the first band */
+		if (index == 0)
+			continue;
+
+		work[index] = CreateThreadpoolWork(shadow_capture_compare_work_callback, band, NULL);
+		if (work[index])
+			SubmitThreadpoolWork(work[index]);
+		else
+			shadow_capture_compare_band(band);
+	}
 
-	WLog_INFO(TAG, "%s", col_str);
+	shadow_capture_compare_band(&bands[0]);
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	for (index = 1; index < numBands; index++)
+	{
+		if (!work[index])
+			continue;
 
-	WLog_INFO(TAG, "%s", col_str);
+		WaitForThreadpoolWorkCallbacks(work[index], FALSE);
+		CloseThreadpoolWork(work[index]);
+	}
 
+	/* Merge the runs of dirty tiles of each tile row */
+	rc = 0;
 	for (ty = 0; ty < nrow; ty++)
 	{
 		for (tx = 0; tx < ncol; tx++)
-			sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+		{
+			RECTANGLE_16 rect;
+
+			if (!dirty[1ull * ty * ncol + tx])
+				continue;
 
-		WLog_INFO(TAG, "%s", col_str);
-		WLog_INFO(TAG, "|%s|", rows[ty] ? "O" : "X");
+			rect.left = (UINT16)(tx * SHADOW_CAPTURE_TILE_SIZE);
+			rect.top = (UINT16)(ty * SHADOW_CAPTURE_TILE_SIZE);
+
+			while ((tx < ncol) && dirty[1ull * ty * ncol + tx])
+				tx++;
+
+			rect.right = (UINT16)MIN(tx * SHADOW_CAPTURE_TILE_SIZE, nWidth);
+			rect.bottom = (UINT16)MIN((ty + 1) * SHADOW_CAPTURE_TILE_SIZE, nHeight);
+
+			if (!region16_union_rect(region, region, &rect))
+			{
+				rc = -1;
+				goto fail;
+			}
+
+			rc = 1;
+		}
 	}
 
-	WLog_INFO(TAG,
-	          "left: %" PRIu32 " top: %" PRIu32 " right: %" PRIu32 " bottom: %" PRIu32
-	          " ncol: %" PRIu32 " nrow: %" PRIu32,
-	          l, t, r, b, ncol, nrow);
-	free(col_str);
+#ifdef WITH_DEBUG_SHADOW_CAPTURE
+	region16_print(region);
 #endif
-	return 1;
+fail:
+	free(dirty);
+	return rc;
+}
+
+int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
+                           UINT32 nStep2, RECTANGLE_16* rect)
+{
+	int rc;
+	REGION16 region;
+
+	WINPR_ASSERT(rect);
+	ZeroMemory(rect, sizeof(RECTANGLE_16));
+	region16_init(&region);
+	rc = shadow_capture_compare_region(pData1, nStep1, nWidth, nHeight, pData2, nStep2, &region);
+
+	if (rc > 0)
+		*rect = *region16_extents(&region);
+
+	region16_uninit(&region);
+	return rc;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
@@ -36,6 +36,13 @@
 
 #define TAG CLIENT_TAG("shadow")
 
+#define SHADOW_CLEARCODEC_MAX_AREA (256 * 256)
+#define SHADOW_CLEARCODEC_MAX_COLORS 64
+
+/* Cached 64x64 tiles, within the 16 MB (small cache) and 100 MB client cache budgets */
+#define SHADOW_GFX_SMALL_CACHE_SLOTS 1000
+#define SHADOW_GFX_CACHE_SLOTS 4096
+
 typedef struct
 {
 	BOOL gfxOpened;
@@ -685,7 +692,8 @@ fail:
 	return rc;
 }
 
-static INLINE void shadow_client_common_frame_acknowledge(rdpShadowClient* client, UINT32 frameId)
+static INLINE void shadow_client_common_frame_acknowledge(rdpShadowClient* client, UINT32 frameId,
+                                                          UINT32 queueDepth)
 {
 	/*
 	 * Record the last client acknowledged frame id to
@@ -697,19 +705,16 @@ static INLINE void shadow_client_common_frame_acknowledge(rdpShadowClient* clien
 	 */
 	WINPR_ASSERT(client);
 	WINPR_ASSERT(client->encoder);
-	client->encoder->lastAckframeId = frameId;
+	shadow_encoder_frame_acknowledge(client->encoder, frameId, queueDepth);
 }
 
 static BOOL shadow_client_surface_frame_acknowledge(rdpContext* context, UINT32 frameId)
 {
 	rdpShadowClient* client = (rdpShadowClient*)context;
-	shadow_client_common_frame_acknowledge(client, frameId);
 	/*
 	 * Reset queueDepth for legacy none RDPGFX acknowledge
 	 */
-	WINPR_ASSERT(client);
-	WINPR_ASSERT(client->encoder);
-	client->encoder->queueDepth = QUEUE_DEPTH_UNAVAILABLE;
+	shadow_client_common_frame_acknowledge(client, frameId, QUEUE_DEPTH_UNAVAILABLE);
 	return TRUE;
 }
 
@@ -723,14 +728,46 @@ shadow_client_rdpgfx_frame_acknowledge(RdpgfxServerContext* context,
 	WINPR_ASSERT(frameAcknowledge);
 
 	client = (rdpShadowClient*)context->custom;
-	shadow_client_common_frame_acknowledge(client, frameAcknowledge->frameId);
+	shadow_client_common_frame_acknowledge(client, frameAcknowledge->frameId,
+	                                       frameAcknowledge->queueDepth);
+	return CHANNEL_RC_OK;
+}
+
+static UINT shadow_client_rdpgfx_qoe_frame_acknowledge(
+    RdpgfxServerContext* context, const RDPGFX_QOE_FRAME_ACKNOWLEDGE_PDU* qoeFrameAcknowledge)
+{
+	rdpShadowClient* client;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(qoeFrameAcknowledge);
 
+	client = (rdpShadowClient*)context->custom;
 	WINPR_ASSERT(client);
-	WINPR_ASSERT(client->encoder);
-	client->encoder->queueDepth = frameAcknowledge->queueDepth;
+	shadow_encoder_qoe_frame_acknowledge(client->encoder, qoeFrameAcknowledge);
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Function description
+ * The content analysis only trusts cache entries it stored itself with two independent
+ * tile hashes, entries offered from the persistent cache of the client only carry one.
+ * None are imported so every cache slot starts free.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT
+shadow_client_rdpgfx_cache_import_offer(RdpgfxServerContext* context,
+                                        const RDPGFX_CACHE_IMPORT_OFFER_PDU* cacheImportOffer)
+{
+	RDPGFX_CACHE_IMPORT_REPLY_PDU reply = { 0 };
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(cacheImportOffer);
+
+	reply.importedEntriesCount = 0;
+	return IFCALLRESULT(CHANNEL_RC_OK, context->CacheImportReply, context, &reply);
+}
+
 static BOOL shadow_are_caps_filtered(const rdpSettings* settings, UINT32 caps)
 {
 	UINT32 filter;
@@ -993,26 +1030,195 @@ static INLINE UINT32 rdpgfx_estimate_h264_avc420(RDPGFX_AVC420_BITMAP_STREAM* ha
 	       havc420->length;
 }
 
+/**
+ * Function description
+ *
+ * @return TRUE if the region is small and low-color enough to be sent with ClearCodec
+ */
+static BOOL shadow_client_prefer_clearcodec(const BYTE* pSrcData, UINT32 nSrcStep,
+                                            UINT32 SrcFormat, UINT16 nXSrc, UINT16 nYSrc,
+                                            UINT16 nWidth, UINT16 nHeight)
+{
+	UINT32 x, y;
+	UINT32 count = 0;
+	UINT32 colors[SHADOW_CLEARCODEC_MAX_COLORS] = { 0 };
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+
+	if ((nWidth == 0) || (nHeight == 0) || (bpp == 0))
+		return FALSE;
+
+	if (1ull * nWidth * nHeight > SHADOW_CLEARCODEC_MAX_AREA)
+		return FALSE;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		const BYTE* line = &pSrcData[(nYSrc + y) * nSrcStep + nXSrc * bpp];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			UINT32 i;
+			const UINT32 color = FreeRDPReadColor(&line[x * bpp], SrcFormat);
+
+			if ((count > 0) && (colors[count - 1] == color))
+				continue;
+
+			for (i = 0; i < count; i++)
+			{
+				if (colors[i] == color)
+					break;
+			}
+
+			if (i < count)
+				continue;
+
+			if (count >= ARRAYSIZE(colors))
+				return FALSE;
+
+			colors[count++] = color;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL shadow_client_send_surface_clear(rdpShadowClient* client, const BYTE* pSrcData,
+                                             UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nXSrc,
+                                             UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight)
+{
+	int rc;
+	UINT error = CHANNEL_RC_OK;
+	rdpShadowEncoder* encoder = client->encoder;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
+	RDPGFX_END_FRAME_PDU cmdend = { 0 };
+	SYSTEMTIME sTime = { 0 };
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+	const BYTE* src = &pSrcData[nYSrc * nSrcStep + nXSrc * bpp];
+
+	if (shadow_encoder_prepare(encoder, FREERDP_CODEC_CLEARCODEC) < 0)
+	{
+		WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_CLEARCODEC");
+		return FALSE;
+	}
+
+	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+	GetSystemTime(&sTime);
+	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
+	                              sTime.wMilliseconds);
+	cmdend.frameId = cmdstart.frameId;
+	cmd.surfaceId = client->surfaceId;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = nXSrc;
+	cmd.top = nYSrc;
+	cmd.right = cmd.left + nWidth;
+	cmd.bottom = cmd.top + nHeight;
+	cmd.width = nWidth;
+	cmd.height = nHeight;
+
+	rc = clear_compress(encoder->clear, src, nSrcStep * (nHeight - 1) + nWidth * bpp, SrcFormat,
+	                    nWidth, nHeight, nSrcStep, &cmd.data, &cmd.length);
+
+	if (rc < 0)
+	{
+		WLog_ERR(TAG, "clear_compress failed");
+		return FALSE;
+	}
+
+	cmd.codecId = RDPGFX_CODECID_CLEARCODEC;
+
+	IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
+	          &cmdend);
+	free(cmd.data);
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Get the RemoteFX frame of rect encoded by the shared encoder
+ *
+ * @return The frame, to be released with shadow_share_release, or NULL on failure
+ */
+static SHADOW_SHARED_FRAME* shadow_client_share_rfx(rdpShadowClient* client, rdpShadowShare* share,
+                                                    const RFX_RECT* rect, const BYTE* pSrcData,
+                                                    UINT32 nSrcStep, size_t maxDataSize)
+{
+	SHADOW_SHARE_RFX_KEY key = { 0 };
+	const rdpSettings* settings = client->context.settings;
+
+	WINPR_ASSERT(settings);
+
+	key.data = pSrcData;
+	key.width = settings->DesktopWidth;
+	key.height = settings->DesktopHeight;
+	key.scanline = nSrcStep;
+	key.rect = *rect;
+	key.quantVals = shadow_encoder_rfx_quantization(client->encoder);
+	key.maxDataSize = maxDataSize;
+	return shadow_share_encode_rfx(share, &key);
+}
+
+/**
+ * Function description
+ * Data of a shared RemoteFX message for this client. The shared buffer is sent as is
+ * unless the client still needs the header blocks, then both are written to s.
+ *
+ * @return The data to send, NULL on failure
+ */
+static BYTE* shadow_client_shared_rfx_data(rdpShadowClient* client, wStream* s,
+                                           const SHADOW_SHARED_FRAME* frame, size_t index,
+                                           UINT32* length)
+{
+	wStream* message = frame->messages[index];
+	const size_t size = Stream_Length(message);
+
+	Stream_SetPosition(s, 0);
+	if (!rfx_write_message_header(client->encoder->rfx, s))
+		return NULL;
+
+	if (Stream_GetPosition(s) == 0)
+	{
+		WINPR_ASSERT(size <= UINT32_MAX);
+		*length = (UINT32)size;
+		return Stream_Buffer(message);
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, size))
+		return NULL;
+
+	Stream_Write(s, Stream_Buffer(message), size);
+	WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
+	*length = (UINT32)Stream_GetPosition(s);
+	return Stream_Buffer(s);
+}
+
 /**
  * Function description
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE* pSrcData,
-                                           UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nXSrc,
-                                           UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight)
+static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, rdpShadowShare* share,
+                                           const BYTE* pSrcData, UINT32 nSrcStep,
+                                           UINT32 SrcFormat, const REGION16* region)
 {
 	UINT32 id;
 	UINT error = CHANNEL_RC_OK;
 	const rdpContext* context = (const rdpContext*)client;
 	const rdpSettings* settings;
 	rdpShadowEncoder* encoder;
+	const RECTANGLE_16* extents;
+	UINT16 nWidth, nHeight;
 	RDPGFX_SURFACE_COMMAND cmd = { 0 };
 	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
 	RDPGFX_END_FRAME_PDU cmdend = { 0 };
 	SYSTEMTIME sTime = { 0 };
 
-	if (!context || !pSrcData)
+	if (!context || !pSrcData || !region)
 		return FALSE;
 
 	settings = context->settings;
@@ -1021,6 +1227,11 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	if (!settings || !encoder)
 		return FALSE;
 
+	/* GFX/h264 always full screen encoded, the other codecs encode the region */
+	nWidth = (UINT16)settings->DesktopWidth;
+	nHeight = (UINT16)settings->DesktopHeight;
+	extents = region16_extents(region);
+
 	if (client->first_frame)
 	{
 		rfx_context_reset(encoder->rfx, nWidth, nHeight);
@@ -1034,15 +1245,15 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	cmdend.frameId = cmdstart.frameId;
 	cmd.surfaceId = client->surfaceId;
 	cmd.format = PIXEL_FORMAT_BGRX32;
-	cmd.left = nXSrc;
-	cmd.top = nYSrc;
-	cmd.right = cmd.left + nWidth;
-	cmd.bottom = cmd.top + nHeight;
+	cmd.left = 0;
+	cmd.top = 0;
+	cmd.right = nWidth;
+	cmd.bottom = nHeight;
 	cmd.width = nWidth;
 	cmd.height = nHeight;
 
 	id = freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId);
-	if (settings->GfxAVC444 || settings->GfxAVC444v2)
+	if (encoder->h264Selected && (settings->GfxAVC444 || settings->GfxAVC444v2))
 	{
 		INT32 rc;
 		RDPGFX_AVC444_BITMAP_STREAM avc444 = { 0 };
@@ -1092,7 +1303,7 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			return FALSE;
 		}
 	}
-	else if (settings->GfxH264)
+	else if (encoder->h264Selected && settings->GfxH264)
 	{
 		INT32 rc;
 		RDPGFX_AVC420_BITMAP_STREAM avc420 = { 0 };
@@ -1142,6 +1353,7 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		BOOL rc;
 		wStream* s;
 		RFX_RECT rect;
+		SHADOW_SHARED_FRAME* frame = NULL;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
@@ -1152,38 +1364,40 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		s = Stream_New(NULL, 1024);
 		WINPR_ASSERT(s);
 
-		WINPR_ASSERT(cmd.left <= UINT16_MAX);
-		WINPR_ASSERT(cmd.top <= UINT16_MAX);
-		WINPR_ASSERT(cmd.right <= UINT16_MAX);
-		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
-		rect.x = (UINT16)cmd.left;
-		rect.y = (UINT16)cmd.top;
-		rect.width = (UINT16)cmd.right - cmd.left;
-		rect.height = (UINT16)cmd.bottom - cmd.top;
+		rect.x = extents->left;
+		rect.y = extents->top;
+		rect.width = extents->right - extents->left;
+		rect.height = extents->bottom - extents->top;
 
-		rc = rfx_compose_message(encoder->rfx, s, &rect, 1, pSrcData, nWidth, nHeight, nSrcStep);
+		if (share)
+		{
+			frame = shadow_client_share_rfx(client, share, &rect, pSrcData, nSrcStep, 0);
+			if (frame)
+				cmd.data = shadow_client_shared_rfx_data(client, s, frame, 0, &cmd.length);
+			rc = (cmd.data != NULL);
+		}
+		else
+		{
+			rc = rfx_compose_message(encoder->rfx, s, &rect, 1, pSrcData, nWidth, nHeight,
+			                         nSrcStep);
+			cmd.data = Stream_Buffer(s);
+			WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
+			cmd.length = (UINT32)Stream_GetPosition(s);
+		}
 
 		if (!rc)
 		{
 			WLog_ERR(TAG, "rfx_compose_message failed");
+			shadow_share_release(frame);
 			Stream_Free(s, TRUE);
 			return FALSE;
 		}
 
-		/* rc > 0 means new data */
-		if (rc > 0)
-		{
-			const size_t pos = Stream_GetPosition(s);
-			WINPR_ASSERT(pos <= UINT32_MAX);
-
-			cmd.codecId = RDPGFX_CODECID_CAVIDEO;
-			cmd.data = Stream_Buffer(s);
-			cmd.length = (UINT32)pos;
-
-			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-			          &cmdend);
-		}
+		cmd.codecId = RDPGFX_CODECID_CAVIDEO;
+		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
+		          &cmdend);
 
+		shadow_share_release(frame);
 		Stream_Free(s, TRUE);
 		if (error)
 		{
@@ -1194,8 +1408,6 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive))
 	{
 		INT32 rc;
-		REGION16 region;
-		RECTANGLE_16 regionRect;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
 		{
@@ -1203,19 +1415,9 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			return FALSE;
 		}
 
-		WINPR_ASSERT(cmd.left <= UINT16_MAX);
-		WINPR_ASSERT(cmd.top <= UINT16_MAX);
-		WINPR_ASSERT(cmd.right <= UINT16_MAX);
-		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
-		regionRect.left = (UINT16)cmd.left;
-		regionRect.top = (UINT16)cmd.top;
-		regionRect.right = (UINT16)cmd.right;
-		regionRect.bottom = (UINT16)cmd.bottom;
-		region16_init(&region);
-		region16_union_rect(&region, &region, &regionRect);
+		/* An empty region only sends the pending tile upgrades */
 		rc = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight, cmd.format,
-		                          nWidth, nHeight, nSrcStep, &region, &cmd.data, &cmd.length);
-		region16_uninit(&region);
+		                          nWidth, nHeight, nSrcStep, region, &cmd.data, &cmd.length);
 		if (rc < 0)
 		{
 			WLog_ERR(TAG, "progressive_compress failed");
@@ -1240,10 +1442,10 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxPlanar))
 	{
 		BOOL rc;
-		const UINT32 w = cmd.right - cmd.left;
-		const UINT32 h = cmd.bottom - cmd.top;
+		const UINT32 w = extents->right - extents->left;
+		const UINT32 h = extents->bottom - extents->top;
 		const BYTE* src =
-		    &pSrcData[cmd.top * nSrcStep + cmd.left * FreeRDPGetBytesPerPixel(SrcFormat)];
+		    &pSrcData[extents->top * nSrcStep + extents->left * FreeRDPGetBytesPerPixel(SrcFormat)];
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
 		{
 			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
@@ -1259,6 +1461,12 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		WINPR_ASSERT(cmd.data || (cmd.length == 0));
 
 		cmd.codecId = RDPGFX_CODECID_PLANAR;
+		cmd.left = extents->left;
+		cmd.top = extents->top;
+		cmd.right = extents->right;
+		cmd.bottom = extents->bottom;
+		cmd.width = w;
+		cmd.height = h;
 
 		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
 		          &cmdend);
@@ -1272,17 +1480,24 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	else
 	{
 		BOOL rc;
-		const UINT32 w = cmd.right - cmd.left;
-		const UINT32 h = cmd.bottom - cmd.top;
+		const UINT32 w = extents->right - extents->left;
+		const UINT32 h = extents->bottom - extents->top;
 		const UINT32 length = w * 4 * h;
 		BYTE* data = malloc(length);
 
 		WINPR_ASSERT(data);
 
 		rc = freerdp_image_copy(data, PIXEL_FORMAT_BGRA32, 0, 0, 0, w, h, pSrcData, SrcFormat,
-		                        nSrcStep, cmd.left, cmd.top, NULL, 0);
+		                        nSrcStep, extents->left, extents->top, NULL, 0);
 		WINPR_ASSERT(rc);
 
+		cmd.left = extents->left;
+		cmd.top = extents->top;
+		cmd.right = extents->right;
+		cmd.bottom = extents->bottom;
+		cmd.width = w;
+		cmd.height = h;
+
 		cmd.data = data;
 		cmd.length = length;
 		cmd.codecId = RDPGFX_CODECID_UNCOMPRESSED;
@@ -1301,12 +1516,338 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 
 /**
  * Function description
+ * Send the commands found by the content analysis in a frame of their own,
+ * the areas they overwrite are added to replaced.
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcData,
-                                            UINT32 nSrcStep, UINT16 nXSrc, UINT16 nYSrc,
-                                            UINT16 nWidth, UINT16 nHeight)
+static BOOL shadow_client_send_surface_commands(rdpShadowClient* client,
+                                                const SHADOW_CONTENT_COMMANDS* commands,
+                                                REGION16* replaced)
+{
+	UINT32 index;
+	UINT32 count;
+	BOOL ret = FALSE;
+	UINT error = CHANNEL_RC_OK;
+	RECTANGLE_16* fillRects = NULL;
+	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
+	RDPGFX_END_FRAME_PDU cmdend = { 0 };
+	SYSTEMTIME sTime = { 0 };
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(commands);
+	WINPR_ASSERT(replaced);
+
+	if ((commands->numStores == 0) && !commands->move && (commands->numFills == 0) &&
+	    (commands->numLoads == 0))
+		return TRUE;
+
+	cmdstart.frameId = shadow_encoder_create_frame_id(client->encoder);
+	GetSystemTime(&sTime);
+	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
+	                              sTime.wMilliseconds);
+	cmdend.frameId = cmdstart.frameId;
+
+	IFCALLRET(client->rdpgfx->StartFrame, error, client->rdpgfx, &cmdstart);
+	if (error)
+		goto fail;
+
+	/* Cache the old tiles first, before they get overwritten */
+	for (index = 0; index < commands->numStores; index++)
+	{
+		const SHADOW_CONTENT_STORE* store = &commands->stores[index];
+		RDPGFX_SURFACE_TO_CACHE_PDU pdu = { 0 };
+
+		if (store->evict)
+		{
+			RDPGFX_EVICT_CACHE_ENTRY_PDU evict = { 0 };
+			evict.cacheSlot = store->cacheSlot;
+			IFCALLRET(client->rdpgfx->EvictCacheEntry, error, client->rdpgfx, &evict);
+			if (error)
+				goto fail;
+		}
+
+		pdu.surfaceId = client->surfaceId;
+		pdu.cacheKey = store->cacheKey;
+		pdu.cacheSlot = store->cacheSlot;
+		pdu.rectSrc = store->rect;
+		IFCALLRET(client->rdpgfx->SurfaceToCache, error, client->rdpgfx, &pdu);
+		if (error)
+			goto fail;
+	}
+
+	if (commands->move)
+	{
+		RDPGFX_SURFACE_TO_SURFACE_PDU pdu = { 0 };
+		RDPGFX_POINT16 destPt = { 0 };
+		RECTANGLE_16 rect = { 0 };
+
+		destPt.x = commands->moveX;
+		destPt.y = commands->moveY;
+		pdu.surfaceIdSrc = client->surfaceId;
+		pdu.surfaceIdDest = client->surfaceId;
+		pdu.rectSrc = commands->moveSrc;
+		pdu.destPtsCount = 1;
+		pdu.destPts = &destPt;
+		IFCALLRET(client->rdpgfx->SurfaceToSurface, error, client->rdpgfx, &pdu);
+		if (error)
+			goto fail;
+
+		rect.left = destPt.x;
+		rect.top = destPt.y;
+		rect.right = destPt.x + (pdu.rectSrc.right - pdu.rectSrc.left);
+		rect.bottom = destPt.y + (pdu.rectSrc.bottom - pdu.rectSrc.top);
+		if (!region16_union_rect(replaced, replaced, &rect))
+			goto fail;
+	}
+
+	if (commands->numFills > 0)
+	{
+		fillRects = (RECTANGLE_16*)calloc(commands->numFills, sizeof(RECTANGLE_16));
+		if (!fillRects)
+			goto fail;
+	}
+
+	/* One SolidFill per run of tiles with the same color */
+	for (index = 0; index < commands->numFills; index += count)
+	{
+		const UINT32 color = commands->fills[index].color;
+		RDPGFX_SOLID_FILL_PDU pdu = { 0 };
+
+		for (count = 0; (index + count < commands->numFills) &&
+		                (commands->fills[index + count].color == color);
+		     count++)
+		{
+			fillRects[count] = commands->fills[index + count].rect;
+			if (!region16_union_rect(replaced, replaced, &fillRects[count]))
+				goto fail;
+		}
+
+		pdu.surfaceId = client->surfaceId;
+		pdu.fillPixel.B = (BYTE)(color & 0xFF);
+		pdu.fillPixel.G = (BYTE)((color >> 8) & 0xFF);
+		pdu.fillPixel.R = (BYTE)((color >> 16) & 0xFF);
+		pdu.fillPixel.XA = 0xFF;
+		pdu.fillRectCount = (UINT16)count;
+		pdu.fillRects = fillRects;
+		IFCALLRET(client->rdpgfx->SolidFill, error, client->rdpgfx, &pdu);
+		if (error)
+			goto fail;
+	}
+
+	for (index = 0; index < commands->numLoads; index++)
+	{
+		const SHADOW_CONTENT_LOAD* load = &commands->loads[index];
+		RDPGFX_CACHE_TO_SURFACE_PDU pdu = { 0 };
+		RDPGFX_POINT16 destPt = { 0 };
+		RECTANGLE_16 rect = { 0 };
+
+		destPt.x = load->x;
+		destPt.y = load->y;
+		pdu.cacheSlot = load->cacheSlot;
+		pdu.surfaceId = client->surfaceId;
+		pdu.destPtsCount = 1;
+		pdu.destPts = &destPt;
+		IFCALLRET(client->rdpgfx->CacheToSurface, error, client->rdpgfx, &pdu);
+		if (error)
+			goto fail;
+
+		rect.left = load->x;
+		rect.top = load->y;
+		rect.right = load->x + SHADOW_CONTENT_TILE_SIZE;
+		rect.bottom = load->y + SHADOW_CONTENT_TILE_SIZE;
+		if (!region16_union_rect(replaced, replaced, &rect))
+			goto fail;
+	}
+
+	IFCALLRET(client->rdpgfx->EndFrame, error, client->rdpgfx, &cmdend);
+	if (error)
+		goto fail;
+
+	ret = TRUE;
+fail:
+	if (error)
+		WLog_ERR(TAG, "Sending GFX surface commands failed with error %" PRIu32 "", error);
+	free(fillRects);
+	return ret;
+}
+
+/* The GFX codecs below H.264 that decode to exactly the source pixels */
+static BOOL shadow_client_gfx_lossless(const rdpSettings* settings)
+{
+	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) &&
+	    (freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId) != 0))
+		return FALSE;
+
+	return !freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive);
+}
+
+/**
+ * Function description
+ * Send the damaged region of the GFX surface. Scrolled areas, single color tiles
+ * and cached tiles are sent with cheap GFX commands, small low-color leftovers
+ * with ClearCodec and everything else with the negotiated codec.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_gfx_update(rdpShadowClient* client, rdpShadowShare* share,
+                                                  const BYTE* pSrcData, UINT32 nSrcStep,
+                                                  UINT32 SrcFormat, REGION16* region)
+{
+	BOOL ret = FALSE;
+	BOOL clear = FALSE;
+	REGION16 replaced;
+	REGION16 resend;
+	const RECTANGLE_16* extents;
+	const rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+	SHADOW_CONTENT_COMMANDS commands = { 0 };
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(region);
+
+	settings = client->context.settings;
+	encoder = client->encoder;
+	WINPR_ASSERT(settings);
+	WINPR_ASSERT(encoder);
+
+	region16_init(&replaced);
+	region16_init(&resend);
+
+	/* H.264 has motion compensation of its own */
+	if (!encoder->h264Selected)
+	{
+		if (!shadow_content_analyze(encoder->content, pSrcData, nSrcStep, region, &commands))
+			goto fail;
+
+		if (!shadow_client_send_surface_commands(client, &commands, &replaced))
+			goto fail;
+	}
+
+	/* Small updates of text and UI elements are cheaper with ClearCodec */
+	extents = region16_extents(region);
+	if (!client->first_frame && !region16_is_empty(region) &&
+	    shadow_client_prefer_clearcodec(pSrcData, nSrcStep, SrcFormat, extents->left, extents->top,
+	                                    extents->right - extents->left,
+	                                    extents->bottom - extents->top))
+	{
+		clear = TRUE;
+		if (!region16_union_rect(&replaced, &replaced, extents))
+			goto fail;
+	}
+
+	/* Progressive tiles overwritten by other commands must not get upgrades */
+	if (encoder->progressive && !region16_is_empty(&replaced))
+	{
+		if (!progressive_context_invalidate_region(encoder->progressive, &replaced, &resend))
+			goto fail;
+	}
+
+	/* A changed number of quality passes restarts the pending upgrades */
+	if (!shadow_encoder_update_progressive(encoder, &resend))
+		goto fail;
+
+	if (!region16_is_empty(&resend))
+	{
+		UINT32 index;
+		UINT32 numRects = 0;
+		const RECTANGLE_16* rects = region16_rects(&resend, &numRects);
+
+		for (index = 0; index < numRects; index++)
+		{
+			clear = FALSE;
+			if (!region16_union_rect(region, region, &rects[index]))
+				goto fail;
+		}
+	}
+
+	if (clear)
+		ret = shadow_client_send_surface_clear(client, pSrcData, nSrcStep, SrcFormat, extents->left,
+		                                       extents->top, extents->right - extents->left,
+		                                       extents->bottom - extents->top);
+	else if (!region16_is_empty(region) ||
+	         progressive_context_has_pending_upgrades(encoder->progressive))
+		ret = shadow_client_send_surface_gfx(client, share, pSrcData, nSrcStep, SrcFormat, region);
+	else
+		ret = TRUE;
+
+	/* Only tiles the client got without codec loss may be cached or moved later */
+	if (ret && !encoder->h264Selected && !region16_is_empty(region))
+	{
+		if (clear || shadow_client_gfx_lossless(settings))
+			shadow_content_set_exact(encoder->content, region16_extents(region), TRUE);
+		else
+		{
+			UINT32 index;
+			UINT32 numRects = 0;
+			const RECTANGLE_16* rects = region16_rects(region, &numRects);
+
+			for (index = 0; index < numRects; index++)
+				shadow_content_set_exact(encoder->content, &rects[index], FALSE);
+		}
+	}
+
+fail:
+	region16_uninit(&resend);
+	region16_uninit(&replaced);
+	return ret;
+}
+
+/**
+ * Function description
+ * Send the RemoteFX messages of rect encoded by the shared encoder as surface bits
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_shared_surface_bits(rdpShadowClient* client, rdpShadowShare* share,
+                                                   SURFACE_BITS_COMMAND* cmd, UINT32 frameId,
+                                                   const RFX_RECT* rect, const BYTE* pSrcData,
+                                                   UINT32 nSrcStep)
+{
+	size_t i;
+	BOOL ret = TRUE;
+	rdpUpdate* update = client->context.update;
+	rdpShadowEncoder* encoder = client->encoder;
+	SHADOW_SHARED_FRAME* frame = shadow_client_share_rfx(
+	    client, share, rect, pSrcData, nSrcStep, client->context.settings->MultifragMaxRequestSize);
+
+	if (!frame)
+	{
+		WLog_ERR(TAG, "Shared RemoteFX encoding failed");
+		return FALSE;
+	}
+
+	for (i = 0; ret && (i < frame->numMessages); i++)
+	{
+		const BOOL first = (i == 0) ? TRUE : FALSE;
+		const BOOL last = ((i + 1) == frame->numMessages) ? TRUE : FALSE;
+
+		cmd->bmp.bitmapData =
+		    shadow_client_shared_rfx_data(client, encoder->bs, frame, i, &cmd->bmp.bitmapDataLength);
+
+		if (!cmd->bmp.bitmapData)
+			ret = FALSE;
+		else if (!encoder->frameAck)
+			IFCALLRET(update->SurfaceBits, ret, update->context, cmd);
+		else
+			IFCALLRET(update->SurfaceFrameBits, ret, update->context, cmd, first, last, frameId);
+
+		if (!ret)
+			WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
+	}
+
+	shadow_share_release(frame);
+	return ret;
+}
+
+/**
+ * Function description
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowShare* share,
+                                            BYTE* pSrcData, UINT32 nSrcStep, UINT16 nXSrc,
+                                            UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight)
 {
 	BOOL ret = TRUE;
 	size_t i;
@@ -1355,14 +1896,6 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		rect.width = nWidth;
 		rect.height = nHeight;
 
-		if (!(messages = rfx_encode_messages(
-		          encoder->rfx, &rect, 1, pSrcData, settings->DesktopWidth, settings->DesktopHeight,
-		          nSrcStep, &numMessages, settings->MultifragMaxRequestSize)))
-		{
-			WLog_ERR(TAG, "rfx_encode_messages failed");
-			return FALSE;
-		}
-
 		cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
 		WINPR_ASSERT(rfxID <= UINT16_MAX);
 		cmd.bmp.codecID = (UINT16)rfxID;
@@ -1378,47 +1911,62 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		cmd.bmp.height = (UINT16)settings->DesktopHeight;
 		cmd.skipCompression = TRUE;
 
-		if (numMessages > 0)
-			messageRects = messages[0].rects;
-
-		for (i = 0; i < numMessages; i++)
+		if (share)
+			ret = shadow_client_send_shared_surface_bits(client, share, &cmd, frameId, &rect,
+			                                             pSrcData, nSrcStep);
+		else
 		{
-			Stream_SetPosition(s, 0);
+			if (!(messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
+			                                     settings->DesktopWidth, settings->DesktopHeight,
+			                                     nSrcStep, &numMessages,
+			                                     settings->MultifragMaxRequestSize)))
+			{
+				WLog_ERR(TAG, "rfx_encode_messages failed");
+				return FALSE;
+			}
+
+			if (numMessages > 0)
+				messageRects = messages[0].rects;
 
-			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+			for (i = 0; i < numMessages; i++)
 			{
-				while (i < numMessages)
+				Stream_SetPosition(s, 0);
+
+				if (!rfx_write_message(encoder->rfx, s, &messages[i]))
 				{
-					rfx_message_free(encoder->rfx, &messages[i++]);
-				}
+					while (i < numMessages)
+					{
+						rfx_message_free(encoder->rfx, &messages[i++]);
+					}
 
-				WLog_ERR(TAG, "rfx_write_message failed");
-				ret = FALSE;
-				break;
-			}
+					WLog_ERR(TAG, "rfx_write_message failed");
+					ret = FALSE;
+					break;
+				}
 
-			rfx_message_free(encoder->rfx, &messages[i]);
-			WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
-			cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
-			cmd.bmp.bitmapData = Stream_Buffer(s);
-			first = (i == 0) ? TRUE : FALSE;
-			last = ((i + 1) == numMessages) ? TRUE : FALSE;
+				rfx_message_free(encoder->rfx, &messages[i]);
+				WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
+				cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
+				cmd.bmp.bitmapData = Stream_Buffer(s);
+				first = (i == 0) ? TRUE : FALSE;
+				last = ((i + 1) == numMessages) ? TRUE : FALSE;
 
-			if (!encoder->frameAck)
-				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
-			else
-				IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
-				          frameId);
+				if (!encoder->frameAck)
+					IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
+				else
+					IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
+					          frameId);
 
-			if (!ret)
-			{
-				WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
-				break;
+				if (!ret)
+				{
+					WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
+					break;
+				}
 			}
-		}
 
-		free(messageRects);
-		free(messages);
+			free(messageRects);
+			free(messages);
+		}
 	}
 	if (freerdp_settings_get_bool(settings, FreeRDP_NSCodec) && (nsID != 0))
 	{
@@ -1687,7 +2235,8 @@ out:
  *
  * @return TRUE on success (or nothing need to be updated)
  */
-static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GFX_STATUS* pStatus)
+static BOOL shadow_client_send_surface_update(rdpShadowClient* client, rdpShadowShare* share,
+                                              SHADOW_GFX_STATUS* pStatus)
 {
 	BOOL ret = TRUE;
 	INT64 nXSrc, nYSrc;
@@ -1696,7 +2245,9 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	rdpSettings* settings;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
+	BOOL h264;
 	REGION16 invalidRegion;
+	REGION16 gfxRegion;
 	RECTANGLE_16 surfaceRect;
 	const RECTANGLE_16* extents;
 	BYTE* pSrcData;
@@ -1747,7 +2298,10 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	if (region16_is_empty(&invalidRegion))
 	{
 		/* No image region need to be updated. Success */
-		goto out;
+		/* On a static screen the progressive tiles may still wait for their quality upgrades */
+		if (!pStatus->gfxSurfaceCreated ||
+		    !progressive_context_has_pending_upgrades(client->encoder->progressive))
+			goto out;
 	}
 
 	extents = region16_extents(&invalidRegion);
@@ -1780,10 +2334,6 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 
 	if (settings->SupportGraphicsPipeline && pStatus->gfxOpened)
 	{
-		/* GFX/h264 always full screen encoded */
-		nWidth = settings->DesktopWidth;
-		nHeight = settings->DesktopHeight;
-
 		/* Create primary surface if have not */
 		if (!pStatus->gfxSurfaceCreated)
 		{
@@ -1795,27 +2345,66 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 				goto out;
 
 			pStatus->gfxSurfaceCreated = TRUE;
+
+			/* The new surface has no progressive tiles to upgrade yet */
+			if (client->encoder->progressive &&
+			    !(ret = progressive_context_reset(client->encoder->progressive)))
+				goto out;
+
+			if (!(ret = shadow_content_reset(
+			          client->encoder->content, settings->DesktopWidth, settings->DesktopHeight,
+			          settings->GfxSmallCache ? SHADOW_GFX_SMALL_CACHE_SLOTS
+			                                  : SHADOW_GFX_CACHE_SLOTS)))
+				goto out;
 		}
 
-		WINPR_ASSERT(nWidth >= 0);
-		WINPR_ASSERT(nWidth <= UINT16_MAX);
-		WINPR_ASSERT(nHeight >= 0);
-		WINPR_ASSERT(nHeight <= UINT16_MAX);
-		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, SrcFormat, 0, 0,
-		                                     (UINT16)nWidth, (UINT16)nHeight);
-	}
-	else if (settings->RemoteFxCodec || freerdp_settings_get_bool(settings, FreeRDP_NSCodec))
-	{
-		WINPR_ASSERT(nXSrc >= 0);
-		WINPR_ASSERT(nXSrc <= UINT16_MAX);
-		WINPR_ASSERT(nYSrc >= 0);
-		WINPR_ASSERT(nYSrc <= UINT16_MAX);
-		WINPR_ASSERT(nWidth >= 0);
-		WINPR_ASSERT(nWidth <= UINT16_MAX);
-		WINPR_ASSERT(nHeight >= 0);
-		WINPR_ASSERT(nHeight <= UINT16_MAX);
-		ret = shadow_client_send_surface_bits(client, pSrcData, nSrcStep, (UINT16)nXSrc,
-		                                      (UINT16)nYSrc, (UINT16)nWidth, (UINT16)nHeight);
+		/* H.264 covers slow links, otherwise the sharper codecs are used */
+		h264 = client->encoder->h264Selected;
+		if (!shadow_encoder_select_h264(
+		        client->encoder,
+		        (settings->RemoteFxCodec &&
+		         (freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId) != 0)) ||
+		            settings->GfxProgressive) &&
+		    h264)
+		{
+			/* The surface holds H.264 output, upgrades and cache state are unknown */
+			if (client->encoder->progressive &&
+			    !(ret = progressive_context_reset(client->encoder->progressive)))
+				goto out;
+
+			if (!(ret = shadow_content_reset(
+			          client->encoder->content, settings->DesktopWidth, settings->DesktopHeight,
+			          settings->GfxSmallCache ? SHADOW_GFX_SMALL_CACHE_SLOTS
+			                                  : SHADOW_GFX_CACHE_SLOTS)))
+				goto out;
+
+			region16_union_rect(&invalidRegion, &invalidRegion, &surfaceRect);
+			if (server->shareSubRect)
+				region16_intersect_rect(&invalidRegion, &invalidRegion, &(server->subRect));
+		}
+
+		/* The GFX surface starts at the shared sub rect */
+		region16_init(&gfxRegion);
+		rects = region16_rects(&invalidRegion, &numRects);
+
+		for (index = 0; index < numRects; index++)
+		{
+			RECTANGLE_16 rect = rects[index];
+
+			if (server->shareSubRect)
+			{
+				rect.left -= server->subRect.left;
+				rect.top -= server->subRect.top;
+				rect.right -= server->subRect.left;
+				rect.bottom -= server->subRect.top;
+			}
+
+			region16_union_rect(&gfxRegion, &gfxRegion, &rect);
+		}
+
+		ret = shadow_client_send_surface_gfx_update(client, share, pSrcData, nSrcStep, SrcFormat,
+		                                            &gfxRegion);
+		region16_uninit(&gfxRegion);
 	}
 	else
 	{
@@ -1827,8 +2416,22 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 		WINPR_ASSERT(nWidth <= UINT16_MAX);
 		WINPR_ASSERT(nHeight >= 0);
 		WINPR_ASSERT(nHeight <= UINT16_MAX);
-		ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep, (UINT16)nXSrc,
-		                                       (UINT16)nYSrc, (UINT16)nWidth, (UINT16)nHeight);
+
+		/* the frame markers and the updates of a frame leave in one write */
+		if (!(ret = freerdp_transport_cork(context)))
+			goto out;
+
+		if (settings->RemoteFxCodec || freerdp_settings_get_bool(settings, FreeRDP_NSCodec))
+			ret = shadow_client_send_surface_bits(client, share, pSrcData, nSrcStep,
+			                                      (UINT16)nXSrc, (UINT16)nYSrc, (UINT16)nWidth,
+			                                      (UINT16)nHeight);
+		else
+			ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep, (UINT16)nXSrc,
+			                                       (UINT16)nYSrc, (UINT16)nWidth,
+			                                       (UINT16)nHeight);
+
+		if (!freerdp_transport_uncork(context))
+			ret = FALSE;
 	}
 
 out:
@@ -1837,6 +2440,42 @@ out:
 	return ret;
 }
 
+/**
+ * Function description
+ *
+ * @return Wait timeout of the client thread, finite while changes were deferred by the
+ *         frame rate control or progressive tiles still wait for their quality upgrades
+ */
+static DWORD shadow_client_update_timeout(rdpShadowClient* client, const SHADOW_GFX_STATUS* pStatus)
+{
+	BOOL deferred;
+	DWORD timeout = INFINITE;
+	rdpShadowEncoder* encoder;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(pStatus);
+
+	encoder = client->encoder;
+	if (!client->activated || client->suppressOutput || !encoder)
+		return INFINITE;
+
+	EnterCriticalSection(&(client->lock));
+	deferred = !region16_is_empty(&(client->invalidRegion));
+	LeaveCriticalSection(&(client->lock));
+
+	if (deferred && shadow_encoder_frame_due(encoder, &timeout))
+		return 0;
+
+	if (pStatus->gfxSurfaceCreated &&
+	    progressive_context_has_pending_upgrades(encoder->progressive))
+	{
+		const DWORD upgrade = (encoder->fps > 0) ? (1000 / encoder->fps) : 100;
+		timeout = MIN(timeout, upgrade);
+	}
+
+	return timeout;
+}
+
 /**
  * Function description
  * Notify client for resize. The new desktop width/height
@@ -2053,8 +2692,11 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 	wMessage pointerAlphaMsg;
 	wMessage audioVolumeMsg;
 	HANDLE events[32] = { 0 };
+	HANDLE waitEvents[32] = { 0 };
+	DWORD nWaitEvents = 0;
+	WINPR_WAIT_SET* waitSet = NULL;
 	HANDLE ChannelEvent;
-	void* UpdateSubscriber;
+	void* UpdateSubscriber = NULL;
 	HANDLE UpdateEvent;
 	freerdp_peer* peer;
 	rdpContext* context;
@@ -2119,12 +2761,17 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 	rc = freerdp_settings_set_bool(settings, FreeRDP_HasExtendedMouseEvent, TRUE);
 	WINPR_ASSERT(rc);
 
+	/* The handles rarely change, keep them registered between the waits */
+	waitSet = CreateWaitSet();
+	if (!waitSet)
+		goto fail;
+
 	while (1)
 	{
 		nCount = 0;
 		events[nCount++] = UpdateEvent;
 		{
-			DWORD tmp = peer->GetEventHandles(peer, &events[nCount], 64 - nCount);
+			DWORD tmp = peer->GetEventHandles(peer, &events[nCount], ARRAYSIZE(events) - 3);
 
 			if (tmp == 0)
 			{
@@ -2136,11 +2783,32 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 		}
 		events[nCount++] = ChannelEvent;
 		events[nCount++] = MessageQueue_Event(MsgQueue);
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+
+		/* The peer handles live as long as the peer, only register a changed list */
+		if ((nCount != nWaitEvents) || (memcmp(events, waitEvents, nCount * sizeof(HANDLE)) != 0))
+		{
+			if (!SetWaitSetHandles(waitSet, nCount, events))
+				goto fail;
+
+			memcpy(waitEvents, events, nCount * sizeof(HANDLE));
+			nWaitEvents = nCount;
+		}
+
+		status = WaitForWaitSet(waitSet, shadow_client_update_timeout(client, &gfxstatus));
 
 		if (status == WAIT_FAILED)
 			goto fail;
 
+		if (status == WAIT_TIMEOUT)
+		{
+			/* Send deferred changes or refine the progressive tiles of a static screen */
+			if (!shadow_client_send_surface_update(client, NULL, &gfxstatus))
+			{
+				WLog_ERR(TAG, "Failed to send surface update");
+				break;
+			}
+		}
+
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
 			/* The UpdateEvent means to start sending current frame. It is
@@ -2164,10 +2832,20 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 						break;
 					}
 				}
+				else if (!shadow_encoder_frame_due(client->encoder, NULL))
+				{
+					/* Above the frame rate the link carries, collect the changes for later */
+					if (!shadow_client_no_surface_update(client, &gfxstatus))
+					{
+						WLog_ERR(TAG, "Failed to handle surface update");
+						break;
+					}
+				}
 				else
 				{
-					/* Send frame */
-					if (!shadow_client_send_surface_update(client, &gfxstatus))
+					/* Send frame, clients with the same settings share the encoding */
+					if (!shadow_client_send_surface_update(client, client->server->share,
+					                                       &gfxstatus))
 					{
 						WLog_ERR(TAG, "Failed to send surface update");
 						break;
@@ -2229,7 +2907,10 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 					if (settings->SupportGraphicsPipeline && client->rdpgfx && !gfxstatus.gfxOpened)
 					{
 						client->rdpgfx->FrameAcknowledge = shadow_client_rdpgfx_frame_acknowledge;
+						client->rdpgfx->QoeFrameAcknowledge =
+						    shadow_client_rdpgfx_qoe_frame_acknowledge;
 						client->rdpgfx->CapsAdvertise = shadow_client_rdpgfx_caps_advertise;
+						client->rdpgfx->CacheImportOffer = shadow_client_rdpgfx_cache_import_offer;
 
 						if (!client->rdpgfx->Open(client->rdpgfx))
 						{
@@ -2332,6 +3013,7 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 	}
 
 fail:
+	FreeWaitSet(waitSet);
 
 	/* Free channels early because we establish channels in post connect */
 	if (client->audin && !IFCALLRESULT(TRUE, client->audin->IsOpen, client->audin))
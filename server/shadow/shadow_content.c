@@ -0,0 +1,733 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server GFX Content Analysis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+
+#include "shadow_content.h"
+
+/* Minimum number of rows a scrolled area must have to be sent with SurfaceToSurface */
+#define SHADOW_CONTENT_MIN_SCROLL_ROWS 16
+
+/* Tiles that stayed unchanged for this many updates are cached before being overwritten */
+#define SHADOW_CONTENT_CACHE_MIN_AGE 4
+
+/* Bits of the direct mapped cache key index */
+#define SHADOW_CONTENT_INDEX_BITS 13
+#define SHADOW_CONTENT_INDEX_SIZE (1 << SHADOW_CONTENT_INDEX_BITS)
+
+#define SHADOW_CONTENT_FNV_OFFSET 0xCBF29CE484222325ULL
+#define SHADOW_CONTENT_FNV_PRIME 0x100000001B3ULL
+
+/* Multiplier of the second, independent tile hash checked on cache hits */
+#define SHADOW_CONTENT_CHECK_PRIME 0x9E3779B97F4A7C15ULL
+
+typedef struct
+{
+	BOOL known;        /* the frame copy holds what the client displays */
+	BOOL exact;        /* the client displays the frame copy without codec loss */
+	UINT64 lastChange; /* update counter of the last change */
+} SHADOW_CONTENT_TILE;
+
+typedef struct
+{
+	BOOL used;
+	UINT64 key;
+	UINT64 check;
+	UINT64 lastUse;
+} SHADOW_CONTENT_SLOT;
+
+struct rdp_shadow_content
+{
+	UINT32 width;
+	UINT32 height;
+	UINT32 scanline;
+	BYTE* frame;
+
+	UINT32 gridWidth;
+	UINT32 gridHeight;
+	SHADOW_CONTENT_TILE* tiles;
+
+	UINT32 maxCacheSlots;
+	SHADOW_CONTENT_SLOT* slots;
+	UINT16* cacheIndex;
+	UINT32 usedCacheSlots;
+	UINT64 updateCount;
+
+	UINT64* curHashes;
+	UINT64* prevHashes;
+	UINT32* votes;
+	UINT32* rowTable;
+	UINT32 rowTableSize;
+
+	UINT32 numStores;
+	SHADOW_CONTENT_STORE* stores;
+	UINT32 numFills;
+	SHADOW_CONTENT_FILL* fills;
+	UINT32 numLoads;
+	SHADOW_CONTENT_LOAD* loads;
+};
+
+static INLINE const BYTE* shadow_content_pixel(const BYTE* data, UINT32 step, UINT32 x, UINT32 y)
+{
+	return &data[1ull * y * step + 4ull * x];
+}
+
+/* FNV hash of a tile used as cache key, check gets a second hash mixed differently */
+static UINT64 shadow_content_hash(const BYTE* data, UINT32 step, const RECTANGLE_16* rect,
+                                  UINT64* check)
+{
+	UINT32 x, y;
+	UINT64 hash = SHADOW_CONTENT_FNV_OFFSET;
+	UINT64 mix = 0;
+
+	for (y = rect->top; y < rect->bottom; y++)
+	{
+		const UINT32* line = (const UINT32*)shadow_content_pixel(data, step, rect->left, y);
+
+		for (x = 0; x < (UINT32)(rect->right - rect->left); x++)
+		{
+			hash ^= line[x];
+			hash *= SHADOW_CONTENT_FNV_PRIME;
+			mix = (mix + line[x]) * SHADOW_CONTENT_CHECK_PRIME;
+			mix ^= mix >> 32;
+		}
+	}
+
+	*check = mix;
+	return hash;
+}
+
+/* Hash of a row, 0 for rows of a single color which match anywhere */
+static UINT64 shadow_content_hash_row(const BYTE* data, UINT32 step, UINT32 left, UINT32 right,
+                                      UINT32 y)
+{
+	UINT32 x;
+	BOOL uniform = TRUE;
+	UINT64 hash = SHADOW_CONTENT_FNV_OFFSET;
+	const UINT32* line = (const UINT32*)shadow_content_pixel(data, step, left, y);
+
+	for (x = 0; x < right - left; x++)
+	{
+		uniform &= (line[x] == line[0]);
+		hash ^= line[x];
+		hash *= SHADOW_CONTENT_FNV_PRIME;
+	}
+
+	return uniform ? 0 : (hash | 1);
+}
+
+static BOOL shadow_content_is_uniform(const BYTE* data, UINT32 step, const RECTANGLE_16* rect,
+                                      UINT32* color)
+{
+	UINT32 x, y;
+	const UINT32 first = *(const UINT32*)shadow_content_pixel(data, step, rect->left, rect->top);
+
+	for (y = rect->top; y < rect->bottom; y++)
+	{
+		const UINT32* line = (const UINT32*)shadow_content_pixel(data, step, rect->left, y);
+
+		for (x = 0; x < (UINT32)(rect->right - rect->left); x++)
+		{
+			if (line[x] != first)
+				return FALSE;
+		}
+	}
+
+	*color = first;
+	return TRUE;
+}
+
+static BOOL shadow_content_equal(const BYTE* pSrcData, UINT32 nSrcStep, const BYTE* data,
+                                 UINT32 step, const RECTANGLE_16* rect)
+{
+	UINT32 y;
+	const size_t size = 4ull * (rect->right - rect->left);
+
+	for (y = rect->top; y < rect->bottom; y++)
+	{
+		if (memcmp(shadow_content_pixel(pSrcData, nSrcStep, rect->left, y),
+		           shadow_content_pixel(data, step, rect->left, y), size) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void shadow_content_copy(BYTE* data, UINT32 step, const BYTE* pSrcData, UINT32 nSrcStep,
+                                const RECTANGLE_16* rect)
+{
+	UINT32 y;
+	const size_t size = 4ull * (rect->right - rect->left);
+
+	for (y = rect->top; y < rect->bottom; y++)
+		CopyMemory((BYTE*)shadow_content_pixel(data, step, rect->left, y),
+		           shadow_content_pixel(pSrcData, nSrcStep, rect->left, y), size);
+}
+
+static void shadow_content_tile_rect(const rdpShadowContent* content, UINT32 x, UINT32 y,
+                                     RECTANGLE_16* rect)
+{
+	rect->left = (UINT16)(x * SHADOW_CONTENT_TILE_SIZE);
+	rect->top = (UINT16)(y * SHADOW_CONTENT_TILE_SIZE);
+	rect->right = (UINT16)MIN((x + 1) * SHADOW_CONTENT_TILE_SIZE, content->width);
+	rect->bottom = (UINT16)MIN((y + 1) * SHADOW_CONTENT_TILE_SIZE, content->height);
+}
+
+static BOOL shadow_content_rect_exact(const rdpShadowContent* content, const RECTANGLE_16* rect)
+{
+	UINT32 x, y;
+
+	for (y = rect->top / SHADOW_CONTENT_TILE_SIZE;
+	     y <= (rect->bottom - 1U) / SHADOW_CONTENT_TILE_SIZE; y++)
+	{
+		for (x = rect->left / SHADOW_CONTENT_TILE_SIZE;
+		     x <= (rect->right - 1U) / SHADOW_CONTENT_TILE_SIZE; x++)
+		{
+			if (!content->tiles[y * content->gridWidth + x].exact)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Add the parts of rect outside of exclude (may be NULL) to region */
+static BOOL shadow_content_union_outside(REGION16* region, const RECTANGLE_16* rect,
+                                         const RECTANGLE_16* exclude)
+{
+	RECTANGLE_16 part;
+	RECTANGLE_16 inner;
+
+	if (!exclude || !rectangles_intersection(rect, exclude, &inner))
+		return region16_union_rect(region, region, rect);
+
+	part = *rect;
+	part.bottom = inner.top;
+	if (!rectangle_is_empty(&part) && !region16_union_rect(region, region, &part))
+		return FALSE;
+
+	part = *rect;
+	part.top = inner.bottom;
+	if (!rectangle_is_empty(&part) && !region16_union_rect(region, region, &part))
+		return FALSE;
+
+	part = inner;
+	part.left = rect->left;
+	part.right = inner.left;
+	if (!rectangle_is_empty(&part) && !region16_union_rect(region, region, &part))
+		return FALSE;
+
+	part = inner;
+	part.left = inner.right;
+	part.right = rect->right;
+	if (!rectangle_is_empty(&part) && !region16_union_rect(region, region, &part))
+		return FALSE;
+
+	return TRUE;
+}
+
+/* The high bits of FNV hashes mix all of the input */
+static INLINE UINT16* shadow_content_cache_bucket(rdpShadowContent* content, UINT64 key)
+{
+	return &content->cacheIndex[key >> (64 - SHADOW_CONTENT_INDEX_BITS)];
+}
+
+static UINT16 shadow_content_cache_lookup(rdpShadowContent* content, UINT64 key, UINT64 check)
+{
+	const UINT16 slot = *shadow_content_cache_bucket(content, key);
+
+	if ((slot == 0) || !content->slots[slot].used || (content->slots[slot].key != key) ||
+	    (content->slots[slot].check != check))
+		return 0;
+
+	content->slots[slot].lastUse = content->updateCount;
+	return slot;
+}
+
+/* Find a free cache slot or the least recently used one not referenced by this update */
+static UINT16 shadow_content_cache_insert(rdpShadowContent* content, UINT64 key, UINT64 check,
+                                          BOOL* evict)
+{
+	UINT32 index;
+	UINT16* bucket;
+	UINT32 slot = 0;
+	SHADOW_CONTENT_SLOT* entry;
+
+	if (content->usedCacheSlots < content->maxCacheSlots)
+		slot = ++content->usedCacheSlots;
+	else
+	{
+		for (index = 1; index <= content->maxCacheSlots; index++)
+		{
+			const SHADOW_CONTENT_SLOT* cur = &content->slots[index];
+
+			if (cur->lastUse == content->updateCount)
+				continue;
+
+			if ((slot == 0) || (cur->lastUse < content->slots[slot].lastUse))
+				slot = index;
+		}
+
+		if (slot == 0)
+			return 0;
+	}
+
+	entry = &content->slots[slot];
+	*evict = entry->used;
+
+	if (entry->used)
+	{
+		bucket = shadow_content_cache_bucket(content, entry->key);
+		if (*bucket == slot)
+			*bucket = 0;
+	}
+
+	entry->used = TRUE;
+	entry->key = key;
+	entry->check = check;
+	entry->lastUse = content->updateCount;
+	*shadow_content_cache_bucket(content, key) = (UINT16)slot;
+	return (UINT16)slot;
+}
+
+/**
+ * Look for a vertically scrolled area in rect by matching row hashes of the new content
+ * against the frame known by the client. The offset most rows agree on is verified and
+ * the longest run of identical rows becomes a SurfaceToSurface command.
+ */
+static BOOL shadow_content_detect_scroll(rdpShadowContent* content, const BYTE* pSrcData,
+                                         UINT32 nSrcStep, const RECTANGLE_16* rect,
+                                         SHADOW_CONTENT_COMMANDS* commands)
+{
+	UINT32 y;
+	INT32 offset;
+	INT32 bestOffset = 0;
+	UINT32 bestVotes = 0;
+	UINT32 run = 0;
+	UINT32 bestRun = 0;
+	UINT32 bestEnd = 0;
+	const UINT32 mask = content->rowTableSize - 1;
+	const UINT32 width = rect->right - rect->left;
+	const UINT32 height = rect->bottom - rect->top;
+
+	if ((width < SHADOW_CONTENT_TILE_SIZE) || (height < 2 * SHADOW_CONTENT_MIN_SCROLL_ROWS))
+		return FALSE;
+
+	/* Only content the client has without codec loss can be moved */
+	if (!shadow_content_rect_exact(content, rect))
+		return FALSE;
+
+	ZeroMemory(content->rowTable, sizeof(UINT32) * content->rowTableSize);
+	ZeroMemory(content->votes, sizeof(UINT32) * 2 * height);
+
+	for (y = 0; y < height; y++)
+	{
+		UINT64 hash;
+		UINT32 bucket;
+
+		content->curHashes[y] =
+		    shadow_content_hash_row(pSrcData, nSrcStep, rect->left, rect->right, rect->top + y);
+		hash = shadow_content_hash_row(content->frame, content->scanline, rect->left, rect->right,
+		                               rect->top + y);
+		content->prevHashes[y] = hash;
+
+		if (hash == 0)
+			continue;
+
+		bucket = (UINT32)hash & mask;
+		while (content->rowTable[bucket] &&
+		       (content->prevHashes[content->rowTable[bucket] - 1] != hash))
+			bucket = (bucket + 1) & mask;
+
+		if (!content->rowTable[bucket])
+			content->rowTable[bucket] = y + 1;
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		const UINT64 hash = content->curHashes[y];
+		UINT32 bucket = (UINT32)hash & mask;
+
+		if (hash == 0)
+			continue;
+
+		while (content->rowTable[bucket])
+		{
+			const UINT32 prev = content->rowTable[bucket] - 1;
+
+			if (content->prevHashes[prev] == hash)
+			{
+				if (prev != y)
+					content->votes[prev + height - y]++;
+				break;
+			}
+
+			bucket = (bucket + 1) & mask;
+		}
+	}
+
+	for (y = 0; y < 2 * height; y++)
+	{
+		if (content->votes[y] > bestVotes)
+		{
+			bestVotes = content->votes[y];
+			bestOffset = (INT32)y - (INT32)height;
+		}
+	}
+
+	if (bestVotes < SHADOW_CONTENT_MIN_SCROLL_ROWS)
+		return FALSE;
+
+	/* Rows y of the new content are rows y + offset of the old one */
+	offset = bestOffset;
+	for (y = (UINT32)MAX(0, -offset); y < (UINT32)MIN((INT32)height, (INT32)height - offset); y++)
+	{
+		const UINT32 src = (UINT32)((INT32)y + offset);
+
+		if ((content->curHashes[y] == content->prevHashes[src]) &&
+		    (memcmp(shadow_content_pixel(pSrcData, nSrcStep, rect->left, rect->top + y),
+		            shadow_content_pixel(content->frame, content->scanline, rect->left,
+		                                 rect->top + src),
+		            4ull * width) == 0))
+		{
+			if (++run > bestRun)
+			{
+				bestRun = run;
+				bestEnd = y + 1;
+			}
+		}
+		else
+			run = 0;
+	}
+
+	if (bestRun < SHADOW_CONTENT_MIN_SCROLL_ROWS)
+		return FALSE;
+
+	commands->move = TRUE;
+	commands->moveX = rect->left;
+	commands->moveY = (UINT16)(rect->top + bestEnd - bestRun);
+	commands->moveSrc.left = rect->left;
+	commands->moveSrc.right = rect->right;
+	commands->moveSrc.top = (UINT16)(commands->moveY + offset);
+	commands->moveSrc.bottom = (UINT16)(commands->moveSrc.top + bestRun);
+	return TRUE;
+}
+
+/**
+ * Find the parts of region that can be sent with cheap GFX commands: scrolled areas,
+ * tiles of a single color and tiles whose content is in the client cache. Tiles that
+ * did not change are dropped, region is replaced by the tiles left for the codec.
+ */
+BOOL shadow_content_analyze(rdpShadowContent* content, const BYTE* pSrcData, UINT32 nSrcStep,
+                            REGION16* region, SHADOW_CONTENT_COMMANDS* commands)
+{
+	BOOL rc = FALSE;
+	UINT32 x, y;
+	RECTANGLE_16 extents;
+	RECTANGLE_16 moveDst = { 0 };
+	REGION16 residual;
+
+	WINPR_ASSERT(content);
+	WINPR_ASSERT(pSrcData);
+	WINPR_ASSERT(region);
+	WINPR_ASSERT(commands);
+
+	ZeroMemory(commands, sizeof(SHADOW_CONTENT_COMMANDS));
+	content->numStores = 0;
+	content->numFills = 0;
+	content->numLoads = 0;
+
+	if (!content->frame || region16_is_empty(region))
+		return TRUE;
+
+	extents = *region16_extents(region);
+	if ((extents.right > content->width) || (extents.bottom > content->height))
+		return FALSE;
+
+	content->updateCount++;
+	region16_init(&residual);
+
+	if (shadow_content_detect_scroll(content, pSrcData, nSrcStep, &extents, commands))
+	{
+		moveDst.left = commands->moveX;
+		moveDst.top = commands->moveY;
+		moveDst.right = commands->moveSrc.right;
+		moveDst.bottom = (UINT16)(commands->moveY + commands->moveSrc.bottom -
+		                          commands->moveSrc.top);
+	}
+
+	for (y = extents.top / SHADOW_CONTENT_TILE_SIZE;
+	     y <= (extents.bottom - 1U) / SHADOW_CONTENT_TILE_SIZE; y++)
+	{
+		for (x = extents.left / SHADOW_CONTENT_TILE_SIZE;
+		     x <= (extents.right - 1U) / SHADOW_CONTENT_TILE_SIZE; x++)
+		{
+			UINT32 color;
+			UINT16 slot = 0;
+			RECTANGLE_16 rect;
+			SHADOW_CONTENT_TILE* tile = &content->tiles[y * content->gridWidth + x];
+			BOOL full;
+
+			shadow_content_tile_rect(content, x, y, &rect);
+			full = ((rect.right - rect.left) == SHADOW_CONTENT_TILE_SIZE) &&
+			       ((rect.bottom - rect.top) == SHADOW_CONTENT_TILE_SIZE);
+
+			if (!region16_intersects_rect(region, &rect) &&
+			    !(commands->move && rectangles_intersects(&moveDst, &rect)))
+				continue;
+
+			if (tile->known &&
+			    shadow_content_equal(pSrcData, nSrcStep, content->frame, content->scanline, &rect))
+				continue;
+
+			/* Keep the old content of static tiles, it may come back (window switches).
+			 * The client caches its surface, so only tiles it got without codec loss. */
+			if (tile->exact && full &&
+			    (content->updateCount - tile->lastChange > SHADOW_CONTENT_CACHE_MIN_AGE) &&
+			    (content->maxCacheSlots > 0) &&
+			    !shadow_content_is_uniform(content->frame, content->scanline, &rect, &color))
+			{
+				UINT64 check;
+				const UINT64 key =
+				    shadow_content_hash(content->frame, content->scanline, &rect, &check);
+
+				if (shadow_content_cache_lookup(content, key, check) == 0)
+				{
+					SHADOW_CONTENT_STORE* store = &content->stores[content->numStores];
+
+					store->cacheSlot =
+					    shadow_content_cache_insert(content, key, check, &store->evict);
+					if (store->cacheSlot != 0)
+					{
+						store->cacheKey = key;
+						store->rect = rect;
+						content->numStores++;
+					}
+				}
+			}
+
+			tile->known = TRUE;
+			tile->exact = TRUE;
+			tile->lastChange = content->updateCount;
+			shadow_content_copy(content->frame, content->scanline, pSrcData, nSrcStep, &rect);
+
+			if (commands->move && (rect.left >= moveDst.left) && (rect.right <= moveDst.right) &&
+			    (rect.top >= moveDst.top) && (rect.bottom <= moveDst.bottom))
+				continue;
+
+			if (shadow_content_is_uniform(pSrcData, nSrcStep, &rect, &color))
+			{
+				SHADOW_CONTENT_FILL* fill = &content->fills[content->numFills++];
+				fill->color = color;
+				fill->rect = rect;
+				continue;
+			}
+
+			if (full && (content->maxCacheSlots > 0))
+			{
+				UINT64 check;
+				const UINT64 key = shadow_content_hash(pSrcData, nSrcStep, &rect, &check);
+
+				slot = shadow_content_cache_lookup(content, key, check);
+			}
+
+			if (slot != 0)
+			{
+				SHADOW_CONTENT_LOAD* load = &content->loads[content->numLoads++];
+				load->cacheSlot = slot;
+				load->x = rect.left;
+				load->y = rect.top;
+				continue;
+			}
+
+			/* Exact again once sent with a lossless codec, see shadow_content_set_exact */
+			tile->exact = FALSE;
+			if (!shadow_content_union_outside(&residual, &rect, commands->move ? &moveDst : NULL))
+				goto fail;
+		}
+	}
+
+	if (!region16_copy(region, &residual))
+		goto fail;
+
+	commands->numStores = content->numStores;
+	commands->stores = content->stores;
+	commands->numFills = content->numFills;
+	commands->fills = content->fills;
+	commands->numLoads = content->numLoads;
+	commands->loads = content->loads;
+	rc = TRUE;
+fail:
+	region16_uninit(&residual);
+	return rc;
+}
+
+/**
+ * Tell whether the client got the tiles of rect without codec loss. Lossless marks only
+ * tiles rect covers completely, lossy ones every tile rect touches.
+ */
+void shadow_content_set_exact(rdpShadowContent* content, const RECTANGLE_16* rect, BOOL exact)
+{
+	UINT32 x, y;
+
+	WINPR_ASSERT(content);
+	WINPR_ASSERT(rect);
+
+	if (!content->frame || rectangle_is_empty(rect))
+		return;
+
+	for (y = rect->top / SHADOW_CONTENT_TILE_SIZE;
+	     y <= MIN(rect->bottom - 1U, content->height - 1U) / SHADOW_CONTENT_TILE_SIZE; y++)
+	{
+		for (x = rect->left / SHADOW_CONTENT_TILE_SIZE;
+		     x <= MIN(rect->right - 1U, content->width - 1U) / SHADOW_CONTENT_TILE_SIZE; x++)
+		{
+			RECTANGLE_16 tileRect;
+			SHADOW_CONTENT_TILE* tile = &content->tiles[y * content->gridWidth + x];
+
+			if (!exact)
+			{
+				tile->exact = FALSE;
+				continue;
+			}
+
+			shadow_content_tile_rect(content, x, y, &tileRect);
+			if (tile->known && (tileRect.left >= rect->left) && (tileRect.right <= rect->right) &&
+			    (tileRect.top >= rect->top) && (tileRect.bottom <= rect->bottom))
+				tile->exact = TRUE;
+		}
+	}
+}
+
+static void shadow_content_free_frame(rdpShadowContent* content)
+{
+	winpr_aligned_free(content->frame);
+	free(content->tiles);
+	free(content->curHashes);
+	free(content->prevHashes);
+	free(content->votes);
+	free(content->rowTable);
+	free(content->stores);
+	free(content->fills);
+	free(content->loads);
+	content->frame = NULL;
+	content->tiles = NULL;
+	content->curHashes = NULL;
+	content->prevHashes = NULL;
+	content->votes = NULL;
+	content->rowTable = NULL;
+	content->stores = NULL;
+	content->fills = NULL;
+	content->loads = NULL;
+	content->width = 0;
+	content->height = 0;
+}
+
+/**
+ * Forget the surface content known by the client, e.g. for a new GFX surface.
+ * The cache slots survive, they are kept by the client until the channel is closed.
+ */
+BOOL shadow_content_reset(rdpShadowContent* content, UINT32 width, UINT32 height,
+                          UINT32 maxCacheSlots)
+{
+	size_t numTiles;
+
+	WINPR_ASSERT(content);
+
+	if ((width == 0) || (height == 0) || (width > UINT16_MAX) || (height > UINT16_MAX))
+		return FALSE;
+
+	if (maxCacheSlots != content->maxCacheSlots)
+	{
+		free(content->slots);
+		content->slots = NULL;
+		content->maxCacheSlots = 0;
+		content->usedCacheSlots = 0;
+		ZeroMemory(content->cacheIndex, sizeof(UINT16) * SHADOW_CONTENT_INDEX_SIZE);
+
+		if (maxCacheSlots > 0)
+		{
+			content->slots =
+			    (SHADOW_CONTENT_SLOT*)calloc(maxCacheSlots + 1ull, sizeof(SHADOW_CONTENT_SLOT));
+			if (!content->slots)
+				return FALSE;
+			content->maxCacheSlots = maxCacheSlots;
+		}
+	}
+
+	shadow_content_free_frame(content);
+	content->gridWidth = (width + SHADOW_CONTENT_TILE_SIZE - 1) / SHADOW_CONTENT_TILE_SIZE;
+	content->gridHeight = (height + SHADOW_CONTENT_TILE_SIZE - 1) / SHADOW_CONTENT_TILE_SIZE;
+	numTiles = 1ull * content->gridWidth * content->gridHeight;
+	content->scanline = width * 4;
+	content->rowTableSize = 1;
+	while (content->rowTableSize < 2 * height)
+		content->rowTableSize <<= 1;
+
+	content->frame = (BYTE*)winpr_aligned_malloc(1ull * content->scanline * height, 16);
+	content->tiles = (SHADOW_CONTENT_TILE*)calloc(numTiles, sizeof(SHADOW_CONTENT_TILE));
+	content->curHashes = (UINT64*)calloc(height, sizeof(UINT64));
+	content->prevHashes = (UINT64*)calloc(height, sizeof(UINT64));
+	content->votes = (UINT32*)calloc(2ull * height, sizeof(UINT32));
+	content->rowTable = (UINT32*)calloc(content->rowTableSize, sizeof(UINT32));
+	content->stores = (SHADOW_CONTENT_STORE*)calloc(numTiles, sizeof(SHADOW_CONTENT_STORE));
+	content->fills = (SHADOW_CONTENT_FILL*)calloc(numTiles, sizeof(SHADOW_CONTENT_FILL));
+	content->loads = (SHADOW_CONTENT_LOAD*)calloc(numTiles, sizeof(SHADOW_CONTENT_LOAD));
+
+	if (!content->frame || !content->tiles || !content->curHashes || !content->prevHashes ||
+	    !content->votes || !content->rowTable || !content->stores || !content->fills ||
+	    !content->loads)
+	{
+		shadow_content_free_frame(content);
+		return FALSE;
+	}
+
+	content->width = width;
+	content->height = height;
+	return TRUE;
+}
+
+rdpShadowContent* shadow_content_new(void)
+{
+	rdpShadowContent* content = (rdpShadowContent*)calloc(1, sizeof(rdpShadowContent));
+
+	if (!content)
+		return NULL;
+
+	content->cacheIndex = (UINT16*)calloc(SHADOW_CONTENT_INDEX_SIZE, sizeof(UINT16));
+	if (!content->cacheIndex)
+	{
+		free(content);
+		return NULL;
+	}
+
+	return content;
+}
+
+void shadow_content_free(rdpShadowContent* content)
+{
+	if (!content)
+		return;
+
+	shadow_content_free_frame(content);
+	free(content->slots);
+	free(content->cacheIndex);
+	free(content);
+}
@@ -0,0 +1,91 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server GFX Content Analysis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_CONTENT_H
+#define FREERDP_SERVER_SHADOW_CONTENT_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/codec/region.h>
+
+#include <winpr/crt.h>
+
+#define SHADOW_CONTENT_TILE_SIZE 64
+
+typedef struct rdp_shadow_content rdpShadowContent;
+
+/* Save the old content of a tile to a cache slot (SurfaceToCache) */
+typedef struct
+{
+	BOOL evict; /* the slot holds another tile, send EvictCacheEntry first */
+	UINT16 cacheSlot;
+	UINT64 cacheKey;
+	RECTANGLE_16 rect;
+} SHADOW_CONTENT_STORE;
+
+/* Fill a tile with a single color (SolidFill) */
+typedef struct
+{
+	UINT32 color; /* PIXEL_FORMAT_BGRX32 */
+	RECTANGLE_16 rect;
+} SHADOW_CONTENT_FILL;
+
+/* Restore a tile from a cache slot (CacheToSurface) */
+typedef struct
+{
+	UINT16 cacheSlot;
+	UINT16 x;
+	UINT16 y;
+} SHADOW_CONTENT_LOAD;
+
+/* Result of shadow_content_analyze, to be sent in this order before the residual region */
+typedef struct
+{
+	UINT32 numStores;
+	const SHADOW_CONTENT_STORE* stores;
+
+	BOOL move; /* SurfaceToSurface of a scrolled area */
+	RECTANGLE_16 moveSrc;
+	UINT16 moveX;
+	UINT16 moveY;
+
+	UINT32 numFills;
+	const SHADOW_CONTENT_FILL* fills;
+
+	UINT32 numLoads;
+	const SHADOW_CONTENT_LOAD* loads;
+} SHADOW_CONTENT_COMMANDS;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	BOOL shadow_content_reset(rdpShadowContent* content, UINT32 width, UINT32 height,
+	                          UINT32 maxCacheSlots);
+	BOOL shadow_content_analyze(rdpShadowContent* content, const BYTE* pSrcData, UINT32 nSrcStep,
+	                            REGION16* region, SHADOW_CONTENT_COMMANDS* commands);
+	void shadow_content_set_exact(rdpShadowContent* content, const RECTANGLE_16* rect,
+	                              BOOL exact);
+
+	rdpShadowContent* shadow_content_new(void);
+	void shadow_content_free(rdpShadowContent* content);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_CONTENT_H */
@@ -19,6 +19,7 @@
 #include <freerdp/config.h>
 
 #include <winpr/assert.h>
+#include <winpr/sysinfo.h>
 
 #include "shadow.h"
 
@@ -27,16 +28,45 @@
 #include <freerdp/log.h>
 #define TAG CLIENT_TAG("shadow")
 
+#define SHADOW_ENCODER_DEFAULT_FPS 16
+#define SHADOW_ENCODER_MAX_FPS 32
+#define SHADOW_ENCODER_MAX_FPS_LAN 60
+
+/* Queueing delay tolerated before the frame rate is reduced (ms) */
+#define SHADOW_ENCODER_QUEUE_DELAY 100
+/* Minimum time between two quality changes, also the time a change of the network
+ * class has to persist (ms) */
+#define SHADOW_ENCODER_QUALITY_INTERVAL 1000
+/* Window of the minimum acknowledge delay, follows route changes (ms) */
+#define SHADOW_ENCODER_DELAY_WINDOW 10000
+/* Window of the acknowledged throughput (ms) */
+#define SHADOW_ENCODER_THROUGHPUT_WINDOW 1000
+/* Interval and duration of the network characteristics detection (ms) */
+#define SHADOW_ENCODER_AUTODETECT_INTERVAL 5000
+#define SHADOW_ENCODER_BANDWIDTH_WINDOW 1000
+
+#define SHADOW_ENCODER_MIN_BITRATE 256000
+#define SHADOW_ENCODER_MAX_QP 51
+
+/* RemoteFX quantization values per SHADOW_QUALITY_* */
+static const UINT32 shadow_encoder_rfx_quant[][10] = {
+	{ 8, 8, 8, 8, 9, 9, 10, 10, 10, 11 },
+	{ 7, 7, 7, 7, 8, 8, 9, 9, 9, 10 },
+	{ 6, 6, 6, 6, 7, 7, 8, 8, 8, 9 },
+};
+
 UINT32 shadow_encoder_preferred_fps(rdpShadowEncoder* encoder)
 {
-	/* Return preferred fps calculated according to the last
-	 * sent frame id and last client-acknowledged frame id.
+	/* Return preferred fps calculated by the rate control from the
+	 * frame acknowledges and the detected network characteristics.
 	 */
 	return encoder->fps;
 }
 
 UINT32 shadow_encoder_inflight_frames(rdpShadowEncoder* encoder)
 {
+	UINT32 count;
+
 	/* Return inflight frame count.
 	 * If queueDepth is SUSPEND_FRAME_ACKNOWLEDGEMENT, count = 0
 	 * Otherwise, calculate count =
@@ -44,40 +74,365 @@ UINT32 shadow_encoder_inflight_frames(rdpShadowEncoder* encoder)
 	 * Note: This function is exported so that subsystem could
 	 * implement its own strategy to tune fps.
 	 */
-	return (encoder->queueDepth == SUSPEND_FRAME_ACKNOWLEDGEMENT)
-	           ? 0
-	           : encoder->frameId - encoder->lastAckframeId;
+	EnterCriticalSection(&encoder->lock);
+	count = (encoder->queueDepth == SUSPEND_FRAME_ACKNOWLEDGEMENT)
+	            ? 0
+	            : encoder->frameId - encoder->lastAckframeId;
+	LeaveCriticalSection(&encoder->lock);
+	return count;
 }
 
-UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder)
+const UINT32* shadow_encoder_rfx_quantization(const rdpShadowEncoder* encoder)
 {
-	UINT32 frameId;
-	UINT32 inFlightFrames = shadow_encoder_inflight_frames(encoder);
+	return shadow_encoder_rfx_quant[encoder->quality];
+}
 
-	/*
-	 * Calculate preferred fps according to how much frames are
-	 * in-progress. Note that it only works when subsytem implementation
-	 * calls shadow_encoder_preferred_fps and takes the suggestion.
-	 */
-	if (inFlightFrames > 1)
+static UINT32 shadow_encoder_initial_quality(const rdpSettings* settings)
+{
+	switch (settings->ConnectionType)
+	{
+		case CONNECTION_TYPE_MODEM:
+		case CONNECTION_TYPE_BROADBAND_LOW:
+			return SHADOW_QUALITY_LOW;
+
+		case CONNECTION_TYPE_SATELLITE:
+		case CONNECTION_TYPE_BROADBAND_HIGH:
+		case CONNECTION_TYPE_WAN:
+			return SHADOW_QUALITY_MEDIUM;
+
+		default:
+			return SHADOW_QUALITY_HIGH;
+	}
+}
+
+static UINT32 shadow_encoder_rtt(const rdpShadowEncoder* encoder)
+{
+	const rdpContext* context = (const rdpContext*)encoder->client;
+
+	if (context->autodetect && (context->autodetect->netCharAverageRTT > 0))
+		return context->autodetect->netCharAverageRTT;
+
+	return encoder->minAckDelay;
+}
+
+/* Bandwidth detected by the client in kbit/s, 0 if unknown. Clients that do not count the
+ * regular traffic of a continuous measurement report less than was actually delivered. */
+static UINT32 shadow_encoder_bandwidth(const rdpShadowEncoder* encoder)
+{
+	const rdpContext* context = (const rdpContext*)encoder->client;
+
+	if (!context->autodetect || (context->autodetect->netCharBandwidth < encoder->throughput))
+		return 0;
+
+	return context->autodetect->netCharBandwidth;
+}
+
+static UINT32 shadow_encoder_queue_delay(const rdpShadowEncoder* encoder)
+{
+	if (encoder->ackDelay <= encoder->minAckDelay)
+		return 0;
+
+	return encoder->ackDelay - encoder->minAckDelay;
+}
+
+static void shadow_encoder_apply_quality(rdpShadowEncoder* encoder)
+{
+	const UINT32 bandwidth = shadow_encoder_bandwidth(encoder);
+	const UINT32 reduction = SHADOW_QUALITY_HIGH - encoder->quality;
+
+	if (encoder->rfx)
+		rfx_context_set_quantization(encoder->rfx, shadow_encoder_rfx_quantization(encoder), 1);
+
+	if (encoder->h264)
+	{
+		UINT32 bitRate = encoder->server->h264BitRate >> reduction;
+
+		/* Leave a quarter of the link to the other traffic */
+		if (bandwidth > 0)
+			bitRate = MIN(bitRate, bandwidth / 4 * 3000);
+
+		encoder->h264->BitRate = MAX(bitRate, SHADOW_ENCODER_MIN_BITRATE);
+		encoder->h264->FrameRate = encoder->fps;
+		encoder->h264->QP = MIN(encoder->server->h264QP + 6 * reduction, SHADOW_ENCODER_MAX_QP);
+	}
+}
+
+/* Periodic RTT and continuous bandwidth measurements, the results are read from
+ * rdpAutoDetect */
+static void shadow_encoder_autodetect(rdpShadowEncoder* encoder, UINT64 now)
+{
+	BOOL rc = TRUE;
+	rdpContext* context = (rdpContext*)encoder->client;
+	rdpAutoDetect* autodetect = context->autodetect;
+
+	if (!autodetect || !freerdp_settings_get_bool(context->settings, FreeRDP_NetworkAutoDetect) ||
+	    !(context->settings->EarlyCapabilityFlags & RNS_UD_CS_SUPPORT_NETCHAR_AUTODETECT))
+		return;
+
+	if (encoder->bandwidthMeasuring)
 	{
-		encoder->fps = (100 / (inFlightFrames + 1) * encoder->maxFps) / 100;
+		if (now - encoder->autodetectTime < SHADOW_ENCODER_BANDWIDTH_WINDOW)
+			return;
+
+		encoder->bandwidthMeasuring = FALSE;
+		IFCALLRET(autodetect->BandwidthMeasureStop, rc, context, encoder->autodetectSequence++);
 	}
-	else
+	else if ((encoder->autodetectTime == 0) ||
+	         (now - encoder->autodetectTime >= SHADOW_ENCODER_AUTODETECT_INTERVAL))
+	{
+		encoder->autodetectTime = now;
+		IFCALLRET(autodetect->RTTMeasureRequest, rc, context, encoder->autodetectSequence++);
+
+		if (rc)
+		{
+			IFCALLRET(autodetect->BandwidthMeasureStart, rc, context,
+			          encoder->autodetectSequence++);
+			encoder->bandwidthMeasuring = rc;
+		}
+	}
+
+	if (!rc)
+		WLog_DBG(TAG, "network characteristics detection failed");
+}
+
+/**
+ * Adjust frame rate and quality to the frame acknowledges:
+ * The frame rate grows by one per frame while fewer frames than fit into the round trip are
+ * in flight and shrinks by a quarter, at most once per round trip, when frames queue up. The
+ * quality follows with some hysteresis, it drops when the frame rate alone cannot drain the
+ * queue or the detected bandwidth is used up and rises while the full frame rate is sustained.
+ */
+static void shadow_encoder_update_rate(rdpShadowEncoder* encoder, UINT64 now)
+{
+	BOOL lan;
+	BOOL congested;
+	UINT32 window;
+	UINT32 quality = encoder->quality;
+	const UINT32 inFlightFrames = shadow_encoder_inflight_frames(encoder);
+	const UINT32 rtt = shadow_encoder_rtt(encoder);
+	const UINT32 bandwidth = shadow_encoder_bandwidth(encoder);
+	const UINT32 queueDelay = shadow_encoder_queue_delay(encoder);
+
+	/* A fast local network gets a higher frame rate and may leave H.264. The class only
+	 * changes once the measurements agree for a while, each codec switch costs a full
+	 * surface update. */
+	lan = (rtt <= 10) && (queueDelay <= 10) && ((bandwidth == 0) || (bandwidth >= 100000));
+
+	if (lan == (encoder->maxFps == SHADOW_ENCODER_MAX_FPS_LAN))
+		encoder->lastLanChange = now;
+	else if (now - encoder->lastLanChange >= SHADOW_ENCODER_QUALITY_INTERVAL)
 	{
-		encoder->fps += 2;
+		encoder->maxFps = lan ? SHADOW_ENCODER_MAX_FPS_LAN : SHADOW_ENCODER_MAX_FPS;
+		encoder->lastLanChange = now;
+	}
 
-		if (encoder->fps > encoder->maxFps)
-			encoder->fps = encoder->maxFps;
+	window = 2 + (rtt + encoder->clientDelay) * encoder->fps / 1000;
+	congested =
+	    (inFlightFrames > window) || (queueDelay > MAX(SHADOW_ENCODER_QUEUE_DELAY, rtt));
+
+	if (congested)
+	{
+		if (now - encoder->lastRateChange >= MAX(SHADOW_ENCODER_QUEUE_DELAY, rtt))
+		{
+			encoder->fps = encoder->fps * 3 / 4;
+			encoder->lastRateChange = now;
+		}
 	}
+	else if (inFlightFrames < window)
+		encoder->fps++;
+
+	if (encoder->fps > encoder->maxFps)
+		encoder->fps = encoder->maxFps;
 
 	if (encoder->fps < 1)
 		encoder->fps = 1;
 
+	if (now - encoder->lastQualityChange < SHADOW_ENCODER_QUALITY_INTERVAL)
+		return;
+
+	if ((congested && (encoder->fps <= encoder->maxFps / 2)) ||
+	    ((bandwidth > 0) && (encoder->throughput > bandwidth / 10 * 8)))
+	{
+		if (quality > SHADOW_QUALITY_LOW)
+			quality--;
+	}
+	else if (!congested && (encoder->fps >= encoder->maxFps * 3 / 4) &&
+	         ((bandwidth == 0) || (encoder->throughput < bandwidth / 2)))
+	{
+		if (quality < SHADOW_QUALITY_HIGH)
+			quality++;
+	}
+
+	if (quality != encoder->quality)
+	{
+		WLog_DBG(TAG,
+		         "quality %" PRIu32 " -> %" PRIu32 " (fps %" PRIu32 ", rtt %" PRIu32
+		         " ms, queue %" PRIu32 " ms, %" PRIu32 " kbit/s)",
+		         encoder->quality, quality, encoder->fps, rtt, queueDelay, encoder->throughput);
+		encoder->quality = quality;
+		encoder->lastQualityChange = now;
+		shadow_encoder_apply_quality(encoder);
+	}
+	else if (encoder->h264 && (encoder->h264->FrameRate != encoder->fps))
+	{
+		/* Reconfiguring the H.264 encoder is not free, only follow the frame rate slowly */
+		encoder->h264->FrameRate = encoder->fps;
+		encoder->lastQualityChange = now;
+	}
+}
+
+UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder)
+{
+	UINT32 frameId;
+	SHADOW_ENCODER_FRAME* frame;
+	const UINT64 now = GetTickCount64();
+
+	/*
+	 * Calculate preferred fps and quality according to how much frames are
+	 * in-progress. Note that the capture rate only follows when subsytem
+	 * implementation calls shadow_encoder_preferred_fps and takes the suggestion.
+	 */
+	shadow_encoder_autodetect(encoder, now);
+
+	EnterCriticalSection(&encoder->lock);
+	shadow_encoder_update_rate(encoder, now);
+
 	frameId = ++encoder->frameId;
+	frame = &encoder->frames[frameId % SHADOW_ENCODER_FRAME_HISTORY];
+	frame->frameId = frameId;
+	frame->time = now;
+	frame->sent = freerdp_get_transport_sent((rdpContext*)encoder->client, FALSE);
+	LeaveCriticalSection(&encoder->lock);
 	return frameId;
 }
 
+void shadow_encoder_frame_acknowledge(rdpShadowEncoder* encoder, UINT32 frameId,
+                                      UINT32 queueDepth)
+{
+	UINT32 delay;
+	const UINT64 now = GetTickCount64();
+	const SHADOW_ENCODER_FRAME* frame = &encoder->frames[frameId % SHADOW_ENCODER_FRAME_HISTORY];
+
+	EnterCriticalSection(&encoder->lock);
+
+	/*
+	 * Record the last client acknowledged frame id to
+	 * calculate how much frames are in progress.
+	 * Some rdp clients (win7 mstsc) skips frame ACK if it is
+	 * inactive, we should not expect ACK for each frame.
+	 * So it is OK to calculate inflight frame count according to
+	 * a latest acknowledged frame id.
+	 */
+	encoder->lastAckframeId = frameId;
+	encoder->queueDepth = queueDepth;
+
+	if (frame->frameId != frameId)
+		goto out;
+
+	delay = (UINT32)MIN(now - frame->time, UINT32_MAX);
+	encoder->ackDelay = encoder->ackDelay ? (encoder->ackDelay * 7 + delay) / 8 : delay;
+
+	if ((encoder->minAckDelayTime == 0) || (delay < encoder->minAckDelay) ||
+	    (now - encoder->minAckDelayTime >= SHADOW_ENCODER_DELAY_WINDOW))
+	{
+		encoder->minAckDelay = delay;
+		encoder->minAckDelayTime = now;
+	}
+
+	/* Everything sent before the frame has arrived */
+	if (encoder->ackedBytesTime == 0)
+	{
+		encoder->ackedBytesTime = now;
+		encoder->ackedSent = frame->sent;
+		goto out;
+	}
+
+	encoder->ackedBytes += (ULONG)(frame->sent - encoder->ackedSent);
+	encoder->ackedSent = frame->sent;
+
+	if (now - encoder->ackedBytesTime >= SHADOW_ENCODER_THROUGHPUT_WINDOW)
+	{
+		encoder->throughput =
+		    (UINT32)MIN(encoder->ackedBytes * 8 / (now - encoder->ackedBytesTime), UINT32_MAX);
+		encoder->ackedBytes = 0;
+		encoder->ackedBytesTime = now;
+	}
+
+out:
+	LeaveCriticalSection(&encoder->lock);
+}
+
+void shadow_encoder_qoe_frame_acknowledge(rdpShadowEncoder* encoder,
+                                          const RDPGFX_QOE_FRAME_ACKNOWLEDGE_PDU* qoe)
+{
+	const UINT32 delay = (UINT32)qoe->timeDiffSE + qoe->timeDiffEDR;
+
+	EnterCriticalSection(&encoder->lock);
+	encoder->clientDelay = encoder->clientDelay ? (encoder->clientDelay * 7 + delay) / 8 : delay;
+	LeaveCriticalSection(&encoder->lock);
+}
+
+BOOL shadow_encoder_frame_due(rdpShadowEncoder* encoder, DWORD* timeout)
+{
+	UINT64 elapsed;
+	UINT32 interval;
+	const SHADOW_ENCODER_FRAME* frame;
+
+	EnterCriticalSection(&encoder->lock);
+	interval = 1000 / MAX(encoder->fps, 1);
+	frame = &encoder->frames[encoder->frameId % SHADOW_ENCODER_FRAME_HISTORY];
+
+	if ((encoder->frameId == 0) || (frame->frameId != encoder->frameId))
+	{
+		LeaveCriticalSection(&encoder->lock);
+		return TRUE;
+	}
+
+	elapsed = GetTickCount64() - frame->time;
+	LeaveCriticalSection(&encoder->lock);
+
+	if (elapsed >= interval)
+		return TRUE;
+
+	if (timeout)
+		*timeout = (DWORD)(interval - elapsed);
+
+	return FALSE;
+}
+
+static UINT32 shadow_encoder_progressive_passes(const rdpShadowEncoder* encoder)
+{
+	/* Coarse first passes for changed tiles on slow links, refined while the screen is static */
+	return 3 - encoder->quality;
+}
+
+BOOL shadow_encoder_update_progressive(rdpShadowEncoder* encoder, REGION16* pending)
+{
+	BOOL rc;
+	REGION16 region;
+	RECTANGLE_16 rect = { 0 };
+	const UINT32 passes = shadow_encoder_progressive_passes(encoder);
+
+	if (!encoder->progressive || (encoder->progressivePasses == passes))
+		return TRUE;
+
+	/* The tiles still waiting for upgrades have to be encoded again */
+	WINPR_ASSERT(encoder->width <= UINT16_MAX);
+	WINPR_ASSERT(encoder->height <= UINT16_MAX);
+	rect.right = (UINT16)encoder->width;
+	rect.bottom = (UINT16)encoder->height;
+	region16_init(&region);
+	rc = region16_union_rect(&region, &region, &rect) &&
+	     progressive_context_invalidate_region(encoder->progressive, &region, pending) &&
+	     progressive_context_set_quality_passes(encoder->progressive, passes);
+	region16_uninit(&region);
+
+	if (rc)
+		encoder->progressivePasses = passes;
+
+	return rc;
+}
+
 static int shadow_encoder_init_grid(rdpShadowEncoder* encoder)
 {
 	UINT32 i, j, k;
@@ -265,6 +620,10 @@ static int shadow_encoder_init_progressive(rdpShadowEncoder* encoder)
 	if (!progressive_context_reset(encoder->progressive))
 		goto fail;
 
+	encoder->progressivePasses = shadow_encoder_progressive_passes(encoder);
+	if (!progressive_context_set_quality_passes(encoder->progressive, encoder->progressivePasses))
+		goto fail;
+
 	encoder->codecs |= FREERDP_CODEC_PROGRESSIVE;
 	return 1;
 fail:
@@ -272,6 +631,25 @@ fail:
 	return -1;
 }
 
+static int shadow_encoder_init_clear(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+	if (!encoder->clear)
+		encoder->clear = clear_context_new(TRUE);
+
+	if (!encoder->clear)
+		goto fail;
+
+	if (!clear_context_reset(encoder->clear))
+		goto fail;
+
+	encoder->codecs |= FREERDP_CODEC_CLEARCODEC;
+	return 1;
+fail:
+	clear_context_free(encoder->clear);
+	return -1;
+}
+
 static int shadow_encoder_init(rdpShadowEncoder* encoder)
 {
 	encoder->width = encoder->server->screen->width;
@@ -362,6 +740,19 @@ static int shadow_encoder_uninit_progressive(rdpShadowEncoder* encoder)
 	return 1;
 }
 
+static int shadow_encoder_uninit_clear(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+	if (encoder->clear)
+	{
+		clear_context_free(encoder->clear);
+		encoder->clear = NULL;
+	}
+
+	encoder->codecs &= (UINT32)~FREERDP_CODEC_CLEARCODEC;
+	return 1;
+}
+
 static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 {
 	shadow_encoder_uninit_grid(encoder);
@@ -383,9 +774,25 @@ static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 
 	shadow_encoder_uninit_progressive(encoder);
 
+	shadow_encoder_uninit_clear(encoder);
+
 	return 1;
 }
 
+BOOL shadow_encoder_select_h264(rdpShadowEncoder* encoder, BOOL alternatives)
+{
+	/* The other codecs look better and need less processing where the link can carry them */
+	const BOOL h264 = !alternatives || (encoder->quality < SHADOW_QUALITY_HIGH) ||
+	                  (encoder->maxFps < SHADOW_ENCODER_MAX_FPS_LAN);
+
+	/* Other codecs updated the surface, start over with a key frame */
+	if (h264 && !encoder->h264Selected)
+		shadow_encoder_uninit_h264(encoder);
+
+	encoder->h264Selected = h264;
+	return h264;
+}
+
 int shadow_encoder_reset(rdpShadowEncoder* encoder)
 {
 	int status;
@@ -402,22 +809,39 @@ int shadow_encoder_reset(rdpShadowEncoder* encoder)
 	if (status < 0)
 		return -1;
 
+	EnterCriticalSection(&encoder->lock);
+	encoder->fps = SHADOW_ENCODER_DEFAULT_FPS;
+	encoder->maxFps = SHADOW_ENCODER_MAX_FPS;
+	encoder->frameId = 0;
+	encoder->lastAckframeId = 0;
+	encoder->frameAck = settings->SurfaceFrameMarkerEnabled;
+	encoder->quality = shadow_encoder_initial_quality(settings);
+	encoder->lastRateChange = 0;
+	encoder->lastQualityChange = 0;
+	encoder->lastLanChange = 0;
+	ZeroMemory(encoder->frames, sizeof(encoder->frames));
+	encoder->ackDelay = 0;
+	encoder->minAckDelay = 0;
+	encoder->minAckDelayTime = 0;
+	encoder->clientDelay = 0;
+	encoder->ackedBytes = 0;
+	encoder->ackedBytesTime = 0;
+	encoder->throughput = 0;
+	encoder->h264Selected = FALSE;
+	LeaveCriticalSection(&encoder->lock);
+
 	status = shadow_encoder_prepare(encoder, codecs);
 
 	if (status < 0)
 		return -1;
 
-	encoder->fps = 16;
-	encoder->maxFps = 32;
-	encoder->frameId = 0;
-	encoder->lastAckframeId = 0;
-	encoder->frameAck = settings->SurfaceFrameMarkerEnabled;
 	return 1;
 }
 
 int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 {
 	int status;
+	const UINT32 prepared = encoder->codecs;
 
 	if ((codecs & FREERDP_CODEC_REMOTEFX) && !(encoder->codecs & FREERDP_CODEC_REMOTEFX))
 	{
@@ -474,6 +898,18 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
+	if ((codecs & FREERDP_CODEC_CLEARCODEC) && !(encoder->codecs & FREERDP_CODEC_CLEARCODEC))
+	{
+		WLog_DBG(TAG, "initializing ClearCodec encoder");
+		status = shadow_encoder_init_clear(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
+	if (encoder->codecs != prepared)
+		shadow_encoder_apply_quality(encoder);
+
 	return 1;
 }
 
@@ -486,13 +922,23 @@ rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client)
 	if (!encoder)
 		return NULL;
 
+	if (!InitializeCriticalSectionAndSpinCount(&encoder->lock, 4000))
+	{
+		free(encoder);
+		return NULL;
+	}
+
 	encoder->client = client;
 	encoder->server = server;
-	encoder->fps = 16;
-	encoder->maxFps = 32;
+	encoder->fps = SHADOW_ENCODER_DEFAULT_FPS;
+	encoder->maxFps = SHADOW_ENCODER_MAX_FPS;
+	encoder->quality = SHADOW_QUALITY_HIGH;
+	encoder->content = shadow_content_new();
 
-	if (shadow_encoder_init(encoder) < 0)
+	if (!encoder->content || (shadow_encoder_init(encoder) < 0))
 	{
+		shadow_content_free(encoder->content);
+		DeleteCriticalSection(&encoder->lock);
 		free(encoder);
 		return NULL;
 	}
@@ -506,5 +952,7 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 		return;
 
 	shadow_encoder_uninit(encoder);
+	shadow_content_free(encoder->content);
+	DeleteCriticalSection(&encoder->lock);
 	free(encoder);
 }
@@ -27,6 +27,22 @@
 
 #include <freerdp/server/shadow.h>
 
+#include "shadow_content.h"
+
+#define SHADOW_ENCODER_FRAME_HISTORY 64
+
+/* Encoding quality selected by the rate control */
+#define SHADOW_QUALITY_LOW 0
+#define SHADOW_QUALITY_MEDIUM 1
+#define SHADOW_QUALITY_HIGH 2
+
+typedef struct
+{
+	UINT32 frameId;
+	UINT64 time;
+	ULONG sent; /* transport bytes sent before the frame */
+} SHADOW_ENCODER_FRAME;
+
 struct rdp_shadow_encoder
 {
 	rdpShadowClient* client;
@@ -51,6 +67,8 @@ struct rdp_shadow_encoder
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
 	H264_CONTEXT* h264;
 	PROGRESSIVE_CONTEXT* progressive;
+	CLEAR_CONTEXT* clear;
+	rdpShadowContent* content;
 
 	UINT32 fps;
 	UINT32 maxFps;
@@ -58,6 +76,28 @@ struct rdp_shadow_encoder
 	UINT32 frameId;
 	UINT32 lastAckframeId;
 	UINT32 queueDepth;
+
+	/* Rate control, see shadow_encoder_update_rate. The frame acknowledges arrive on the
+	 * thread of the graphics channel, lock holds the state they share with the client thread */
+	CRITICAL_SECTION lock;
+	UINT32 quality;
+	UINT64 lastRateChange;
+	UINT64 lastQualityChange;
+	UINT64 lastLanChange;
+	SHADOW_ENCODER_FRAME frames[SHADOW_ENCODER_FRAME_HISTORY];
+	UINT32 ackDelay;    /* smoothed time from sending a frame to its acknowledge (ms) */
+	UINT32 minAckDelay; /* lowest ackDelay seen in the current window (ms) */
+	UINT64 minAckDelayTime;
+	UINT32 clientDelay; /* smoothed decode and render time reported with QoE (ms) */
+	ULONG ackedSent;
+	UINT64 ackedBytes;
+	UINT64 ackedBytesTime;
+	UINT32 throughput; /* acknowledged kbit/s */
+	UINT64 autodetectTime;
+	UINT16 autodetectSequence;
+	BOOL bandwidthMeasuring;
+	BOOL h264Selected;
+	UINT32 progressivePasses;
 };
 
 #ifdef __cplusplus
@@ -68,6 +108,14 @@ extern "C"
 	int shadow_encoder_reset(rdpShadowEncoder* encoder);
 	int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs);
 	UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder);
+	void shadow_encoder_frame_acknowledge(rdpShadowEncoder* encoder, UINT32 frameId,
+	                                      UINT32 queueDepth);
+	void shadow_encoder_qoe_frame_acknowledge(rdpShadowEncoder* encoder,
+	                                          const RDPGFX_QOE_FRAME_ACKNOWLEDGE_PDU* qoe);
+	BOOL shadow_encoder_frame_due(rdpShadowEncoder* encoder, DWORD* timeout);
+	BOOL shadow_encoder_select_h264(rdpShadowEncoder* encoder, BOOL alternatives);
+	BOOL shadow_encoder_update_progressive(rdpShadowEncoder* encoder, REGION16* pending);
+	const UINT32* shadow_encoder_rfx_quantization(const rdpShadowEncoder* encoder);
 
 	rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client);
 	void shadow_encoder_free(rdpShadowEncoder* encoder);
@@ -392,6 +392,10 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 			if (!freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444, arg->Value ? TRUE : FALSE))
 				return COMMAND_LINE_ERROR;
 		}
+		CommandLineSwitchCase(arg, "shared-encode")
+		{
+			server->sharedEncode = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchCase(arg, "keytab")
 		{
 			if (!freerdp_settings_set_string(settings, FreeRDP_KerberosKeytab, arg->Value))
@@ -847,6 +851,15 @@ int shadow_server_init(rdpShadowServer* server)
 
 	server->listener->info = (void*)server;
 	server->listener->PeerAccepted = shadow_client_accepted;
+
+	if (server->sharedEncode)
+	{
+		server->share = shadow_share_new(server);
+
+		if (!server->share)
+			goto fail_share;
+	}
+
 	server->subsystem = shadow_subsystem_new();
 
 	if (!server->subsystem)
@@ -859,6 +872,9 @@ int shadow_server_init(rdpShadowServer* server)
 
 	shadow_subsystem_free(server->subsystem);
 fail_subsystem_new:
+	shadow_share_free(server->share);
+	server->share = NULL;
+fail_share:
 	freerdp_listener_free(server->listener);
 	server->listener = NULL;
 fail_listener:
@@ -890,6 +906,8 @@ int shadow_server_uninit(rdpShadowServer* server)
 	shadow_server_stop(server);
 	shadow_subsystem_uninit(server->subsystem);
 	shadow_subsystem_free(server->subsystem);
+	shadow_share_free(server->share);
+	server->share = NULL;
 	freerdp_listener_free(server->listener);
 	server->listener = NULL;
 	free(server->CertificateFile);
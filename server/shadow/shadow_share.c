@@ -0,0 +1,298 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server Shared Encoding
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
+
+#include "shadow_share.h"
+
+struct rdp_shadow_share
+{
+	CRITICAL_SECTION lock;
+	wArrayList* frames; /* frames of the current capture frame */
+
+	/* One encoder context, and with it one thread pool, for all clients */
+	CRITICAL_SECTION encodeLock;
+	RFX_CONTEXT* rfx;
+	UINT32 width;
+	UINT32 height;
+	const UINT32* quantVals;
+};
+
+void shadow_share_release(SHADOW_SHARED_FRAME* frame)
+{
+	size_t i;
+
+	if (!frame || (InterlockedDecrement(&frame->refCount) > 0))
+		return;
+
+	for (i = 0; i < frame->numMessages; i++)
+		Stream_Free(frame->messages[i], TRUE);
+
+	free(frame->messages);
+
+	if (frame->event)
+		CloseHandle(frame->event);
+
+	free(frame);
+}
+
+static void shadow_share_release_frame(void* obj)
+{
+	shadow_share_release((SHADOW_SHARED_FRAME*)obj);
+}
+
+static BOOL shadow_share_key_equal(const SHADOW_SHARE_RFX_KEY* a, const SHADOW_SHARE_RFX_KEY* b)
+{
+	return (a->data == b->data) && (a->width == b->width) && (a->height == b->height) &&
+	       (a->scanline == b->scanline) && (a->rect.x == b->rect.x) && (a->rect.y == b->rect.y) &&
+	       (a->rect.width == b->rect.width) && (a->rect.height == b->rect.height) &&
+	       (a->quantVals == b->quantVals) && (a->maxDataSize == b->maxDataSize);
+}
+
+static BOOL shadow_share_write_messages(rdpShadowShare* share, SHADOW_SHARED_FRAME* frame,
+                                        RFX_MESSAGE* messages, size_t numMessages)
+{
+	size_t i;
+
+	frame->messages = (wStream**)calloc(numMessages, sizeof(wStream*));
+	if (!frame->messages)
+		return FALSE;
+
+	for (i = 0; i < numMessages; i++)
+	{
+		frame->messages[i] = Stream_New(NULL, 1024);
+		if (!frame->messages[i])
+			return FALSE;
+
+		frame->numMessages++;
+		if (!rfx_write_message_frame(share->rfx, frame->messages[i], &messages[i]))
+			return FALSE;
+
+		Stream_SealLength(frame->messages[i]);
+	}
+
+	return TRUE;
+}
+
+static BOOL shadow_share_encode(rdpShadowShare* share, SHADOW_SHARED_FRAME* frame)
+{
+	BOOL rc;
+	size_t i;
+	size_t numMessages = 1;
+	RFX_MESSAGE* messages;
+	RFX_RECT* messageRects = NULL;
+	const SHADOW_SHARE_RFX_KEY* key = &frame->key;
+
+	if ((share->width != key->width) || (share->height != key->height))
+	{
+		if (!rfx_context_reset(share->rfx, key->width, key->height))
+			return FALSE;
+
+		share->width = key->width;
+		share->height = key->height;
+	}
+
+	if (share->quantVals != key->quantVals)
+	{
+		if (!rfx_context_set_quantization(share->rfx, key->quantVals, 1))
+			return FALSE;
+
+		share->quantVals = key->quantVals;
+	}
+
+	if (key->maxDataSize > 0)
+		messages = rfx_encode_messages(share->rfx, &key->rect, 1, key->data, key->width,
+		                               key->height, key->scanline, &numMessages, key->maxDataSize);
+	else
+		messages = rfx_encode_message(share->rfx, &key->rect, 1, key->data, key->width,
+		                              key->height, key->scanline);
+
+	if (!messages)
+		return FALSE;
+
+	rc = shadow_share_write_messages(share, frame, messages, numMessages);
+
+	if (key->maxDataSize > 0)
+	{
+		if (numMessages > 0)
+			messageRects = messages[0].rects;
+
+		for (i = 0; i < numMessages; i++)
+			rfx_message_free(share->rfx, &messages[i]);
+
+		free(messageRects);
+		free(messages);
+	}
+	else
+	{
+		messages->freeRects = TRUE;
+		rfx_message_free(share->rfx, messages);
+	}
+
+	return rc;
+}
+
+/**
+ * Function description
+ * Get the RemoteFX frame for key, encoded by the first client asking for it while the
+ * others wait for the result.
+ *
+ * @return The frame, to be released with shadow_share_release, or NULL on failure
+ */
+SHADOW_SHARED_FRAME* shadow_share_encode_rfx(rdpShadowShare* share, const SHADOW_SHARE_RFX_KEY* key)
+{
+	size_t index;
+	BOOL encode = FALSE;
+	SHADOW_SHARED_FRAME* frame = NULL;
+
+	WINPR_ASSERT(share);
+	WINPR_ASSERT(key);
+
+	EnterCriticalSection(&share->lock);
+
+	for (index = 0; index < ArrayList_Count(share->frames); index++)
+	{
+		SHADOW_SHARED_FRAME* cur = (SHADOW_SHARED_FRAME*)ArrayList_GetItem(share->frames, index);
+
+		if (shadow_share_key_equal(&cur->key, key))
+		{
+			frame = cur;
+			break;
+		}
+	}
+
+	if (!frame)
+	{
+		frame = (SHADOW_SHARED_FRAME*)calloc(1, sizeof(SHADOW_SHARED_FRAME));
+
+		if (frame)
+		{
+			frame->key = *key;
+			frame->refCount = 1;
+			frame->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+			if (!frame->event || !ArrayList_Append(share->frames, frame))
+			{
+				shadow_share_release(frame);
+				frame = NULL;
+			}
+			else
+				encode = TRUE;
+		}
+	}
+
+	if (frame)
+		InterlockedIncrement(&frame->refCount);
+
+	LeaveCriticalSection(&share->lock);
+
+	if (!frame)
+		return NULL;
+
+	if (encode)
+	{
+		EnterCriticalSection(&share->encodeLock);
+		frame->success = shadow_share_encode(share, frame);
+		LeaveCriticalSection(&share->encodeLock);
+		SetEvent(frame->event);
+	}
+	else
+		WaitForSingleObject(frame->event, INFINITE);
+
+	if (!frame->success)
+	{
+		shadow_share_release(frame);
+		return NULL;
+	}
+
+	return frame;
+}
+
+/**
+ * Function description
+ * Drop the frames of the last capture frame, called before the next one is published.
+ */
+void shadow_share_next_frame(rdpShadowShare* share)
+{
+	if (!share)
+		return;
+
+	EnterCriticalSection(&share->lock);
+	ArrayList_Clear(share->frames);
+	LeaveCriticalSection(&share->lock);
+}
+
+rdpShadowShare* shadow_share_new(rdpShadowServer* server)
+{
+	wObject* obj;
+	rdpShadowShare* share;
+
+	WINPR_ASSERT(server);
+
+	share = (rdpShadowShare*)calloc(1, sizeof(rdpShadowShare));
+	if (!share)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&share->lock, 4000))
+		goto fail_lock;
+
+	if (!InitializeCriticalSectionAndSpinCount(&share->encodeLock, 4000))
+		goto fail_encode_lock;
+
+	share->frames = ArrayList_New(FALSE);
+	if (!share->frames)
+		goto fail_frames;
+
+	obj = ArrayList_Object(share->frames);
+	obj->fnObjectFree = shadow_share_release_frame;
+
+	share->rfx = rfx_context_new_ex(TRUE, server->settings->ThreadingFlags);
+	if (!share->rfx)
+		goto fail_rfx;
+
+	share->rfx->mode = server->rfxMode;
+	rfx_context_set_pixel_format(share->rfx, PIXEL_FORMAT_BGRX32);
+	return share;
+
+fail_rfx:
+	ArrayList_Free(share->frames);
+fail_frames:
+	DeleteCriticalSection(&share->encodeLock);
+fail_encode_lock:
+	DeleteCriticalSection(&share->lock);
+fail_lock:
+	free(share);
+	return NULL;
+}
+
+void shadow_share_free(rdpShadowShare* share)
+{
+	if (!share)
+		return;
+
+	ArrayList_Free(share->frames);
+	rfx_context_free(share->rfx);
+	DeleteCriticalSection(&share->encodeLock);
+	DeleteCriticalSection(&share->lock);
+	free(share);
+}
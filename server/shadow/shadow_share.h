@@ -0,0 +1,76 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server Shared Encoding
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_SHARE_H
+#define FREERDP_SERVER_SHADOW_SHARE_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/codec/rfx.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+/*
+ * Clients that look at the same surface with the same codec parameters get the frames
+ * of one capture encoded only once. The encoded frames live until the next capture
+ * frame is published and every client released them.
+ */
+
+/* Everything the RemoteFX output depends on */
+typedef struct
+{
+	const BYTE* data; /* start of the shared surface */
+	UINT32 width;
+	UINT32 height;
+	UINT32 scanline;
+	RFX_RECT rect;
+	const UINT32* quantVals; /* 10 quantization values */
+	size_t maxDataSize;      /* 0 for a single message */
+} SHADOW_SHARE_RFX_KEY;
+
+typedef struct
+{
+	SHADOW_SHARE_RFX_KEY key;
+
+	/* RemoteFX frame blocks of each message, every client writes its own header blocks */
+	size_t numMessages;
+	wStream** messages;
+
+	BOOL success;
+	HANDLE event; /* set when the messages are encoded */
+	LONG refCount;
+} SHADOW_SHARED_FRAME;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	void shadow_share_next_frame(rdpShadowShare* share);
+
+	SHADOW_SHARED_FRAME* shadow_share_encode_rfx(rdpShadowShare* share,
+	                                             const SHADOW_SHARE_RFX_KEY* key);
+	void shadow_share_release(SHADOW_SHARED_FRAME* frame);
+
+	rdpShadowShare* shadow_share_new(rdpShadowServer* server);
+	void shadow_share_free(rdpShadowShare* share);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_SHARE_H */
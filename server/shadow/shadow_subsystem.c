@@ -280,5 +280,9 @@ int shadow_subsystem_pointer_convert_alpha_pointer_data(
 
 void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem)
 {
+	/* Frames shared by the clients are only valid for one capture frame */
+	if (subsystem->server)
+		shadow_share_next_frame(subsystem->server->share);
+
 	shadow_multiclient_publish_and_wait(subsystem->updateEvent);
 }
@@ -414,6 +414,10 @@ extern "C"
 
 #define WMQ_QUIT 0xFFFFFFFF
 
+/* MessageQueue_NewEx flags */
+#define WMQ_FLAG_RING 0x00000001            /* lock free ring of fixed capacity, one consumer */
+#define WMQ_FLAG_SINGLE_PRODUCER 0x00000002 /* ring only: messages are posted by one thread */
+
 	WINPR_API wObject* MessageQueue_Object(wMessageQueue* queue);
 	WINPR_API HANDLE MessageQueue_Event(wMessageQueue* queue);
 	WINPR_API BOOL MessageQueue_Wait(wMessageQueue* queue);
@@ -424,9 +428,24 @@ extern "C"
 	                                 void* lParam);
 	WINPR_API BOOL MessageQueue_PostQuit(wMessageQueue* queue, int nExitCode);
 
+	/*! \brief Posts several messages at once, either all of them are queued or none.
+	 *
+	 *  \return TRUE if the messages were queued, FALSE if the queue is closed or a ring
+	 *          has no room for all of them.
+	 */
+	WINPR_API BOOL MessageQueue_PostMany(wMessageQueue* queue, const wMessage* messages,
+	                                     size_t count);
+
 	WINPR_API int MessageQueue_Get(wMessageQueue* queue, wMessage* message);
 	WINPR_API int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove);
 
+	/*! \brief Waits for messages and removes as many as are queued, up to 'count'.
+	 *          Nothing after a WMQ_QUIT message is returned.
+	 *
+	 *  \return The number of messages stored in 'messages', 0 if waiting failed.
+	 */
+	WINPR_API size_t MessageQueue_GetMany(wMessageQueue* queue, wMessage* messages, size_t count);
+
 	/*! \brief Clears all elements in a message queue.
 	 *
 	 *  \note If dynamically allocated data is part of the messages,
@@ -453,6 +472,22 @@ extern "C"
 	 */
 	WINPR_API wMessageQueue* MessageQueue_New(const wObject* callback);
 
+	/*! \brief Creates a new message queue with a different implementation.
+	 *
+	 * With WMQ_FLAG_RING the messages are kept in a ring of 'capacity' entries, rounded up
+	 * to a power of two, and posting and getting do not take a lock. Posting to a full
+	 * ring fails. Only one thread at a time may get, peek or clear messages. With
+	 * WMQ_FLAG_SINGLE_PRODUCER only one thread at a time may post messages either.
+	 *
+	 * \param callback see MessageQueue_New
+	 * \param flags a combination of WMQ_FLAG_* values, 0 for the default queue
+	 * \param capacity the number of messages a ring holds, ignored without WMQ_FLAG_RING
+	 *
+	 * \return A pointer to a newly allocated MessageQueue or NULL.
+	 */
+	WINPR_API wMessageQueue* MessageQueue_NewEx(const wObject* callback, DWORD flags,
+	                                            size_t capacity);
+
 	/*! \brief Frees resources allocated by a message queue.
 	 * 				 This function will only free resources allocated
 	 *				 internally.
@@ -234,6 +234,21 @@ extern "C"
 
 #endif /* WINPR_THREAD_POOL */
 
+	/* WinPR extensions */
+
+	/**
+	 * Submit a set of work objects at once, waking as many idle workers as needed with a single
+	 * signal. Equivalent to calling SubmitThreadpoolWork on each element.
+	 */
+	WINPR_API VOID winpr_SubmitThreadpoolWorkBatch(PTP_WORK* works, size_t count);
+
+	/**
+	 * Wait for the outstanding callbacks of a set of work objects.
+	 * Equivalent to calling WaitForThreadpoolWorkCallbacks on each element.
+	 */
+	WINPR_API VOID winpr_WaitForThreadpoolWorkBatchCallbacks(PTP_WORK* works, size_t count,
+	                                                         BOOL fCancelPendingCallbacks);
+
 #if !defined(_WIN32)
 #define WINPR_CALLBACK_ENVIRON 1
 #elif defined(_WIN32) && (_WIN32_WINNT < 0x0600)
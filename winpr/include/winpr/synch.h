@@ -419,6 +419,24 @@ extern "C"
 
 	WINPR_API void* GetEventWaitObject(HANDLE hEvent);
 
+	/**
+	 * A wait set keeps its handles registered between waits, so a loop waiting on the
+	 * same handles again and again does not pay for setting them up on every call.
+	 * WaitForWaitSet behaves like WaitForMultipleObjects with bWaitAll FALSE.
+	 * Setting the handles the set already holds only compares them.
+	 * A wait set must only be used by one thread at a time.
+	 */
+	typedef struct winpr_wait_set WINPR_WAIT_SET;
+
+	WINPR_API WINPR_WAIT_SET* CreateWaitSet(void);
+	WINPR_API void FreeWaitSet(WINPR_WAIT_SET* set);
+
+	WINPR_API BOOL SetWaitSetHandles(WINPR_WAIT_SET* set, DWORD nCount, const HANDLE* lpHandles);
+	WINPR_API BOOL AddWaitSetHandle(WINPR_WAIT_SET* set, HANDLE hHandle);
+	WINPR_API BOOL RemoveWaitSetHandle(WINPR_WAIT_SET* set, HANDLE hHandle);
+
+	WINPR_API DWORD WaitForWaitSet(WINPR_WAIT_SET* set, DWORD dwMilliseconds);
+
 #ifdef __cplusplus
 }
 #endif
@@ -65,6 +65,13 @@ extern "C"
 #define WLOG_APPENDER_JOURNALD 5
 #define WLOG_APPENDER_UDP 6
 
+/**
+ * Asynchronous Logging
+ */
+#define WLOG_ASYNC_OFF 0
+#define WLOG_ASYNC_BLOCK 1 /* wait for room while the queue is full */
+#define WLOG_ASYNC_DROP 2  /* drop messages below WLOG_ERROR while the queue is full */
+
 	typedef struct
 	{
 		DWORD Type;
@@ -192,6 +199,23 @@ extern "C"
 	WINPR_API BOOL WLog_CloseAppender(wLog* log);
 	WINPR_API BOOL WLog_ConfigureAppender(wLogAppender* appender, const char* setting, void* value);
 
+	/**
+	 * @brief Hands messages of the appender of \b log to a background thread writing them.
+	 *
+	 * Callers only copy a message into a queue of \b capacity entries (0 for the default),
+	 * \b policy decides what happens while it is full. Must not be called while other threads
+	 * are logging to the appender.
+	 *
+	 * @return TRUE on success, FALSE otherwise
+	 */
+	WINPR_API BOOL WLog_SetAsync(wLog* log, DWORD policy, size_t capacity);
+
+	/** @brief Waits until all messages queued for the appender of \b log have been written */
+	WINPR_API BOOL WLog_Flush(wLog* log);
+
+	/** @brief Number of messages dropped by the appender of \b log since async mode started */
+	WINPR_API size_t WLog_GetDroppedMessageCount(wLog* log);
+
 	WINPR_API wLogLayout* WLog_GetLogLayout(wLog* log);
 	WINPR_API BOOL WLog_Layout_SetPrefixFormat(wLog* log, wLogLayout* layout, const char* format);
 
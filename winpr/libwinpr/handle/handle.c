@@ -21,6 +21,7 @@
 #include <winpr/config.h>
 
 #include <winpr/handle.h>
+#include <winpr/interlocked.h>
 
 #ifndef _WIN32
 
@@ -40,6 +41,20 @@
 
 #include "../handle/handle.h"
 
+static LONGLONG g_NextHandleId = 0;
+
+UINT64 winpr_Handle_NewId(void)
+{
+	LONGLONG id;
+
+	do
+	{
+		id = g_NextHandleId;
+	} while (InterlockedCompareExchange64(&g_NextHandleId, id + 1, id) != id);
+
+	return (UINT64)id + 1;
+}
+
 BOOL CloseHandle(HANDLE hObject)
 {
 	ULONG Type;
@@ -111,8 +111,11 @@ typedef struct
 	ULONG Type;
 	ULONG Mode;
 	HANDLE_OPS* ops;
+	UINT64 Id; /* unique per process, tells a new handle at a reused address from an old one */
 } WINPR_HANDLE;
 
+UINT64 winpr_Handle_NewId(void);
+
 static INLINE BOOL WINPR_HANDLE_IS_HANDLED(HANDLE handle, ULONG type, BOOL invalidValue)
 {
 	WINPR_HANDLE* pWinprHandle = (WINPR_HANDLE*)handle;
@@ -139,6 +142,7 @@ static INLINE void WINPR_HANDLE_SET_TYPE_AND_MODE(void* _handle, ULONG _type, UL
 
 	hdl->Type = _type;
 	hdl->Mode = _mode;
+	hdl->Id = winpr_Handle_NewId();
 }
 
 static INLINE BOOL winpr_Handle_GetInfo(HANDLE handle, ULONG* pType, WINPR_HANDLE** pObject)
@@ -22,8 +22,11 @@
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/library.h>
+#include <winpr/interlocked.h>
 
 #include "pool.h"
+#include "../log.h"
+#define TAG WINPR_TAG("pool")
 
 #ifdef WINPR_THREAD_POOL
 
@@ -51,64 +54,340 @@ static BOOL CALLBACK init_module(PINIT_ONCE once, PVOID param, PVOID* context)
 static TP_POOL DEFAULT_POOL = {
 	0,    /* DWORD Minimum */
 	500,  /* DWORD Maximum */
-	NULL, /* wArrayList* Threads */
 	NULL, /* wQueue* PendingQueue */
 	NULL, /* HANDLE TerminateEvent */
-	NULL, /* wCountdownEvent* WorkComplete */
+	0,    /* LONG Terminate */
+	0,    /* LONG NumWorkers */
 };
 
-static DWORD WINAPI thread_pool_work_func(LPVOID arg)
+static INLINE LONG tp_load(LONG volatile* value)
 {
-	DWORD status;
-	PTP_POOL pool;
+	/* Interlocked operations are full barriers, use one for an acquire load */
+	return InterlockedCompareExchange(value, 0, 0);
+}
+
+static BOOL tp_worker_push(TP_WORKER* worker, PTP_WORK work)
+{
+	LONG pos = tp_load(&worker->EnqueuePos);
+
+	while (1)
+	{
+		TP_WORKER_CELL* cell = &worker->Cells[(UINT32)pos % TP_WORKER_QUEUE_SIZE];
+		const LONG diff = (LONG)((UINT32)tp_load(&cell->Sequence) - (UINT32)pos);
+
+		if (diff == 0)
+		{
+			const LONG next = (LONG)((UINT32)pos + 1);
+
+			if (InterlockedCompareExchange(&worker->EnqueuePos, next, pos) == pos)
+			{
+				cell->Work = work;
+				InterlockedExchange(&cell->Sequence, next);
+				return TRUE;
+			}
+		}
+		else if (diff < 0)
+			return FALSE; /* full */
+
+		pos = tp_load(&worker->EnqueuePos);
+	}
+}
+
+static PTP_WORK tp_worker_pop(TP_WORKER* worker)
+{
+	LONG pos = tp_load(&worker->DequeuePos);
+
+	while (1)
+	{
+		TP_WORKER_CELL* cell = &worker->Cells[(UINT32)pos % TP_WORKER_QUEUE_SIZE];
+		const LONG next = (LONG)((UINT32)pos + 1);
+		const LONG diff = (LONG)((UINT32)tp_load(&cell->Sequence) - (UINT32)next);
+
+		if (diff == 0)
+		{
+			if (InterlockedCompareExchange(&worker->DequeuePos, next, pos) == pos)
+			{
+				/* a cancelled item was cleared by ThreadpoolCancelWork, skip it */
+				PTP_WORK work = (PTP_WORK)cell->Work;
+
+				if (work && (InterlockedCompareExchangePointer((PVOID volatile*)&cell->Work,
+				                                               NULL, work) != work))
+					work = NULL;
+
+				InterlockedExchange(&cell->Sequence,
+				                    (LONG)((UINT32)pos + TP_WORKER_QUEUE_SIZE));
+
+				if (work)
+					return work;
+			}
+		}
+		else if (diff < 0)
+			return NULL; /* empty */
+
+		pos = tp_load(&worker->DequeuePos);
+	}
+}
+
+static PTP_WORK tp_pool_next_work(PTP_POOL pool, TP_WORKER* worker)
+{
+	LONG index;
 	PTP_WORK work;
-	HANDLE events[2];
-	PTP_CALLBACK_INSTANCE callbackInstance;
+	const LONG count = tp_load(&pool->NumWorkers);
 
-	pool = (PTP_POOL)arg;
+	if ((work = tp_worker_pop(worker)))
+		return work;
 
-	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+	if (tp_load(&pool->Overflow) > 0)
+	{
+		if ((work = (PTP_WORK)Queue_Dequeue(pool->PendingQueue)))
+		{
+			InterlockedDecrement(&pool->Overflow);
+			return work;
+		}
+	}
+
+	for (index = 1; index < count; index++)
+	{
+		TP_WORKER* victim = pool->Workers[(worker->Index + index) % count];
+
+		if ((work = tp_worker_pop(victim)))
+			return work;
+	}
+
+	return NULL;
+}
+
+static void tp_pool_wake_workers(PTP_POOL pool, LONG count)
+{
+	LONG woken = 0;
+
+	while (woken < count)
+	{
+		const LONG idle = tp_load(&pool->Idle);
 
+		if (idle <= 0)
+			break;
+
+		if (InterlockedCompareExchange(&pool->Idle, idle - 1, idle) == idle)
+			woken++;
+	}
+
+	if (woken > 0)
+		ReleaseSemaphore(pool->WorkSemaphore, woken, NULL);
+}
+
+static void tp_pool_leave_idle(PTP_POOL pool)
+{
+	/* if a submitter already claimed our slot the released token causes one spurious wakeup */
 	while (1)
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		const LONG idle = tp_load(&pool->Idle);
 
-		if (status == WAIT_OBJECT_0)
+		if (idle <= 0)
 			break;
 
-		if (status != (WAIT_OBJECT_0 + 1))
+		if (InterlockedCompareExchange(&pool->Idle, idle - 1, idle) == idle)
 			break;
+	}
+}
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE)Queue_Dequeue(pool->PendingQueue);
+void ThreadpoolPostWork(PTP_POOL pool, PTP_WORK const* works, size_t count)
+{
+	size_t index;
+	const LONG numWorkers = tp_load(&pool->NumWorkers);
+
+	for (index = 0; index < count; index++)
+	{
+		BOOL queued = FALSE;
+		PTP_WORK work = works[index];
 
-		if (callbackInstance)
+		InterlockedIncrement(&work->Pending);
+
+		if (numWorkers > 0)
 		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+			const UINT32 next = (UINT32)InterlockedIncrement(&pool->NextWorker);
+			queued = tp_worker_push(pool->Workers[next % (UINT32)numWorkers], work);
+		}
+
+		if (!queued)
+		{
+			Queue_Enqueue(pool->PendingQueue, work);
+			InterlockedIncrement(&pool->Overflow);
 		}
 	}
 
+	tp_pool_wake_workers(pool, (count < TP_POOL_MAX_WORKERS) ? (LONG)count : TP_POOL_MAX_WORKERS);
+}
+
+void ThreadpoolWaitWork(PTP_POOL pool, PTP_WORK work)
+{
+	while (tp_load(&work->Pending) > 0)
+	{
+		InterlockedIncrement(&pool->Waiters);
+
+		if (tp_load(&work->Pending) <= 0)
+		{
+			LONG waiters;
+
+			do
+			{
+				waiters = tp_load(&pool->Waiters);
+			} while ((waiters > 0) &&
+			         (InterlockedCompareExchange(&pool->Waiters, waiters - 1, waiters) != waiters));
+
+			break;
+		}
+
+		if (WaitForSingleObject(pool->DoneSemaphore, INFINITE) != WAIT_OBJECT_0)
+			break;
+	}
+}
+
+static void tp_pool_wake_waiters(PTP_POOL pool)
+{
+	const LONG waiters = InterlockedExchange(&pool->Waiters, 0);
+
+	if (waiters > 0)
+		ReleaseSemaphore(pool->DoneSemaphore, waiters, NULL);
+}
+
+void ThreadpoolCancelWork(PTP_POOL pool, PTP_WORK work)
+{
+	LONG index;
+	size_t count;
+	LONG cancelled = 0;
+	const LONG numWorkers = tp_load(&pool->NumWorkers);
+
+	/* queued items of the work object are cleared in place, workers skip empty cells */
+	for (index = 0; index < numWorkers; index++)
+	{
+		TP_WORKER* worker = pool->Workers[index];
+		UINT32 pos = (UINT32)tp_load(&worker->DequeuePos);
+		const UINT32 end = (UINT32)tp_load(&worker->EnqueuePos);
+
+		for (; pos != end; pos++)
+		{
+			TP_WORKER_CELL* cell = &worker->Cells[pos % TP_WORKER_QUEUE_SIZE];
+
+			if (InterlockedCompareExchangePointer((PVOID volatile*)&cell->Work, NULL, work) ==
+			    work)
+				cancelled++;
+		}
+	}
+
+	Queue_Lock(pool->PendingQueue);
+	count = Queue_Count(pool->PendingQueue);
+
+	while (count-- > 0)
+	{
+		PTP_WORK pending = (PTP_WORK)Queue_Dequeue(pool->PendingQueue);
+
+		if (pending == work)
+		{
+			InterlockedDecrement(&pool->Overflow);
+			cancelled++;
+		}
+		else
+			Queue_Enqueue(pool->PendingQueue, pending);
+	}
+
+	Queue_Unlock(pool->PendingQueue);
+
+	if (cancelled > 0)
+	{
+		InterlockedExchangeAdd(&work->Pending, -cancelled);
+		tp_pool_wake_waiters(pool);
+	}
+}
+
+static void tp_worker_run(PTP_POOL pool, PTP_WORK work)
+{
+	TP_CALLBACK_INSTANCE callbackInstance = { 0 };
+
+	callbackInstance.Work = work;
+	work->WorkCallback(&callbackInstance, work->CallbackParameter, work);
+
+	/* the work object may be closed as soon as Pending drops, do not touch it afterwards */
+	InterlockedDecrement(&work->Pending);
+	tp_pool_wake_waiters(pool);
+}
+
+static DWORD WINAPI thread_pool_work_func(LPVOID arg)
+{
+	DWORD status;
+	PTP_WORK work;
+	HANDLE events[2];
+	TP_WORKER* worker = (TP_WORKER*)arg;
+	PTP_POOL pool = worker->Pool;
+
+	events[0] = pool->TerminateEvent;
+	events[1] = pool->WorkSemaphore;
+
+	while (!tp_load(&pool->Terminate))
+	{
+		if ((work = tp_pool_next_work(pool, worker)))
+		{
+			tp_worker_run(pool, work);
+			continue;
+		}
+
+		InterlockedIncrement(&pool->Idle);
+
+		/* recheck after announcing, a concurrent submit either sees us idle or we see its work */
+		if ((work = tp_pool_next_work(pool, worker)))
+		{
+			tp_pool_leave_idle(pool);
+			tp_worker_run(pool, work);
+			continue;
+		}
+
+		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+
+		if (status != (WAIT_OBJECT_0 + 1))
+			break;
+	}
+
 	ExitThread(0);
 	return 0;
 }
 
-static void threads_close(void* thread)
+static BOOL tp_pool_add_worker(PTP_POOL pool)
 {
-	WaitForSingleObject(thread, INFINITE);
-	CloseHandle(thread);
+	LONG index;
+	TP_WORKER* worker;
+	const LONG count = pool->NumWorkers;
+
+	if (count >= TP_POOL_MAX_WORKERS)
+		return TRUE;
+
+	if (!(worker = (TP_WORKER*)calloc(1, sizeof(TP_WORKER))))
+		return FALSE;
+
+	worker->Pool = pool;
+	worker->Index = (DWORD)count;
+
+	for (index = 0; index < TP_WORKER_QUEUE_SIZE; index++)
+		worker->Cells[index].Sequence = index;
+
+	pool->Workers[count] = worker;
+
+	if (!(worker->Thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)worker, 0, NULL)))
+	{
+		pool->Workers[count] = NULL;
+		free(worker);
+		return FALSE;
+	}
+
+	InterlockedIncrement(&pool->NumWorkers);
+	return TRUE;
 }
 
 static BOOL InitializeThreadpool(PTP_POOL pool)
 {
 	BOOL rc = FALSE;
 	int index;
-	wObject* obj;
-	HANDLE thread;
 
-	if (pool->Threads)
+	if (pool->NumWorkers > 0)
 		return TRUE;
 
 	pool->Minimum = 0;
@@ -117,30 +396,19 @@ static BOOL InitializeThreadpool(PTP_POOL pool)
 	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
 		goto fail;
 
-	if (!(pool->WorkComplete = CountdownEvent_New(0)))
-		goto fail;
-
 	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
 		goto fail;
 
-	if (!(pool->Threads = ArrayList_New(TRUE)))
+	if (!(pool->WorkSemaphore = CreateSemaphore(NULL, 0, INT32_MAX, NULL)))
 		goto fail;
 
-	obj = ArrayList_Object(pool->Threads);
-	obj->fnObjectFree = threads_close;
+	if (!(pool->DoneSemaphore = CreateSemaphore(NULL, 0, INT32_MAX, NULL)))
+		goto fail;
 
 	for (index = 0; index < 4; index++)
 	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)pool, 0, NULL)))
-		{
-			goto fail;
-		}
-
-		if (!ArrayList_Append(pool->Threads, thread))
-		{
-			CloseHandle(thread);
+		if (!tp_pool_add_worker(pool))
 			goto fail;
-		}
 	}
 
 	rc = TRUE;
@@ -149,13 +417,19 @@ fail:
 	return rc;
 }
 
-PTP_POOL GetDefaultThreadpool(void)
+static BOOL CALLBACK init_default_pool(PINIT_ONCE once, PVOID param, PVOID* context)
 {
-	PTP_POOL pool = NULL;
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(context);
+	return InitializeThreadpool((PTP_POOL)param);
+}
 
-	pool = &DEFAULT_POOL;
+PTP_POOL GetDefaultThreadpool(void)
+{
+	static INIT_ONCE init_once_default_pool = INIT_ONCE_STATIC_INIT;
+	PTP_POOL pool = &DEFAULT_POOL;
 
-	if (!InitializeThreadpool(pool))
+	if (!InitOnceExecuteOnce(&init_once_default_pool, init_default_pool, pool, NULL))
 		return NULL;
 
 	return pool;
@@ -193,12 +467,25 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
+	/* pending work is dropped, as the work objects might already be closed */
+	InterlockedExchange(&ptpp->Terminate, 1);
+
+	if (ptpp->TerminateEvent)
+		SetEvent(ptpp->TerminateEvent);
+
+	for (LONG index = 0; index < ptpp->NumWorkers; index++)
+	{
+		TP_WORKER* worker = ptpp->Workers[index];
+
+		WaitForSingleObject(worker->Thread, INFINITE);
+		CloseHandle(worker->Thread);
+		free(worker);
+	}
 
-	ArrayList_Free(ptpp->Threads);
 	Queue_Free(ptpp->PendingQueue);
-	CountdownEvent_Free(ptpp->WorkComplete);
 	CloseHandle(ptpp->TerminateEvent);
+	CloseHandle(ptpp->WorkSemaphore);
+	CloseHandle(ptpp->DoneSemaphore);
 
 	{
 		TP_POOL empty = { 0 };
@@ -211,26 +498,25 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 
 BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 {
-	HANDLE thread;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSetThreadpoolThreadMinimum)
 		return pSetThreadpoolThreadMinimum(ptpp, cthrdMic);
 #endif
+	/* the portable pool has a fixed upper bound of workers */
+	if (cthrdMic > TP_POOL_MAX_WORKERS)
+	{
+		WLog_ERR(TAG, "at most %d threads are supported, %" PRIu32 " requested",
+		         TP_POOL_MAX_WORKERS, cthrdMic);
+		return FALSE;
+	}
+
 	ptpp->Minimum = cthrdMic;
 
-	while (ArrayList_Count(ptpp->Threads) < (INT64)ptpp->Minimum)
+	while (ptpp->NumWorkers < (LONG)ptpp->Minimum)
 	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)ptpp, 0, NULL)))
-		{
+		if (!tp_pool_add_worker(ptpp))
 			return FALSE;
-		}
-
-		if (!ArrayList_Append(ptpp->Threads, thread))
-		{
-			CloseHandle(thread);
-			return FALSE;
-		}
 	}
 
 	return TRUE;
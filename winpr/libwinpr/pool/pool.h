@@ -26,6 +26,30 @@
 #include <winpr/thread.h>
 #include <winpr/collections.h>
 
+#define TP_POOL_MAX_WORKERS 64
+#define TP_WORKER_QUEUE_SIZE 256
+
+/**
+ * Each worker owns a bounded multi-producer/multi-consumer ring of work items.
+ * Submitters distribute items round robin, idle workers steal from the others.
+ */
+typedef struct
+{
+	LONG Sequence;
+	PTP_WORK Work;
+} TP_WORKER_CELL;
+
+typedef struct
+{
+	PTP_POOL Pool;
+	DWORD Index;
+	HANDLE Thread;
+	LONG EnqueuePos;
+	BYTE Padding[64 - sizeof(LONG)];
+	LONG DequeuePos;
+	TP_WORKER_CELL Cells[TP_WORKER_QUEUE_SIZE];
+} TP_WORKER;
+
 #if defined(_WIN32)
 #if (_WIN32_WINNT < _WIN32_WINNT_WIN6) || defined(__MINGW32__)
 struct _TP_CALLBACK_INSTANCE
@@ -37,10 +61,17 @@ struct _TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
+	wQueue* PendingQueue; /* overflow for full worker queues */
 	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	LONG Terminate;
+	LONG NumWorkers;
+	TP_WORKER* Workers[TP_POOL_MAX_WORKERS];
+	LONG NextWorker;
+	LONG Overflow;
+	LONG Idle; /* sleeping workers not yet signalled */
+	HANDLE WorkSemaphore;
+	LONG Waiters; /* threads waiting for callbacks to complete */
+	HANDLE DoneSemaphore;
 };
 
 struct _TP_WORK
@@ -48,6 +79,7 @@ struct _TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	LONG Pending;
 };
 
 struct _TP_TIMER
@@ -81,10 +113,17 @@ struct S_TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
+	wQueue* PendingQueue; /* overflow for full worker queues */
 	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	LONG Terminate;
+	LONG NumWorkers;
+	TP_WORKER* Workers[TP_POOL_MAX_WORKERS];
+	LONG NextWorker;
+	LONG Overflow;
+	LONG Idle; /* sleeping workers not yet signalled */
+	HANDLE WorkSemaphore;
+	LONG Waiters; /* threads waiting for callbacks to complete */
+	HANDLE DoneSemaphore;
 };
 
 struct S_TP_WORK
@@ -92,6 +131,7 @@ struct S_TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	LONG Pending;
 };
 
 struct S_TP_TIMER
@@ -118,5 +158,8 @@ struct S_TP_CLEANUP_GROUP
 #endif
 
 PTP_POOL GetDefaultThreadpool(void);
+void ThreadpoolPostWork(PTP_POOL pool, PTP_WORK const* works, size_t count);
+void ThreadpoolWaitWork(PTP_POOL pool, PTP_WORK work);
+void ThreadpoolCancelWork(PTP_POOL pool, PTP_WORK work);
 
 #endif /* WINPR_POOL_PRIVATE_H */
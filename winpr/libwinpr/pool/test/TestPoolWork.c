@@ -2,6 +2,7 @@
 #include <winpr/wtypes.h>
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/synch.h>
 #include <winpr/interlocked.h>
 
 static LONG count = 0;
@@ -123,6 +124,168 @@ fail:
 	return rc;
 }
 
+static void CALLBACK test_BatchCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                        PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	InterlockedIncrement((LONG*)context);
+}
+
+static BOOL test3(void)
+{
+	BOOL rc = FALSE;
+	size_t index;
+	LONG counts[1000] = { 0 };
+	PTP_WORK works[ARRAYSIZE(counts)] = { 0 };
+	printf("Batch Submit\n");
+
+	for (index = 0; index < ARRAYSIZE(works); index++)
+	{
+		works[index] = CreateThreadpoolWork(test_BatchCallback, &counts[index], NULL);
+
+		if (!works[index])
+		{
+			printf("CreateThreadpoolWork failure\n");
+			goto fail;
+		}
+	}
+
+	/* more items than the worker queues can hold to exercise the overflow queue */
+	winpr_SubmitThreadpoolWorkBatch(works, ARRAYSIZE(works));
+	winpr_SubmitThreadpoolWorkBatch(works, ARRAYSIZE(works));
+	winpr_WaitForThreadpoolWorkBatchCallbacks(works, ARRAYSIZE(works), FALSE);
+
+	for (index = 0; index < ARRAYSIZE(counts); index++)
+	{
+		if (counts[index] != 2)
+		{
+			printf("work %" PRIuz " ran %" PRId32 " times\n", index, counts[index]);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < ARRAYSIZE(works); index++)
+	{
+		if (works[index])
+			CloseThreadpoolWork(works[index]);
+	}
+
+	return rc;
+}
+
+typedef struct
+{
+	HANDLE release;
+	LONG started;
+	LONG ran;
+} test_cancel;
+
+static void CALLBACK test_BlockingCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                           PTP_WORK work)
+{
+	test_cancel* cancel = (test_cancel*)context;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	InterlockedIncrement(&cancel->started);
+	WaitForSingleObject(cancel->release, INFINITE);
+}
+
+static void CALLBACK test_CancelledCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                            PTP_WORK work)
+{
+	test_cancel* cancel = (test_cancel*)context;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	InterlockedIncrement(&cancel->ran);
+}
+
+static BOOL test4(void)
+{
+	BOOL rc = FALSE;
+	int index;
+	PTP_POOL pool;
+	PTP_WORK blocking = NULL;
+	PTP_WORK cancelled = NULL;
+	TP_CALLBACK_ENVIRON environment;
+	test_cancel cancel = { 0 };
+	printf("Cancel Pending Callbacks\n");
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		return FALSE;
+	}
+
+#if !defined(_WIN32)
+	/* the portable pool refuses more workers than it supports */
+	if (SetThreadpoolThreadMinimum(pool, 1000))
+	{
+		printf("SetThreadpoolThreadMinimum accepted more threads than supported\n");
+		goto fail;
+	}
+#endif
+
+	if (!SetThreadpoolThreadMinimum(pool, 4))
+		goto fail;
+
+	if (!(cancel.release = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto fail;
+
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+	blocking = CreateThreadpoolWork(test_BlockingCallback, &cancel, &environment);
+	cancelled = CreateThreadpoolWork(test_CancelledCallback, &cancel, &environment);
+
+	if (!blocking || !cancelled)
+		goto fail;
+
+	/* keep every worker busy so nothing submitted afterwards can start */
+	for (index = 0; index < 4; index++)
+		SubmitThreadpoolWork(blocking);
+
+	while (InterlockedCompareExchange(&cancel.started, 0, 0) < 4)
+		Sleep(1);
+
+	for (index = 0; index < 1000; index++)
+		SubmitThreadpoolWork(cancelled);
+
+	/* returns without running anything, the queued callbacks are dropped */
+	WaitForThreadpoolWorkCallbacks(cancelled, TRUE);
+	SetEvent(cancel.release);
+	WaitForThreadpoolWorkCallbacks(blocking, FALSE);
+
+	if (cancel.ran != 0)
+	{
+		printf("%" PRId32 " cancelled callbacks ran\n", cancel.ran);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (cancel.release)
+		SetEvent(cancel.release);
+
+	if (blocking)
+	{
+		WaitForThreadpoolWorkCallbacks(blocking, FALSE);
+		CloseThreadpoolWork(blocking);
+	}
+
+	if (cancelled)
+		CloseThreadpoolWork(cancelled);
+
+	CloseThreadpool(pool);
+
+	if (cancel.release)
+		CloseHandle(cancel.release);
+
+	return rc;
+}
+
 int TestPoolWork(int argc, char* argv[])
 {
 
@@ -135,5 +298,11 @@ int TestPoolWork(int argc, char* argv[])
 	if (!test2())
 		return -1;
 
+	if (!test3())
+		return -1;
+
+	if (!test4())
+		return -1;
+
 	return 0;
 }
@@ -125,7 +125,6 @@ VOID winpr_CloseThreadpoolWork(PTP_WORK pwk)
 VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 {
 	PTP_POOL pool;
-	PTP_CALLBACK_INSTANCE callbackInstance;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 
@@ -137,14 +136,7 @@ VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 
 #endif
 	pool = pwk->CallbackEnvironment->Pool;
-	callbackInstance = (PTP_CALLBACK_INSTANCE)calloc(1, sizeof(TP_CALLBACK_INSTANCE));
-
-	if (callbackInstance)
-	{
-		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		Queue_Enqueue(pool->PendingQueue, callbackInstance);
-	}
+	ThreadpoolPostWork(pool, &pwk, 1);
 }
 
 BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
@@ -163,7 +155,6 @@ BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
 
 VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallbacks)
 {
-	HANDLE event;
 	PTP_POOL pool;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
@@ -176,10 +167,52 @@ VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallb
 
 #endif
 	pool = pwk->CallbackEnvironment->Pool;
-	event = CountdownEvent_WaitHandle(pool->WorkComplete);
 
-	if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)
-		WLog_ERR(TAG, "error waiting on work completion");
+	if (fCancelPendingCallbacks)
+		ThreadpoolCancelWork(pool, pwk);
+
+	ThreadpoolWaitWork(pool, pwk);
 }
 
 #endif /* WINPR_THREAD_POOL defined */
+
+VOID winpr_SubmitThreadpoolWorkBatch(PTP_WORK* works, size_t count)
+{
+	size_t index;
+#ifdef WINPR_THREAD_POOL
+	PTP_POOL pool;
+#ifdef _WIN32
+	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
+
+	if (!pSubmitThreadpoolWork)
+#endif
+	{
+		/* post runs of work objects sharing a pool in one go */
+		for (index = 0; index < count;)
+		{
+			size_t end = index + 1;
+			pool = works[index]->CallbackEnvironment->Pool;
+
+			while ((end < count) && (works[end]->CallbackEnvironment->Pool == pool))
+				end++;
+
+			ThreadpoolPostWork(pool, &works[index], end - index);
+			index = end;
+		}
+
+		return;
+	}
+#endif
+
+	for (index = 0; index < count; index++)
+		SubmitThreadpoolWork(works[index]);
+}
+
+VOID winpr_WaitForThreadpoolWorkBatchCallbacks(PTP_WORK* works, size_t count,
+                                               BOOL fCancelPendingCallbacks)
+{
+	size_t index;
+
+	for (index = 0; index < count; index++)
+		WaitForThreadpoolWorkCallbacks(works[index], fCancelPendingCallbacks);
+}
@@ -0,0 +1,140 @@
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+static BOOL test_wait(WINPR_WAIT_SET* set, DWORD timeout, DWORD expected, const char* what)
+{
+	const DWORD status = WaitForWaitSet(set, timeout);
+
+	if (status != expected)
+	{
+		printf("%s: WaitForWaitSet returned 0x%08" PRIx32 " instead of 0x%08" PRIx32 "\n", what,
+		       status, expected);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+int TestSynchWaitSet(int argc, char* argv[])
+{
+	int rc = -1;
+	size_t i;
+	HANDLE events[4] = { 0 };
+	HANDLE handles[3];
+	WINPR_WAIT_SET* set;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	set = CreateWaitSet();
+	if (!set)
+	{
+		printf("CreateWaitSet failure\n");
+		return -1;
+	}
+
+	for (i = 0; i < ARRAYSIZE(events); i++)
+	{
+		events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!events[i])
+		{
+			printf("CreateEvent failure\n");
+			goto fail;
+		}
+	}
+
+	if (WaitForWaitSet(set, 0) != WAIT_FAILED)
+	{
+		printf("WaitForWaitSet on an empty set unexpectedly succeeded\n");
+		goto fail;
+	}
+
+	handles[0] = events[0];
+	handles[1] = events[1];
+	handles[2] = events[1]; /* the same handle twice shares one registration */
+
+	if (!SetWaitSetHandles(set, ARRAYSIZE(handles), handles))
+	{
+		printf("SetWaitSetHandles failure\n");
+		goto fail;
+	}
+
+	if (!test_wait(set, 10, WAIT_TIMEOUT, "nothing signaled"))
+		goto fail;
+
+	SetEvent(events[1]);
+
+	for (i = 0; i < 3; i++)
+	{
+		if (!test_wait(set, INFINITE, WAIT_OBJECT_0 + 1, "manual reset event"))
+			goto fail;
+	}
+
+	/* the lowest signaled index wins */
+	SetEvent(events[0]);
+
+	if (!test_wait(set, 0, WAIT_OBJECT_0, "two signaled events"))
+		goto fail;
+
+	ResetEvent(events[0]);
+	ResetEvent(events[1]);
+
+	if (!AddWaitSetHandle(set, events[3]))
+	{
+		printf("AddWaitSetHandle failure\n");
+		goto fail;
+	}
+
+	SetEvent(events[3]);
+
+	if (!test_wait(set, INFINITE, WAIT_OBJECT_0 + 3, "added handle"))
+		goto fail;
+
+	ResetEvent(events[3]);
+
+	if (!test_wait(set, 10, WAIT_TIMEOUT, "added handle after reset"))
+		goto fail;
+
+	/* a new handle in place of a closed one must be picked up */
+	if (!RemoveWaitSetHandle(set, events[0]) || RemoveWaitSetHandle(set, events[0]))
+	{
+		printf("RemoveWaitSetHandle failure\n");
+		goto fail;
+	}
+
+	CloseHandle(events[0]);
+	events[0] = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (!events[0])
+	{
+		printf("CreateEvent failure\n");
+		goto fail;
+	}
+
+	handles[0] = events[2];
+	handles[1] = events[0];
+
+	if (!SetWaitSetHandles(set, 2, handles))
+	{
+		printf("SetWaitSetHandles failure\n");
+		goto fail;
+	}
+
+	if (!test_wait(set, 0, WAIT_OBJECT_0 + 1, "replaced handle"))
+		goto fail;
+
+	SetEvent(events[2]);
+
+	if (!test_wait(set, 0, WAIT_OBJECT_0, "replaced handle and old handle"))
+		goto fail;
+
+	rc = 0;
+fail:
+	for (i = 0; i < ARRAYSIZE(events); i++)
+	{
+		if (events[i])
+			CloseHandle(events[i]);
+	}
+
+	FreeWaitSet(set);
+	return rc;
+}
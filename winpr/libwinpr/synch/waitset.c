@@ -0,0 +1,457 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Synchronization Functions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#include "../log.h"
+#define TAG WINPR_TAG("synch.waitset")
+
+#if !defined(_WIN32) && defined(HAVE_SYS_EPOLL_H)
+#define WITH_WAIT_SET_EPOLL
+#endif
+
+#ifdef WITH_WAIT_SET_EPOLL
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "../handle/handle.h"
+
+/*
+ * The file descriptors of the handles stay registered with the epoll instance between
+ * waits. A registration is identified by the file descriptor together with the handle
+ * that added it, so a closed handle whose address and descriptor got reused is not
+ * mistaken for the old one.
+ */
+typedef struct
+{
+	int fd;
+	UINT32 events;
+	HANDLE owner;
+	UINT64 ownerId;
+	BOOL registered;
+	BOOL alwaysReady; /* regular files can not be added to epoll, but poll always signals them */
+	UINT32 revents;
+} WINPR_WAIT_SET_FD;
+
+typedef struct
+{
+	UINT64 id;
+	UINT32 events;
+	DWORD fdIndex;
+} WINPR_WAIT_SET_ENTRY;
+#endif
+
+struct winpr_wait_set
+{
+	DWORD count;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+#ifdef WITH_WAIT_SET_EPOLL
+	int epfd;
+	BOOL retry; /* a registration failed, the next update must not be skipped */
+	WINPR_WAIT_SET_ENTRY entries[MAXIMUM_WAIT_OBJECTS];
+	DWORD fdCount;
+	WINPR_WAIT_SET_FD fds[MAXIMUM_WAIT_OBJECTS];
+#endif
+};
+
+#ifdef WITH_WAIT_SET_EPOLL
+static UINT32 handle_mode_to_epoll_events(ULONG mode)
+{
+	UINT32 events = 0;
+
+	if (mode & WINPR_FD_READ)
+		events |= EPOLLIN;
+
+	if (mode & WINPR_FD_WRITE)
+		events |= EPOLLOUT;
+
+	return events;
+}
+
+static BOOL wait_set_fd_equal(const WINPR_WAIT_SET_FD* a, const WINPR_WAIT_SET_FD* b)
+{
+	return (a->fd == b->fd) && (a->events == b->events) && (a->owner == b->owner) &&
+	       (a->ownerId == b->ownerId);
+}
+
+static BOOL wait_set_register(WINPR_WAIT_SET* set, WINPR_WAIT_SET_FD* cur)
+{
+	struct epoll_event event = { 0 };
+
+	event.events = cur->events;
+	event.data.fd = cur->fd;
+
+	if (epoll_ctl(set->epfd, EPOLL_CTL_ADD, cur->fd, &event) == 0)
+	{
+		cur->registered = TRUE;
+		return TRUE;
+	}
+
+	switch (errno)
+	{
+		case EEXIST:
+			/* still registered from a handle that was closed while its descriptor was
+			 * duplicated elsewhere */
+			if (epoll_ctl(set->epfd, EPOLL_CTL_MOD, cur->fd, &event) != 0)
+				break;
+
+			cur->registered = TRUE;
+			return TRUE;
+
+		case EPERM:
+			cur->alwaysReady = TRUE;
+			return TRUE;
+
+		default:
+			break;
+	}
+
+	WLog_ERR(TAG, "epoll_ctl(%d) failed with [%d] %s", cur->fd, errno, strerror(errno));
+	return FALSE;
+}
+
+/* Loops set the same handles before every wait, that must only cost a compare */
+static BOOL wait_set_unchanged(const WINPR_WAIT_SET* set, DWORD nCount, const HANDLE* lpHandles)
+{
+	DWORD index;
+
+	if (set->retry || (nCount != set->count))
+		return FALSE;
+
+	for (index = 0; index < nCount; index++)
+	{
+		ULONG Type;
+		WINPR_HANDLE* Object;
+
+		if (set->handles[index] != lpHandles[index])
+			return FALSE;
+
+		if (!winpr_Handle_GetInfo(lpHandles[index], &Type, &Object) ||
+		    (Object->Id != set->entries[index].id))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL wait_set_update(WINPR_WAIT_SET* set, DWORD nCount, const HANDLE* lpHandles)
+{
+	DWORD index;
+	DWORD fdIndex;
+	DWORD fdCount = 0;
+	BOOL rc = TRUE;
+	WINPR_WAIT_SET_ENTRY entries[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	WINPR_WAIT_SET_FD fds[MAXIMUM_WAIT_OBJECTS] = { 0 };
+
+	if (wait_set_unchanged(set, nCount, lpHandles))
+		return TRUE;
+
+	/* resolve all handles before the epoll set is touched */
+	for (index = 0; index < nCount; index++)
+	{
+		ULONG Type;
+		WINPR_HANDLE* Object;
+		WINPR_WAIT_SET_ENTRY* entry = &entries[index];
+		int fd;
+
+		if (!winpr_Handle_GetInfo(lpHandles[index], &Type, &Object))
+		{
+			WLog_ERR(TAG, "invalid handle at %" PRIu32, index);
+			SetLastError(ERROR_INVALID_HANDLE);
+			return FALSE;
+		}
+
+		fd = winpr_Handle_getFd(Object);
+		if (fd == -1)
+		{
+			WLog_ERR(TAG, "invalid file descriptor at %" PRIu32, index);
+			SetLastError(ERROR_INVALID_HANDLE);
+			return FALSE;
+		}
+
+		entry->id = Object->Id;
+		entry->events = handle_mode_to_epoll_events(Object->Mode);
+
+		for (fdIndex = 0; fdIndex < fdCount; fdIndex++)
+		{
+			if (fds[fdIndex].fd == fd)
+				break;
+		}
+
+		if (fdIndex == fdCount)
+		{
+			fds[fdIndex].fd = fd;
+			fds[fdIndex].owner = lpHandles[index];
+			fds[fdIndex].ownerId = Object->Id;
+			fdCount++;
+		}
+
+		fds[fdIndex].events |= entry->events;
+		entry->fdIndex = fdIndex;
+	}
+
+	/* keep the registrations that did not change, drop the others */
+	for (fdIndex = 0; fdIndex < set->fdCount; fdIndex++)
+	{
+		DWORD x;
+		const WINPR_WAIT_SET_FD* old = &set->fds[fdIndex];
+		BOOL keep = FALSE;
+
+		if (!old->registered && !old->alwaysReady)
+			continue;
+
+		for (x = 0; x < fdCount; x++)
+		{
+			if (wait_set_fd_equal(old, &fds[x]))
+			{
+				fds[x].registered = old->registered;
+				fds[x].alwaysReady = old->alwaysReady;
+				keep = TRUE;
+				break;
+			}
+		}
+
+		/* the descriptor might be closed already, which removed it from the set */
+		if (!keep && old->registered)
+			epoll_ctl(set->epfd, EPOLL_CTL_DEL, old->fd, NULL);
+	}
+
+	for (fdIndex = 0; fdIndex < fdCount; fdIndex++)
+	{
+		WINPR_WAIT_SET_FD* cur = &fds[fdIndex];
+
+		if (cur->registered || cur->alwaysReady)
+			continue;
+
+		/* failed registrations are retried by the next update */
+		if (!wait_set_register(set, cur))
+		{
+			SetLastError(ERROR_INTERNAL_ERROR);
+			rc = FALSE;
+		}
+	}
+
+	if (nCount)
+		memmove(set->handles, lpHandles, nCount * sizeof(HANDLE));
+
+	memcpy(set->entries, entries, sizeof(entries));
+	memcpy(set->fds, fds, sizeof(fds));
+	set->fdCount = fdCount;
+	set->count = nCount;
+	set->retry = !rc;
+	return rc;
+}
+
+static DWORD wait_set_wait(WINPR_WAIT_SET* set, DWORD dwMilliseconds)
+{
+	DWORD index;
+	UINT64 now = GetTickCount64();
+	UINT64 dueTime = 0xFFFFFFFFFFFFFFFF;
+	struct epoll_event events[MAXIMUM_WAIT_OBJECTS];
+
+	if (dwMilliseconds != INFINITE)
+		dueTime = now + dwMilliseconds;
+
+	do
+	{
+		int i;
+		int status;
+		int timeout = -1;
+		BOOL alwaysReady = FALSE;
+
+		for (index = 0; index < set->fdCount; index++)
+		{
+			set->fds[index].revents = 0;
+
+			if (set->fds[index].alwaysReady)
+			{
+				set->fds[index].revents = set->fds[index].events;
+				alwaysReady = TRUE;
+			}
+		}
+
+		if (alwaysReady)
+			timeout = 0;
+		else if (dwMilliseconds != INFINITE)
+			timeout = (dueTime - now > INT_MAX) ? INT_MAX : (int)(dueTime - now);
+
+		status = epoll_wait(set->epfd, events, (int)set->fdCount, timeout);
+		if (status < 0)
+		{
+			if (errno == EINTR)
+			{
+				now = GetTickCount64();
+				continue;
+			}
+
+			WLog_ERR(TAG, "epoll_wait() failure [%d] %s", errno, strerror(errno));
+			SetLastError(ERROR_INTERNAL_ERROR);
+			return WAIT_FAILED;
+		}
+
+		for (i = 0; i < status; i++)
+		{
+			for (index = 0; index < set->fdCount; index++)
+			{
+				if (set->fds[index].fd == events[i].data.fd)
+				{
+					set->fds[index].revents |= events[i].events;
+					break;
+				}
+			}
+		}
+
+		/* like WaitForMultipleObjects the lowest signaled index wins */
+		for (index = 0; index < set->count; index++)
+		{
+			const WINPR_WAIT_SET_ENTRY* entry = &set->entries[index];
+
+			if (set->fds[entry->fdIndex].revents & entry->events)
+			{
+				DWORD rc = winpr_Handle_cleanup(set->handles[index]);
+				if (rc != WAIT_OBJECT_0)
+				{
+					WLog_ERR(TAG, "error in cleanup function for handle at index=%" PRIu32,
+					         index);
+					return rc;
+				}
+
+				return WAIT_OBJECT_0 + index;
+			}
+		}
+
+		now = GetTickCount64();
+	} while (now < dueTime);
+
+	return WAIT_TIMEOUT;
+}
+#endif
+
+WINPR_WAIT_SET* CreateWaitSet(void)
+{
+	WINPR_WAIT_SET* set = (WINPR_WAIT_SET*)calloc(1, sizeof(WINPR_WAIT_SET));
+
+	if (!set)
+		return NULL;
+
+#ifdef WITH_WAIT_SET_EPOLL
+	set->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (set->epfd < 0)
+	{
+		WLog_ERR(TAG, "epoll_create1() failure [%d] %s", errno, strerror(errno));
+		free(set);
+		return NULL;
+	}
+#endif
+
+	return set;
+}
+
+void FreeWaitSet(WINPR_WAIT_SET* set)
+{
+	if (!set)
+		return;
+
+#ifdef WITH_WAIT_SET_EPOLL
+	close(set->epfd);
+#endif
+	free(set);
+}
+
+BOOL SetWaitSetHandles(WINPR_WAIT_SET* set, DWORD nCount, const HANDLE* lpHandles)
+{
+	if (!set || (nCount > MAXIMUM_WAIT_OBJECTS) || (nCount && !lpHandles))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+#ifdef WITH_WAIT_SET_EPOLL
+	return wait_set_update(set, nCount, lpHandles);
+#else
+	if (nCount)
+		memmove(set->handles, lpHandles, nCount * sizeof(HANDLE));
+
+	set->count = nCount;
+	return TRUE;
+#endif
+}
+
+BOOL AddWaitSetHandle(WINPR_WAIT_SET* set, HANDLE hHandle)
+{
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+
+	if (!set || (set->count >= MAXIMUM_WAIT_OBJECTS))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	memcpy(handles, set->handles, set->count * sizeof(HANDLE));
+	handles[set->count] = hHandle;
+	return SetWaitSetHandles(set, set->count + 1, handles);
+}
+
+BOOL RemoveWaitSetHandle(WINPR_WAIT_SET* set, HANDLE hHandle)
+{
+	DWORD index;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+
+	if (!set)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	for (index = 0; index < set->count; index++)
+	{
+		if (set->handles[index] == hHandle)
+			break;
+	}
+
+	if (index == set->count)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	memcpy(handles, set->handles, index * sizeof(HANDLE));
+	memcpy(&handles[index], &set->handles[index + 1], (set->count - index - 1) * sizeof(HANDLE));
+	return SetWaitSetHandles(set, set->count - 1, handles);
+}
+
+DWORD WaitForWaitSet(WINPR_WAIT_SET* set, DWORD dwMilliseconds)
+{
+	if (!set || !set->count)
+	{
+		WLog_ERR(TAG, "empty wait set");
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+#ifdef WITH_WAIT_SET_EPOLL
+	return wait_set_wait(set, dwMilliseconds);
+#else
+	return WaitForMultipleObjects(set->count, set->handles, FALSE, dwMilliseconds);
+#endif
+}
@@ -22,9 +22,16 @@
 #include <winpr/crt.h>
 #include <winpr/sysinfo.h>
 #include <winpr/assert.h>
+#include <winpr/interlocked.h>
 
 #include <winpr/collections.h>
 
+typedef struct
+{
+	LONG volatile sequence;
+	wMessage message;
+} wMessageCell;
+
 struct s_wMessageQueue
 {
 	size_t head;
@@ -37,6 +44,15 @@ struct s_wMessageQueue
 	HANDLE event;
 
 	wObject object;
+
+	/* Ring of WMQ_FLAG_RING queues: a cell is free for the producer at position p when its
+	 * sequence is p, and holds a message for the consumer at position p when it is p + 1. */
+	DWORD flags;
+	wMessageCell* cells;
+	ULONG mask;
+	LONG volatile enqueuePos;
+	ULONG dequeuePos;
+	LONG volatile count;
 };
 
 /**
@@ -71,9 +87,122 @@ HANDLE MessageQueue_Event(wMessageQueue* queue)
 size_t MessageQueue_Size(wMessageQueue* queue)
 {
 	WINPR_ASSERT(queue);
+
+	if (queue->flags & WMQ_FLAG_RING)
+	{
+		const LONG count = queue->count;
+		return (count > 0) ? (size_t)count : 0;
+	}
+
 	return queue->size;
 }
 
+static LONG MessageQueue_Load(LONG volatile* value)
+{
+	return InterlockedExchangeAdd(value, 0);
+}
+
+/**
+ * The event is only touched when the ring turns from empty to non-empty and back, the
+ * count may be off by the messages being published right now.
+ */
+static void MessageQueue_RingSignal(wMessageQueue* queue, LONG count)
+{
+	const LONG old = InterlockedExchangeAdd(&queue->count, count);
+
+	if ((old <= 0) && (old + count > 0))
+		SetEvent(queue->event);
+}
+
+static void MessageQueue_RingUnsignal(wMessageQueue* queue)
+{
+	if (InterlockedDecrement(&queue->count) != 0)
+		return;
+
+	ResetEvent(queue->event);
+
+	/* a producer may have signaled in between */
+	if (MessageQueue_Load(&queue->count) > 0)
+		SetEvent(queue->event);
+}
+
+static BOOL MessageQueue_RingPost(wMessageQueue* queue, const wMessage* messages, size_t count)
+{
+	size_t x;
+	ULONG pos;
+	const UINT64 now = GetTickCount64();
+
+	if ((count == 0) || (count > queue->mask + 1ull) || queue->closed)
+		return FALSE;
+
+	/* reserve the cells, once the last one is free all before it are free as well */
+	for (;;)
+	{
+		LONG diff;
+		const wMessageCell* last;
+
+		if (queue->flags & WMQ_FLAG_SINGLE_PRODUCER)
+			pos = (ULONG)queue->enqueuePos;
+		else
+			pos = (ULONG)MessageQueue_Load(&queue->enqueuePos);
+
+		last = &queue->cells[(pos + count - 1) & queue->mask];
+		diff = (LONG)((ULONG)MessageQueue_Load((LONG volatile*)&last->sequence) -
+		              (ULONG)(pos + count - 1));
+
+		if (diff < 0)
+			return FALSE; /* full */
+
+		if (diff > 0)
+			continue; /* taken by another producer */
+
+		if (queue->flags & WMQ_FLAG_SINGLE_PRODUCER)
+		{
+			queue->enqueuePos = (LONG)(pos + count);
+			break;
+		}
+
+		if ((ULONG)InterlockedCompareExchange(&queue->enqueuePos, (LONG)(pos + count),
+		                                      (LONG)pos) == pos)
+			break;
+	}
+
+	for (x = 0; x < count; x++)
+	{
+		wMessageCell* cell = &queue->cells[(pos + x) & queue->mask];
+
+		cell->message = messages[x];
+		cell->message.time = now;
+		InterlockedExchange(&cell->sequence, (LONG)(pos + x + 1));
+
+		if (messages[x].id == WMQ_QUIT)
+			queue->closed = TRUE;
+	}
+
+	MessageQueue_RingSignal(queue, (LONG)count);
+	return TRUE;
+}
+
+static BOOL MessageQueue_RingTake(wMessageQueue* queue, wMessage* message, BOOL remove)
+{
+	const ULONG pos = queue->dequeuePos;
+	wMessageCell* cell = &queue->cells[pos & queue->mask];
+
+	if ((ULONG)MessageQueue_Load(&cell->sequence) != pos + 1)
+		return FALSE;
+
+	*message = cell->message;
+
+	if (remove)
+	{
+		InterlockedExchange(&cell->sequence, (LONG)(pos + queue->mask + 1));
+		queue->dequeuePos = pos + 1;
+		MessageQueue_RingUnsignal(queue);
+	}
+
+	return TRUE;
+}
+
 /**
  * Methods
  */
@@ -109,8 +238,8 @@ static BOOL MessageQueue_EnsureCapacity(wMessageQueue* queue, size_t count)
 		queue->capacity = new_capacity;
 		ZeroMemory(&(queue->array[old_capacity]), (new_capacity - old_capacity) * sizeof(wMessage));
 
-		/* rearrange wrapped entries */
-		if (queue->tail <= queue->head)
+		/* rearrange wrapped entries, an empty queue has none */
+		if ((queue->size > 0) && (queue->tail <= queue->head))
 		{
 			CopyMemory(&(queue->array[old_capacity]), queue->array, queue->tail * sizeof(wMessage));
 			queue->tail += old_capacity;
@@ -130,6 +259,10 @@ BOOL MessageQueue_Dispatch(wMessageQueue* queue, const wMessage* message)
 		return FALSE;
 
 	WINPR_ASSERT(queue);
+
+	if (queue->flags & WMQ_FLAG_RING)
+		return MessageQueue_RingPost(queue, message, 1);
+
 	EnterCriticalSection(&queue->lock);
 
 	if (queue->closed)
@@ -145,7 +278,8 @@ BOOL MessageQueue_Dispatch(wMessageQueue* queue, const wMessage* message)
 	queue->tail = (queue->tail + 1) % queue->capacity;
 	queue->size++;
 
-	if (queue->size > 0)
+	/* the event stays set until the queue is empty again */
+	if (queue->size == 1)
 		SetEvent(queue->event);
 
 	if (message->id == WMQ_QUIT)
@@ -175,10 +309,66 @@ BOOL MessageQueue_PostQuit(wMessageQueue* queue, int nExitCode)
 	return MessageQueue_Post(queue, NULL, WMQ_QUIT, (void*)(size_t)nExitCode, NULL);
 }
 
+BOOL MessageQueue_PostMany(wMessageQueue* queue, const wMessage* messages, size_t count)
+{
+	size_t x;
+	UINT64 now;
+	BOOL ret = FALSE;
+
+	WINPR_ASSERT(queue);
+
+	if (!messages)
+		return FALSE;
+
+	if (queue->flags & WMQ_FLAG_RING)
+		return MessageQueue_RingPost(queue, messages, count);
+
+	now = GetTickCount64();
+	EnterCriticalSection(&queue->lock);
+
+	if (queue->closed)
+		goto out;
+
+	if (!MessageQueue_EnsureCapacity(queue, count))
+		goto out;
+
+	for (x = 0; x < count; x++)
+	{
+		wMessage* dst = &(queue->array[queue->tail]);
+
+		*dst = messages[x];
+		dst->time = now;
+		queue->tail = (queue->tail + 1) % queue->capacity;
+		queue->size++;
+
+		if (messages[x].id == WMQ_QUIT)
+			queue->closed = TRUE;
+	}
+
+	if ((queue->size > 0) && (queue->size == count))
+		SetEvent(queue->event);
+
+	ret = TRUE;
+out:
+	LeaveCriticalSection(&queue->lock);
+	return ret;
+}
+
 int MessageQueue_Get(wMessageQueue* queue, wMessage* message)
 {
 	int status = -1;
 
+	if (queue->flags & WMQ_FLAG_RING)
+	{
+		while (!MessageQueue_RingTake(queue, message, TRUE))
+		{
+			if (!MessageQueue_Wait(queue))
+				return status;
+		}
+
+		return (message->id != WMQ_QUIT) ? 1 : 0;
+	}
+
 	if (!MessageQueue_Wait(queue))
 		return status;
 
@@ -207,6 +397,10 @@ int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove)
 	int status = 0;
 
 	WINPR_ASSERT(queue);
+
+	if (queue->flags & WMQ_FLAG_RING)
+		return MessageQueue_RingTake(queue, message, remove) ? 1 : 0;
+
 	EnterCriticalSection(&queue->lock);
 
 	if (queue->size > 0)
@@ -230,11 +424,70 @@ int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove)
 	return status;
 }
 
+size_t MessageQueue_GetMany(wMessageQueue* queue, wMessage* messages, size_t count)
+{
+	size_t x = 0;
+
+	WINPR_ASSERT(queue);
+
+	if (!messages || (count == 0))
+		return 0;
+
+	if (queue->flags & WMQ_FLAG_RING)
+	{
+		while (x < count)
+		{
+			if (!MessageQueue_RingTake(queue, &messages[x], TRUE))
+			{
+				if (x > 0)
+					break;
+
+				if (!MessageQueue_Wait(queue))
+					return 0;
+
+				continue;
+			}
+
+			if (messages[x++].id == WMQ_QUIT)
+				break;
+		}
+
+		return x;
+	}
+
+	if (!MessageQueue_Wait(queue))
+		return 0;
+
+	EnterCriticalSection(&queue->lock);
+
+	while ((x < count) && (queue->size > 0))
+	{
+		messages[x] = queue->array[queue->head];
+		ZeroMemory(&(queue->array[queue->head]), sizeof(wMessage));
+		queue->head = (queue->head + 1) % queue->capacity;
+		queue->size--;
+
+		if (messages[x++].id == WMQ_QUIT)
+			break;
+	}
+
+	if (queue->size < 1)
+		ResetEvent(queue->event);
+
+	LeaveCriticalSection(&queue->lock);
+	return x;
+}
+
 /**
  * Construction, Destruction
  */
 
 wMessageQueue* MessageQueue_New(const wObject* callback)
+{
+	return MessageQueue_NewEx(callback, 0, 0);
+}
+
+wMessageQueue* MessageQueue_NewEx(const wObject* callback, DWORD flags, size_t capacity)
 {
 	wMessageQueue* queue = NULL;
 
@@ -242,10 +495,32 @@ wMessageQueue* MessageQueue_New(const wObject* callback)
 	if (!queue)
 		return NULL;
 
+	queue->flags = flags;
+
 	if (!InitializeCriticalSectionAndSpinCount(&queue->lock, 4000))
 		goto fail;
 
-	if (!MessageQueue_EnsureCapacity(queue, 32))
+	if (flags & WMQ_FLAG_RING)
+	{
+		ULONG x;
+		ULONG size = 2;
+
+		if (capacity > (1ul << 30))
+			goto fail;
+
+		while (size < capacity)
+			size <<= 1;
+
+		queue->cells = (wMessageCell*)calloc(size, sizeof(wMessageCell));
+		if (!queue->cells)
+			goto fail;
+
+		for (x = 0; x < size; x++)
+			queue->cells[x].sequence = (LONG)x;
+
+		queue->mask = size - 1;
+	}
+	else if (!MessageQueue_EnsureCapacity(queue, 32))
 		goto fail;
 
 	queue->event = CreateEvent(NULL, TRUE, FALSE, NULL);
@@ -273,6 +548,7 @@ void MessageQueue_Free(wMessageQueue* queue)
 	CloseHandle(queue->event);
 	DeleteCriticalSection(&queue->lock);
 
+	free(queue->cells);
 	free(queue->array);
 	free(queue);
 }
@@ -284,6 +560,22 @@ int MessageQueue_Clear(wMessageQueue* queue)
 	WINPR_ASSERT(queue);
 	WINPR_ASSERT(queue->event);
 
+	if (queue->flags & WMQ_FLAG_RING)
+	{
+		wMessage msg;
+
+		while (MessageQueue_RingTake(queue, &msg, TRUE))
+		{
+			if (queue->object.fnObjectUninit)
+				queue->object.fnObjectUninit(&msg);
+			if (queue->object.fnObjectFree)
+				queue->object.fnObjectFree(&msg);
+		}
+
+		queue->closed = FALSE;
+		return status;
+	}
+
 	EnterCriticalSection(&queue->lock);
 
 	while (queue->size > 0)
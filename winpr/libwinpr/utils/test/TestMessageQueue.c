@@ -1,6 +1,7 @@
 
 #include <winpr/crt.h>
 #include <winpr/thread.h>
+#include <winpr/interlocked.h>
 #include <winpr/collections.h>
 
 static DWORD WINAPI message_queue_consumer_thread(LPVOID arg)
@@ -24,6 +25,175 @@ static DWORD WINAPI message_queue_consumer_thread(LPVOID arg)
 	return 0;
 }
 
+#define TEST_PRODUCERS 4
+#define TEST_MESSAGES 20000
+
+static DWORD WINAPI message_queue_producer_thread(LPVOID arg)
+{
+	size_t x;
+	wMessageQueue* queue = (wMessageQueue*)arg;
+	static LONG producers = 0;
+	const size_t producer = (size_t)InterlockedIncrement(&producers);
+
+	for (x = 0; x < TEST_MESSAGES;)
+	{
+		size_t y;
+		wMessage messages[3] = { 0 };
+		size_t count = ARRAYSIZE(messages);
+
+		if (count > TEST_MESSAGES - x)
+			count = TEST_MESSAGES - x;
+
+		for (y = 0; y < count; y++)
+		{
+			messages[y].id = 1;
+			messages[y].wParam = (void*)producer;
+			messages[y].lParam = (void*)(x + y);
+		}
+
+		/* the ring is bounded, posts fail while it is full */
+		if ((x % 2) == 0)
+		{
+			if (MessageQueue_PostMany(queue, messages, count))
+				x += count;
+			else
+				SwitchToThread();
+		}
+		else if (MessageQueue_Dispatch(queue, &messages[0]))
+			x++;
+		else
+			SwitchToThread();
+	}
+
+	return 0;
+}
+
+static BOOL test_ring(DWORD flags, size_t producers)
+{
+	size_t x;
+	size_t received = 0;
+	BOOL rc = FALSE;
+	HANDLE threads[TEST_PRODUCERS] = { 0 };
+	size_t next[TEST_PRODUCERS * 2 + 1] = { 0 };
+	wMessage messages[16];
+	wMessageQueue* queue = MessageQueue_NewEx(NULL, WMQ_FLAG_RING | flags, 60);
+
+	if (!queue)
+		return FALSE;
+
+	/* capacity is rounded up to a power of two */
+	for (x = 0; x < 64; x++)
+	{
+		if (!MessageQueue_Post(queue, NULL, 1, NULL, NULL))
+			break;
+	}
+
+	if ((x != 64) || MessageQueue_Post(queue, NULL, 1, NULL, NULL) ||
+	    (MessageQueue_Size(queue) != 64))
+	{
+		printf("ring accepted %" PRIuz " messages\n", x);
+		goto fail;
+	}
+
+	MessageQueue_Clear(queue);
+
+	for (x = 0; x < producers; x++)
+	{
+		if (!(threads[x] =
+		          CreateThread(NULL, 0, message_queue_producer_thread, (void*)queue, 0, NULL)))
+			goto fail;
+	}
+
+	while (received < producers * TEST_MESSAGES)
+	{
+		size_t y;
+		const size_t count = MessageQueue_GetMany(queue, messages, ARRAYSIZE(messages));
+
+		if (count == 0)
+			goto fail;
+
+		for (y = 0; y < count; y++)
+		{
+			const size_t producer = (size_t)messages[y].wParam;
+
+			/* messages of one producer arrive in order */
+			if ((producer >= ARRAYSIZE(next)) || ((size_t)messages[y].lParam != next[producer]))
+			{
+				printf("unexpected message %" PRIuz " of producer %" PRIuz "\n",
+				       (size_t)messages[y].lParam, producer);
+				goto fail;
+			}
+
+			next[producer]++;
+		}
+
+		received += count;
+	}
+
+	if (!MessageQueue_PostQuit(queue, 0) || MessageQueue_Post(queue, NULL, 1, NULL, NULL) ||
+	    (MessageQueue_GetMany(queue, messages, ARRAYSIZE(messages)) != 1) ||
+	    (messages[0].id != WMQ_QUIT) || (MessageQueue_Size(queue) != 0))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	for (x = 0; x < producers; x++)
+	{
+		if (threads[x])
+		{
+			WaitForSingleObject(threads[x], INFINITE);
+			CloseHandle(threads[x]);
+		}
+	}
+
+	if (!rc)
+		printf("ring test with flags 0x%08" PRIx32 " failed\n", flags);
+
+	MessageQueue_Free(queue);
+	return rc;
+}
+
+static BOOL test_post_many(void)
+{
+	size_t x;
+	BOOL rc = FALSE;
+	wMessage messages[100] = { 0 };
+	wMessageQueue* queue = MessageQueue_New(NULL);
+
+	if (!queue)
+		return FALSE;
+
+	for (x = 0; x < ARRAYSIZE(messages); x++)
+		messages[x].id = (UINT32)x + 1;
+
+	messages[50].id = WMQ_QUIT;
+
+	if (!MessageQueue_PostMany(queue, messages, ARRAYSIZE(messages)) ||
+	    (MessageQueue_Size(queue) != ARRAYSIZE(messages)))
+		goto fail;
+
+	ZeroMemory(messages, sizeof(messages));
+
+	/* stops after the quit message */
+	if ((MessageQueue_GetMany(queue, messages, 10) != 10) || (messages[9].id != 10) ||
+	    (MessageQueue_GetMany(queue, messages, ARRAYSIZE(messages)) != 41) ||
+	    (messages[40].id != WMQ_QUIT) ||
+	    (MessageQueue_GetMany(queue, messages, ARRAYSIZE(messages)) != 49) ||
+	    (messages[0].id != 52) || (MessageQueue_Size(queue) != 0))
+		goto fail;
+
+	if (MessageQueue_PostMany(queue, messages, 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	if (!rc)
+		printf("MessageQueue_PostMany test failed\n");
+
+	MessageQueue_Free(queue);
+	return rc;
+}
+
 int TestMessageQueue(int argc, char* argv[])
 {
 	HANDLE thread;
@@ -54,5 +224,11 @@ int TestMessageQueue(int argc, char* argv[])
 	MessageQueue_Free(queue);
 	CloseHandle(thread);
 
+	if (!test_post_many())
+		return -1;
+
+	if (!test_ring(WMQ_FLAG_SINGLE_PRODUCER, 1) || !test_ring(0, TEST_PRODUCERS))
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,175 @@
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/wlog.h>
+
+#define TEST_THREADS 4
+#define TEST_MESSAGES 5000
+
+static BOOL success = TRUE;
+static DWORD mainThreadId = 0;
+static UINT32 next[TEST_THREADS] = { 0 };
+static size_t received = 0;
+static size_t others = 0;
+static size_t errors = 0;
+static size_t warnings = 0;
+static HANDLE gate = NULL;
+
+static BOOL CallbackAppenderMessage(const wLogMessage* msg)
+{
+	UINT32 thread = 0;
+	UINT32 index = 0;
+
+	if (GetCurrentThreadId() == mainThreadId)
+	{
+		fprintf(stderr, "message written on the logging thread\n");
+		success = FALSE;
+	}
+
+	if (gate)
+		WaitForSingleObject(gate, INFINITE);
+
+	if (msg->Level == WLOG_ERROR)
+		errors++;
+	else if (msg->Level == WLOG_WARN)
+		warnings++;
+	else if (sscanf(msg->TextString, "thread %" PRIu32 " message %" PRIu32, &thread, &index) == 2)
+	{
+		/* messages of one thread are written in order */
+		if ((thread >= TEST_THREADS) || (next[thread] != index))
+		{
+			fprintf(stderr, "unexpected message '%s'\n", msg->TextString);
+			success = FALSE;
+		}
+		else
+			next[thread]++;
+
+		received++;
+	}
+	else
+		others++;
+
+	return TRUE;
+}
+
+static DWORD WINAPI test_thread(LPVOID arg)
+{
+	UINT32 x;
+	const UINT32 thread = (UINT32)(size_t)arg;
+	wLog* log = WLog_Get("com.test.async");
+
+	for (x = 0; x < TEST_MESSAGES; x++)
+		WLog_Print(log, WLOG_INFO, "thread %" PRIu32 " message %" PRIu32, thread, x);
+
+	return 0;
+}
+
+static BOOL test_block(wLog* root)
+{
+	size_t x;
+	HANDLE threads[TEST_THREADS] = { 0 };
+
+	if (!WLog_SetAsync(root, WLOG_ASYNC_BLOCK, 64))
+		return FALSE;
+
+	for (x = 0; x < TEST_THREADS; x++)
+	{
+		if (!(threads[x] = CreateThread(NULL, 0, test_thread, (void*)x, 0, NULL)))
+			return FALSE;
+	}
+
+	for (x = 0; x < TEST_THREADS; x++)
+	{
+		WaitForSingleObject(threads[x], INFINITE);
+		CloseHandle(threads[x]);
+	}
+
+	if (!WLog_Flush(root))
+		return FALSE;
+
+	if ((received != TEST_THREADS * TEST_MESSAGES) || (WLog_GetDroppedMessageCount(root) != 0))
+	{
+		fprintf(stderr, "%" PRIuz " messages written\n", received);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_drop(wLog* root)
+{
+	UINT32 x;
+	size_t dropped;
+	BOOL rc = FALSE;
+	wLog* log = WLog_Get("com.test.async");
+
+	if (!(gate = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	if (!WLog_SetAsync(root, WLOG_ASYNC_DROP, 2))
+		goto fail;
+
+	/* the writer is stuck in the callback, the queue fills up */
+	for (x = 0; x < 100; x++)
+		WLog_Print(log, WLOG_INFO, "message %" PRIu32, x);
+
+	dropped = WLog_GetDroppedMessageCount(root);
+
+	if (dropped == 0)
+	{
+		fprintf(stderr, "no messages dropped\n");
+		goto fail;
+	}
+
+	SetEvent(gate);
+
+	/* errors are not dropped */
+	WLog_Print(log, WLOG_ERROR, "an error");
+
+	if (!WLog_Flush(root))
+		goto fail;
+
+	if ((others + dropped != 100) || (errors != 1) || (warnings != 1))
+	{
+		fprintf(stderr, "%" PRIuz " messages written, %" PRIuz " dropped\n", others, dropped);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	WLog_SetAsync(root, WLOG_ASYNC_OFF, 0);
+	CloseHandle(gate);
+	gate = NULL;
+	return rc;
+}
+
+int TestWLogAsync(int argc, char* argv[])
+{
+	wLog* root;
+	wLogCallbacks callbacks = { 0 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	mainThreadId = GetCurrentThreadId();
+	root = WLog_GetRoot();
+
+	if (!WLog_SetLogAppenderType(root, WLOG_APPENDER_CALLBACK))
+		return -1;
+
+	callbacks.message = CallbackAppenderMessage;
+
+	if (!WLog_ConfigureAppender(WLog_GetLogAppender(root), "callbacks", (void*)&callbacks))
+		return -1;
+
+	WLog_SetLogLevel(root, WLOG_INFO);
+
+	if (!WLog_OpenAppender(root))
+		return -1;
+
+	if (!test_block(root) || !test_drop(root))
+		success = FALSE;
+
+	WLog_CloseAppender(root);
+	return success ? 0 : -1;
+}
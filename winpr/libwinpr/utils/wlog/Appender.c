@@ -20,12 +20,17 @@
 #include <winpr/config.h>
 
 #include "Appender.h"
+#include "Async.h"
 
 void WLog_Appender_Free(wLog* log, wLogAppender* appender)
 {
 	if (!appender)
 		return;
 
+	/* writes out what is still queued */
+	WLog_Async_Free(appender->Async);
+	appender->Async = NULL;
+
 	if (appender->Layout)
 	{
 		WLog_Layout_Free(log, appender->Layout);
@@ -82,6 +87,9 @@ BOOL WLog_CloseAppender(wLog* log)
 	if (!appender->Close)
 		return TRUE;
 
+	if (appender->Async)
+		WLog_Async_Flush(appender->Async);
+
 	if (appender->active)
 	{
 		status = appender->Close(log, appender);
@@ -151,17 +159,74 @@ static wLogAppender* WLog_Appender_New(wLog* log, DWORD logAppenderType)
 
 BOOL WLog_SetLogAppenderType(wLog* log, DWORD logAppenderType)
 {
+	DWORD policy = WLOG_ASYNC_OFF;
+	size_t capacity = 0;
+
 	if (!log)
 		return FALSE;
 
 	if (log->Appender)
 	{
+		/* the new appender is written the same way */
+		if (log->Appender->Async)
+		{
+			policy = WLog_Async_GetPolicy(log->Appender->Async);
+			capacity = WLog_Async_GetCapacity(log->Appender->Async);
+		}
+
 		WLog_Appender_Free(log, log->Appender);
 		log->Appender = NULL;
 	}
 
 	log->Appender = WLog_Appender_New(log, logAppenderType);
-	return log->Appender != NULL;
+
+	if (!log->Appender)
+		return FALSE;
+
+	if (policy != WLOG_ASYNC_OFF)
+		return WLog_SetAsync(log, policy, capacity);
+
+	return TRUE;
+}
+
+BOOL WLog_SetAsync(wLog* log, DWORD policy, size_t capacity)
+{
+	wLogAppender* appender = WLog_GetLogAppender(log);
+
+	if (!appender)
+		return FALSE;
+
+	WLog_Async_Free(appender->Async);
+	appender->Async = NULL;
+
+	if (policy == WLOG_ASYNC_OFF)
+		return TRUE;
+
+	appender->Async = WLog_Async_New(log, appender, policy, capacity);
+	return appender->Async != NULL;
+}
+
+BOOL WLog_Flush(wLog* log)
+{
+	wLogAppender* appender = WLog_GetLogAppender(log);
+
+	if (!appender)
+		return FALSE;
+
+	if (!appender->Async)
+		return TRUE;
+
+	return WLog_Async_Flush(appender->Async);
+}
+
+size_t WLog_GetDroppedMessageCount(wLog* log)
+{
+	wLogAppender* appender = WLog_GetLogAppender(log);
+
+	if (!appender || !appender->Async)
+		return 0;
+
+	return WLog_Async_GetDropped(appender->Async);
 }
 
 BOOL WLog_ConfigureAppender(wLogAppender* appender, const char* setting, void* value)
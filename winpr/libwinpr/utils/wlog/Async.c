@@ -0,0 +1,432 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * WinPR Logger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
+
+#include "wlog.h"
+#include "Async.h"
+
+#define WLOG_ASYNC_RECORD 1
+#define WLOG_ASYNC_FLUSH 2
+
+/* messages taken from the queue at once */
+#define WLOG_ASYNC_BATCH 64
+
+/**
+ * Messages are copied into a single allocation together with everything they point to that
+ * does not outlive the call, and written by a thread owning the appender.
+ */
+
+struct s_wLogAsync
+{
+	wLog* log;
+	wLogAppender* appender;
+	DWORD policy;
+	size_t capacity;
+
+	wMessageQueue* queue;
+	HANDLE thread;
+	DWORD threadId;
+	BOOL volatile closing;
+
+	LONG volatile dropped;
+	LONG reported;
+};
+
+typedef struct
+{
+	wLog* log;
+	wLogMessage message;
+	wLogOrigin origin;
+} wLogAsyncRecord;
+
+static BYTE* WLog_Async_Copy(BYTE* dst, const void* src, size_t length, void** copy)
+{
+	if (!src || (length == 0))
+		return dst;
+
+	memcpy(dst, src, length);
+	*copy = dst;
+	return dst + length;
+}
+
+static wLogAsyncRecord* WLog_Async_NewRecord(wLog* log, const wLogMessage* message)
+{
+	BYTE* p;
+	void* copy = NULL;
+	size_t length = 0;
+	size_t textLength = 0;
+	size_t formatLength = 0;
+	wLogAsyncRecord* record;
+
+	switch (message->Type)
+	{
+		case WLOG_MESSAGE_TEXT:
+			if (message->TextString)
+				textLength = strlen(message->TextString) + 1;
+
+			if (message->FormatString && (message->FormatString != message->TextString))
+				formatLength = strlen(message->FormatString) + 1;
+
+			break;
+
+		case WLOG_MESSAGE_DATA:
+			length = message->Length;
+			break;
+
+		case WLOG_MESSAGE_IMAGE:
+			length = message->ImageWidth * message->ImageHeight * ((message->ImageBpp + 7) / 8);
+			break;
+
+		case WLOG_MESSAGE_PACKET:
+			length = message->PacketLength;
+			break;
+
+		default:
+			return NULL;
+	}
+
+	record = (wLogAsyncRecord*)malloc(sizeof(wLogAsyncRecord) + textLength + formatLength + length);
+
+	if (!record)
+		return NULL;
+
+	record->log = log;
+	record->message = *message;
+	record->message.PrefixString = NULL;
+	WLog_Layout_GetOrigin(&record->origin);
+	p = (BYTE*)&record[1];
+
+	switch (message->Type)
+	{
+		case WLOG_MESSAGE_TEXT:
+			p = WLog_Async_Copy(p, message->TextString, textLength, &copy);
+			record->message.TextString = (LPCSTR)copy;
+
+			if (message->FormatString == message->TextString)
+				record->message.FormatString = record->message.TextString;
+			else
+			{
+				copy = NULL;
+				WLog_Async_Copy(p, message->FormatString, formatLength, &copy);
+				record->message.FormatString = (LPCSTR)copy;
+			}
+
+			break;
+
+		case WLOG_MESSAGE_DATA:
+			WLog_Async_Copy(p, message->Data, length, &record->message.Data);
+			break;
+
+		case WLOG_MESSAGE_IMAGE:
+			WLog_Async_Copy(p, message->ImageData, length, &record->message.ImageData);
+			break;
+
+		case WLOG_MESSAGE_PACKET:
+			WLog_Async_Copy(p, message->PacketData, length, &record->message.PacketData);
+			break;
+
+		default:
+			break;
+	}
+
+	return record;
+}
+
+static void WLog_Async_WriteMessage(wLogAsync* async, wLog* log, wLogMessage* message)
+{
+	wLogAppender* appender = async->appender;
+
+	/* the appender logging by itself is caught by the posting side */
+	switch (message->Type)
+	{
+		case WLOG_MESSAGE_TEXT:
+			if (appender->WriteMessage)
+				appender->WriteMessage(log, appender, message);
+			break;
+
+		case WLOG_MESSAGE_DATA:
+			if (appender->WriteDataMessage)
+				appender->WriteDataMessage(log, appender, message);
+			break;
+
+		case WLOG_MESSAGE_IMAGE:
+			if (appender->WriteImageMessage)
+				appender->WriteImageMessage(log, appender, message);
+			break;
+
+		case WLOG_MESSAGE_PACKET:
+			if (appender->WritePacketMessage)
+				appender->WritePacketMessage(log, appender, message);
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void WLog_Async_WriteRecord(wLogAsync* async, wLogAsyncRecord* record)
+{
+	wLogAppender* appender = async->appender;
+
+	appender->Layout->Origin = &record->origin;
+	WLog_Async_WriteMessage(async, record->log, &record->message);
+	appender->Layout->Origin = NULL;
+}
+
+static void WLog_Async_ReportDropped(wLogAsync* async)
+{
+	LONG count;
+	wLogMessage message = { 0 };
+	char text[64] = { 0 };
+	const LONG dropped = async->dropped;
+
+	if (dropped == async->reported)
+		return;
+
+	count = dropped - async->reported;
+	async->reported = dropped;
+
+	_snprintf(text, sizeof(text) - 1, "%" PRId32 " log messages dropped", count);
+	message.Type = WLOG_MESSAGE_TEXT;
+	message.Level = WLOG_WARN;
+	message.FormatString = text;
+	message.TextString = text;
+	message.LineNumber = __LINE__;
+	message.FileName = __FILE__;
+	message.FunctionName = __FUNCTION__;
+	WLog_Async_WriteMessage(async, async->log, &message);
+}
+
+static DWORD WINAPI WLog_Async_Thread(LPVOID arg)
+{
+	BOOL running = TRUE;
+	wLogAsync* async = (wLogAsync*)arg;
+	wMessage messages[WLOG_ASYNC_BATCH];
+
+	WINPR_ASSERT(async);
+
+	while (running)
+	{
+		size_t x;
+		const size_t count = MessageQueue_GetMany(async->queue, messages, ARRAYSIZE(messages));
+
+		if (count == 0)
+			break;
+
+		EnterCriticalSection(&async->appender->lock);
+
+		for (x = 0; x < count; x++)
+		{
+			wMessage* message = &messages[x];
+
+			switch (message->id)
+			{
+				case WLOG_ASYNC_RECORD:
+					WLog_Async_WriteRecord(async, (wLogAsyncRecord*)message->wParam);
+					free(message->wParam);
+					break;
+
+				case WLOG_ASYNC_FLUSH:
+					WLog_Async_ReportDropped(async);
+					SetEvent((HANDLE)message->wParam);
+					break;
+
+				case WMQ_QUIT:
+					running = FALSE;
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		WLog_Async_ReportDropped(async);
+		LeaveCriticalSection(&async->appender->lock);
+	}
+
+	return 0;
+}
+
+static BOOL WLog_Async_Post(wLogAsync* async, const wMessage* message, BOOL block)
+{
+	/* whatever the writer logs itself could only ever wait for itself */
+	if (GetCurrentThreadId() == async->threadId)
+		return FALSE;
+
+	while (!MessageQueue_Dispatch(async->queue, message))
+	{
+		if (async->closing)
+			return FALSE;
+
+		if (!block)
+		{
+			InterlockedIncrement(&async->dropped);
+			return FALSE;
+		}
+
+		SwitchToThread();
+	}
+
+	return TRUE;
+}
+
+BOOL WLog_Async_Write(wLogAsync* async, wLog* log, const wLogMessage* message)
+{
+	wMessage msg = { 0 };
+	wLogAsyncRecord* record;
+
+	WINPR_ASSERT(async);
+	WINPR_ASSERT(message);
+
+	if (!(record = WLog_Async_NewRecord(log, message)))
+		return FALSE;
+
+	msg.id = WLOG_ASYNC_RECORD;
+	msg.wParam = record;
+
+	if (!WLog_Async_Post(async, &msg,
+	                     (async->policy != WLOG_ASYNC_DROP) || (message->Level >= WLOG_ERROR)))
+	{
+		free(record);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL WLog_Async_Flush(wLogAsync* async)
+{
+	BOOL rc = FALSE;
+	wMessage msg = { 0 };
+
+	WINPR_ASSERT(async);
+
+	if (GetCurrentThreadId() == async->threadId)
+		return TRUE;
+
+	msg.id = WLOG_ASYNC_FLUSH;
+	msg.wParam = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!msg.wParam)
+		return FALSE;
+
+	if (WLog_Async_Post(async, &msg, TRUE))
+		rc = WaitForSingleObject(msg.wParam, INFINITE) == WAIT_OBJECT_0;
+
+	CloseHandle(msg.wParam);
+	return rc;
+}
+
+DWORD WLog_Async_GetPolicy(wLogAsync* async)
+{
+	WINPR_ASSERT(async);
+	return async->policy;
+}
+
+size_t WLog_Async_GetCapacity(wLogAsync* async)
+{
+	WINPR_ASSERT(async);
+	return async->capacity;
+}
+
+size_t WLog_Async_GetDropped(wLogAsync* async)
+{
+	WINPR_ASSERT(async);
+	return (size_t)async->dropped;
+}
+
+static void WLog_Async_MessageFree(void* obj)
+{
+	wMessage* message = (wMessage*)obj;
+
+	/* only left over when the writer could not be started */
+	if (message->id == WLOG_ASYNC_RECORD)
+		free(message->wParam);
+	else if (message->id == WLOG_ASYNC_FLUSH)
+		SetEvent((HANDLE)message->wParam);
+}
+
+wLogAsync* WLog_Async_New(wLog* log, wLogAppender* appender, DWORD policy, size_t capacity)
+{
+	wObject callback = { 0 };
+	wLogAsync* async;
+
+	WINPR_ASSERT(appender);
+
+	if ((policy != WLOG_ASYNC_BLOCK) && (policy != WLOG_ASYNC_DROP))
+		return NULL;
+
+	async = (wLogAsync*)calloc(1, sizeof(wLogAsync));
+
+	if (!async)
+		return NULL;
+
+	if (capacity == 0)
+		capacity = WLOG_ASYNC_DEFAULT_CAPACITY;
+
+	async->log = log;
+	async->appender = appender;
+	async->policy = policy;
+	async->capacity = capacity;
+	callback.fnObjectFree = WLog_Async_MessageFree;
+	async->queue = MessageQueue_NewEx(&callback, WMQ_FLAG_RING, capacity);
+
+	if (!async->queue)
+		goto fail;
+
+	async->thread = CreateThread(NULL, 0, WLog_Async_Thread, async, 0, &async->threadId);
+
+	if (!async->thread)
+		goto fail;
+
+	return async;
+fail:
+	WLog_Async_Free(async);
+	return NULL;
+}
+
+void WLog_Async_Free(wLogAsync* async)
+{
+	if (!async)
+		return;
+
+	if (async->thread)
+	{
+		wMessage msg = { 0 };
+
+		/* everything queued before is written */
+		msg.id = WMQ_QUIT;
+		WLog_Async_Post(async, &msg, TRUE);
+		async->closing = TRUE;
+		WaitForSingleObject(async->thread, INFINITE);
+		CloseHandle(async->thread);
+	}
+
+	MessageQueue_Free(async->queue);
+	free(async);
+}
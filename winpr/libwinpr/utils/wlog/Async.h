@@ -0,0 +1,35 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * WinPR Logger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WINPR_WLOG_ASYNC_PRIVATE_H
+#define WINPR_WLOG_ASYNC_PRIVATE_H
+
+#include "wlog.h"
+
+#define WLOG_ASYNC_DEFAULT_CAPACITY 4096
+
+wLogAsync* WLog_Async_New(wLog* log, wLogAppender* appender, DWORD policy, size_t capacity);
+void WLog_Async_Free(wLogAsync* async);
+
+DWORD WLog_Async_GetPolicy(wLogAsync* async);
+size_t WLog_Async_GetCapacity(wLogAsync* async);
+size_t WLog_Async_GetDropped(wLogAsync* async);
+
+BOOL WLog_Async_Write(wLogAsync* async, wLog* log, const wLogMessage* message);
+BOOL WLog_Async_Flush(wLogAsync* async);
+
+#endif /* WINPR_WLOG_ASYNC_PRIVATE_H */
@@ -57,6 +57,19 @@ static void WLog_PrintMessagePrefix(wLog* log, wLogMessage* message, const char*
 	va_end(args);
 }
 
+void WLog_Layout_GetOrigin(wLogOrigin* origin)
+{
+	WINPR_ASSERT(origin);
+
+	GetLocalTime(&origin->Time);
+#if defined __linux__ && !defined ANDROID
+	/* On Linux we prefer to see the LWP id */
+	origin->ThreadId = (size_t)syscall(SYS_gettid);
+#else
+	origin->ThreadId = (size_t)GetCurrentThreadId();
+#endif
+}
+
 BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* message)
 {
 	char* p;
@@ -64,12 +77,22 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 	int argc = 0;
 	void* args[32] = { 0 };
 	char format[256] = { 0 };
-	SYSTEMTIME localTime;
+	wLogOrigin current;
+	const wLogOrigin* origin;
+	const SYSTEMTIME* localTime;
 
 	WINPR_ASSERT(layout);
 	WINPR_ASSERT(message);
 
-	GetLocalTime(&localTime);
+	origin = layout->Origin;
+
+	if (!origin)
+	{
+		WLog_Layout_GetOrigin(&current);
+		origin = &current;
+	}
+
+	localTime = &origin->Time;
 	index = 0;
 	p = (char*)layout->FormatString;
 
@@ -156,14 +179,12 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 't') && (p[1] == 'i') && (p[2] == 'd')) /* thread id */
 				{
+					args[argc++] = (void*)origin->ThreadId;
 #if defined __linux__ && !defined ANDROID
-					/* On Linux we prefer to see the LWP id */
-					args[argc++] = (void*)(size_t)syscall(SYS_gettid);
 					format[index++] = '%';
 					format[index++] = 'l';
 					format[index++] = 'd';
 #else
-					args[argc++] = (void*)(size_t)GetCurrentThreadId();
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '8';
@@ -173,14 +194,14 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 'y') && (p[1] == 'r')) /* year */
 				{
-					args[argc++] = (void*)(size_t)localTime.wYear;
+					args[argc++] = (void*)(size_t)localTime->wYear;
 					format[index++] = '%';
 					format[index++] = 'u';
 					p++;
 				}
 				else if ((p[0] == 'm') && (p[1] == 'o')) /* month */
 				{
-					args[argc++] = (void*)(size_t)localTime.wMonth;
+					args[argc++] = (void*)(size_t)localTime->wMonth;
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '2';
@@ -189,7 +210,7 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 'd') && (p[1] == 'w')) /* day of week */
 				{
-					args[argc++] = (void*)(size_t)localTime.wDayOfWeek;
+					args[argc++] = (void*)(size_t)localTime->wDayOfWeek;
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '2';
@@ -198,7 +219,7 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 'd') && (p[1] == 'y')) /* day */
 				{
-					args[argc++] = (void*)(size_t)localTime.wDay;
+					args[argc++] = (void*)(size_t)localTime->wDay;
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '2';
@@ -207,7 +228,7 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 'h') && (p[1] == 'r')) /* hours */
 				{
-					args[argc++] = (void*)(size_t)localTime.wHour;
+					args[argc++] = (void*)(size_t)localTime->wHour;
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '2';
@@ -216,7 +237,7 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 'm') && (p[1] == 'i')) /* minutes */
 				{
-					args[argc++] = (void*)(size_t)localTime.wMinute;
+					args[argc++] = (void*)(size_t)localTime->wMinute;
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '2';
@@ -225,7 +246,7 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 's') && (p[1] == 'e')) /* seconds */
 				{
-					args[argc++] = (void*)(size_t)localTime.wSecond;
+					args[argc++] = (void*)(size_t)localTime->wSecond;
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '2';
@@ -234,7 +255,7 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 'm') && (p[1] == 'l')) /* milliseconds */
 				{
-					args[argc++] = (void*)(size_t)localTime.wMilliseconds;
+					args[argc++] = (void*)(size_t)localTime->wMilliseconds;
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '3';
@@ -20,20 +20,34 @@
 #ifndef WINPR_WLOG_LAYOUT_PRIVATE_H
 #define WINPR_WLOG_LAYOUT_PRIVATE_H
 
+#include <winpr/sysinfo.h>
+
 #include "wlog.h"
 
 /**
  * Log Layout
  */
 
+/* where and when a message was logged */
+typedef struct
+{
+	SYSTEMTIME Time;
+	size_t ThreadId;
+} wLogOrigin;
+
 struct s_wLogLayout
 {
 	DWORD Type;
 
 	LPSTR FormatString;
+
+	/* origin of a message written on another thread, NULL for the current one */
+	const wLogOrigin* Origin;
 };
 
 wLogLayout* WLog_Layout_New(wLog* log);
 void WLog_Layout_Free(wLog* log, wLogLayout* layout);
 
+void WLog_Layout_GetOrigin(wLogOrigin* origin);
+
 #endif /* WINPR_WLOG_LAYOUT_PRIVATE_H */
@@ -36,6 +36,7 @@
 #endif
 
 #include "wlog.h"
+#include "Async.h"
 
 typedef struct
 {
@@ -84,6 +85,13 @@ static void WLog_Uninit_(void)
 	if (!root)
 		return;
 
+	/* queued records reference their child logger, write them out first */
+	if (root->Appender)
+	{
+		WLog_Async_Free(root->Appender->Async);
+		root->Appender->Async = NULL;
+	}
+
 	for (index = 0; index < root->ChildrenCount; index++)
 	{
 		child = root->Children[index];
@@ -106,6 +114,59 @@ static void WLog_Unlock(wLog* log)
 	LeaveCriticalSection(&log->lock);
 }
 
+static BOOL WLog_InitializeAsync(wLog* root)
+{
+	char* env;
+	DWORD nSize;
+	DWORD policy = WLOG_ASYNC_OFF;
+	unsigned long capacity = 0;
+	LPCSTR async = "WLOG_ASYNC";
+	LPCSTR size = "WLOG_ASYNC_CAPACITY";
+
+	nSize = GetEnvironmentVariableA(async, NULL, 0);
+
+	if (!nSize)
+		return TRUE;
+
+	env = (LPSTR)malloc(nSize);
+
+	if (!env)
+		return FALSE;
+
+	if (GetEnvironmentVariableA(async, env, nSize) != nSize - 1)
+	{
+		fprintf(stderr, "%s environment variable modified in my back", async);
+		free(env);
+		return FALSE;
+	}
+
+	if (_stricmp(env, "BLOCK") == 0)
+		policy = WLOG_ASYNC_BLOCK;
+	else if (_stricmp(env, "DROP") == 0)
+		policy = WLOG_ASYNC_DROP;
+
+	free(env);
+	nSize = GetEnvironmentVariableA(size, NULL, 0);
+
+	if (nSize)
+	{
+		env = (LPSTR)malloc(nSize);
+
+		if (!env)
+			return FALSE;
+
+		if (GetEnvironmentVariableA(size, env, nSize) == nSize - 1)
+			capacity = strtoul(env, NULL, 0);
+
+		free(env);
+	}
+
+	if (policy == WLOG_ASYNC_OFF)
+		return TRUE;
+
+	return WLog_SetAsync(root, policy, capacity);
+}
+
 static BOOL CALLBACK WLog_InitializeRoot(PINIT_ONCE InitOnce, PVOID Parameter, PVOID* Context)
 {
 	char* env;
@@ -164,6 +225,9 @@ static BOOL CALLBACK WLog_InitializeRoot(PINIT_ONCE InitOnce, PVOID Parameter, P
 	if (!WLog_SetLogAppenderType(g_RootLog, logAppenderType))
 		goto fail;
 
+	if (!WLog_InitializeAsync(g_RootLog))
+		goto fail;
+
 	if (!WLog_ParseFilters(g_RootLog))
 		goto fail;
 
@@ -239,6 +303,9 @@ static BOOL WLog_Write(wLog* log, wLogMessage* message)
 		if (!WLog_OpenAppender(log))
 			return FALSE;
 
+	if (appender->Async)
+		return WLog_Async_Write(appender->Async, log, message);
+
 	EnterCriticalSection(&appender->lock);
 
 	if (appender->WriteMessage)
@@ -273,6 +340,9 @@ static BOOL WLog_WriteData(wLog* log, wLogMessage* message)
 	if (!appender->WriteDataMessage)
 		return FALSE;
 
+	if (appender->Async)
+		return WLog_Async_Write(appender->Async, log, message);
+
 	EnterCriticalSection(&appender->lock);
 
 	if (appender->recursive)
@@ -304,6 +374,9 @@ static BOOL WLog_WriteImage(wLog* log, wLogMessage* message)
 	if (!appender->WriteImageMessage)
 		return FALSE;
 
+	if (appender->Async)
+		return WLog_Async_Write(appender->Async, log, message);
+
 	EnterCriticalSection(&appender->lock);
 
 	if (appender->recursive)
@@ -335,6 +408,9 @@ static BOOL WLog_WritePacket(wLog* log, wLogMessage* message)
 	if (!appender->WritePacketMessage)
 		return FALSE;
 
+	if (appender->Async)
+		return WLog_Async_Write(appender->Async, log, message);
+
 	EnterCriticalSection(&appender->lock);
 
 	if (appender->recursive)
@@ -25,6 +25,8 @@
 #define WLOG_MAX_PREFIX_SIZE 512
 #define WLOG_MAX_STRING_SIZE 8192
 
+typedef struct s_wLogAsync wLogAsync;
+
 typedef BOOL (*WLOG_APPENDER_OPEN_FN)(wLog* log, wLogAppender* appender);
 typedef BOOL (*WLOG_APPENDER_CLOSE_FN)(wLog* log, wLogAppender* appender);
 typedef BOOL (*WLOG_APPENDER_WRITE_MESSAGE_FN)(wLog* log, wLogAppender* appender,
@@ -48,6 +50,7 @@ typedef void (*WLOG_APPENDER_FREE)(wLogAppender* appender);
 	void* DataMessageContext;                                 \
 	void* ImageMessageContext;                                \
 	void* PacketMessageContext;                               \
+	wLogAsync* Async;                                         \
 	WLOG_APPENDER_OPEN_FN Open;                               \
 	WLOG_APPENDER_CLOSE_FN Close;                             \
 	WLOG_APPENDER_WRITE_MESSAGE_FN WriteMessage;              \